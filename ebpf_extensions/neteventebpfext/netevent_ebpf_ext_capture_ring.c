@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the capture ring shared with user mode.
+ */
+
+#include "ebpf_ext.h"
+#include "ebpf_ext_tracelog.h"
+#include "netevent_ebpf_ext_capture_ring.h"
+
+#include <errno.h>
+
+// Alignment of the records in the data area, so that the end of the data area always has room for a padding record.
+#define NETEVENT_CAPTURE_RECORD_ALIGNMENT sizeof(netevent_capture_record_t)
+
+// The header of the ring has a page of its own, so that the data area starts on a page boundary.
+#define NETEVENT_CAPTURE_RING_DATA_OFFSET PAGE_SIZE
+
+typedef struct _netevent_capture_ring
+{
+    uint32_t data_size; ///< Size of the data area, a power of two.
+
+    EX_PUSH_LOCK mapping_lock; ///< Serializes the mapping and unmapping of the ring.
+    uint8_t* buffer;           ///< Header page followed by the data area, NULL until the ring is first mapped.
+    MDL* mdl;                  ///< MDL describing the buffer.
+    void* user_address;        ///< Address of the buffer in the process it is mapped into, NULL if not mapped.
+    PEPROCESS owner_process;   ///< Process the buffer is mapped into, referenced while it is mapped.
+    const void* owner_file;    ///< File object the buffer was mapped through.
+
+    KSPIN_LOCK lock;          ///< Serializes the writers, and protects the fields below.
+    bool mapped;              ///< Records are only written while the ring is mapped.
+    uint64_t producer_offset; ///< Copy of the producer offset, which is not read back from the shared header.
+    uint64_t written_count;
+    uint64_t dropped_count;
+} netevent_capture_ring_t;
+
+_Must_inspect_result_ NTSTATUS
+netevent_capture_ring_create(uint32_t data_size, _Outptr_ netevent_capture_ring_t** ring)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    netevent_capture_ring_t* local_ring = NULL;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    *ring = NULL;
+
+    if (data_size == 0 || (data_size & (data_size - 1)) != 0 || (data_size % PAGE_SIZE) != 0) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    local_ring = (netevent_capture_ring_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(netevent_capture_ring_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, local_ring, "capture_ring", status);
+    memset(local_ring, 0, sizeof(netevent_capture_ring_t));
+    local_ring->data_size = data_size;
+    ExInitializePushLock(&local_ring->mapping_lock);
+    KeInitializeSpinLock(&local_ring->lock);
+
+    *ring = local_ring;
+
+Exit:
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+void
+netevent_capture_ring_destroy(_In_opt_ _Frees_ptr_opt_ netevent_capture_ring_t* ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->user_address != NULL) {
+        (void)netevent_capture_ring_unmap(ring, ring->owner_file);
+    }
+    if (ring->mdl != NULL) {
+        IoFreeMdl(ring->mdl);
+    }
+    if (ring->buffer != NULL) {
+        ExFreePool(ring->buffer);
+    }
+    ExFreePool(ring);
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS netevent_capture_ring_map(
+    _Inout_ netevent_capture_ring_t* ring,
+    _In_opt_ const void* file_object,
+    _Out_ netevent_capture_ring_mapping_t* mapping)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    size_t buffer_size = NETEVENT_CAPTURE_RING_DATA_OFFSET + (size_t)ring->data_size;
+    netevent_capture_ring_header_t* header;
+    void* user_address = NULL;
+    KIRQL old_irql;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    memset(mapping, 0, sizeof(*mapping));
+
+    ExAcquirePushLockExclusive(&ring->mapping_lock);
+
+    if (ring->user_address != NULL) {
+        status = STATUS_DEVICE_BUSY;
+        goto Exit;
+    }
+
+    if (ring->buffer == NULL) {
+        // Allocations of a page or more are page aligned.
+        ring->buffer = (uint8_t*)ExAllocatePoolUninitialized(NonPagedPoolNx, buffer_size, EBPF_EXTENSION_POOL_TAG);
+        EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, ring->buffer, "capture_ring buffer", status);
+        memset(ring->buffer, 0, buffer_size);
+
+        ring->mdl = IoAllocateMdl(ring->buffer, (ULONG)buffer_size, FALSE, FALSE, NULL);
+        if (ring->mdl == NULL) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "IoAllocateMdl failed");
+            ExFreePool(ring->buffer);
+            ring->buffer = NULL;
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Exit;
+        }
+        MmBuildMdlForNonPagedPool(ring->mdl);
+    }
+
+    // A new consumer only sees the records written after it mapped the ring. Late writers that saw the previous
+    // mapping are serialized by the spin lock.
+    header = (netevent_capture_ring_header_t*)ring->buffer;
+    KeAcquireSpinLock(&ring->lock, &old_irql);
+    memset(header, 0, sizeof(*header));
+    header->data_offset = NETEVENT_CAPTURE_RING_DATA_OFFSET;
+    header->data_size = ring->data_size;
+    ring->producer_offset = 0;
+    KeReleaseSpinLock(&ring->lock, old_irql);
+
+    // Mapping into user mode raises an exception on failure.
+    __try {
+        user_address = MmMapLockedPagesSpecifyCache(
+            ring->mdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        user_address = NULL;
+    }
+    if (user_address == NULL) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "MmMapLockedPagesSpecifyCache failed");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+    ring->user_address = user_address;
+    ring->owner_process = PsGetCurrentProcess();
+    ObReferenceObject(ring->owner_process);
+    ring->owner_file = file_object;
+
+    KeAcquireSpinLock(&ring->lock, &old_irql);
+    ring->mapped = true;
+    KeReleaseSpinLock(&ring->lock, old_irql);
+
+    mapping->address = (uint64_t)(uintptr_t)user_address;
+    mapping->size = buffer_size;
+
+Exit:
+    ExReleasePushLockExclusive(&ring->mapping_lock);
+
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS
+    netevent_capture_ring_unmap(_Inout_ netevent_capture_ring_t* ring, _In_opt_ const void* file_object)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    KIRQL old_irql;
+    KAPC_STATE apc_state;
+    bool attached = false;
+
+    ExAcquirePushLockExclusive(&ring->mapping_lock);
+
+    if (ring->user_address == NULL || ring->owner_file != file_object) {
+        status = STATUS_INVALID_DEVICE_STATE;
+        goto Exit;
+    }
+
+    // Writers still running keep writing to the buffer through its system address, which remains valid.
+    KeAcquireSpinLock(&ring->lock, &old_irql);
+    ring->mapped = false;
+    KeReleaseSpinLock(&ring->lock, old_irql);
+
+    // User mode addresses are only valid in the process they belong to. The last handle to the file object may be
+    // closed by another process the handle was duplicated into, so the owner is attached to unmap the buffer.
+    if (ring->owner_process != PsGetCurrentProcess()) {
+        KeStackAttachProcess(ring->owner_process, &apc_state);
+        attached = true;
+    }
+    MmUnmapLockedPages(ring->user_address, ring->mdl);
+    if (attached) {
+        KeUnstackDetachProcess(&apc_state);
+    }
+
+    ObDereferenceObject(ring->owner_process);
+    ring->user_address = NULL;
+    ring->owner_process = NULL;
+    ring->owner_file = NULL;
+
+Exit:
+    ExReleasePushLockExclusive(&ring->mapping_lock);
+
+    return status;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) int32_t netevent_capture_ring_write(
+    _Inout_ netevent_capture_ring_t* ring,
+    _In_ const netevent_data_header_t* data_header,
+    _In_reads_bytes_(PKTMON_EVENT_HEADER_LENGTH) const uint8_t* pktmon_header,
+    _In_reads_bytes_(data_length) const uint8_t* data,
+    uint32_t data_length)
+{
+    int32_t result = 0;
+    KIRQL old_irql;
+    netevent_capture_ring_header_t* header;
+    uint8_t* data_area;
+    netevent_capture_record_t* record;
+    uint64_t mask = ring->data_size - 1;
+    uint64_t record_length = sizeof(netevent_capture_record_t) + sizeof(netevent_data_header_t) +
+                             PKTMON_EVENT_HEADER_LENGTH + (uint64_t)data_length;
+    uint64_t consumer_offset;
+    uint64_t used;
+    uint64_t position;
+    uint64_t padding_length = 0;
+
+    record_length = (record_length + NETEVENT_CAPTURE_RECORD_ALIGNMENT - 1) & ~(NETEVENT_CAPTURE_RECORD_ALIGNMENT - 1);
+
+    KeAcquireSpinLock(&ring->lock, &old_irql);
+
+    if (!ring->mapped) {
+        result = -ENODEV;
+        goto Exit;
+    }
+
+    header = (netevent_capture_ring_header_t*)ring->buffer;
+    data_area = ring->buffer + NETEVENT_CAPTURE_RING_DATA_OFFSET;
+
+    // The consumer offset is written by user mode, and must not be trusted: a consumer ahead of the producer is
+    // treated as a full ring.
+    consumer_offset = (uint64_t)ReadAcquire64((volatile LONG64*)&header->consumer_offset);
+    used = ring->producer_offset - consumer_offset;
+
+    // A record never wraps around the end of the data area, which is padded instead.
+    position = ring->producer_offset & mask;
+    if (position + record_length > ring->data_size) {
+        padding_length = ring->data_size - position;
+    }
+
+    if (used > ring->data_size || padding_length + record_length > ring->data_size - used) {
+        ring->dropped_count++;
+        WriteRelease64((volatile LONG64*)&header->dropped_count, (LONG64)ring->dropped_count);
+        result = -ENOSPC;
+        goto Exit;
+    }
+
+    if (padding_length != 0) {
+        record = (netevent_capture_record_t*)(data_area + position);
+        record->length = (uint32_t)padding_length;
+        record->flags = NETEVENT_CAPTURE_RECORD_FLAG_PADDING;
+        record->captured_length = 0;
+        record->reserved = 0;
+        position = 0;
+    }
+
+    record = (netevent_capture_record_t*)(data_area + position);
+    record->length = (uint32_t)record_length;
+    record->flags = 0;
+    record->captured_length = data_length;
+    record->reserved = 0;
+    memcpy(record + 1, data_header, sizeof(netevent_data_header_t));
+    memcpy((uint8_t*)(record + 1) + sizeof(netevent_data_header_t), pktmon_header, PKTMON_EVENT_HEADER_LENGTH);
+    memcpy(
+        (uint8_t*)(record + 1) + sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH, data, data_length);
+
+    // Publish the record once it is fully written.
+    ring->producer_offset += padding_length + record_length;
+    WriteRelease64((volatile LONG64*)&header->producer_offset, (LONG64)ring->producer_offset);
+    ring->written_count++;
+
+Exit:
+    KeReleaseSpinLock(&ring->lock, old_irql);
+    return result;
+}
+
+void
+netevent_capture_ring_get_stats(_In_ netevent_capture_ring_t* ring, _Out_ netevent_capture_ring_stats_t* stats)
+{
+    // The counters are read without synchronization, a slightly stale value is acceptable.
+    stats->written_count = ring->written_count;
+    stats->dropped_count = ring->dropped_count;
+}
@@ -0,0 +1,105 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_netevent_stats.h"
+#include "framework.h"
+
+/**
+ * @brief Ring of captured events shared with a user mode process, which maps it into its address space and consumes
+ * the records without a device control request per record. The ring memory is allocated on the first mapping, and
+ * reused by the later ones until the ring is destroyed.
+ */
+typedef struct _netevent_capture_ring netevent_capture_ring_t;
+
+/**
+ * @brief Usage statistics of a capture ring.
+ */
+typedef struct _netevent_capture_ring_stats
+{
+    uint64_t written_count; ///< Number of records written to the ring.
+    uint64_t dropped_count; ///< Number of records dropped because the ring was full.
+} netevent_capture_ring_stats_t;
+
+/**
+ * @brief Create a capture ring.
+ *
+ * @param[in] data_size Size of the data area of the ring. Must be a power of two and a multiple of the page size.
+ * @param[out] ring Pointer to the created capture ring.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_INVALID_PARAMETER The data size is not a power of two or not a multiple of the page size.
+ * @retval STATUS_INSUFFICIENT_RESOURCES Memory allocation failed.
+ */
+_Must_inspect_result_ NTSTATUS
+netevent_capture_ring_create(uint32_t data_size, _Outptr_ netevent_capture_ring_t** ring);
+
+/**
+ * @brief Free a capture ring, unmapping it if it is still mapped. The caller must ensure that the ring is no longer
+ * used.
+ *
+ * @param[in] ring Pointer to the capture ring.
+ */
+void
+netevent_capture_ring_destroy(_In_opt_ _Frees_ptr_opt_ netevent_capture_ring_t* ring);
+
+/**
+ * @brief Map the capture ring into the current process, and reset it so that the process only consumes the records
+ * written from then on. The mapping is owned by the given file object, and lasts until it is unmapped through that file
+ * object or the ring is destroyed.
+ *
+ * @param[in] ring Pointer to the capture ring.
+ * @param[in] file_object Opaque identifier of the file object the mapping is requested on.
+ * @param[out] mapping Address and size of the mapping.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_DEVICE_BUSY The ring is already mapped into a process.
+ * @retval STATUS_INSUFFICIENT_RESOURCES Memory allocation or mapping failed.
+ */
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS netevent_capture_ring_map(
+    _Inout_ netevent_capture_ring_t* ring,
+    _In_opt_ const void* file_object,
+    _Out_ netevent_capture_ring_mapping_t* mapping);
+
+/**
+ * @brief Unmap the capture ring from the process it is mapped into, if the mapping is owned by the given file object.
+ * The ring may be unmapped from the context of any process.
+ *
+ * @param[in] ring Pointer to the capture ring.
+ * @param[in] file_object Opaque identifier of the file object the unmapping is requested on.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_INVALID_DEVICE_STATE The ring is not mapped through the given file object.
+ */
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS
+    netevent_capture_ring_unmap(_Inout_ netevent_capture_ring_t* ring, _In_opt_ const void* file_object);
+
+/**
+ * @brief Write a record to the capture ring, if it is mapped.
+ *
+ * @param[in] ring Pointer to the capture ring.
+ * @param[in] data_header Netevent data header of the record.
+ * @param[in] pktmon_header PKTMON header of the event, PKTMON_EVENT_HEADER_LENGTH bytes long.
+ * @param[in] data Event data following the PKTMON header.
+ * @param[in] data_length Number of bytes of event data to write.
+ *
+ * @retval 0 The record was written.
+ * @retval -ENODEV The ring is not mapped.
+ * @retval -ENOSPC The ring is full, the record is counted as dropped.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL) int32_t netevent_capture_ring_write(
+    _Inout_ netevent_capture_ring_t* ring,
+    _In_ const netevent_data_header_t* data_header,
+    _In_reads_bytes_(PKTMON_EVENT_HEADER_LENGTH) const uint8_t* pktmon_header,
+    _In_reads_bytes_(data_length) const uint8_t* data,
+    uint32_t data_length);
+
+/**
+ * @brief Get the usage statistics of a capture ring.
+ *
+ * @param[in] ring Pointer to the capture ring.
+ * @param[out] stats Usage statistics.
+ */
+void
+netevent_capture_ring_get_stats(_In_ netevent_capture_ring_t* ring, _Out_ netevent_capture_ring_stats_t* stats);
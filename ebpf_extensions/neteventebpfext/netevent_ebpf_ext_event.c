@@ -6,9 +6,15 @@
  * @brief This file implements the netevent event-monitor program type hook on eBPF for Windows.
  */
 
+#include "ebpf_ext_per_cpu_buffer.h"
 #include "ebpf_netevent_hooks.h"
+#include "ebpf_netevent_stats.h"
+#include "netevent_ebpf_ext_capture_ring.h"
 #include "netevent_ebpf_ext_event.h"
+#include "netevent_ebpf_ext_flow.h"
+#include "netevent_ebpf_ext_flow_table.h"
 #include "netevent_ebpf_ext_program_info.h"
+#include "netevent_ebpf_ext_summary.h"
 
 #include <errno.h>
 
@@ -23,14 +29,105 @@ typedef struct _pktmon_evt_stream_packet_header_minimal
     // Only EventId field is accessed, other fields are not defined here
 } PKTMON_EVT_STREAM_PACKET_HEADER_MINIMAL;
 
+// Offsets of the PKTMON_EVT_STREAM_PACKET_HEADER fields decoded into the program context. The header is packed: the
+// one byte EventId and the PKTMON_EVT_STREAM_PACKET_DESCRIPTOR are followed by the PKTMON_EVT_STREAM_METADATA.
+#define PKTMON_EVENT_HEADER_PACKET_GROUP_OFFSET 13
+#define PKTMON_EVENT_HEADER_DIRECTION_OFFSET 25
+#define PKTMON_EVENT_HEADER_PACKET_TYPE_OFFSET 27
+#define PKTMON_EVENT_HEADER_COMPONENT_ID_OFFSET 29
+#define PKTMON_EVENT_HEADER_EDGE_ID_OFFSET 31
+#define PKTMON_EVENT_HEADER_FILTER_ID_OFFSET 33
+#define PKTMON_EVENT_HEADER_DROP_REASON_OFFSET 35
+#define PKTMON_EVENT_HEADER_DROP_LOCATION_OFFSET 39
+#define PKTMON_EVENT_HEADER_PROCESSOR_OFFSET 43
+#define PKTMON_EVENT_HEADER_TIMESTAMP_OFFSET 45
+
 //
 // Global variables.
 //
 #define INIT_EVENT_BUFFER_SIZE 4096
-static uint32_t _cpu_count = 0;
-// Define a per-cpu dynamic event buffer for optimizing the event data copy.
-static uint8_t** _event_buffers = NULL;
-static size_t* _event_buffer_sizes = NULL;
+// Define a per-cpu dynamic event buffer for optimizing the event data copy, with a pool of buffers for the events
+// dispatched at PASSIVE_LEVEL.
+static ebpf_ext_per_cpu_buffer_t* _event_buffer = NULL;
+
+// Idle event buffers are shrunk at PASSIVE_LEVEL, outside of the event path, by a work item queued by a timer.
+// Trim interval of the event buffers, in 100ns units.
+#define EVENT_BUFFER_TRIM_INTERVAL (10 * 1000 * 1000)
+static PEX_TIMER _event_buffer_trim_timer = NULL;
+static EXT_CALLBACK _event_buffer_trim_timer_callback;
+static PIO_WORKITEM _event_buffer_trim_work_item = NULL;
+static IO_WORKITEM_ROUTINE _event_buffer_trim_work_item_routine;
+static EX_RUNDOWN_REF _event_buffer_trim_rundown; ///< Held while the trim work item is queued.
+static volatile long _event_buffer_trim_queued = 0;
+
+// Flow table aggregating the events passed to bpf_netevent_flow_table_update, and the timer flushing it.
+#define NETEVENT_FLOW_TABLE_SHARD_ENTRY_COUNT 256
+#define NETEVENT_FLOW_TABLE_QUEUE_RECORD_COUNT 4096
+// Flush interval of the flow table, in 100ns units.
+#define NETEVENT_FLOW_TABLE_FLUSH_INTERVAL (10 * 1000 * 1000)
+static netevent_flow_table_t* _netevent_flow_table = NULL;
+static PEX_TIMER _netevent_flow_table_timer = NULL;
+static EXT_CALLBACK _netevent_flow_table_timer_callback;
+
+// Capture ring written by bpf_netevent_capture, and mapped by user mode with IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING.
+static netevent_capture_ring_t* _netevent_capture_ring = NULL;
+
+// Drop event coalescing. Each processor has a direct-mapped table of the drop events it recently emitted. An event is
+// only coalesced into an entry whose EventId, DropReason, key length and first NETEVENT_COALESCING_KEY_PREFIX_LENGTH
+// bytes of key match its own, and whose hash of the whole key does.
+#define NETEVENT_COALESCING_TABLE_ENTRY_COUNT 256
+#define NETEVENT_COALESCING_KEY_PREFIX_LENGTH 16
+typedef struct _netevent_coalescing_entry
+{
+    uint64_t key_hash;     ///< Hash of the key of the last emitted event, 0 for an empty entry.
+    uint64_t window_start; ///< Interrupt time at which the last event was emitted.
+    uint32_t repeat_count; ///< Number of events coalesced since the last event was emitted.
+    uint32_t drop_reason;  ///< PKTMON DropReason of the last emitted event.
+    uint32_t key_length;   ///< Number of bytes of event data in the key of the last emitted event.
+    uint8_t event_type;    ///< PKTMON EventId of the last emitted event.
+    uint8_t key_prefix[NETEVENT_COALESCING_KEY_PREFIX_LENGTH]; ///< First bytes of the key of the last emitted event.
+} netevent_coalescing_entry_t;
+// Coalescing window in 100ns units (0 when coalescing is disabled) and key length, set with
+// IOCTL_NETEVENT_EXT_SET_COALESCING.
+static volatile uint64_t _netevent_coalescing_window = 0;
+static volatile uint32_t _netevent_coalescing_key_length = 0;
+
+// Drop event sampling. Each processor has a direct-mapped table of token buckets, one per stratum (DropReason and
+// ComponentId). Tokens are counted in NETEVENT_SAMPLING_TOKEN units so that a bucket can be refilled by the elapsed
+// interrupt time multiplied by the rate.
+#define NETEVENT_SAMPLING_TABLE_ENTRY_COUNT 256
+#define NETEVENT_SAMPLING_TOKEN (10 * 1000 * 1000)
+// Longest elapsed time, in 100ns units, a refill accounts for, which keeps the refill from overflowing.
+#define NETEVENT_SAMPLING_MAX_REFILL_INTERVAL (10ull * NETEVENT_SAMPLING_TOKEN)
+typedef struct _netevent_sampling_entry
+{
+    uint32_t drop_reason;   ///< PKTMON DropReason of the stratum.
+    uint16_t component_id;  ///< PKTMON ComponentId of the stratum.
+    uint16_t in_use;        ///< Whether the entry holds a stratum.
+    uint32_t skipped_count; ///< Number of events skipped since the last event was dispatched.
+    uint64_t last_refill;   ///< Interrupt time of the last refill.
+    uint64_t tokens;        ///< Available tokens, in NETEVENT_SAMPLING_TOKEN units.
+} netevent_sampling_entry_t;
+// Sampling rate in tokens per second (0 when sampling is disabled) and bucket capacity in tokens, set with
+// IOCTL_NETEVENT_EXT_SET_SAMPLING.
+static volatile uint32_t _netevent_sampling_rate = 0;
+static volatile uint32_t _netevent_sampling_burst = 0;
+
+// Pipeline statistics of a single processor. Each slot is only updated by its processor at DISPATCH_LEVEL, and is
+// padded to a cache line so that processors never share a line.
+typedef struct DECLSPEC_CACHEALIGN _netevent_cpu_stats
+{
+    netevent_ext_stats_t stats;
+    netevent_summary_md_t summary; ///< Summary counters since the extension was loaded, the interval is not set.
+    netevent_coalescing_entry_t coalescing_table[NETEVENT_COALESCING_TABLE_ENTRY_COUNT];
+    netevent_sampling_entry_t sampling_table[NETEVENT_SAMPLING_TABLE_ENTRY_COUNT];
+    uint64_t sequence; ///< Sequence number of the next event dispatched by the processor.
+} netevent_cpu_stats_t;
+static uint32_t _netevent_cpu_stats_count = 0;
+static netevent_cpu_stats_t* _netevent_cpu_stats = NULL;
+// Statistics of the events pushed on processors beyond _netevent_cpu_stats_count, which are updated without
+// synchronization.
+static netevent_cpu_stats_t _netevent_overflow_stats = {0};
 
 // Define the GUID for the NetEvent NPI (must match the one of the provider)
 const NPIID netevent_npiid = {0x2227e81a, 0x8d8b, 0x11d4, {0xab, 0xad, 0x00, 0x90, 0x27, 0x71, 0x9e, 0x09}};
@@ -57,14 +154,12 @@ _ebpf_netevent_program_context_destroy(
     _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
     _Inout_ size_t* context_size_out);
 
-typedef struct _netevent_event
-{
-    uint8_t* event_start;
-    uint8_t* event_end;
-} netevent_event_t;
+static void
+_ebpf_netevent_push_event(_In_ netevent_event_t* netevent_event, uint8_t source_id);
 
 static void
-_ebpf_netevent_push_event(_In_ netevent_event_t* netevent_event);
+_ebpf_netevent_push_events(
+    _In_reads_(event_count) netevent_event_t* netevent_events, uint32_t event_count, uint8_t source_id);
 
 NTSTATUS
 _netevent_ebpf_extension_attach_provider(
@@ -73,35 +168,59 @@ _netevent_ebpf_extension_attach_provider(
     _In_ PNPI_REGISTRATION_INSTANCE provider_registration_instance);
 
 NTSTATUS
-_netevent_ebpf_extension_detach_provider(_In_ HANDLE nmr_binding_handle);
+_netevent_ebpf_extension_detach_provider(_In_ void* client_binding_context);
+
+void
+_netevent_ebpf_extension_cleanup_binding_context(_In_ void* client_binding_context);
 
 //
-// Structures for attaching to NetEvent (as an NMR client)
+// Structures for attaching to NetEvent (as an NMR client), see ebpf_netevent_npi.h for the ones shared with the
+// providers.
 //
 
-typedef struct netevent_ext_header
-{
-    uint16_t version; ///< Version of the extension data structure.
-    size_t size;      ///< Size of the netevent function addresses structure.
-} netevent_ext_header_t;
-
-// This is the type definition for the netevent helper function addresses.
-// This type should be matched by the Netevent NMI provider.
-typedef struct netevent_ext_function_addresses
-{
-    netevent_ext_header_t header;
-    netevent_capture_type_t capture_type;
-    uint32_t helper_function_count;
-    uint64_t* helper_function_address;
-} netevent_ext_function_addresses_t;
-
-// Dispatch table for the client module's helper functions
-static const void* _ebpf_netevent_ext_helper_functions[] = {(void*)&_ebpf_netevent_push_event};
-netevent_ext_function_addresses_t _netevent_client_dispatch = {
-    .header = {.version = EBPF_NETEVENT_EXTENSION_VERSION, .size = sizeof(netevent_ext_function_addresses_t)},
-    .capture_type = NeteventCapture_Drop,
-    .helper_function_count = EBPF_COUNT_OF(_ebpf_netevent_ext_helper_functions),
-    .helper_function_address = (uint64_t*)_ebpf_netevent_ext_helper_functions};
+// The extension only offers zero copy once the program context can be declared read-only.
+#if NETEVENT_PROGRAM_CONTEXT_READ_ONLY
+#define NETEVENT_EXTENSION_CAPABILITIES (NETEVENT_CAPABILITY_BATCH | NETEVENT_CAPABILITY_ZERO_COPY)
+#else
+#define NETEVENT_EXTENSION_CAPABILITIES NETEVENT_CAPABILITY_BATCH
+#endif
+
+// Largest event size the event buffers are reserved for, larger events still grow the buffers on demand.
+#define NETEVENT_MAX_RESERVED_EVENT_SIZE (64 * 1024)
+
+// Maximum number of NetEvent providers the extension can be bound to at the same time.
+#define NETEVENT_MAX_PROVIDER_BINDINGS 4
+
+// The push functions do not take a binding context, so each binding is given its own dispatch table, whose helper
+// functions tag the events with the source id of the binding. Providers must only call the helpers that are present in
+// the version of the dispatch table they were given:
+// - [0] push_event(event): all versions.
+// - [1] push_events(events, count): EBPF_NETEVENT_EXTENSION_VERSION_PUSH_EVENTS and later.
+#define NETEVENT_DEFINE_PROVIDER_BINDING_HELPERS(source_id)                                  \
+    static void _ebpf_netevent_push_event_##source_id(_In_ netevent_event_t* netevent_event) \
+    {                                                                                        \
+        _ebpf_netevent_push_event(netevent_event, source_id);                                \
+    }                                                                                        \
+    static void _ebpf_netevent_push_events_##source_id(                                      \
+        _In_reads_(event_count) netevent_event_t* netevent_events, uint32_t event_count)     \
+    {                                                                                        \
+        _ebpf_netevent_push_events(netevent_events, event_count, source_id);                 \
+    }                                                                                        \
+    static const void* _ebpf_netevent_ext_helper_functions_##source_id[] = {                 \
+        (void*)&_ebpf_netevent_push_event_##source_id, (void*)&_ebpf_netevent_push_events_##source_id};
+
+NETEVENT_DEFINE_PROVIDER_BINDING_HELPERS(0)
+NETEVENT_DEFINE_PROVIDER_BINDING_HELPERS(1)
+NETEVENT_DEFINE_PROVIDER_BINDING_HELPERS(2)
+NETEVENT_DEFINE_PROVIDER_BINDING_HELPERS(3)
+#undef NETEVENT_DEFINE_PROVIDER_BINDING_HELPERS
+
+#define NETEVENT_CLIENT_DISPATCH(source_id)                                                                     \
+    {.header = {.version = EBPF_NETEVENT_EXTENSION_VERSION, .size = sizeof(netevent_ext_function_addresses_t)}, \
+     .capture_type = NeteventCapture_Drop,                                                                      \
+     .helper_function_count = EBPF_COUNT_OF(_ebpf_netevent_ext_helper_functions_##source_id),                   \
+     .helper_function_address = (uint64_t*)_ebpf_netevent_ext_helper_functions_##source_id,                     \
+     .capabilities = NETEVENT_EXTENSION_CAPABILITIES}
 
 // Context structure for the client module's registration
 typedef struct CLIENT_REGISTRATION_CONTEXT_
@@ -111,29 +230,33 @@ typedef struct CLIENT_REGISTRATION_CONTEXT_
 } CLIENT_REGISTRATION_CONTEXT, *PCLIENT_REGISTRATION_CONTEXT;
 static CLIENT_REGISTRATION_CONTEXT _netevent_client_registration_context = {.client_registration_handle = NULL};
 
-// Context structure for the client module's binding to a provider module
+// Context structure for the client module's binding to a provider module. The bindings are statically allocated, one
+// per source id, so that a provider still pushing events while it detaches never uses freed memory.
 typedef struct CLIENT_BINDING_CONTEXT_
 {
+    volatile long in_use; ///< Whether the binding is attached to a provider, until its context is cleaned up.
+    uint8_t source_id;    ///< Source id of the events pushed through this binding.
     HANDLE nmr_binding_handle;
-    void* client_context;
     void* provider_binding_context;
     const void* provider_dispatch;
     PNPI_REGISTRATION_INSTANCE provider_registration_instance;
+    netevent_ext_function_addresses_t client_dispatch; ///< Dispatch table given to the provider.
+    uint32_t provider_capabilities;                    ///< NETEVENT_CAPABILITY_* flags of the provider.
 } CLIENT_BINDING_CONTEXT, *PCLIENT_BINDING_CONTEXT;
-CLIENT_BINDING_CONTEXT _netevent_client_binding_context = {
-    .nmr_binding_handle = NULL,
-    .client_context = NULL,
-    .provider_binding_context = NULL,
-    .provider_dispatch = NULL,
-    .provider_registration_instance = NULL};
+static CLIENT_BINDING_CONTEXT _netevent_client_binding_contexts[NETEVENT_MAX_PROVIDER_BINDINGS] = {
+    {.source_id = 0, .client_dispatch = NETEVENT_CLIENT_DISPATCH(0)},
+    {.source_id = 1, .client_dispatch = NETEVENT_CLIENT_DISPATCH(1)},
+    {.source_id = 2, .client_dispatch = NETEVENT_CLIENT_DISPATCH(2)},
+    {.source_id = 3, .client_dispatch = NETEVENT_CLIENT_DISPATCH(3)}};
+#undef NETEVENT_CLIENT_DISPATCH
 
 // Structure for the extension NMR client module's characteristics
 const NPI_CLIENT_CHARACTERISTICS _netevent_client_characteristics = {
     0,
     sizeof(NPI_CLIENT_CHARACTERISTICS),
-    _netevent_ebpf_extension_attach_provider, // Called by NMR after the client module has registered with NMR.
+    _netevent_ebpf_extension_attach_provider, // Called by NMR for each NetEvent provider, once registered with NMR.
     _netevent_ebpf_extension_detach_provider,
-    NULL,
+    _netevent_ebpf_extension_cleanup_binding_context,
     {0, sizeof(NPI_REGISTRATION_INSTANCE), &netevent_npiid, &netevent_client_module_id, 0, NULL}};
 
 //
@@ -147,11 +270,16 @@ _netevent_ebpf_extension_attach_provider(
 {
     EBPF_EXT_LOG_ENTRY();
     NTSTATUS status;
+    CLIENT_BINDING_CONTEXT* binding_context = NULL;
+    const netevent_provider_characteristics_t* provider_characteristics =
+        (const netevent_provider_characteristics_t*)provider_registration_instance->NpiSpecificCharacteristics;
+    uint32_t provider_capabilities = 0;
+    uint32_t max_event_size = 0;
 
     UNREFERENCED_PARAMETER(client_context);
-    UNREFERENCED_PARAMETER(provider_registration_instance);
 
-    if (provider_registration_instance->NpiSpecificCharacteristics == NULL) {
+    // Each provider's characteristics are checked on its own binding.
+    if (provider_characteristics == NULL) {
         status = STATUS_NOINTERFACE;
         EBPF_EXT_LOG_MESSAGE(
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
@@ -160,15 +288,57 @@ _netevent_ebpf_extension_attach_provider(
         goto Exit;
     }
 
+    if (provider_characteristics->version >= NETEVENT_PROVIDER_CHARACTERISTICS_VERSION_CAPABILITIES &&
+        provider_characteristics->size >= sizeof(netevent_provider_characteristics_t)) {
+        provider_capabilities = provider_characteristics->capabilities;
+        max_event_size = min(provider_characteristics->max_event_size, NETEVENT_MAX_RESERVED_EVENT_SIZE);
+    }
+
+    for (uint32_t index = 0; index < NETEVENT_MAX_PROVIDER_BINDINGS; index++) {
+        if (InterlockedCompareExchange(&_netevent_client_binding_contexts[index].in_use, TRUE, FALSE) == FALSE) {
+            binding_context = &_netevent_client_binding_contexts[index];
+            break;
+        }
+    }
+    if (binding_context == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "Too many netevent providers, provider not attached");
+        goto Exit;
+    }
+    binding_context->nmr_binding_handle = nmr_binding_handle;
+    binding_context->provider_registration_instance = provider_registration_instance;
+    binding_context->provider_capabilities = provider_capabilities;
+
+    // The event buffers are sized once for the largest event of the provider, so that its events never cause an
+    // allocation while they are dispatched. Without a reservation, the buffers keep growing on demand.
+    binding_context->client_dispatch.reserved_event_size = 0;
+    if (max_event_size != 0 && _event_buffer != NULL) {
+        NTSTATUS reserve_status =
+            ebpf_ext_per_cpu_buffer_reserve(_event_buffer, sizeof(netevent_data_header_t) + max_event_size);
+        if (NT_SUCCESS(reserve_status)) {
+            binding_context->client_dispatch.reserved_event_size = max_event_size;
+        } else {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_WARNING,
+                EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+                "Failed to reserve the event buffers for the provider's max event size",
+                reserve_status);
+        }
+    }
+
     // Attach to the NetEvent provider module.
     status = NmrClientAttachProvider(
         nmr_binding_handle,
-        &_netevent_client_binding_context,
-        &_netevent_client_dispatch,
-        &_netevent_client_binding_context.provider_binding_context,
-        &_netevent_client_binding_context.provider_dispatch);
+        binding_context,
+        &binding_context->client_dispatch,
+        &binding_context->provider_binding_context,
+        &binding_context->provider_dispatch);
     if (!NT_SUCCESS(status)) {
-        EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "NmrRegisterProvider", status);
+        EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "NmrClientAttachProvider", status);
+        InterlockedExchange(&binding_context->in_use, FALSE);
         goto Exit;
     }
 
@@ -177,16 +347,33 @@ Exit:
 }
 
 NTSTATUS
-_netevent_ebpf_extension_detach_provider(_In_ HANDLE nmr_binding_handle)
+_netevent_ebpf_extension_detach_provider(_In_ void* client_binding_context)
 {
     EBPF_EXT_LOG_ENTRY();
 
-    UNREFERENCED_PARAMETER(nmr_binding_handle);
-    // neteventebpfext does not maintain any state for the provider, therefore no action needed here.
+    UNREFERENCED_PARAMETER(client_binding_context);
+    // The binding is only released once NMR cleans up its context, after the provider has detached as well.
 
     EBPF_EXT_RETURN_NTSTATUS(STATUS_SUCCESS);
 }
 
+void
+_netevent_ebpf_extension_cleanup_binding_context(_In_ void* client_binding_context)
+{
+    CLIENT_BINDING_CONTEXT* binding_context = (CLIENT_BINDING_CONTEXT*)client_binding_context;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    binding_context->nmr_binding_handle = NULL;
+    binding_context->provider_binding_context = NULL;
+    binding_context->provider_dispatch = NULL;
+    binding_context->provider_registration_instance = NULL;
+    binding_context->provider_capabilities = 0;
+    InterlockedExchange(&binding_context->in_use, FALSE);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
 //
 // Event Hook NPI Provider.
 //
@@ -201,9 +388,40 @@ ebpf_extension_data_t _netevent_ebpf_extension_netevent_event_hook_provider_data
     .data = &_netevent_ebpf_netevent_event_hook_provider_data};
 NPI_MODULEID DECLSPEC_SELECTANY _ebpf_netevent_event_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
 static ebpf_extension_hook_provider_t* _ebpf_netevent_event_hook_provider_context = NULL;
+//
+// Helper functions exposed to client eBPF programs.
+//
+_Success_(return >= 0) static int32_t _ebpf_netevent_push_event_helper(_In_ netevent_event_md_t* netevent_event_md);
+
+_Success_(return >= 0) static int32_t _ebpf_netevent_parse_flow_helper(
+    _In_ netevent_event_md_t* netevent_event_md,
+    _Out_writes_bytes_(flow_key_length) uint8_t* flow_key,
+    uint32_t flow_key_length);
+
+_Success_(return >= 0) static int32_t _ebpf_netevent_flow_table_update_helper(
+    _In_ netevent_event_md_t* netevent_event_md);
+
+_Success_(return >= 0) static int32_t _ebpf_netevent_capture_helper(
+    _In_ netevent_event_md_t* netevent_event_md, uint32_t snaplen);
+
+static const void* _ebpf_netevent_event_helper_functions[] = {
+    (void*)&_ebpf_netevent_push_event_helper,
+    (void*)&_ebpf_netevent_parse_flow_helper,
+    (void*)&_ebpf_netevent_flow_table_update_helper,
+    (void*)&_ebpf_netevent_capture_helper,
+};
+
+static ebpf_helper_function_addresses_t _ebpf_netevent_event_helper_function_address_table = {
+    .header = {EBPF_HELPER_FUNCTION_ADDRESSES_CURRENT_VERSION, EBPF_HELPER_FUNCTION_ADDRESSES_CURRENT_VERSION_SIZE},
+    .helper_function_count = EBPF_COUNT_OF(_ebpf_netevent_event_helper_functions),
+    .helper_function_address = (uint64_t*)_ebpf_netevent_event_helper_functions,
+};
+
 EX_PUSH_LOCK _ebpf_netevent_event_hook_provider_lock;
 bool _ebpf_netevent_event_hook_provider_registered = FALSE;
 uint64_t _ebpf_netevent_event_hook_provider_registration_count = 0;
+// Number of attached clients per capture type, protected by _ebpf_netevent_event_hook_provider_lock.
+static uint64_t _ebpf_netevent_capture_type_client_count[NeteventCapture_None + 1] = {0};
 
 //
 // Event Program Information NPI Provider.
@@ -211,7 +429,7 @@ uint64_t _ebpf_netevent_event_hook_provider_registration_count = 0;
 static ebpf_program_data_t _ebpf_netevent_event_program_data = {
     .header = EBPF_PROGRAM_DATA_HEADER,
     .program_info = &_ebpf_netevent_event_program_info,
-    .program_type_specific_helper_function_addresses = NULL, // No helper functions exposed to client eBPF programs.
+    .program_type_specific_helper_function_addresses = &_ebpf_netevent_event_helper_function_address_table,
     .context_create = _ebpf_netevent_program_context_create,
     .context_destroy = _ebpf_netevent_program_context_destroy,
     .required_irql = PASSIVE_LEVEL,
@@ -225,6 +443,120 @@ NPI_MODULEID DECLSPEC_SELECTANY _ebpf_netevent_event_program_info_provider_modul
 
 static ebpf_extension_program_info_provider_t* _ebpf_netevent_event_program_info_provider_context = NULL;
 
+static inline bool
+_netevent_is_valid_attach_opts_size(size_t size)
+{
+    return (size == NETEVENT_ATTACH_OPTS_SIZE_V1) || (size == NETEVENT_ATTACH_OPTS_SIZE_V2) ||
+           (size == NETEVENT_ATTACH_OPTS_SIZE_V3) || (size == sizeof(netevent_attach_opts_t));
+}
+
+// Get the attach options of a client. Fields missing from earlier versions of the attach options are zeroed.
+static inline void
+_netevent_get_attach_opts(_In_ const ebpf_extension_data_t* client_data, _Out_ netevent_attach_opts_t* attach_opts)
+{
+    memset(attach_opts, 0, sizeof(*attach_opts));
+    memcpy(attach_opts, client_data->data, min(client_data->data_size, sizeof(*attach_opts)));
+}
+
+// Check whether an event with the given PKTMON EventId is of a class requested by a capture type.
+static inline bool
+_netevent_capture_type_matches_event(netevent_capture_type_t capture_type, uint8_t event_id)
+{
+    switch (capture_type) {
+    case NeteventCapture_All:
+        return true;
+    case NeteventCapture_Flow:
+        return event_id == NETEVENT_EVENT_TYPE_PKTMON_FLOW;
+    case NeteventCapture_Drop:
+        return event_id == NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    default:
+        return false;
+    }
+}
+
+// Decode the PKTMON header fields into the typed fields of a program context. The header must be at least
+// PKTMON_EVENT_HEADER_LENGTH bytes long.
+static void
+_netevent_decode_pktmon_header(_In_ const uint8_t* pktmon_header, _Inout_ netevent_event_md_t* netevent_event_md)
+{
+#define NETEVENT_DECODE_FIELD(field, offset) \
+    memcpy(&netevent_event_md->field, pktmon_header + (offset), sizeof(netevent_event_md->field))
+
+    netevent_event_md->event_type = (uint8_t)((PKTMON_EVT_STREAM_PACKET_HEADER_MINIMAL*)pktmon_header)->EventId;
+    NETEVENT_DECODE_FIELD(packet_group, PKTMON_EVENT_HEADER_PACKET_GROUP_OFFSET);
+    NETEVENT_DECODE_FIELD(direction, PKTMON_EVENT_HEADER_DIRECTION_OFFSET);
+    NETEVENT_DECODE_FIELD(packet_type, PKTMON_EVENT_HEADER_PACKET_TYPE_OFFSET);
+    NETEVENT_DECODE_FIELD(component_id, PKTMON_EVENT_HEADER_COMPONENT_ID_OFFSET);
+    NETEVENT_DECODE_FIELD(edge_id, PKTMON_EVENT_HEADER_EDGE_ID_OFFSET);
+    NETEVENT_DECODE_FIELD(filter_id, PKTMON_EVENT_HEADER_FILTER_ID_OFFSET);
+    NETEVENT_DECODE_FIELD(drop_reason, PKTMON_EVENT_HEADER_DROP_REASON_OFFSET);
+    NETEVENT_DECODE_FIELD(drop_location, PKTMON_EVENT_HEADER_DROP_LOCATION_OFFSET);
+    NETEVENT_DECODE_FIELD(processor, PKTMON_EVENT_HEADER_PROCESSOR_OFFSET);
+    NETEVENT_DECODE_FIELD(timestamp, PKTMON_EVENT_HEADER_TIMESTAMP_OFFSET);
+
+#undef NETEVENT_DECODE_FIELD
+}
+
+// Check whether an event passes the capture type and the filters of a client's attach options, using the fields
+// decoded from the event's PKTMON header.
+static inline bool
+_netevent_client_matches_event(
+    _In_ const netevent_attach_opts_t* attach_opts, _In_ const netevent_event_md_t* netevent_event_md)
+{
+    const uint32_t* event_id_mask = attach_opts->event_id_mask;
+    bool event_id_mask_set = false;
+
+    if (!_netevent_capture_type_matches_event(attach_opts->capture_type, netevent_event_md->event_type)) {
+        return false;
+    }
+
+    for (uint32_t index = 0; index < NETEVENT_EVENT_ID_MASK_WORDS; index++) {
+        event_id_mask_set |= (event_id_mask[index] != 0);
+    }
+    if (event_id_mask_set &&
+        (event_id_mask[netevent_event_md->event_type / 32] & (1u << (netevent_event_md->event_type % 32))) == 0) {
+        return false;
+    }
+
+    if ((attach_opts->flags & NETEVENT_ATTACH_FLAG_FILTER_DROP_REASON) &&
+        attach_opts->drop_reason != netevent_event_md->drop_reason) {
+        return false;
+    }
+
+    if ((attach_opts->flags & NETEVENT_ATTACH_FLAG_FILTER_COMPONENT_ID) &&
+        attach_opts->component_id != netevent_event_md->component_id) {
+        return false;
+    }
+
+    return true;
+}
+
+// Update the capture type requested from the NetEvent providers to the union of the capture types of all attached
+// clients. Must be called with _ebpf_netevent_event_hook_provider_lock held.
+static void
+_netevent_update_capture_type()
+{
+    const uint64_t* count = _ebpf_netevent_capture_type_client_count;
+    bool capture_flow = (count[NeteventCapture_All] != 0) || (count[NeteventCapture_Flow] != 0);
+    bool capture_drop = (count[NeteventCapture_All] != 0) || (count[NeteventCapture_Drop] != 0);
+    netevent_capture_type_t capture_type;
+
+    if (capture_flow && capture_drop) {
+        capture_type = NeteventCapture_All;
+    } else if (capture_flow) {
+        capture_type = NeteventCapture_Flow;
+    } else if (capture_drop) {
+        capture_type = NeteventCapture_Drop;
+    } else {
+        capture_type = NeteventCapture_None;
+    }
+
+    // The dispatch tables of the unused bindings are updated as well, for the providers that attach later.
+    for (uint32_t index = 0; index < NETEVENT_MAX_PROVIDER_BINDINGS; index++) {
+        _netevent_client_binding_contexts[index].client_dispatch.capture_type = capture_type;
+    }
+}
+
 //
 // Event Hook NPI Client Attach and Detach Callbacks (to NetEvent NPI provider).
 // Callbacks invoked when a Program Information NPI client attaches/detaches.
@@ -236,26 +568,34 @@ _netevent_ebpf_extension_netevent_on_client_attach(
     _In_ const ebpf_extension_hook_provider_t* provider_context)
 {
     ebpf_result_t result = EBPF_SUCCESS;
-    bool push_lock_acquired = false;
-    netevent_attach_opts_t* attach_opts;
+    netevent_attach_opts_t* attach_opts = NULL;
     const ebpf_extension_data_t* client_data = ebpf_extension_hook_client_get_client_data(attaching_client);
 
     EBPF_EXT_LOG_ENTRY();
 
     UNREFERENCED_PARAMETER(provider_context);
 
+    // Only the exact sizes of the known attach options versions are accepted.
     if (client_data == NULL || client_data->header.version < EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION ||
-        client_data->data_size != sizeof(*attach_opts) || client_data->data == NULL) {
+        !_netevent_is_valid_attach_opts_size(client_data->data_size) || client_data->data == NULL) {
         EBPF_EXT_LOG_MESSAGE(
             EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Invalid client data passed to attach.");
         result = EBPF_INVALID_ARGUMENT;
         goto Exit;
     }
 
-    attach_opts = (netevent_attach_opts_t*)client_data->data;
-    if ((attach_opts->capture_type >= NeteventCapture_All) && (attach_opts->capture_type <= NeteventCapture_None)) {
-        _netevent_client_dispatch.capture_type = attach_opts->capture_type;
-    } else {
+    // The attach options are normalized once here, and read directly from the client's provider data on dispatch.
+    attach_opts = (netevent_attach_opts_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(netevent_attach_opts_t), EBPF_NETEVENT_EXTENSION_POOL_TAG);
+    if (attach_opts == NULL) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Failed to allocate attach opts.");
+        result = EBPF_NO_MEMORY;
+        goto Exit;
+    }
+    _netevent_get_attach_opts(client_data, attach_opts);
+
+    if ((attach_opts->capture_type < NeteventCapture_All) || (attach_opts->capture_type > NeteventCapture_None)) {
         EBPF_EXT_LOG_MESSAGE(
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
             EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
@@ -264,19 +604,76 @@ _netevent_ebpf_extension_netevent_on_client_attach(
         goto Exit;
     }
 
+    if ((attach_opts->flags & ~NETEVENT_ATTACH_FLAGS_ALL) != 0) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Unsupported flags in attach opts.");
+        result = EBPF_OPERATION_NOT_SUPPORTED;
+        goto Exit;
+    }
+
+    result = netevent_ebpf_ext_reference_provider(attach_opts->capture_type);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+
+    ebpf_extension_hook_client_set_provider_data((ebpf_extension_hook_client_t*)attaching_client, attach_opts);
+    attach_opts = NULL;
+
+Exit:
+    if (attach_opts != NULL) {
+        ExFreePool(attach_opts);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_netevent_ebpf_extension_netevent_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    const netevent_attach_opts_t* attach_opts =
+        (const netevent_attach_opts_t*)ebpf_extension_hook_client_get_provider_data(detaching_client);
+
+    EBPF_EXT_LOG_ENTRY();
+
+    netevent_ebpf_ext_dereference_provider(attach_opts->capture_type);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+// The attach options stay in use by the events being dispatched until the detached client is run down.
+static void
+_netevent_ebpf_extension_netevent_on_client_cleanup(_In_ const ebpf_extension_hook_client_t* detached_client)
+{
+    ExFreePool((void*)ebpf_extension_hook_client_get_provider_data(detached_client));
+}
+
+ebpf_result_t
+netevent_ebpf_ext_reference_provider(netevent_capture_type_t capture_type)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
     ExAcquirePushLockExclusive(&_ebpf_netevent_event_hook_provider_lock);
-    push_lock_acquired = true;
+
+    // The NetEvent providers are asked for the union of the capture types of all clients, and events are demultiplexed
+    // to the clients that requested them in _ebpf_netevent_push_event. The union is updated before registering, as the
+    // provider may read the capture type when it attaches.
+    _ebpf_netevent_capture_type_client_count[capture_type]++;
+    _netevent_update_capture_type();
 
     if (!_ebpf_netevent_event_hook_provider_registered) {
         // Register and attach the neteventebpfext extension to NetEvent as an NMR Client.
-        // This will invoke the _netevent_ebpf_extension_attach_provider() callback.
+        // This will invoke the _netevent_ebpf_extension_attach_provider() callback for each NetEvent provider.
         NTSTATUS status = NmrRegisterClient(
             &_netevent_client_characteristics,
             &_netevent_client_registration_context,
-            &_netevent_client_binding_context.nmr_binding_handle);
+            &_netevent_client_registration_context.client_registration_handle);
         if (!NT_SUCCESS(status)) {
             EBPF_EXT_LOG_MESSAGE_NTSTATUS(
                 EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Attach to netevent failed", status);
+            _ebpf_netevent_capture_type_client_count[capture_type]--;
+            _netevent_update_capture_type();
             result = EBPF_OPERATION_NOT_SUPPORTED;
             goto Exit;
         }
@@ -286,38 +683,37 @@ _netevent_ebpf_extension_netevent_on_client_attach(
     _ebpf_netevent_event_hook_provider_registration_count++;
 
 Exit:
-    if (push_lock_acquired) {
-        ExReleasePushLockExclusive(&_ebpf_netevent_event_hook_provider_lock);
-    }
+    ExReleasePushLockExclusive(&_ebpf_netevent_event_hook_provider_lock);
 
     EBPF_EXT_RETURN_RESULT(result);
 }
 
-static void
-_netevent_ebpf_extension_netevent_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+void
+netevent_ebpf_ext_dereference_provider(netevent_capture_type_t capture_type)
 {
-    ebpf_result_t result = EBPF_SUCCESS;
-
     EBPF_EXT_LOG_ENTRY();
 
-    UNREFERENCED_PARAMETER(detaching_client);
-
-    // Unregister the netevent create notify routine.
     ExAcquirePushLockExclusive(&_ebpf_netevent_event_hook_provider_lock);
 
     _ebpf_netevent_event_hook_provider_registration_count--;
+    _ebpf_netevent_capture_type_client_count[capture_type]--;
+    _netevent_update_capture_type();
 
     if (_ebpf_netevent_event_hook_provider_registered && _ebpf_netevent_event_hook_provider_registration_count == 0) {
         // Detach the neteventebpfext extension from NetEvent as an NMR Client.
-        // This will invoke the _netevent_ebpf_extension_detach_provider() callback.
-        NTSTATUS status = NmrDeregisterClient(_netevent_client_binding_context.nmr_binding_handle);
+        // This will invoke the _netevent_ebpf_extension_detach_provider() callback for each NetEvent provider. The
+        // bindings must be released before the client can register again.
+        NTSTATUS status = NmrDeregisterClient(_netevent_client_registration_context.client_registration_handle);
+        if (status == STATUS_PENDING) {
+            status =
+                NmrWaitForClientDeregisterComplete(_netevent_client_registration_context.client_registration_handle);
+        }
         if (!NT_SUCCESS(status)) {
             EBPF_EXT_LOG_MESSAGE_NTSTATUS(
                 EBPF_EXT_TRACELOG_LEVEL_ERROR,
                 EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
                 "Detach from netevent failed",
                 status);
-            result = EBPF_OPERATION_NOT_SUPPORTED;
         }
         _ebpf_netevent_event_hook_provider_registered = FALSE;
     }
@@ -337,13 +733,55 @@ ebpf_ext_register_netevent()
 
     EBPF_EXT_LOG_ENTRY();
 
-    size_t event_buffers_array_size = 0;
-    size_t event_buffer_sizes_array_size = 0;
-
     const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
         &_ebpf_netevent_event_program_info_provider_moduleid, &_ebpf_netevent_event_program_data};
     const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
-        &_ebpf_netevent_event_hook_provider_moduleid, &_netevent_ebpf_netevent_event_hook_provider_data};
+        &_ebpf_netevent_event_hook_provider_moduleid,
+        &_netevent_ebpf_netevent_event_hook_provider_data,
+        EBPF_EXTENSION_HOOK_MAX_CLIENTS,
+        _netevent_ebpf_extension_netevent_on_client_cleanup};
+
+    // Allocate the per-CPU statistics before any event can be pushed.
+    uint32_t cpu_count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    _netevent_cpu_stats = (netevent_cpu_stats_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNxCacheAligned, cpu_count * sizeof(netevent_cpu_stats_t), EBPF_NETEVENT_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, _netevent_cpu_stats, "_netevent_cpu_stats", status);
+    memset(_netevent_cpu_stats, 0, cpu_count * sizeof(netevent_cpu_stats_t));
+    _netevent_cpu_stats_count = cpu_count;
+
+    // The flow table is flushed periodically, from its creation on.
+    status = netevent_flow_table_create(
+        NETEVENT_FLOW_TABLE_SHARD_ENTRY_COUNT, NETEVENT_FLOW_TABLE_QUEUE_RECORD_COUNT, &_netevent_flow_table);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "Insufficient memory initializing the flow table",
+            status);
+        goto Exit;
+    }
+
+    _netevent_flow_table_timer = ExAllocateTimer(_netevent_flow_table_timer_callback, NULL, 0);
+    if (_netevent_flow_table_timer == NULL) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "ExAllocateTimer failed");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+    ExSetTimer(
+        _netevent_flow_table_timer, -NETEVENT_FLOW_TABLE_FLUSH_INTERVAL, NETEVENT_FLOW_TABLE_FLUSH_INTERVAL, NULL);
+
+    // The memory of the capture ring is only allocated when user mode first maps it.
+    status = netevent_capture_ring_create(NETEVENT_CAPTURE_RING_DATA_SIZE, &_netevent_capture_ring);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "Insufficient memory initializing the capture ring",
+            status);
+        goto Exit;
+    }
 
     // Set the program type as the provider module id.
     _ebpf_netevent_event_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_NETEVENT;
@@ -379,48 +817,38 @@ ebpf_ext_register_netevent()
         goto Exit;
     }
 
-    // initialize per-cpu event buffers
-    _cpu_count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
-    event_buffers_array_size = _cpu_count * sizeof(uint8_t*);
-    event_buffer_sizes_array_size = _cpu_count * sizeof(size_t);
-
-    _event_buffers = (uint8_t**)ExAllocatePoolUninitialized(
-        NonPagedPoolNx, event_buffers_array_size, EBPF_NETEVENT_EXTENSION_POOL_TAG);
-
-    _event_buffer_sizes = (size_t*)ExAllocatePoolUninitialized(
-        NonPagedPoolNx, event_buffer_sizes_array_size, EBPF_NETEVENT_EXTENSION_POOL_TAG);
-
-    if (_event_buffers == NULL || _event_buffer_sizes == NULL) {
-        status = STATUS_INSUFFICIENT_RESOURCES;
+    // Per-CPU event buffers are allocated on first use. The pool has a buffer per processor, as many as the callers
+    // that can dispatch at PASSIVE_LEVEL without being preempted by one another.
+    status = ebpf_ext_per_cpu_buffer_create(INIT_EVENT_BUFFER_SIZE, cpu_count, &_event_buffer);
+    if (!NT_SUCCESS(status)) {
         EBPF_EXT_LOG_MESSAGE_NTSTATUS(
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
             EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-            "Insufficient memory initializing the event buffer array",
+            "Insufficient memory initializing the event buffer",
             status);
         goto Exit;
     }
 
-#pragma warning(push)
-#pragma warning(disable : 6386) // Buffer overrun while writing to '_event_buffer_sizes':  the writable size is
-                                // 'event_buffer_sizes_array_size' bytes, but '16' bytes might be written.
-#pragma warning(disable : 6385) // Reading invalid data from '_event_buffer_sizes':  the readable size is
-                                // 'event_buffer_sizes_array_size' bytes, but '16' bytes may be read.
-    for (size_t i = 0; i < _cpu_count; i++) {
-        // Allocate a buffer for each CPU.
-        _event_buffer_sizes[i] = INIT_EVENT_BUFFER_SIZE;
-        _event_buffers[i] = (uint8_t*)ExAllocatePoolUninitialized(
-            NonPagedPoolNx, _event_buffer_sizes[i], EBPF_NETEVENT_EXTENSION_POOL_TAG);
-        if (_event_buffers[i] == NULL) {
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
-                EBPF_EXT_TRACELOG_LEVEL_ERROR,
-                EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-                "Insufficient memory initializing the event buffer",
-                status);
-            goto Exit;
-        }
+    ExInitializeRundownProtection(&_event_buffer_trim_rundown);
+    _event_buffer_trim_work_item = IoAllocateWorkItem(_ebpf_ext_driver_device_object);
+    if (_event_buffer_trim_work_item == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "IoAllocateWorkItem", status);
+        goto Exit;
+    }
+    _event_buffer_trim_timer = ExAllocateTimer(_event_buffer_trim_timer_callback, NULL, 0);
+    if (_event_buffer_trim_timer == NULL) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "ExAllocateTimer failed");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+    ExSetTimer(_event_buffer_trim_timer, -EVENT_BUFFER_TRIM_INTERVAL, EVENT_BUFFER_TRIM_INTERVAL, NULL);
+
+    status = netevent_ebpf_ext_summary_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
     }
-#pragma warning(pop)
 
 Exit:
     if (!NT_SUCCESS(status)) {
@@ -432,6 +860,7 @@ Exit:
 void
 ebpf_ext_unregister_netevent()
 {
+    netevent_ebpf_ext_summary_unregister_providers();
     if (_ebpf_netevent_event_hook_provider_context) {
         ebpf_extension_hook_provider_unregister(_ebpf_netevent_event_hook_provider_context);
         _ebpf_netevent_event_hook_provider_context = NULL;
@@ -440,34 +869,245 @@ ebpf_ext_unregister_netevent()
         ebpf_extension_program_info_provider_unregister(_ebpf_netevent_event_program_info_provider_context);
         _ebpf_netevent_event_program_info_provider_context = NULL;
     }
-    if (_event_buffer_sizes != NULL) {
-        ExFreePool(_event_buffer_sizes);
-        _event_buffer_sizes = NULL;
+    if (_netevent_flow_table_timer != NULL) {
+        // Wait for a running flush to complete.
+        ExDeleteTimer(_netevent_flow_table_timer, TRUE, TRUE, NULL);
+        _netevent_flow_table_timer = NULL;
     }
-    if (_event_buffers != NULL) {
-        for (size_t i = 0; i < _cpu_count; i++) {
-            if (_event_buffers[i] != NULL) {
-                ExFreePool(_event_buffers[i]);
-                _event_buffers[i] = NULL;
-            }
+    if (_netevent_flow_table != NULL) {
+        netevent_flow_table_destroy(_netevent_flow_table);
+        _netevent_flow_table = NULL;
+    }
+    if (_netevent_capture_ring != NULL) {
+        netevent_capture_ring_destroy(_netevent_capture_ring);
+        _netevent_capture_ring = NULL;
+    }
+    if (_event_buffer_trim_timer != NULL) {
+        ExDeleteTimer(_event_buffer_trim_timer, TRUE, TRUE, NULL);
+        _event_buffer_trim_timer = NULL;
+    }
+    if (_event_buffer_trim_work_item != NULL) {
+        // Wait for a queued trim to complete.
+        ExWaitForRundownProtectionRelease(&_event_buffer_trim_rundown);
+        IoFreeWorkItem(_event_buffer_trim_work_item);
+        _event_buffer_trim_work_item = NULL;
+    }
+    if (_event_buffer != NULL) {
+        ebpf_ext_per_cpu_buffer_destroy(_event_buffer);
+        _event_buffer = NULL;
+    }
+    _netevent_coalescing_window = 0;
+    _netevent_sampling_rate = 0;
+    if (_netevent_cpu_stats != NULL) {
+        _netevent_cpu_stats_count = 0;
+        ExFreePool(_netevent_cpu_stats);
+        _netevent_cpu_stats = NULL;
+    }
+}
+
+void
+ebpf_ext_netevent_get_event_buffer_stats(_Out_ ebpf_ext_per_cpu_buffer_stats_t* stats)
+{
+    if (_event_buffer == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    ebpf_ext_per_cpu_buffer_get_stats(_event_buffer, stats);
+}
+
+void
+ebpf_ext_netevent_get_stats(_Out_ netevent_ext_stats_t* stats)
+{
+    ebpf_ext_per_cpu_buffer_stats_t buffer_stats;
+    uint64_t* total = (uint64_t*)stats;
+    const size_t counter_count = sizeof(*stats) / sizeof(uint64_t);
+
+    // Every field of the statistics is a counter, except for the buffer statistics which are set below.
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t index = 0; index <= _netevent_cpu_stats_count; index++) {
+        const netevent_cpu_stats_t* cpu_stats =
+            (index < _netevent_cpu_stats_count) ? &_netevent_cpu_stats[index] : &_netevent_overflow_stats;
+        const uint64_t* counters = (const uint64_t*)&cpu_stats->stats;
+        for (size_t counter = 0; counter < counter_count; counter++) {
+            total[counter] += counters[counter];
+        }
+    }
+
+    ebpf_ext_netevent_get_event_buffer_stats(&buffer_stats);
+    stats->buffer_resize_count = buffer_stats.grow_count + buffer_stats.shrink_count;
+    stats->buffer_peak_size = buffer_stats.peak_size;
+    stats->buffer_pool_empty = buffer_stats.pool_empty_count;
+
+    if (_netevent_flow_table != NULL) {
+        netevent_flow_table_stats_t flow_table_stats;
+        netevent_flow_table_get_stats(_netevent_flow_table, &flow_table_stats);
+        stats->flow_table_updates = flow_table_stats.update_count;
+        stats->flow_table_full = flow_table_stats.full_count;
+        stats->flow_records_flushed = flow_table_stats.flushed_count;
+    }
+
+    if (_netevent_capture_ring != NULL) {
+        netevent_capture_ring_stats_t capture_ring_stats;
+        netevent_capture_ring_get_stats(_netevent_capture_ring, &capture_ring_stats);
+        stats->captured = capture_ring_stats.written_count;
+        stats->capture_dropped = capture_ring_stats.dropped_count;
+    }
+}
+
+void
+netevent_ebpf_ext_get_summary_counters(_Out_ netevent_summary_md_t* counters)
+{
+    uint64_t* total = (uint64_t*)counters;
+    const size_t counter_count = sizeof(*counters) / sizeof(uint64_t);
+
+    memset(counters, 0, sizeof(*counters));
+    for (uint32_t index = 0; index <= _netevent_cpu_stats_count; index++) {
+        const netevent_cpu_stats_t* cpu_stats =
+            (index < _netevent_cpu_stats_count) ? &_netevent_cpu_stats[index] : &_netevent_overflow_stats;
+        const uint64_t* cpu_counters = (const uint64_t*)&cpu_stats->summary;
+        for (size_t counter = 0; counter < counter_count; counter++) {
+            total[counter] += cpu_counters[counter];
         }
-        ExFreePool(_event_buffers);
-        _event_buffers = NULL;
+    }
+}
+
+NTSTATUS
+ebpf_ext_device_control_netevent(
+    _In_opt_ const void* file_object,
+    ULONG io_control_code,
+    _In_reads_bytes_opt_(input_buffer_length) const void* input_buffer,
+    size_t input_buffer_length,
+    _Out_writes_bytes_to_opt_(output_buffer_length, *bytes_returned) void* output_buffer,
+    size_t output_buffer_length,
+    _Out_ size_t* bytes_returned)
+{
+    *bytes_returned = 0;
+
+    switch (io_control_code) {
+    case IOCTL_NETEVENT_EXT_GET_STATS:
+        if (output_buffer == NULL || output_buffer_length < sizeof(netevent_ext_stats_t)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+        ebpf_ext_netevent_get_stats((netevent_ext_stats_t*)output_buffer);
+        *bytes_returned = sizeof(netevent_ext_stats_t);
+        return STATUS_SUCCESS;
+    case IOCTL_NETEVENT_EXT_GET_FLOW_RECORDS:
+        if (output_buffer == NULL || output_buffer_length < sizeof(netevent_flow_record_t)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+        if (_netevent_flow_table == NULL) {
+            return STATUS_DEVICE_NOT_READY;
+        }
+        *bytes_returned = sizeof(netevent_flow_record_t) *
+                          netevent_flow_table_read_records(
+                              _netevent_flow_table,
+                              (netevent_flow_record_t*)output_buffer,
+                              (uint32_t)min(output_buffer_length / sizeof(netevent_flow_record_t), MAXUINT32));
+        return STATUS_SUCCESS;
+    case IOCTL_NETEVENT_EXT_FLUSH_FLOW_TABLE:
+        if (_netevent_flow_table == NULL) {
+            return STATUS_DEVICE_NOT_READY;
+        }
+        netevent_flow_table_flush(_netevent_flow_table);
+        return STATUS_SUCCESS;
+    case IOCTL_NETEVENT_EXT_SET_COALESCING: {
+        const netevent_coalescing_config_t* config = (const netevent_coalescing_config_t*)input_buffer;
+        if (config == NULL || input_buffer_length < sizeof(netevent_coalescing_config_t) ||
+            config->window_us > NETEVENT_COALESCING_MAX_WINDOW_US ||
+            config->key_length > NETEVENT_COALESCING_MAX_KEY_LENGTH) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        // The event path may briefly see the new window with the previous key length, which only affects coalescing.
+        _netevent_coalescing_key_length = config->key_length;
+        _netevent_coalescing_window = (uint64_t)config->window_us * 10;
+        return STATUS_SUCCESS;
+    }
+    case IOCTL_NETEVENT_EXT_SET_SAMPLING: {
+        const netevent_sampling_config_t* config = (const netevent_sampling_config_t*)input_buffer;
+        if (config == NULL || input_buffer_length < sizeof(netevent_sampling_config_t) ||
+            config->rate > NETEVENT_SAMPLING_MAX_RATE || config->burst > NETEVENT_SAMPLING_MAX_BURST ||
+            (config->rate != 0 && config->burst == 0)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        // The event path may briefly see the new rate with the previous burst, which only affects sampling.
+        _netevent_sampling_burst = config->burst;
+        _netevent_sampling_rate = config->rate;
+        return STATUS_SUCCESS;
+    }
+    case IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING: {
+        NTSTATUS status;
+        if (output_buffer == NULL || output_buffer_length < sizeof(netevent_capture_ring_mapping_t)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+        if (_netevent_capture_ring == NULL) {
+            return STATUS_DEVICE_NOT_READY;
+        }
+        status = netevent_capture_ring_map(
+            _netevent_capture_ring, file_object, (netevent_capture_ring_mapping_t*)output_buffer);
+        if (NT_SUCCESS(status)) {
+            *bytes_returned = sizeof(netevent_capture_ring_mapping_t);
+        }
+        return status;
+    }
+    case IOCTL_NETEVENT_EXT_UNMAP_CAPTURE_RING:
+        if (_netevent_capture_ring == NULL) {
+            return STATUS_DEVICE_NOT_READY;
+        }
+        return netevent_capture_ring_unmap(_netevent_capture_ring, file_object);
+    default:
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+}
+
+void
+ebpf_ext_file_cleanup_netevent(_In_opt_ const void* file_object)
+{
+    // The capture ring does not outlive the file object it was mapped through.
+    if (_netevent_capture_ring != NULL) {
+        (void)netevent_capture_ring_unmap(_netevent_capture_ring, file_object);
     }
 }
 
 //
 // Event Hook NPI client helper functions (invoked by NetEvent as the NPI provider).
 //
+
+// Result of parsing the packet carried by an event, shared by all the clients invoked for the event.
+typedef struct _netevent_flow_cache
+{
+    const uint8_t* packet; ///< Full packet, as pushed by the provider.
+    size_t packet_length;
+    bool parsed;
+    int32_t result;
+    size_t header_length; ///< Number of bytes of the packet covered by the parsed headers.
+    netevent_flow_key_t flow_key;
+} netevent_flow_cache_t;
+
 typedef struct _netevent_event_notify_context
 {
     EBPF_CONTEXT_HEADER;
     netevent_event_md_t netevent_event_md;
+    netevent_flow_cache_t* flow_cache; ///< NULL when the event is not shared, e.g. in test runs.
+    uint32_t cpu;                      ///< Processor that numbered the event.
 } netevent_event_notify_context_t;
 
 //
 // eBPF NetEvent Program Information NPI helper routines.
 //
+
+// Size of the netevent_data_header_t of a given version, which the PKTMON header follows.
+static size_t
+_netevent_data_header_size(uint16_t version)
+{
+    if (version < 2) {
+        return NETEVENT_DATA_HEADER_SIZE_V1;
+    }
+    if (version < 5) {
+        return NETEVENT_DATA_HEADER_SIZE_V4;
+    }
+    return sizeof(netevent_data_header_t);
+}
+
 static ebpf_result_t
 _ebpf_netevent_program_context_create(
     _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
@@ -480,8 +1120,9 @@ _ebpf_netevent_program_context_create(
     ebpf_result_t result;
     netevent_event_notify_context_t* netevent_event_context = NULL;
     netevent_data_header_t* header_ptr = (netevent_data_header_t*)data_in;
+    size_t data_header_size;
 
-    if (context_in == NULL || context_size_in < sizeof(netevent_event_md_t)) {
+    if (context_in == NULL || context_size_in < NETEVENT_EVENT_MD_SIZE_V2) {
         EBPF_EXT_LOG_MESSAGE(
             EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Input Context is required");
         result = EBPF_INVALID_ARGUMENT;
@@ -496,12 +1137,21 @@ _ebpf_netevent_program_context_create(
     }
     *context = NULL;
 
-    // Require data_in to be non-null and of sufficient size.
-    if (data_in == NULL || data_size_in < sizeof(netevent_data_header_t)) {
+    // Require data_in to be non-null and of sufficient size for the version of its header.
+    if (data_in == NULL || data_size_in < NETEVENT_DATA_HEADER_SIZE_V1) {
         EBPF_EXT_LOG_MESSAGE(
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
             EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-            "Input Data is required to be non-null and at least sizeof(netevent_data_header_t) bytes");
+            "Input Data is required to be non-null and at least NETEVENT_DATA_HEADER_SIZE_V1 bytes");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+    data_header_size = _netevent_data_header_size(header_ptr->version);
+    if (data_size_in < data_header_size) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "Input Data is required to be at least the size of the netevent_data_header_t of its version");
         result = EBPF_INVALID_ARGUMENT;
         goto Exit;
     }
@@ -512,15 +1162,34 @@ _ebpf_netevent_program_context_create(
     EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(
         EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, netevent_event_context, "netevent_event_context", result);
 
-    // Copy the context from the caller.
-    memcpy(&netevent_event_context->netevent_event_md, context_in, sizeof(netevent_event_md_t));
+    // Copy the context from the caller, which may predate the typed fields.
+    memset(&netevent_event_context->netevent_event_md, 0, sizeof(netevent_event_md_t));
+    memcpy(
+        &netevent_event_context->netevent_event_md,
+        context_in,
+        min(context_size_in, sizeof(netevent_event_md_t)));
+    netevent_event_context->flow_cache = NULL;
+    netevent_event_context->cpu = KeGetCurrentProcessorNumberEx(NULL);
 
     // Copy the event's pointer & size from the caller, to the out context.
     if ((header_ptr->type == NETEVENT_EVENT_TYPE_PKTMON_DROP) ||
         (header_ptr->type == NETEVENT_EVENT_TYPE_PKTMON_FLOW)) {
-        const size_t header_size = PKTMON_EVENT_HEADER_LENGTH + sizeof(netevent_data_header_t);
+        const size_t header_size = PKTMON_EVENT_HEADER_LENGTH + data_header_size;
         netevent_event_context->netevent_event_md.data_meta = (uint8_t*)data_in;
         netevent_event_context->netevent_event_md.data = (uint8_t*)data_in + header_size;
+        // Decode the typed fields as the extension does for the events pushed by the providers.
+        if (data_size_in >= header_size) {
+            _netevent_decode_pktmon_header(data_in + data_header_size, &netevent_event_context->netevent_event_md);
+        }
+        // The source id takes the padding that follows the type before version 4.
+        if (header_ptr->version >= 4) {
+            netevent_event_context->netevent_event_md.source_id = header_ptr->source_id;
+        }
+        if (data_header_size == sizeof(netevent_data_header_t)) {
+            netevent_event_context->netevent_event_md.sequence = header_ptr->sequence;
+            netevent_event_context->netevent_event_md.push_timestamp = header_ptr->push_timestamp;
+            netevent_event_context->cpu = header_ptr->cpu;
+        }
     } else {
         // Currently, no other event types are supported.
         EBPF_EXT_LOG_MESSAGE(
@@ -561,15 +1230,16 @@ _ebpf_netevent_program_context_destroy(
     netevent_event_context = CONTAINING_RECORD(context, netevent_event_notify_context_t, netevent_event_md);
     netevent_event_context_out = (netevent_event_md_t*)context_out;
 
-    if (context_out != NULL && *context_size_out >= sizeof(netevent_event_md_t)) {
-        // Copy the context to the caller.
-        memcpy(netevent_event_context_out, &netevent_event_context->netevent_event_md, sizeof(netevent_event_md_t));
+    if (context_out != NULL && *context_size_out >= NETEVENT_EVENT_MD_SIZE_V2) {
+        // Copy the context to the caller, up to the size of its context.
+        size_t context_size = min(*context_size_out, sizeof(netevent_event_md_t));
+        memcpy(netevent_event_context_out, &netevent_event_context->netevent_event_md, context_size);
 
         // Zero out the event context info.
         netevent_event_context_out->data_meta = 0;
         netevent_event_context_out->data = 0;
         netevent_event_context_out->data_end = 0;
-        *context_size_out = sizeof(netevent_event_md_t);
+        *context_size_out = context_size;
     } else {
         *context_size_out = 0;
     }
@@ -593,30 +1263,400 @@ Exit:
     EBPF_EXT_LOG_EXIT();
 }
 
-void
-_ebpf_netevent_push_event(_In_ netevent_event_t* netevent_event)
+//
+// Helper functions exposed to client eBPF programs.
+//
+_Success_(return >= 0) static int32_t _ebpf_netevent_push_event_helper(_In_ netevent_event_md_t* netevent_event_md)
 {
-    // Logging may delay the event processing, consider enabling only for debugging or if the calling frequency for a
-    // specific use case is low.
-    // EBPF_EXT_LOG_ENTRY();
+    // bpf_netevent_push_event is reserved, events are delivered to user mode with the generic map helpers.
+    UNREFERENCED_PARAMETER(netevent_event_md);
+    return -ENOTSUP;
+}
 
-    if (netevent_event == NULL) {
-        EBPF_EXT_LOG_MESSAGE(
-            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "netevent_event is NULL")
+// Parse the packet of an event, unless another program already did, using local_flow_cache when the event is not
+// shared with other programs.
+static int32_t
+_netevent_parse_event_flow(
+    _In_ netevent_event_md_t* netevent_event_md,
+    _Inout_ netevent_flow_cache_t* local_flow_cache,
+    _Outptr_ netevent_flow_cache_t** event_flow_cache)
+{
+    netevent_event_notify_context_t* netevent_event_context =
+        CONTAINING_RECORD(netevent_event_md, netevent_event_notify_context_t, netevent_event_md);
+    netevent_flow_cache_t* flow_cache = netevent_event_context->flow_cache;
+
+    if (flow_cache == NULL) {
+        // Parse the packet passed to this program.
+        flow_cache = local_flow_cache;
+        flow_cache->packet = netevent_event_md->data;
+        flow_cache->packet_length = netevent_event_md->data_end - netevent_event_md->data;
+        flow_cache->parsed = false;
+    }
+    *event_flow_cache = flow_cache;
+
+    if (!flow_cache->parsed) {
+        flow_cache->result = netevent_parse_flow(
+            flow_cache->packet,
+            flow_cache->packet_length,
+            netevent_event_md->packet_type,
+            &flow_cache->flow_key,
+            &flow_cache->header_length);
+        flow_cache->parsed = true;
+    }
+    return flow_cache->result;
+}
+
+_Success_(return >= 0) static int32_t _ebpf_netevent_parse_flow_helper(
+    _In_ netevent_event_md_t* netevent_event_md,
+    _Out_writes_bytes_(flow_key_length) uint8_t* flow_key,
+    uint32_t flow_key_length)
+{
+    netevent_flow_cache_t local_flow_cache;
+    netevent_flow_cache_t* flow_cache;
+    int32_t result;
+
+    if (flow_key_length < sizeof(netevent_flow_key_t)) {
+        return -EINVAL;
+    }
+    memset(flow_key, 0, flow_key_length);
+
+    result = _netevent_parse_event_flow(netevent_event_md, &local_flow_cache, &flow_cache);
+    if (result != 0) {
+        return result;
+    }
+
+    // The packet may have been truncated to this program's snaplen.
+    if (flow_cache->header_length > (size_t)(netevent_event_md->data_end - netevent_event_md->data)) {
+        return -EINVAL;
+    }
+
+    memcpy(flow_key, &flow_cache->flow_key, sizeof(netevent_flow_key_t));
+    return 0;
+}
+
+_Success_(return >= 0) static int32_t _ebpf_netevent_flow_table_update_helper(
+    _In_ netevent_event_md_t* netevent_event_md)
+{
+    netevent_flow_cache_t local_flow_cache;
+    netevent_flow_cache_t* flow_cache;
+    netevent_flow_record_t key;
+    int32_t result;
+
+    if (_netevent_flow_table == NULL) {
+        return -EINVAL;
+    }
+
+    // The whole packet is parsed here, as the flow table aggregates events regardless of the program's snaplen.
+    result = _netevent_parse_event_flow(netevent_event_md, &local_flow_cache, &flow_cache);
+    if (result != 0) {
+        return result;
+    }
+
+    memset(&key, 0, sizeof(key));
+    memcpy(&key.flow_key, &flow_cache->flow_key, sizeof(key.flow_key));
+    key.flow_key.l3_offset = 0;
+    key.flow_key.l4_offset = 0;
+    key.flow_key.payload_offset = 0;
+    key.drop_reason = netevent_event_md->drop_reason;
+    key.event_type = netevent_event_md->event_type;
+
+    return netevent_flow_table_update(
+        _netevent_flow_table, &key, flow_cache->packet_length, netevent_event_md->timestamp);
+}
+
+_Success_(return >= 0) static int32_t _ebpf_netevent_capture_helper(
+    _In_ netevent_event_md_t* netevent_event_md, uint32_t snaplen)
+{
+    netevent_event_notify_context_t* netevent_event_context =
+        CONTAINING_RECORD(netevent_event_md, netevent_event_notify_context_t, netevent_event_md);
+    netevent_flow_cache_t* flow_cache = netevent_event_context->flow_cache;
+    const uint8_t* data;
+    size_t data_length;
+    netevent_data_header_t data_header;
+
+    if (_netevent_capture_ring == NULL) {
+        return -ENODEV;
+    }
+
+    // Capture from the provider's event memory, which covers the whole event regardless of the program's snaplen and
+    // of the copy made for the program, unless the event is not shared.
+    if (flow_cache != NULL) {
+        data = flow_cache->packet;
+        data_length = flow_cache->packet_length;
+    } else {
+        if (netevent_event_md->data_end < netevent_event_md->data ||
+            netevent_event_md->data - netevent_event_md->data_meta < PKTMON_EVENT_HEADER_LENGTH) {
+            return -EINVAL;
+        }
+        data = netevent_event_md->data;
+        data_length = netevent_event_md->data_end - netevent_event_md->data;
+    }
+
+    memset(&data_header, 0, sizeof(data_header));
+    data_header.type = netevent_event_md->event_type;
+    data_header.source_id = netevent_event_md->source_id;
+    data_header.version = NETEVENT_PKTMON_EVENT_CURRENT_VERSION;
+    data_header.original_length = (uint32_t)data_length;
+    data_header.cpu = netevent_event_context->cpu;
+    data_header.sequence = netevent_event_md->sequence;
+    data_header.push_timestamp = netevent_event_md->push_timestamp;
+
+    if (snaplen != 0 && snaplen < data_length) {
+        data_length = snaplen;
+    }
+
+    // The PKTMON header immediately precedes the event data, in the provider's memory as in the program's context.
+    return netevent_capture_ring_write(
+        _netevent_capture_ring, &data_header, data - PKTMON_EVENT_HEADER_LENGTH, data, (uint32_t)data_length);
+}
+
+static void
+_netevent_flow_table_timer_callback(_In_ PEX_TIMER timer, _In_opt_ PVOID context)
+{
+    UNREFERENCED_PARAMETER(timer);
+    UNREFERENCED_PARAMETER(context);
+
+    netevent_flow_table_flush(_netevent_flow_table);
+}
+
+static void
+_event_buffer_trim_timer_callback(_In_ PEX_TIMER timer, _In_opt_ PVOID context)
+{
+    UNREFERENCED_PARAMETER(timer);
+    UNREFERENCED_PARAMETER(context);
+
+    // A trim that is still queued covers this period.
+    if (InterlockedCompareExchange(&_event_buffer_trim_queued, 1, 0) != 0) {
+        return;
+    }
+    if (!ExAcquireRundownProtection(&_event_buffer_trim_rundown)) {
+        InterlockedExchange(&_event_buffer_trim_queued, 0);
         return;
     }
+    IoQueueWorkItem(_event_buffer_trim_work_item, _event_buffer_trim_work_item_routine, DelayedWorkQueue, NULL);
+}
 
-    ebpf_result_t result;
-    ebpf_extension_hook_client_t* client_context = NULL;
-    netevent_event_notify_context_t netevent_event_notify_context = {0};
+static void
+_event_buffer_trim_work_item_routine(_In_ DEVICE_OBJECT* device_object, _In_opt_ void* context)
+{
+    UNREFERENCED_PARAMETER(device_object);
+    UNREFERENCED_PARAMETER(context);
+
+    ebpf_ext_per_cpu_buffer_trim(_event_buffer);
+
+    InterlockedExchange(&_event_buffer_trim_queued, 0);
+    ExReleaseRundownProtection(&_event_buffer_trim_rundown);
+}
+
+// Copy the event into an event buffer of at least sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH +
+// copy_length bytes, behind a netevent data header, and point the program context at the copy. At most copy_length
+// bytes following the PKTMON header are copied.
+static void
+_ebpf_netevent_copy_event(
+    _In_ const netevent_event_t* netevent_event,
+    uint64_t copy_length,
+    uint32_t cpu,
+    _Out_writes_bytes_(sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH + copy_length) uint8_t* event_buffer,
+    _Inout_ netevent_event_md_t* netevent_event_md,
+    _Inout_ netevent_ext_stats_t* stats)
+{
     netevent_data_header_t* header_ptr = NULL;
     uint8_t* _event_buffer_data_start = NULL;
-    uint8_t* data_start = NULL;
-    uint64_t payload_size = 0;
-    uint64_t total_size = 0;
-    uint32_t current_cpu;
+    uint64_t payload_size = netevent_event->event_end - netevent_event->event_start;
+    uint64_t total_size = sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH + copy_length;
     PKTMON_EVT_STREAM_PACKET_HEADER_MINIMAL* pktmon_header = NULL;
-    KIRQL old_irql = KeGetCurrentIrql();
+
+    // Write the capture header directly into the buffer
+    header_ptr = (netevent_data_header_t*)event_buffer;
+    header_ptr->version = NETEVENT_PKTMON_EVENT_CURRENT_VERSION;
+    pktmon_header = (PKTMON_EVT_STREAM_PACKET_HEADER_MINIMAL*)netevent_event->event_start;
+    header_ptr->type = (uint8_t)pktmon_header->EventId;
+    header_ptr->source_id = netevent_event_md->source_id;
+    header_ptr->cpu = cpu;
+    header_ptr->reserved = 0;
+    header_ptr->sequence = netevent_event_md->sequence;
+    header_ptr->push_timestamp = netevent_event_md->push_timestamp;
+    header_ptr->original_length = (uint32_t)(payload_size - PKTMON_EVENT_HEADER_LENGTH);
+
+    // Copy header into the event buffer.
+    _event_buffer_data_start = event_buffer + sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH;
+    memcpy(event_buffer + sizeof(netevent_data_header_t), netevent_event->event_start, PKTMON_EVENT_HEADER_LENGTH);
+    // Copy the (possibly truncated) payload data into the event buffer.
+    memcpy(_event_buffer_data_start, netevent_event->event_start + PKTMON_EVENT_HEADER_LENGTH, copy_length);
+
+    // Assign pointers to the bpf program context.
+    netevent_event_md->data_meta = event_buffer;
+    netevent_event_md->data = _event_buffer_data_start;
+    netevent_event_md->data_end = event_buffer + total_size;
+
+    stats->copied++;
+    if (copy_length < payload_size - PKTMON_EVENT_HEADER_LENGTH) {
+        stats->truncated++;
+    }
+}
+
+// Fold bytes into a 64-bit FNV-1a hash.
+static inline uint64_t
+_netevent_fnv1a(uint64_t hash, _In_reads_bytes_(length) const void* data, size_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t index = 0; index < length; index++) {
+        hash = (hash ^ bytes[index]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Check whether a drop event repeats, within the coalescing window, one emitted earlier by this processor. Otherwise,
+// record the event as emitted and set its repeat_count to the number of events coalesced since the previous one with
+// the same key. Must be called at DISPATCH_LEVEL, on the processor owning the table.
+static bool
+_netevent_coalesce_event(
+    _Inout_updates_(NETEVENT_COALESCING_TABLE_ENTRY_COUNT) netevent_coalescing_entry_t* coalescing_table,
+    _In_reads_bytes_(data_length) const uint8_t* data,
+    size_t data_length,
+    _Inout_ netevent_event_md_t* netevent_event_md)
+{
+    uint64_t window = _netevent_coalescing_window;
+    size_t key_length = min(data_length, (size_t)_netevent_coalescing_key_length);
+    uint64_t key_hash = 0xcbf29ce484222325ull;
+    uint64_t now;
+    size_t prefix_length;
+    bool same_key;
+    netevent_coalescing_entry_t* entry;
+
+    if (window == 0) {
+        return false;
+    }
+
+    key_hash = _netevent_fnv1a(key_hash, &netevent_event_md->event_type, sizeof(netevent_event_md->event_type));
+    key_hash = _netevent_fnv1a(key_hash, &netevent_event_md->drop_reason, sizeof(netevent_event_md->drop_reason));
+    key_hash = _netevent_fnv1a(key_hash, &key_length, sizeof(key_length));
+    key_hash = _netevent_fnv1a(key_hash, data, key_length);
+    if (key_hash == 0) {
+        key_hash = 1;
+    }
+
+    // The hash alone could match the key of another event sharing the entry. Keys that only differ after their prefix
+    // and whose hashes collide are still taken for the same key.
+    prefix_length = min(key_length, (size_t)NETEVENT_COALESCING_KEY_PREFIX_LENGTH);
+    entry = &coalescing_table[key_hash % NETEVENT_COALESCING_TABLE_ENTRY_COUNT];
+    same_key = entry->key_hash == key_hash && entry->event_type == netevent_event_md->event_type &&
+               entry->drop_reason == netevent_event_md->drop_reason && entry->key_length == key_length &&
+               memcmp(entry->key_prefix, data, prefix_length) == 0;
+
+    // The window starts at the emitted event, so a steady stream of identical events emits one event per window.
+    now = KeQueryInterruptTime();
+    if (same_key && now - entry->window_start < window) {
+        entry->repeat_count++;
+        return true;
+    }
+
+    // The repeat count of an entry replaced by another key is lost, the events remain counted in the statistics.
+    netevent_event_md->repeat_count = same_key ? entry->repeat_count : 0;
+    entry->key_hash = key_hash;
+    entry->window_start = now;
+    entry->repeat_count = 0;
+    entry->drop_reason = netevent_event_md->drop_reason;
+    entry->event_type = netevent_event_md->event_type;
+    entry->key_length = (uint32_t)key_length;
+    memcpy(entry->key_prefix, data, prefix_length);
+    return false;
+}
+
+// Check whether a drop event is to be dispatched, according to the token bucket of its stratum on this processor. The
+// decision only depends on the fields decoded from the PKTMON header, so skipped events are never copied. When the
+// event is dispatched, set its sample_weight to the number of events of the stratum it stands for. Must be called at
+// DISPATCH_LEVEL, on the processor owning the table.
+static bool
+_netevent_sample_event(
+    _Inout_updates_(NETEVENT_SAMPLING_TABLE_ENTRY_COUNT) netevent_sampling_entry_t* sampling_table,
+    _Inout_ netevent_event_md_t* netevent_event_md)
+{
+    uint64_t rate = _netevent_sampling_rate;
+    uint64_t capacity = (uint64_t)_netevent_sampling_burst * NETEVENT_SAMPLING_TOKEN;
+    uint64_t stratum_hash = 0xcbf29ce484222325ull;
+    uint64_t now;
+    netevent_sampling_entry_t* entry;
+
+    if (rate == 0) {
+        return true;
+    }
+
+    stratum_hash =
+        _netevent_fnv1a(stratum_hash, &netevent_event_md->drop_reason, sizeof(netevent_event_md->drop_reason));
+    stratum_hash =
+        _netevent_fnv1a(stratum_hash, &netevent_event_md->component_id, sizeof(netevent_event_md->component_id));
+
+    // A stratum replacing another one in its entry starts with a full bucket, the skipped events of the previous one
+    // remain counted in the statistics.
+    now = KeQueryInterruptTime();
+    entry = &sampling_table[stratum_hash % NETEVENT_SAMPLING_TABLE_ENTRY_COUNT];
+    if (!entry->in_use || entry->drop_reason != netevent_event_md->drop_reason ||
+        entry->component_id != netevent_event_md->component_id) {
+        entry->drop_reason = netevent_event_md->drop_reason;
+        entry->component_id = netevent_event_md->component_id;
+        entry->in_use = TRUE;
+        entry->skipped_count = 0;
+        entry->tokens = capacity;
+    } else {
+        entry->tokens += min(now - entry->last_refill, NETEVENT_SAMPLING_MAX_REFILL_INTERVAL) * rate;
+        entry->tokens = min(entry->tokens, capacity);
+    }
+    entry->last_refill = now;
+
+    if (entry->tokens < NETEVENT_SAMPLING_TOKEN) {
+        if (entry->skipped_count < MAXUINT32 - 1) {
+            entry->skipped_count++;
+        }
+        return false;
+    }
+    entry->tokens -= NETEVENT_SAMPLING_TOKEN;
+    netevent_event_md->sample_weight = entry->skipped_count + 1;
+    entry->skipped_count = 0;
+    return true;
+}
+
+// Event prepared for the clients that asked for it, by _ebpf_netevent_prepare_event.
+typedef struct _netevent_prepared_event
+{
+    netevent_event_notify_context_t zero_copy_context; ///< Context on the provider's memory, with the decoded fields.
+    netevent_flow_cache_t flow_cache;                  ///< Parsing result shared by the clients.
+    bool copy_needed;                                  ///< Whether a client needs a copy of the event.
+    uint64_t copy_length;                              ///< Number of bytes after the PKTMON header to copy.
+    bool zero_copy_allowed;                            ///< Whether both the extension and the provider allow it.
+} netevent_prepared_event_t;
+
+// Count an event and find the clients of a snapshot whose capture type and filters it passes. Returns true if clients
+// are to be invoked, in which case the event is numbered and prepared for them. Must be called at DISPATCH_LEVEL, as it
+// updates the tables of the current CPU.
+static bool
+_ebpf_netevent_prepare_event(
+    _In_ const netevent_event_t* netevent_event,
+    uint8_t source_id,
+    uint64_t push_timestamp,
+    _In_opt_ ebpf_extension_hook_client_snapshot_t* snapshot,
+    _Inout_ netevent_cpu_stats_t* cpu_stats,
+    _Out_ netevent_prepared_event_t* prepared)
+{
+    netevent_ext_stats_t* stats = &cpu_stats->stats;
+    netevent_summary_md_t* summary = &cpu_stats->summary;
+    uint64_t payload_size = 0;
+    uint32_t client_count = 0;
+    uint32_t size_bucket = 0;
+    bool client_matched = false;
+    netevent_event_md_t* event_fields = &prepared->zero_copy_context.netevent_event_md;
+
+    memset(&prepared->zero_copy_context, 0, sizeof(prepared->zero_copy_context));
+    prepared->copy_needed = false;
+    prepared->copy_length = 0;
+    prepared->zero_copy_allowed =
+        (NETEVENT_EXTENSION_CAPABILITIES & NETEVENT_CAPABILITY_ZERO_COPY) != 0 &&
+        (_netevent_client_binding_contexts[source_id].provider_capabilities & NETEVENT_CAPABILITY_ZERO_COPY) != 0;
+
+    stats->received++;
+    if (snapshot != NULL) {
+        client_count = ebpf_extension_hook_client_snapshot_get_count(snapshot);
+    }
 
     // Ensure that we have valid netevent event data.
     if (netevent_event->event_end <= netevent_event->event_start) {
@@ -624,13 +1664,12 @@ _ebpf_netevent_push_event(_In_ netevent_event_t* netevent_event)
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
             EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
             "Invalid event: netevent_event->event_end <= netevent_event->event_start");
-        goto Exit;
+        stats->invalid++;
+        return false;
     }
 
     // Calculate sizes after validating the event data pointers
     payload_size = netevent_event->event_end - netevent_event->event_start;
-    total_size = sizeof(netevent_data_header_t) + payload_size;
-    data_start = netevent_event->event_start + PKTMON_EVENT_HEADER_LENGTH;
 
     // Ensure that the payload is at least as large as the header length.
     if (payload_size < PKTMON_EVENT_HEADER_LENGTH) {
@@ -638,104 +1677,336 @@ _ebpf_netevent_push_event(_In_ netevent_event_t* netevent_event)
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
             EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
             "Invalid event: payload_size < PKTMON_EVENT_HEADER_LENGTH");
-        goto Exit;
+        stats->invalid++;
+        return false;
     }
 
-    // Allocate buffer for header + actual payload size
-    // Currently, the verifier does not support read-only contexts, so we need to copy the event data, rather than
-    // directly passing the existing pointers.
-    // Verifier feature proposal: https://github.com/vbpf/ebpf-verifier/issues/639
+    // The PKTMON header is decoded once per event into the typed context fields shared by all clients. Clients are only
+    // invoked for the events that pass their capture type and filters, which are evaluated on these fields before
+    // anything is copied.
+    _netevent_decode_pktmon_header(netevent_event->event_start, event_fields);
+    event_fields->sample_weight = 1;
+    event_fields->source_id = source_id;
+    event_fields->push_timestamp = push_timestamp;
+
+    // Count the event for the netevent_summary programs, which only run once per interval.
+    summary->event_count++;
+    summary->bytes += payload_size - PKTMON_EVENT_HEADER_LENGTH;
+    summary->component_count[min(event_fields->component_id, NETEVENT_SUMMARY_COMPONENT_COUNT - 1u)]++;
+    if (event_fields->event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP) {
+        stats->event_type_count[NeteventStatsEventType_Drop]++;
+        summary->drop_count++;
+        summary->drop_reason_count[min(event_fields->drop_reason, NETEVENT_SUMMARY_DROP_REASON_COUNT - 1u)]++;
+    } else if (event_fields->event_type == NETEVENT_EVENT_TYPE_PKTMON_FLOW) {
+        stats->event_type_count[NeteventStatsEventType_Flow]++;
+        summary->flow_count++;
+    } else {
+        stats->event_type_count[NeteventStatsEventType_Other]++;
+        summary->other_count++;
+    }
+    while (size_bucket < NETEVENT_STATS_SIZE_BUCKET_COUNT - 1 &&
+           payload_size - PKTMON_EVENT_HEADER_LENGTH >= ((uint64_t)NETEVENT_STATS_SIZE_BUCKET_BASE << size_bucket)) {
+        size_bucket++;
+    }
+    stats->event_size_histogram[size_bucket]++;
+
+    // Drop events coalesced into an earlier one are not dispatched. The events of the processors sharing the overflow
+    // statistics are never coalesced, as their table is not owned by a single processor.
+    if (event_fields->event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP && cpu_stats != &_netevent_overflow_stats &&
+        _netevent_coalesce_event(
+            cpu_stats->coalescing_table,
+            netevent_event->event_start + PKTMON_EVENT_HEADER_LENGTH,
+            payload_size - PKTMON_EVENT_HEADER_LENGTH,
+            event_fields)) {
+        stats->coalesced++;
+        return false;
+    }
 
-    if (old_irql < DISPATCH_LEVEL) {
-        old_irql = KeRaiseIrqlToDpcLevel();
+    // Drop events of a stratum that ran out of tokens are not dispatched either, and the overflow statistics are never
+    // sampled for the same reason.
+    if (event_fields->event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP && cpu_stats != &_netevent_overflow_stats &&
+        !_netevent_sample_event(cpu_stats->sampling_table, event_fields)) {
+        stats->sampled_out++;
+        return false;
     }
-    current_cpu = KeGetCurrentProcessorNumberEx(NULL);
 
-    if (_event_buffers == NULL || _event_buffer_sizes == NULL) {
-        EBPF_EXT_LOG_MESSAGE(
-            EBPF_EXT_TRACELOG_LEVEL_ERROR,
-            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-            "Event buffer arrays have not been initialized - event lost");
-        goto Exit;
+    // The packet is parsed on the first bpf_netevent_parse_flow call of any client, on the provider's event memory
+    // which covers the packet of every client's context.
+    prepared->flow_cache.packet = netevent_event->event_start + PKTMON_EVENT_HEADER_LENGTH;
+    prepared->flow_cache.packet_length = payload_size - PKTMON_EVENT_HEADER_LENGTH;
+    prepared->flow_cache.parsed = false;
+    prepared->zero_copy_context.flow_cache = &prepared->flow_cache;
+
+    // Clients attached with NETEVENT_ATTACH_FLAG_ZERO_COPY run directly on the provider's event memory, which stays
+    // valid until the push returns, when both the extension and the provider allow it.
+    event_fields->data_meta = netevent_event->event_start;
+    event_fields->data = netevent_event->event_start + PKTMON_EVENT_HEADER_LENGTH;
+    event_fields->data_end = netevent_event->event_end;
+
+    // All other clients get a copy of the event. Currently, the verifier does not support read-only contexts, so the
+    // copy is used rather than directly passing the existing pointers, whatever the attach flags. The copy is made
+    // once per event, and only covers the largest snaplen requested by those clients.
+    // Verifier feature proposal: https://github.com/vbpf/ebpf-verifier/issues/639
+    for (uint32_t index = 0; index < client_count; index++) {
+        ebpf_extension_hook_client_t* client_context = ebpf_extension_hook_client_snapshot_get_client(snapshot, index);
+        const netevent_attach_opts_t* attach_opts =
+            (const netevent_attach_opts_t*)ebpf_extension_hook_client_get_provider_data(client_context);
+        if (!_netevent_client_matches_event(attach_opts, event_fields)) {
+            continue;
+        }
+        client_matched = true;
+        if ((attach_opts->flags & NETEVENT_ATTACH_FLAG_ZERO_COPY) == 0 || !prepared->zero_copy_allowed) {
+            uint64_t client_copy_length = payload_size - PKTMON_EVENT_HEADER_LENGTH;
+            if (attach_opts->snaplen != 0 && attach_opts->snaplen < client_copy_length) {
+                client_copy_length = attach_opts->snaplen;
+            }
+            prepared->copy_length = max(prepared->copy_length, client_copy_length);
+            prepared->copy_needed = true;
+        }
     }
 
-    if (current_cpu >= _cpu_count) {
-        EBPF_EXT_LOG_MESSAGE(
-            EBPF_EXT_TRACELOG_LEVEL_ERROR,
-            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-            "Current cpu number is greater than max cpu count - event lost");
-        goto Exit;
+    if (!client_matched) {
+        stats->filtered++;
+        return false;
     }
 
-    if (total_size > _event_buffer_sizes[current_cpu]) {
-        // If the event buffer is too small, attempt to resize it.
-        uint8_t* new_event_buffer =
-            (uint8_t*)ExAllocatePoolUninitialized(NonPagedPoolNx, total_size, EBPF_NETEVENT_EXTENSION_POOL_TAG);
-        if (new_event_buffer == NULL) {
+    // Only the events dispatched to the programs are numbered, so that a consumer receiving all of them can detect the
+    // ones lost after the extension from the gaps in the sequence numbers of each processor.
+    event_fields->sequence = cpu_stats->sequence++;
+    prepared->zero_copy_context.cpu = KeGetCurrentProcessorNumberEx(NULL);
+    return true;
+}
+
+// Invoke the clients an event was prepared for, copying the event for those that need a copy. At DISPATCH_LEVEL the
+// copy is made in the current CPU's event buffer, and below DISPATCH_LEVEL in a pooled buffer, so that the programs run
+// without raising IRQL. Only the statistics of the copy and of the invocations are updated, in the given counters.
+static void
+_ebpf_netevent_invoke_clients(
+    _In_ const netevent_event_t* netevent_event,
+    _In_ ebpf_extension_hook_client_snapshot_t* snapshot,
+    _Inout_ netevent_prepared_event_t* prepared,
+    _Inout_ netevent_ext_stats_t* stats)
+{
+    ebpf_result_t result;
+    netevent_event_notify_context_t netevent_event_notify_context;
+    netevent_event_md_t* event_fields = &prepared->zero_copy_context.netevent_event_md;
+    uint32_t client_count = ebpf_extension_hook_client_snapshot_get_count(snapshot);
+    uint8_t* event_buffer = NULL;
+    uint32_t buffer_index = 0;
+    bool buffer_pooled = false;
+    bool event_copied = false;
+    KIRQL old_irql = KeGetCurrentIrql();
+    bool irql_raised = false;
+
+    if (prepared->copy_needed) {
+        size_t total_size =
+            (size_t)(sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH + prepared->copy_length);
+        if (_event_buffer == NULL) {
             EBPF_EXT_LOG_MESSAGE(
                 EBPF_EXT_TRACELOG_LEVEL_ERROR,
                 EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-                "Failed to resize the event buffer - event lost");
-            goto Exit;
-        }
-        if (_event_buffers[current_cpu]) {
-            ExFreePool(_event_buffers[current_cpu]);
+                "Event buffer has not been initialized - event lost");
+            stats->lost_no_buffer++;
+        } else {
+            if (old_irql < DISPATCH_LEVEL) {
+                event_buffer = ebpf_ext_per_cpu_buffer_acquire(_event_buffer, total_size, &buffer_index);
+                buffer_pooled = (event_buffer != NULL);
+                if (!buffer_pooled) {
+                    // Fall back to the current CPU's buffer, which is only owned at DISPATCH_LEVEL.
+                    old_irql = KeRaiseIrqlToDpcLevel();
+                    irql_raised = true;
+                }
+            }
+            if (event_buffer == NULL) {
+                event_buffer = ebpf_ext_per_cpu_buffer_get(_event_buffer, total_size);
+            }
+            if (event_buffer == NULL) {
+                EBPF_EXT_LOG_MESSAGE(
+                    EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                    EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+                    "Failed to resize the event buffer - event lost");
+                stats->lost_allocation_failure++;
+            } else {
+                netevent_event_notify_context = prepared->zero_copy_context;
+                _ebpf_netevent_copy_event(
+                    netevent_event,
+                    prepared->copy_length,
+                    prepared->zero_copy_context.cpu,
+                    event_buffer,
+                    &netevent_event_notify_context.netevent_event_md,
+                    stats);
+                event_copied = true;
+            }
         }
-        _event_buffers[current_cpu] = new_event_buffer;
-        _event_buffer_sizes[current_cpu] = total_size;
     }
 
-    // Write the capture header directly into the buffer
-    header_ptr = (netevent_data_header_t*)_event_buffers[current_cpu];
-    header_ptr->version = NETEVENT_PKTMON_EVENT_CURRENT_VERSION;
-    pktmon_header = (PKTMON_EVT_STREAM_PACKET_HEADER_MINIMAL*)netevent_event->event_start;
-    header_ptr->type = (uint8_t)pktmon_header->EventId;
-
-    // Copy header into the event buffer.
-    _event_buffer_data_start =
-        _event_buffers[current_cpu] + sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH;
-    memcpy(
-        _event_buffers[current_cpu] + sizeof(netevent_data_header_t),
-        netevent_event->event_start,
-        PKTMON_EVENT_HEADER_LENGTH);
-    // Copy the payload data into the event buffer.
-    memcpy(_event_buffer_data_start, data_start, payload_size - PKTMON_EVENT_HEADER_LENGTH);
-
-    // Assign pointers to the bpf program context.
-    netevent_event_notify_context.netevent_event_md.data_meta = _event_buffers[current_cpu];
-    netevent_event_notify_context.netevent_event_md.data = _event_buffer_data_start;
-    netevent_event_notify_context.netevent_event_md.data_end = _event_buffers[current_cpu] + total_size;
-
     // For each attached client call the netevent hook.
-    client_context = ebpf_extension_hook_get_next_attached_client(_ebpf_netevent_event_hook_provider_context, NULL);
-    while (client_context != NULL) {
+    for (uint32_t index = 0; index < client_count; index++) {
+        ebpf_extension_hook_client_t* client_context = ebpf_extension_hook_client_snapshot_get_client(snapshot, index);
+        const netevent_attach_opts_t* attach_opts =
+            (const netevent_attach_opts_t*)ebpf_extension_hook_client_get_provider_data(client_context);
+        netevent_event_notify_context_t client_notify_context;
         NTSTATUS status = 0;
-        if (ebpf_extension_hook_client_enter_rundown(client_context)) {
-            result = ebpf_extension_hook_invoke_program(
-                client_context, &netevent_event_notify_context.netevent_event_md, (uint32_t*)&status);
-            if (result != EBPF_SUCCESS) {
-                EBPF_EXT_LOG_MESSAGE_GUID_STATUS(
-                    EBPF_EXT_TRACELOG_LEVEL_ERROR,
-                    EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-                    "netevent_ebpf_extension_hook_invoke_program failed module ",
-                    ebpf_extension_hook_provider_get_client_module_id(client_context),
-                    status);
+
+        if (!_netevent_client_matches_event(attach_opts, event_fields)) {
+            continue;
+        }
+        if ((attach_opts->flags & NETEVENT_ATTACH_FLAG_ZERO_COPY) && prepared->zero_copy_allowed) {
+            client_notify_context = prepared->zero_copy_context;
+        } else if (event_copied) {
+            // Each client only sees up to its own snaplen of the shared copy.
+            netevent_event_md_t* client_event_md = &client_notify_context.netevent_event_md;
+            client_notify_context = netevent_event_notify_context;
+            if (attach_opts->snaplen != 0 &&
+                (uint64_t)(client_event_md->data_end - client_event_md->data) > attach_opts->snaplen) {
+                client_event_md->data_end = client_event_md->data + attach_opts->snaplen;
             }
-            ebpf_extension_hook_client_leave_rundown(client_context);
         } else {
-            EBPF_EXT_LOG_MESSAGE(
+            continue;
+        }
+
+        result = ebpf_extension_hook_invoke_program(
+            client_context, &client_notify_context.netevent_event_md, (uint32_t*)&status);
+        if (result != EBPF_SUCCESS) {
+            stats->invoke_failed++;
+            EBPF_EXT_LOG_MESSAGE_GUID_STATUS(
                 EBPF_EXT_TRACELOG_LEVEL_ERROR,
                 EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
-                "netevent_ebpf_extension_hook_client_enter_rundown failed");
+                "netevent_ebpf_extension_hook_invoke_program failed module ",
+                ebpf_extension_hook_provider_get_client_module_id(client_context),
+                status);
         }
-        client_context =
-            ebpf_extension_hook_get_next_attached_client(_ebpf_netevent_event_hook_provider_context, client_context);
     }
 
-Exit:
-    if (old_irql < DISPATCH_LEVEL) {
+    if (buffer_pooled) {
+        ebpf_ext_per_cpu_buffer_release(_event_buffer, buffer_index);
+    }
+    if (irql_raised) {
         KeLowerIrql(old_irql);
     }
+}
+
+// Add counters collected outside of DISPATCH_LEVEL to the statistics of the current CPU, and reset them. Must be
+// called at DISPATCH_LEVEL.
+static void
+_ebpf_netevent_merge_stats(_Inout_ netevent_ext_stats_t* stats, _Inout_ netevent_ext_stats_t* pending_stats)
+{
+    uint64_t* counters = (uint64_t*)stats;
+    const uint64_t* pending_counters = (const uint64_t*)pending_stats;
+
+    for (size_t counter = 0; counter < sizeof(*stats) / sizeof(uint64_t); counter++) {
+        counters[counter] += pending_counters[counter];
+    }
+    memset(pending_stats, 0, sizeof(*pending_stats));
+}
+
+static inline netevent_cpu_stats_t*
+_ebpf_netevent_get_cpu_stats()
+{
+    uint32_t current_cpu = KeGetCurrentProcessorNumberEx(NULL);
+    return (current_cpu < _netevent_cpu_stats_count) ? &_netevent_cpu_stats[current_cpu] : &_netevent_overflow_stats;
+}
+
+// Push a burst of events below DISPATCH_LEVEL. Only the per-CPU accounting, filtering and numbering of each event run
+// at DISPATCH_LEVEL, and the programs are invoked at the caller's IRQL on pooled event buffers, so that a burst never
+// delays the DPCs of its processor for longer than the preparation of a single event.
+static void
+_ebpf_netevent_push_events_below_dispatch(
+    _In_reads_(event_count) netevent_event_t* netevent_events,
+    uint32_t event_count,
+    uint8_t source_id,
+    uint64_t push_timestamp)
+{
+    ebpf_extension_hook_client_snapshot_t* snapshot = NULL;
+    netevent_ext_stats_t pending_stats = {0};
+    netevent_prepared_event_t prepared;
+    KIRQL old_irql;
+
+    // The snapshot is held under rundown protection, which does not require DISPATCH_LEVEL.
+    snapshot = ebpf_extension_hook_acquire_client_snapshot(_ebpf_netevent_event_hook_provider_context);
+
+    for (uint32_t index = 0; index < event_count; index++) {
+        netevent_cpu_stats_t* cpu_stats;
+        bool invoke;
+
+        old_irql = KeRaiseIrqlToDpcLevel();
+        cpu_stats = _ebpf_netevent_get_cpu_stats();
+        _ebpf_netevent_merge_stats(&cpu_stats->stats, &pending_stats);
+        invoke = _ebpf_netevent_prepare_event(
+            &netevent_events[index], source_id, push_timestamp, snapshot, cpu_stats, &prepared);
+        if (invoke) {
+            cpu_stats->stats.passive_dispatched++;
+        }
+        KeLowerIrql(old_irql);
+
+        // The thread may have moved to another processor, the event keeps the number of the one that prepared it.
+        if (invoke) {
+            _ebpf_netevent_invoke_clients(&netevent_events[index], snapshot, &prepared, &pending_stats);
+        }
+    }
+
+    old_irql = KeRaiseIrqlToDpcLevel();
+    _ebpf_netevent_merge_stats(&_ebpf_netevent_get_cpu_stats()->stats, &pending_stats);
+    KeLowerIrql(old_irql);
+
+    if (snapshot != NULL) {
+        ebpf_extension_hook_release_client_snapshot(snapshot);
+    }
+}
+
+// Push a burst of events from the provider of a binding to the attached clients, taking a client snapshot once for the
+// whole burst. Events pushed at DISPATCH_LEVEL, e.g. from DPCs, are dispatched at once on the per-CPU event buffers.
+static void
+_ebpf_netevent_push_events(
+    _In_reads_(event_count) netevent_event_t* netevent_events, uint32_t event_count, uint8_t source_id)
+{
+    // Logging may delay the event processing, consider enabling only for debugging or if the calling frequency for a
+    // specific use case is low.
+    // EBPF_EXT_LOG_ENTRY();
+
+    if (netevent_events == NULL || event_count == 0) {
+        return;
+    }
+
+    ebpf_extension_hook_client_snapshot_t* snapshot = NULL;
+    netevent_cpu_stats_t* cpu_stats;
+    netevent_prepared_event_t prepared;
+    // The push timestamp is taken once per burst, on entry, so that the latency measured by the consumers includes the
+    // time spent dispatching the earlier events of the burst.
+    uint64_t push_timestamp = (uint64_t)KeQueryPerformanceCounter(NULL).QuadPart;
+
+    if (KeGetCurrentIrql() < DISPATCH_LEVEL) {
+        _ebpf_netevent_push_events_below_dispatch(netevent_events, event_count, source_id, push_timestamp);
+        return;
+    }
+
+    cpu_stats = _ebpf_netevent_get_cpu_stats();
+
+    // The snapshot is NULL when only netevent_summary programs are attached, in which case the events are only counted.
+    snapshot = ebpf_extension_hook_acquire_client_snapshot(_ebpf_netevent_event_hook_provider_context);
+
+    for (uint32_t index = 0; index < event_count; index++) {
+        if (_ebpf_netevent_prepare_event(
+                &netevent_events[index], source_id, push_timestamp, snapshot, cpu_stats, &prepared)) {
+            _ebpf_netevent_invoke_clients(&netevent_events[index], snapshot, &prepared, &cpu_stats->stats);
+        }
+    }
+
+    if (snapshot != NULL) {
+        ebpf_extension_hook_release_client_snapshot(snapshot);
+    }
 
     // EBPF_EXT_LOG_EXIT();
 }
+
+static void
+_ebpf_netevent_push_event(_In_ netevent_event_t* netevent_event, uint8_t source_id)
+{
+    if (netevent_event == NULL) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "netevent_event is NULL")
+        return;
+    }
+
+    _ebpf_netevent_push_events(netevent_event, 1, source_id);
+}
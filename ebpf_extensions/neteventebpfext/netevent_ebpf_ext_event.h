@@ -4,9 +4,11 @@
 #pragma once
 
 #include "ebpf_ext.h"
+#include "ebpf_ext_per_cpu_buffer.h"
+#include "ebpf_netevent_npi.h"
+#include "ebpf_netevent_stats.h"
 
 #define EBPF_NETEVENT_EXTENSION_POOL_TAG 'tvEN'
-#define EBPF_NETEVENT_EXTENSION_VERSION 2
 
 /**
  * @brief Register EVENT NPI providers.
@@ -23,3 +25,50 @@ ebpf_ext_register_netevent();
  */
 void
 ebpf_ext_unregister_netevent();
+
+/**
+ * @brief Get the usage statistics of the per-CPU event buffers, such as the number of resizes and the peak size.
+ *
+ * @param[out] stats Aggregated statistics. All zero if the extension is not registered.
+ */
+void
+ebpf_ext_netevent_get_event_buffer_stats(_Out_ ebpf_ext_per_cpu_buffer_stats_t* stats);
+
+/**
+ * @brief Get the netevent pipeline statistics, aggregated across all processors.
+ *
+ * @param[out] stats Aggregated statistics.
+ */
+void
+ebpf_ext_netevent_get_stats(_Out_ netevent_ext_stats_t* stats);
+
+/**
+ * @brief Take a reference on the binding to the NetEvent provider on behalf of an attached program, registering the
+ * extension as a NetEvent NMR client on the first reference. The provider is asked for the union of the capture types
+ * of all references.
+ *
+ * @param[in] capture_type Capture type of the program.
+ *
+ * @retval EBPF_SUCCESS Operation succeeded.
+ * @retval EBPF_OPERATION_NOT_SUPPORTED Registering the NMR client failed.
+ */
+ebpf_result_t
+netevent_ebpf_ext_reference_provider(netevent_capture_type_t capture_type);
+
+/**
+ * @brief Release a reference taken by netevent_ebpf_ext_reference_provider, deregistering the NetEvent NMR client on
+ * the last one.
+ *
+ * @param[in] capture_type Capture type passed to netevent_ebpf_ext_reference_provider.
+ */
+void
+netevent_ebpf_ext_dereference_provider(netevent_capture_type_t capture_type);
+
+/**
+ * @brief Get the netevent summary counters since the extension was loaded, aggregated across all processors. The
+ * interval fields are not set.
+ *
+ * @param[out] counters Aggregated counters.
+ */
+void
+netevent_ebpf_ext_get_summary_counters(_Out_ netevent_summary_md_t* counters);
@@ -0,0 +1,241 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the parsing of the packets carried by netevent events into flow keys.
+ */
+
+#include "netevent_ebpf_ext_flow.h"
+
+#include <errno.h>
+
+#define ETHERNET_HEADER_LENGTH 14
+#define ETHERNET_TYPE_OFFSET 12
+#define VLAN_TAG_LENGTH 4
+#define VLAN_TAG_MAX_COUNT 2
+#define ETHERNET_TYPE_IPV4 0x0800
+#define ETHERNET_TYPE_IPV6 0x86DD
+#define ETHERNET_TYPE_VLAN 0x8100
+#define ETHERNET_TYPE_QINQ 0x88A8
+
+#define IPV4_HEADER_MIN_LENGTH 20
+#define IPV4_FRAGMENT_OFFSET_MASK 0x1FFF
+#define IPV6_HEADER_LENGTH 40
+#define IPV6_EXTENSION_HEADER_MAX_COUNT 8
+#define IPV6_FRAGMENT_HEADER_LENGTH 8
+
+#define IPPROTO_HOPOPTS_VALUE 0
+#define IPPROTO_TCP_VALUE 6
+#define IPPROTO_UDP_VALUE 17
+#define IPPROTO_ROUTING_VALUE 43
+#define IPPROTO_FRAGMENT_VALUE 44
+#define IPPROTO_DSTOPTS_VALUE 60
+
+#define TCP_HEADER_MIN_LENGTH 20
+#define UDP_HEADER_LENGTH 8
+
+static inline uint16_t
+_read_be16(_In_reads_bytes_(2) const uint8_t* data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+// Parse the IPv4 header at offset, and return the offset following it. The transport header is only present in the
+// first fragment of a packet.
+static int32_t
+_parse_ipv4(
+    _In_reads_bytes_(packet_length) const uint8_t* packet,
+    size_t packet_length,
+    size_t offset,
+    _Inout_ netevent_flow_key_t* flow_key,
+    _Out_ size_t* l4_offset,
+    _Out_ bool* l4_present)
+{
+    const uint8_t* ip_header = packet + offset;
+    size_t ip_header_length;
+
+    *l4_offset = 0;
+    *l4_present = false;
+    if (packet_length - offset < IPV4_HEADER_MIN_LENGTH || (ip_header[0] >> 4) != 4) {
+        return -EINVAL;
+    }
+    ip_header_length = (size_t)(ip_header[0] & 0xF) * 4;
+    if (ip_header_length < IPV4_HEADER_MIN_LENGTH || packet_length - offset < ip_header_length) {
+        return -EINVAL;
+    }
+
+    flow_key->ip_version = 4;
+    flow_key->protocol = ip_header[9];
+    // Store the addresses as IPv4-mapped IPv6 addresses.
+    flow_key->source_address[10] = 0xFF;
+    flow_key->source_address[11] = 0xFF;
+    memcpy(&flow_key->source_address[12], ip_header + 12, 4);
+    flow_key->destination_address[10] = 0xFF;
+    flow_key->destination_address[11] = 0xFF;
+    memcpy(&flow_key->destination_address[12], ip_header + 16, 4);
+
+    *l4_offset = offset + ip_header_length;
+    *l4_present = (_read_be16(ip_header + 6) & IPV4_FRAGMENT_OFFSET_MASK) == 0;
+    return 0;
+}
+
+// Parse the IPv6 header and extension headers at offset, and return the offset following them. The transport header
+// is only present in the first fragment of a packet.
+static int32_t
+_parse_ipv6(
+    _In_reads_bytes_(packet_length) const uint8_t* packet,
+    size_t packet_length,
+    size_t offset,
+    _Inout_ netevent_flow_key_t* flow_key,
+    _Out_ size_t* l4_offset,
+    _Out_ bool* l4_present)
+{
+    const uint8_t* ip_header = packet + offset;
+    uint8_t next_header;
+
+    *l4_offset = 0;
+    *l4_present = false;
+    if (packet_length - offset < IPV6_HEADER_LENGTH || (ip_header[0] >> 4) != 6) {
+        return -EINVAL;
+    }
+
+    flow_key->ip_version = 6;
+    memcpy(flow_key->source_address, ip_header + 8, sizeof(flow_key->source_address));
+    memcpy(flow_key->destination_address, ip_header + 24, sizeof(flow_key->destination_address));
+    next_header = ip_header[6];
+    offset += IPV6_HEADER_LENGTH;
+
+    for (uint32_t index = 0; index < IPV6_EXTENSION_HEADER_MAX_COUNT; index++) {
+        const uint8_t* extension_header = packet + offset;
+        size_t extension_header_length;
+
+        if (next_header != IPPROTO_HOPOPTS_VALUE && next_header != IPPROTO_ROUTING_VALUE &&
+            next_header != IPPROTO_DSTOPTS_VALUE && next_header != IPPROTO_FRAGMENT_VALUE) {
+            break;
+        }
+        if (packet_length - offset < IPV6_FRAGMENT_HEADER_LENGTH) {
+            return -EINVAL;
+        }
+        if (next_header == IPPROTO_FRAGMENT_VALUE) {
+            if ((_read_be16(extension_header + 2) >> 3) != 0) {
+                // Only the first fragment carries the transport header.
+                flow_key->protocol = extension_header[0];
+                *l4_offset = offset + IPV6_FRAGMENT_HEADER_LENGTH;
+                return 0;
+            }
+            extension_header_length = IPV6_FRAGMENT_HEADER_LENGTH;
+        } else {
+            extension_header_length = ((size_t)extension_header[1] + 1) * 8;
+        }
+        if (packet_length - offset < extension_header_length) {
+            return -EINVAL;
+        }
+        next_header = extension_header[0];
+        offset += extension_header_length;
+    }
+
+    flow_key->protocol = next_header;
+    *l4_offset = offset;
+    *l4_present = true;
+    return 0;
+}
+
+int32_t
+netevent_parse_flow(
+    _In_reads_bytes_(packet_length) const uint8_t* packet,
+    size_t packet_length,
+    uint16_t packet_type,
+    _Out_ netevent_flow_key_t* flow_key,
+    _Out_ size_t* header_length)
+{
+    int32_t result;
+    size_t l3_offset = 0;
+    size_t l4_offset = 0;
+    bool l4_present = false;
+    uint8_t ip_version;
+
+    memset(flow_key, 0, sizeof(*flow_key));
+    *header_length = 0;
+
+    if (packet_type == NETEVENT_PACKET_TYPE_ETHERNET) {
+        uint16_t ethernet_type;
+        if (packet_length < ETHERNET_HEADER_LENGTH) {
+            return -EINVAL;
+        }
+        ethernet_type = _read_be16(packet + ETHERNET_TYPE_OFFSET);
+        l3_offset = ETHERNET_HEADER_LENGTH;
+        for (uint32_t index = 0;
+             index < VLAN_TAG_MAX_COUNT && (ethernet_type == ETHERNET_TYPE_VLAN || ethernet_type == ETHERNET_TYPE_QINQ);
+             index++) {
+            if (packet_length - l3_offset < VLAN_TAG_LENGTH) {
+                return -EINVAL;
+            }
+            ethernet_type = _read_be16(packet + l3_offset + 2);
+            l3_offset += VLAN_TAG_LENGTH;
+        }
+        if (ethernet_type == ETHERNET_TYPE_IPV4) {
+            ip_version = 4;
+        } else if (ethernet_type == ETHERNET_TYPE_IPV6) {
+            ip_version = 6;
+        } else {
+            return -ENOTSUP;
+        }
+    } else if (packet_type == NETEVENT_PACKET_TYPE_IP) {
+        if (packet_length == 0) {
+            return -EINVAL;
+        }
+        ip_version = packet[0] >> 4;
+    } else {
+        return -ENOTSUP;
+    }
+
+    if (ip_version == 4) {
+        result = _parse_ipv4(packet, packet_length, l3_offset, flow_key, &l4_offset, &l4_present);
+    } else if (ip_version == 6) {
+        result = _parse_ipv6(packet, packet_length, l3_offset, flow_key, &l4_offset, &l4_present);
+    } else {
+        return -ENOTSUP;
+    }
+    if (result != 0) {
+        goto Exit;
+    }
+
+    flow_key->l3_offset = (uint16_t)l3_offset;
+    *header_length = l4_offset;
+    if (!l4_present) {
+        goto Exit;
+    }
+
+    flow_key->l4_offset = (uint16_t)l4_offset;
+    if (flow_key->protocol == IPPROTO_TCP_VALUE || flow_key->protocol == IPPROTO_UDP_VALUE) {
+        size_t l4_header_length = UDP_HEADER_LENGTH;
+        if (flow_key->protocol == IPPROTO_TCP_VALUE) {
+            if (packet_length - l4_offset < TCP_HEADER_MIN_LENGTH) {
+                result = -EINVAL;
+                goto Exit;
+            }
+            l4_header_length = (size_t)(packet[l4_offset + 12] >> 4) * 4;
+            if (l4_header_length < TCP_HEADER_MIN_LENGTH) {
+                result = -EINVAL;
+                goto Exit;
+            }
+        }
+        if (packet_length - l4_offset < l4_header_length) {
+            result = -EINVAL;
+            goto Exit;
+        }
+        // The ports are kept in network byte order.
+        memcpy(&flow_key->source_port, packet + l4_offset, sizeof(flow_key->source_port));
+        memcpy(&flow_key->destination_port, packet + l4_offset + 2, sizeof(flow_key->destination_port));
+        flow_key->payload_offset = (uint16_t)(l4_offset + l4_header_length);
+        *header_length = flow_key->payload_offset;
+    }
+
+Exit:
+    if (result != 0) {
+        memset(flow_key, 0, sizeof(*flow_key));
+        *header_length = 0;
+    }
+    return result;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_netevent_hooks.h"
+#include "framework.h"
+
+// PKTMON PacketType values of the packets that the flow parser understands.
+#define NETEVENT_PACKET_TYPE_ETHERNET 1
+#define NETEVENT_PACKET_TYPE_IP 3
+
+/**
+ * @brief Parse the L2, L3 and L4 headers of a packet into a normalized 5-tuple.
+ *
+ * Ethernet frames may carry up to two VLAN tags. IPv6 extension headers are skipped, and only the first fragment of
+ * a fragmented packet has its transport header parsed.
+ *
+ * @param[in] packet Start of the packet.
+ * @param[in] packet_length Number of bytes of the packet available at packet.
+ * @param[in] packet_type PKTMON PacketType of the packet.
+ * @param[out] flow_key Parsed 5-tuple and header offsets.
+ * @param[out] header_length Number of bytes of the packet covered by the parsed headers.
+ *
+ * @retval 0 The packet was parsed.
+ * @retval -EINVAL The headers are truncated or malformed.
+ * @retval -ENOTSUP The packet is not an IPv4 or IPv6 packet.
+ */
+int32_t
+netevent_parse_flow(
+    _In_reads_bytes_(packet_length) const uint8_t* packet,
+    size_t packet_length,
+    uint16_t packet_type,
+    _Out_ netevent_flow_key_t* flow_key,
+    _Out_ size_t* header_length);
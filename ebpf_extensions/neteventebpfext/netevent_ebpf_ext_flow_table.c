@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the per-flow aggregation of netevent events.
+ */
+
+#include "ebpf_ext.h"
+#include "ebpf_ext_tracelog.h"
+#include "netevent_ebpf_ext_flow_table.h"
+
+#include <errno.h>
+
+// Maximum number of entries probed to find a flow in a shard.
+#define NETEVENT_FLOW_TABLE_MAX_PROBE_COUNT 16
+
+// Number of bytes of a record that identify its flow.
+#define NETEVENT_FLOW_RECORD_KEY_SIZE (offsetof(netevent_flow_record_t, count))
+
+/**
+ * @brief Flows of a single processor, in an open addressing hash table. A shard is only updated by its processor, and
+ * flushed by the flush timer, under its spin lock.
+ */
+typedef struct DECLSPEC_CACHEALIGN _netevent_flow_table_shard
+{
+    KSPIN_LOCK lock;
+    netevent_flow_record_t* entries; ///< Entries with a zero count are free.
+    uint32_t entry_count;            ///< Number of entries in use.
+    uint64_t update_count;
+    uint64_t full_count;
+} netevent_flow_table_shard_t;
+
+typedef struct _netevent_flow_table
+{
+    uint32_t shard_entry_count;          ///< Size of each shard, a power of two.
+    uint32_t cpu_count;                  ///< Number of shards.
+    netevent_flow_table_shard_t* shards; ///< Cache aligned array of per-CPU shards.
+
+    KSPIN_LOCK queue_lock;           ///< Protects the queue of flushed records.
+    netevent_flow_record_t* queue;   ///< Circular queue of flushed records.
+    uint32_t queue_size;             ///< Capacity of the queue.
+    uint32_t queue_head;             ///< Index of the oldest record.
+    uint32_t queue_count;            ///< Number of records in the queue.
+    uint64_t flushed_count;
+} netevent_flow_table_t;
+
+// FNV-1a hash of the flow identifying bytes of a record.
+static uint32_t
+_netevent_flow_table_hash(_In_ const netevent_flow_record_t* key)
+{
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint32_t hash = 2166136261u;
+    for (size_t index = 0; index < NETEVENT_FLOW_RECORD_KEY_SIZE; index++) {
+        hash = (hash ^ bytes[index]) * 16777619u;
+    }
+    return hash;
+}
+
+_Must_inspect_result_ NTSTATUS
+netevent_flow_table_create(
+    uint32_t shard_entry_count, uint32_t queue_record_count, _Outptr_ netevent_flow_table_t** flow_table)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    netevent_flow_table_t* local_flow_table = NULL;
+    uint32_t cpu_count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    EBPF_EXT_LOG_ENTRY();
+
+    *flow_table = NULL;
+
+    if (shard_entry_count == 0 || (shard_entry_count & (shard_entry_count - 1)) != 0 || queue_record_count == 0) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    local_flow_table = (netevent_flow_table_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(netevent_flow_table_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, local_flow_table, "flow_table", status);
+    memset(local_flow_table, 0, sizeof(netevent_flow_table_t));
+    KeInitializeSpinLock(&local_flow_table->queue_lock);
+    local_flow_table->shard_entry_count = shard_entry_count;
+    local_flow_table->queue_size = queue_record_count;
+
+    local_flow_table->queue = (netevent_flow_record_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, queue_record_count * sizeof(netevent_flow_record_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, local_flow_table->queue, "flow_table queue", status);
+
+    local_flow_table->shards = (netevent_flow_table_shard_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNxCacheAligned, cpu_count * sizeof(netevent_flow_table_shard_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, local_flow_table->shards, "flow_table shards", status);
+    memset(local_flow_table->shards, 0, cpu_count * sizeof(netevent_flow_table_shard_t));
+    local_flow_table->cpu_count = cpu_count;
+
+    for (uint32_t index = 0; index < cpu_count; index++) {
+        netevent_flow_table_shard_t* shard = &local_flow_table->shards[index];
+        KeInitializeSpinLock(&shard->lock);
+        shard->entries = (netevent_flow_record_t*)ExAllocatePoolUninitialized(
+            NonPagedPoolNx, shard_entry_count * sizeof(netevent_flow_record_t), EBPF_EXTENSION_POOL_TAG);
+        EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, shard->entries, "flow_table shard entries", status);
+        memset(shard->entries, 0, shard_entry_count * sizeof(netevent_flow_record_t));
+    }
+
+    *flow_table = local_flow_table;
+    local_flow_table = NULL;
+
+Exit:
+    netevent_flow_table_destroy(local_flow_table);
+
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+void
+netevent_flow_table_destroy(_In_opt_ _Frees_ptr_opt_ netevent_flow_table_t* flow_table)
+{
+    if (flow_table == NULL) {
+        return;
+    }
+
+    if (flow_table->shards != NULL) {
+        for (uint32_t index = 0; index < flow_table->cpu_count; index++) {
+            if (flow_table->shards[index].entries != NULL) {
+                ExFreePool(flow_table->shards[index].entries);
+            }
+        }
+        ExFreePool(flow_table->shards);
+    }
+    if (flow_table->queue != NULL) {
+        ExFreePool(flow_table->queue);
+    }
+    ExFreePool(flow_table);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) int32_t netevent_flow_table_update(
+    _Inout_ netevent_flow_table_t* flow_table, _In_ const netevent_flow_record_t* key, uint64_t bytes, uint64_t timestamp)
+{
+    int32_t result = -ENOSPC;
+    KIRQL old_irql = KeGetCurrentIrql();
+    uint32_t current_cpu;
+    netevent_flow_table_shard_t* shard;
+    uint32_t mask = flow_table->shard_entry_count - 1;
+    uint32_t hash = _netevent_flow_table_hash(key);
+
+    if (old_irql < DISPATCH_LEVEL) {
+        old_irql = KeRaiseIrqlToDpcLevel();
+    }
+
+    current_cpu = KeGetCurrentProcessorNumberEx(NULL);
+    if (current_cpu >= flow_table->cpu_count) {
+        goto Exit;
+    }
+    shard = &flow_table->shards[current_cpu];
+
+    KeAcquireSpinLockAtDpcLevel(&shard->lock);
+    for (uint32_t probe = 0; probe < NETEVENT_FLOW_TABLE_MAX_PROBE_COUNT && probe <= mask; probe++) {
+        netevent_flow_record_t* entry = &shard->entries[(hash + probe) & mask];
+        if (entry->count == 0) {
+            memcpy(entry, key, NETEVENT_FLOW_RECORD_KEY_SIZE);
+            entry->bytes = 0;
+            entry->first_timestamp = timestamp;
+            shard->entry_count++;
+        } else if (memcmp(entry, key, NETEVENT_FLOW_RECORD_KEY_SIZE) != 0) {
+            continue;
+        }
+        entry->count++;
+        entry->bytes += bytes;
+        entry->last_timestamp = timestamp;
+        result = 0;
+        break;
+    }
+    if (result == 0) {
+        shard->update_count++;
+    } else {
+        shard->full_count++;
+    }
+    KeReleaseSpinLockFromDpcLevel(&shard->lock);
+
+Exit:
+    if (old_irql < DISPATCH_LEVEL) {
+        KeLowerIrql(old_irql);
+    }
+    return result;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void netevent_flow_table_flush(_Inout_ netevent_flow_table_t* flow_table)
+{
+    KIRQL old_irql;
+
+    KeAcquireSpinLock(&flow_table->queue_lock, &old_irql);
+    for (uint32_t index = 0; index < flow_table->cpu_count; index++) {
+        netevent_flow_table_shard_t* shard = &flow_table->shards[index];
+
+        KeAcquireSpinLockAtDpcLevel(&shard->lock);
+        // Partially flushing a shard would break its probe sequences, so it is flushed all at once or not at all.
+        if (shard->entry_count != 0 && shard->entry_count <= flow_table->queue_size - flow_table->queue_count) {
+            for (uint32_t entry_index = 0; entry_index < flow_table->shard_entry_count; entry_index++) {
+                netevent_flow_record_t* entry = &shard->entries[entry_index];
+                if (entry->count == 0) {
+                    continue;
+                }
+                flow_table->queue[(flow_table->queue_head + flow_table->queue_count) % flow_table->queue_size] =
+                    *entry;
+                flow_table->queue_count++;
+                memset(entry, 0, sizeof(*entry));
+            }
+            flow_table->flushed_count += shard->entry_count;
+            shard->entry_count = 0;
+        }
+        KeReleaseSpinLockFromDpcLevel(&shard->lock);
+    }
+    KeReleaseSpinLock(&flow_table->queue_lock, old_irql);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) uint32_t netevent_flow_table_read_records(
+    _Inout_ netevent_flow_table_t* flow_table,
+    _Out_writes_to_(record_count, return) netevent_flow_record_t* records,
+    uint32_t record_count)
+{
+    KIRQL old_irql;
+    uint32_t read_count;
+
+    KeAcquireSpinLock(&flow_table->queue_lock, &old_irql);
+    read_count = min(record_count, flow_table->queue_count);
+    for (uint32_t index = 0; index < read_count; index++) {
+        records[index] = flow_table->queue[flow_table->queue_head];
+        flow_table->queue_head = (flow_table->queue_head + 1) % flow_table->queue_size;
+    }
+    flow_table->queue_count -= read_count;
+    KeReleaseSpinLock(&flow_table->queue_lock, old_irql);
+
+    return read_count;
+}
+
+void
+netevent_flow_table_get_stats(_In_ netevent_flow_table_t* flow_table, _Out_ netevent_flow_table_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    // The counters are read without synchronization, a slightly stale value is acceptable.
+    for (uint32_t index = 0; index < flow_table->cpu_count; index++) {
+        stats->update_count += flow_table->shards[index].update_count;
+        stats->full_count += flow_table->shards[index].full_count;
+    }
+    stats->flushed_count = flow_table->flushed_count;
+}
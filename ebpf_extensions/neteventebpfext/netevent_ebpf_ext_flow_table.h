@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_netevent_stats.h"
+#include "framework.h"
+
+/**
+ * @brief Bounded table aggregating netevent events per flow, sharded per processor. Aggregated records are moved to a
+ * queue of flushed records by netevent_flow_table_flush, from which they are read by user mode.
+ */
+typedef struct _netevent_flow_table netevent_flow_table_t;
+
+/**
+ * @brief Usage statistics of a flow table.
+ */
+typedef struct _netevent_flow_table_stats
+{
+    uint64_t update_count;  ///< Number of events aggregated into the table.
+    uint64_t full_count;    ///< Number of events that could not be aggregated because a shard was full.
+    uint64_t flushed_count; ///< Number of records moved to the queue of flushed records.
+} netevent_flow_table_stats_t;
+
+/**
+ * @brief Create a flow table.
+ *
+ * @param[in] shard_entry_count Number of flows each per-processor shard can hold. Must be a power of two.
+ * @param[in] queue_record_count Number of flushed records that can be queued until user mode reads them.
+ * @param[out] flow_table Pointer to the created flow table.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_INVALID_PARAMETER The shard size is not a power of two.
+ * @retval STATUS_INSUFFICIENT_RESOURCES Memory allocation failed.
+ */
+_Must_inspect_result_ NTSTATUS
+netevent_flow_table_create(
+    uint32_t shard_entry_count, uint32_t queue_record_count, _Outptr_ netevent_flow_table_t** flow_table);
+
+/**
+ * @brief Free a flow table. The caller must ensure that the table is no longer used.
+ *
+ * @param[in] flow_table Pointer to the flow table.
+ */
+void
+netevent_flow_table_destroy(_In_opt_ _Frees_ptr_opt_ netevent_flow_table_t* flow_table);
+
+/**
+ * @brief Aggregate an event into the current processor's shard.
+ *
+ * @param[in] flow_table Pointer to the flow table.
+ * @param[in] key Flow key of the event. Only the fields up to the counters are used, and must not contain padding.
+ * @param[in] bytes Length of the packet carried by the event.
+ * @param[in] timestamp Time of the event.
+ *
+ * @retval 0 The event was aggregated.
+ * @retval -ENOSPC The shard is full.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL) int32_t netevent_flow_table_update(
+    _Inout_ netevent_flow_table_t* flow_table, _In_ const netevent_flow_record_t* key, uint64_t bytes, uint64_t timestamp);
+
+/**
+ * @brief Move the aggregated records of every shard to the queue of flushed records. A shard whose records do not all
+ * fit in the queue is left untouched, and keeps aggregating until the next flush.
+ *
+ * @param[in] flow_table Pointer to the flow table.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL) void netevent_flow_table_flush(_Inout_ netevent_flow_table_t* flow_table);
+
+/**
+ * @brief Remove flushed records from the queue.
+ *
+ * @param[in] flow_table Pointer to the flow table.
+ * @param[out] records Buffer that receives the records.
+ * @param[in] record_count Number of records the buffer can hold.
+ *
+ * @returns Number of records copied to the buffer.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL) uint32_t netevent_flow_table_read_records(
+    _Inout_ netevent_flow_table_t* flow_table,
+    _Out_writes_to_(record_count, return) netevent_flow_record_t* records,
+    uint32_t record_count);
+
+/**
+ * @brief Get the usage statistics of a flow table.
+ *
+ * @param[in] flow_table Pointer to the flow table.
+ * @param[out] stats Usage statistics.
+ */
+void
+netevent_flow_table_get_stats(_In_ netevent_flow_table_t* flow_table, _Out_ netevent_flow_table_stats_t* stats);
@@ -16,8 +16,37 @@ static const ebpf_helper_function_prototype_t _netevent_event_ebpf_extension_hel
      .helper_id = EBPF_MAX_GENERAL_HELPER_FUNCTION + 1,
      .name = "bpf_netevent_push_event",
      .return_type = EBPF_RETURN_TYPE_INTEGER,
-     .arguments = {EBPF_ARGUMENT_TYPE_PTR_TO_CTX}}};
+     .arguments = {EBPF_ARGUMENT_TYPE_PTR_TO_CTX}},
+    {.header =
+         {.version = EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION,
+          .size = EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION_SIZE},
+     .helper_id = EBPF_MAX_GENERAL_HELPER_FUNCTION + 2,
+     .name = "bpf_netevent_parse_flow",
+     .return_type = EBPF_RETURN_TYPE_INTEGER,
+     .arguments =
+         {EBPF_ARGUMENT_TYPE_PTR_TO_CTX, EBPF_ARGUMENT_TYPE_PTR_TO_WRITABLE_MEM, EBPF_ARGUMENT_TYPE_CONST_SIZE}},
+    {.header =
+         {.version = EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION,
+          .size = EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION_SIZE},
+     .helper_id = EBPF_MAX_GENERAL_HELPER_FUNCTION + 3,
+     .name = "bpf_netevent_flow_table_update",
+     .return_type = EBPF_RETURN_TYPE_INTEGER,
+     .arguments = {EBPF_ARGUMENT_TYPE_PTR_TO_CTX}},
+    {.header =
+         {.version = EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION,
+          .size = EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION_SIZE},
+     .helper_id = EBPF_MAX_GENERAL_HELPER_FUNCTION + 4,
+     .name = "bpf_netevent_capture",
+     .return_type = EBPF_RETURN_TYPE_INTEGER,
+     .arguments = {EBPF_ARGUMENT_TYPE_PTR_TO_CTX, EBPF_ARGUMENT_TYPE_ANYTHING}}};
 
+// The context covers the whole netevent_event_md_t, so that programs can read the typed PKTMON fields that follow the
+// data pointers.
+//
+// The descriptor cannot declare the region between data_meta and data_end read-only, as the verifier does not support
+// read-only contexts yet (https://github.com/vbpf/ebpf-verifier/issues/639). Programs may thus write to the event data,
+// and the extension must not hand them memory it does not own until this is set.
+#define NETEVENT_PROGRAM_CONTEXT_READ_ONLY 0
 static const ebpf_ctx_descriptor_t _ebpf_netevent_program_context_descriptor = {
     (int)sizeof(netevent_event_md_t),
     EBPF_OFFSET_OF(netevent_event_md_t, data),
@@ -56,3 +85,43 @@ static const ebpf_program_section_info_t _ebpf_netevent_event_section_info[] = {
         .bpf_attach_type = BPF_ATTACH_TYPE_NETEVENT,
     },
 };
+
+// The summary context has no packet data.
+static const ebpf_ctx_descriptor_t _ebpf_netevent_summary_program_context_descriptor = {
+    (int)sizeof(netevent_summary_md_t),
+    -1,
+    -1,
+    -1,
+};
+
+static const ebpf_program_type_descriptor_t _ebpf_program_type_netevent_summary_guid = {
+    .header =
+        {.version = EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION,
+         .size = EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION_SIZE},
+    .name = "netevent_summary",
+    .context_descriptor = &_ebpf_netevent_summary_program_context_descriptor,
+    .program_type = EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY_GUID,
+    .bpf_prog_type = (bpf_prog_type_t)BPF_PROG_TYPE_NETEVENT_SUMMARY,
+    .is_privileged = 0};
+
+static const ebpf_program_info_t _ebpf_netevent_summary_program_info = {
+    .header =
+        {.version = EBPF_PROGRAM_INFORMATION_CURRENT_VERSION, .size = EBPF_PROGRAM_INFORMATION_CURRENT_VERSION_SIZE},
+    .program_type_descriptor = &_ebpf_program_type_netevent_summary_guid,
+    .count_of_program_type_specific_helpers = 0,
+    .program_type_specific_helper_prototype = NULL,
+    .count_of_global_helpers = 0,
+    .global_helper_prototype = NULL};
+
+static const ebpf_program_section_info_t _ebpf_netevent_summary_section_info[] = {
+    {
+        .header =
+            {.version = EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION,
+             .size = EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION_SIZE},
+        .section_name = L"netevent_summary",
+        .program_type = &EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY,
+        .attach_type = &EBPF_ATTACH_TYPE_NETEVENT_SUMMARY,
+        .bpf_program_type = (bpf_prog_type_t)BPF_PROG_TYPE_NETEVENT_SUMMARY,
+        .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_NETEVENT_SUMMARY,
+    },
+};
@@ -0,0 +1,363 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the periodic netevent summary program type hook on eBPF for Windows.
+ */
+
+#include "ebpf_netevent_hooks.h"
+#include "netevent_ebpf_ext_event.h"
+#include "netevent_ebpf_ext_program_info.h"
+#include "netevent_ebpf_ext_summary.h"
+
+// Interval of the summary timer, in 100ns units.
+#define NETEVENT_SUMMARY_TIMER_INTERVAL ((LONGLONG)NETEVENT_SUMMARY_INTERVAL_MS * 10 * 1000)
+
+static ebpf_result_t
+_netevent_summary_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context);
+
+static void
+_netevent_summary_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out);
+
+static EXT_CALLBACK _netevent_summary_timer_callback;
+
+//
+// Summary Program Information NPI Provider.
+//
+static ebpf_program_data_t _netevent_summary_program_data = {
+    .header = EBPF_PROGRAM_DATA_HEADER,
+    .program_info = &_ebpf_netevent_summary_program_info,
+    .program_type_specific_helper_function_addresses = NULL,
+    .context_create = _netevent_summary_context_create,
+    .context_destroy = _netevent_summary_context_destroy,
+    .required_irql = DISPATCH_LEVEL,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _netevent_summary_program_info_provider_moduleid = {
+    sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_program_info_provider_t* _netevent_summary_program_info_provider_context = NULL;
+
+//
+// Summary Hook NPI Provider.
+//
+ebpf_attach_provider_data_t _netevent_summary_hook_provider_data = {
+    .header = {EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION, EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION_SIZE},
+    .supported_program_type = EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY_GUID,
+    .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_NETEVENT_SUMMARY,
+    .link_type = BPF_LINK_TYPE_PLAIN,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _netevent_summary_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_hook_provider_t* _netevent_summary_hook_provider_context = NULL;
+
+EX_PUSH_LOCK _netevent_summary_hook_provider_lock;
+uint64_t _netevent_summary_hook_provider_registration_count = 0;
+
+// Summary timer, which runs while any program is attached. The per-event path only updates cumulative per-CPU
+// counters, and each expiration passes the difference with the counters of the previous expiration to the programs.
+// The previous counters and the interval start are only accessed by the timer callback, and before it is set.
+static PEX_TIMER _netevent_summary_timer = NULL;
+static netevent_summary_md_t _netevent_summary_previous_counters;
+static uint64_t _netevent_summary_interval_start = 0;
+
+typedef struct _netevent_summary_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    netevent_summary_md_t summary_md;
+} netevent_summary_notify_context_t;
+
+//
+// Client attach/detach handler routines.
+//
+
+static ebpf_result_t
+_netevent_summary_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    bool push_lock_acquired = false;
+    bool provider_referenced = false;
+    const ebpf_extension_data_t* client_data = ebpf_extension_hook_client_get_client_data(attaching_client);
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(provider_context);
+
+    // This attach type has no attach parameter.
+    if (client_data != NULL && client_data->data != NULL && client_data->data_size != 0) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Invalid client data passed to attach.");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    ExAcquirePushLockExclusive(&_netevent_summary_hook_provider_lock);
+    push_lock_acquired = true;
+
+    // Summaries cover every event, so all of them are requested from the NetEvent provider.
+    result = netevent_ebpf_ext_reference_provider(NeteventCapture_All);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+    provider_referenced = true;
+
+    if (_netevent_summary_hook_provider_registration_count == 0) {
+        _netevent_summary_timer = ExAllocateTimer(_netevent_summary_timer_callback, NULL, 0);
+        if (_netevent_summary_timer == NULL) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "ExAllocateTimer failed");
+            result = EBPF_NO_MEMORY;
+            goto Exit;
+        }
+
+        // The first interval starts now, the events counted earlier are not part of it.
+        netevent_ebpf_ext_get_summary_counters(&_netevent_summary_previous_counters);
+        _netevent_summary_interval_start = KeQueryInterruptTime();
+        ExSetTimer(
+            _netevent_summary_timer, -NETEVENT_SUMMARY_TIMER_INTERVAL, NETEVENT_SUMMARY_TIMER_INTERVAL, NULL);
+    }
+
+    _netevent_summary_hook_provider_registration_count++;
+
+Exit:
+    if (result != EBPF_SUCCESS && provider_referenced) {
+        netevent_ebpf_ext_dereference_provider(NeteventCapture_All);
+    }
+    if (push_lock_acquired) {
+        ExReleasePushLockExclusive(&_netevent_summary_hook_provider_lock);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_netevent_summary_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(detaching_client);
+
+    ExAcquirePushLockExclusive(&_netevent_summary_hook_provider_lock);
+
+    _netevent_summary_hook_provider_registration_count--;
+    if (_netevent_summary_hook_provider_registration_count == 0) {
+        // Stop the timer, and wait for a running callback to complete.
+        ExDeleteTimer(_netevent_summary_timer, TRUE, TRUE, NULL);
+        _netevent_summary_timer = NULL;
+    }
+
+    netevent_ebpf_ext_dereference_provider(NeteventCapture_All);
+
+    ExReleasePushLockExclusive(&_netevent_summary_hook_provider_lock);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+//
+// NMR Registration Helper Routines.
+//
+
+void
+netevent_ebpf_ext_summary_unregister_providers()
+{
+    if (_netevent_summary_hook_provider_context) {
+        ebpf_extension_hook_provider_unregister(_netevent_summary_hook_provider_context);
+        _netevent_summary_hook_provider_context = NULL;
+    }
+    if (_netevent_summary_program_info_provider_context) {
+        ebpf_extension_program_info_provider_unregister(_netevent_summary_program_info_provider_context);
+        _netevent_summary_program_info_provider_context = NULL;
+    }
+}
+
+NTSTATUS
+netevent_ebpf_ext_summary_register_providers()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
+        &_netevent_summary_program_info_provider_moduleid, &_netevent_summary_program_data};
+    const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
+        &_netevent_summary_hook_provider_moduleid,
+        &_netevent_summary_hook_provider_data,
+        EBPF_EXTENSION_HOOK_MAX_CLIENTS};
+
+    // Set the program type as the provider module id.
+    _netevent_summary_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY;
+    // Set the attach type as the provider module id.
+    _netevent_summary_hook_provider_moduleid.Guid = EBPF_ATTACH_TYPE_NETEVENT_SUMMARY;
+    status = ebpf_extension_program_info_provider_register(
+        &program_info_provider_parameters, &_netevent_summary_program_info_provider_context);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "ebpf_extension_program_info_provider_register",
+            status);
+        goto Exit;
+    }
+
+    status = ebpf_extension_hook_provider_register(
+        &hook_provider_parameters,
+        _netevent_summary_on_client_attach,
+        _netevent_summary_on_client_detach,
+        NULL,
+        &_netevent_summary_hook_provider_context);
+    if (status != EBPF_SUCCESS) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+            "ebpf_extension_hook_provider_register",
+            status);
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        netevent_ebpf_ext_summary_unregister_providers();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+//
+// eBPF Summary Program Information NPI helper routines.
+//
+static ebpf_result_t
+_netevent_summary_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context)
+{
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_result_t result;
+    netevent_summary_notify_context_t* summary_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_in);
+    UNREFERENCED_PARAMETER(data_size_in);
+
+    *context = NULL;
+
+    if (context_in == NULL || context_size_in < sizeof(netevent_summary_md_t)) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, "Input Context is required");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    summary_context = (netevent_summary_notify_context_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(netevent_summary_notify_context_t), EBPF_NETEVENT_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(
+        EBPF_EXT_TRACELOG_KEYWORD_NETEVENT, summary_context, "summary_context", result);
+
+    // Copy the context from the caller.
+    memcpy(&summary_context->summary_md, context_in, sizeof(netevent_summary_md_t));
+
+    *context = &summary_context->summary_md;
+    result = EBPF_SUCCESS;
+
+Exit:
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_netevent_summary_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out)
+{
+    EBPF_EXT_LOG_ENTRY();
+    netevent_summary_notify_context_t* summary_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_out);
+
+    if (!context) {
+        goto Exit;
+    }
+
+    summary_context = CONTAINING_RECORD(context, netevent_summary_notify_context_t, summary_md);
+
+    if (context_out != NULL && *context_size_out >= sizeof(netevent_summary_md_t)) {
+        // Copy the context to the caller.
+        memcpy(context_out, &summary_context->summary_md, sizeof(netevent_summary_md_t));
+        *context_size_out = sizeof(netevent_summary_md_t);
+    } else {
+        *context_size_out = 0;
+    }
+
+    // This program type has no variable-length data.
+    *data_size_out = 0;
+
+    ExFreePool(summary_context);
+
+Exit:
+    EBPF_EXT_LOG_EXIT();
+}
+
+static void
+_netevent_summary_timer_callback(_In_ PEX_TIMER timer, _In_opt_ PVOID context)
+{
+    ebpf_extension_hook_client_snapshot_t* snapshot;
+    netevent_summary_notify_context_t summary_notify_context;
+    uint64_t* interval_counters = (uint64_t*)&summary_notify_context.summary_md;
+    uint64_t* previous_counters = (uint64_t*)&_netevent_summary_previous_counters;
+    const size_t counter_count = sizeof(netevent_summary_md_t) / sizeof(uint64_t);
+    uint64_t interval_end = KeQueryInterruptTime();
+
+    UNREFERENCED_PARAMETER(timer);
+    UNREFERENCED_PARAMETER(context);
+
+    // The per-CPU counters are never reset, so that the per-event path does not synchronize with this callback. Every
+    // field of the summary is a counter, except for the interval which is set below.
+    memset(&summary_notify_context, 0, sizeof(summary_notify_context));
+    netevent_ebpf_ext_get_summary_counters(&summary_notify_context.summary_md);
+    for (size_t counter = 0; counter < counter_count; counter++) {
+        uint64_t current = interval_counters[counter];
+        interval_counters[counter] = current - previous_counters[counter];
+        previous_counters[counter] = current;
+    }
+    summary_notify_context.summary_md.interval_start = _netevent_summary_interval_start;
+    summary_notify_context.summary_md.interval_end = interval_end;
+    _netevent_summary_interval_start = interval_end;
+
+    snapshot = ebpf_extension_hook_acquire_client_snapshot(_netevent_summary_hook_provider_context);
+    if (snapshot == NULL) {
+        return;
+    }
+
+    // For each attached client call the summary hook.
+    uint32_t client_count = ebpf_extension_hook_client_snapshot_get_count(snapshot);
+    for (uint32_t index = 0; index < client_count; index++) {
+        ebpf_extension_hook_client_t* client_context = ebpf_extension_hook_client_snapshot_get_client(snapshot, index);
+        uint32_t return_value = 0;
+        ebpf_result_t result =
+            ebpf_extension_hook_invoke_program(client_context, &summary_notify_context.summary_md, &return_value);
+        if (result != EBPF_SUCCESS) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_NETEVENT,
+                "ebpf_extension_hook_invoke_program failed");
+        }
+    }
+
+    ebpf_extension_hook_release_client_snapshot(snapshot);
+}
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_ext.h"
+
+/**
+ * @brief Register NETEVENT_SUMMARY NPI providers.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_UNSUCCESSFUL Operation failed.
+ */
+NTSTATUS
+netevent_ebpf_ext_summary_register_providers();
+
+/**
+ * @brief Unregister NETEVENT_SUMMARY NPI providers.
+ *
+ */
+void
+netevent_ebpf_ext_summary_unregister_providers();
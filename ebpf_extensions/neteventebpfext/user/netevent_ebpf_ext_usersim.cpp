@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief User mode implementation of the kernel routines used by the netevent extension that usersim does not provide.
+ */
+
+#include "framework.h"
+
+void
+KeStackAttachProcess(_Inout_ PEPROCESS process, _Out_ PRKAPC_STATE apc_state)
+{
+    UNREFERENCED_PARAMETER(process);
+    memset(apc_state, 0, sizeof(*apc_state));
+}
+
+void
+KeUnstackDetachProcess(_In_ PRKAPC_STATE apc_state)
+{
+    UNREFERENCED_PARAMETER(apc_state);
+}
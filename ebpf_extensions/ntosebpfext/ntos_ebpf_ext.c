@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file registers and unregisters all the NPI providers exposed by ntosebpfext.
+ */
+
+#include "ntos_ebpf_ext_image.h"
+#include "ntos_ebpf_ext_object.h"
+#include "ntos_ebpf_ext_process.h"
+#include "ntos_ebpf_ext_registry.h"
+#include "ntos_ebpf_ext_sample.h"
+#include "ntos_ebpf_ext_thread.h"
+
+// Define the pool tag for this extension
+ULONG EBPF_EXTENSION_POOL_TAG = EBPF_NTOS_EXTENSION_POOL_TAG;
+
+void
+ebpf_ext_unregister_ntos()
+{
+    ntos_ebpf_ext_sample_unregister_providers();
+    ntos_ebpf_ext_object_unregister_providers();
+    ntos_ebpf_ext_registry_unregister_providers();
+    ntos_ebpf_ext_image_unregister_providers();
+    ntos_ebpf_ext_thread_unregister_providers();
+    ntos_ebpf_ext_process_unregister_providers();
+}
+
+NTSTATUS
+ebpf_ext_device_control_ntos(
+    _In_opt_ const void* file_object,
+    ULONG io_control_code,
+    _In_reads_bytes_opt_(input_buffer_length) const void* input_buffer,
+    size_t input_buffer_length,
+    _Out_writes_bytes_to_opt_(output_buffer_length, *bytes_returned) void* output_buffer,
+    size_t output_buffer_length,
+    _Out_ size_t* bytes_returned)
+{
+    UNREFERENCED_PARAMETER(file_object);
+    UNREFERENCED_PARAMETER(io_control_code);
+    UNREFERENCED_PARAMETER(input_buffer);
+    UNREFERENCED_PARAMETER(input_buffer_length);
+    UNREFERENCED_PARAMETER(output_buffer);
+    UNREFERENCED_PARAMETER(output_buffer_length);
+
+    // ntosebpfext does not expose any device control requests.
+    *bytes_returned = 0;
+    return STATUS_INVALID_DEVICE_REQUEST;
+}
+
+void
+ebpf_ext_file_cleanup_ntos(_In_opt_ const void* file_object)
+{
+    UNREFERENCED_PARAMETER(file_object);
+
+    // ntosebpfext does not keep any resources tied to a file object.
+}
+
+NTSTATUS
+ebpf_ext_register_ntos()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    status = ntos_ebpf_ext_process_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ntos_ebpf_ext_thread_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ntos_ebpf_ext_image_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ntos_ebpf_ext_registry_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ntos_ebpf_ext_object_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ntos_ebpf_ext_sample_register_providers();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        ebpf_ext_unregister_ntos();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
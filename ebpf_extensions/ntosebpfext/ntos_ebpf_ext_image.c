@@ -0,0 +1,395 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the image load program type hook on eBPF for Windows.
+ */
+
+#include "ebpf_ntos_hooks.h"
+#include "ntos_ebpf_ext_image.h"
+#include "ntos_ebpf_ext_program_info.h"
+#include "shared_context.h"
+
+#include <errno.h>
+#include <limits.h>
+
+static ebpf_result_t
+_ebpf_image_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context);
+
+static void
+_ebpf_image_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out);
+
+void
+_ebpf_image_load_image_notify_routine(
+    _In_opt_ PUNICODE_STRING full_image_name, _In_ HANDLE process_id, _In_ PIMAGE_INFO image_info);
+
+_Success_(return >= 0) static int32_t _ebpf_image_get_image_name(
+    _In_ image_md_t* image_md, _Out_writes_bytes_(name_length) uint8_t* name, uint32_t name_length);
+
+static const void* _ebpf_image_helper_functions[] = {
+    (void*)&_ebpf_image_get_image_name,
+};
+
+static ebpf_helper_function_addresses_t _ebpf_image_helper_function_address_table = {
+    .header = {EBPF_HELPER_FUNCTION_ADDRESSES_CURRENT_VERSION, EBPF_HELPER_FUNCTION_ADDRESSES_CURRENT_VERSION_SIZE},
+    .helper_function_count = EBPF_COUNT_OF(_ebpf_image_helper_functions),
+    .helper_function_address = (uint64_t*)_ebpf_image_helper_functions,
+};
+
+//
+// Image Program Information NPI Provider.
+//
+static ebpf_program_data_t _ebpf_image_program_data = {
+    .header = EBPF_PROGRAM_DATA_HEADER,
+    .program_info = &_ebpf_image_program_info,
+    .program_type_specific_helper_function_addresses = &_ebpf_image_helper_function_address_table,
+    .context_create = _ebpf_image_context_create,
+    .context_destroy = _ebpf_image_context_destroy,
+    .required_irql = PASSIVE_LEVEL,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_image_program_info_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_program_info_provider_t* _ebpf_image_program_info_provider_context = NULL;
+
+//
+// Image Hook NPI Provider.
+//
+ebpf_attach_provider_data_t _ntos_ebpf_image_hook_provider_data = {
+    .header = {EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION, EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION_SIZE},
+    .supported_program_type = EBPF_PROGRAM_TYPE_IMAGE_GUID,
+    .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_IMAGE,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_image_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_hook_provider_t* _ebpf_image_hook_provider_context = NULL;
+
+EX_PUSH_LOCK _ebpf_image_hook_provider_lock;
+bool _ebpf_image_hook_provider_registered = FALSE;
+uint64_t _ebpf_image_hook_provider_registration_count = 0;
+
+//
+// Client attach/detach handler routines.
+//
+
+static ebpf_result_t
+_ntos_ebpf_extension_image_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    bool push_lock_acquired = false;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(attaching_client);
+    UNREFERENCED_PARAMETER(provider_context);
+
+    ExAcquirePushLockExclusive(&_ebpf_image_hook_provider_lock);
+
+    push_lock_acquired = true;
+
+    if (!_ebpf_image_hook_provider_registered) {
+        // Register the image load notify routine. Also ask for images whose architecture does not match the
+        // system's, so that WOW64 loads are reported too.
+        NTSTATUS status = PsSetLoadImageNotifyRoutineEx(
+            _ebpf_image_load_image_notify_routine, PS_IMAGE_NOTIFY_CONFLICTING_ARCHITECTURE);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "PsSetLoadImageNotifyRoutineEx failed",
+                status);
+            result = EBPF_OPERATION_NOT_SUPPORTED;
+            goto Exit;
+        }
+        _ebpf_image_hook_provider_registered = TRUE;
+    }
+
+    _ebpf_image_hook_provider_registration_count++;
+
+Exit:
+    if (push_lock_acquired) {
+        ExReleasePushLockExclusive(&_ebpf_image_hook_provider_lock);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ntos_ebpf_extension_image_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(detaching_client);
+
+    // Unregister the image load notify routine.
+    ExAcquirePushLockExclusive(&_ebpf_image_hook_provider_lock);
+
+    _ebpf_image_hook_provider_registration_count--;
+
+    if (_ebpf_image_hook_provider_registered && _ebpf_image_hook_provider_registration_count == 0) {
+        NTSTATUS status = PsRemoveLoadImageNotifyRoutine(_ebpf_image_load_image_notify_routine);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "PsRemoveLoadImageNotifyRoutine failed",
+                status);
+        }
+        _ebpf_image_hook_provider_registered = FALSE;
+    }
+
+    ExReleasePushLockExclusive(&_ebpf_image_hook_provider_lock);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+//
+// NMR Registration Helper Routines.
+//
+
+void
+ntos_ebpf_ext_image_unregister_providers()
+{
+    if (_ebpf_image_hook_provider_context) {
+        ebpf_extension_hook_provider_unregister(_ebpf_image_hook_provider_context);
+        _ebpf_image_hook_provider_context = NULL;
+    }
+    if (_ebpf_image_program_info_provider_context) {
+        ebpf_extension_program_info_provider_unregister(_ebpf_image_program_info_provider_context);
+        _ebpf_image_program_info_provider_context = NULL;
+    }
+}
+
+NTSTATUS
+ntos_ebpf_ext_image_register_providers()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
+        &_ebpf_image_program_info_provider_moduleid, &_ebpf_image_program_data};
+    const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
+        &_ebpf_image_hook_provider_moduleid, &_ntos_ebpf_image_hook_provider_data};
+
+    // Set the program type as the provider module id.
+    _ebpf_image_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_IMAGE;
+    _ebpf_image_hook_provider_moduleid.Guid = EBPF_ATTACH_TYPE_IMAGE;
+    status = ebpf_extension_program_info_provider_register(
+        &program_info_provider_parameters, &_ebpf_image_program_info_provider_context);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_program_info_provider_register",
+            status);
+        goto Exit;
+    }
+
+    status = ebpf_extension_hook_provider_register(
+        &hook_provider_parameters,
+        _ntos_ebpf_extension_image_on_client_attach,
+        _ntos_ebpf_extension_image_on_client_detach,
+        NULL,
+        &_ebpf_image_hook_provider_context);
+    if (status != EBPF_SUCCESS) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_hook_provider_register",
+            status);
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        ntos_ebpf_ext_image_unregister_providers();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+typedef struct _image_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    image_md_t image_md;
+    // Image name as passed by the kernel. It is only copied out when a program asks for it.
+    PCUNICODE_STRING full_image_name;
+    UNICODE_STRING image_name;
+} image_notify_context_t;
+
+static ebpf_result_t
+_ebpf_image_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context)
+{
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_result_t result;
+    image_notify_context_t* image_context = NULL;
+
+    *context = NULL;
+
+    if (context_in == NULL || context_size_in < sizeof(image_notify_context_t)) {
+        EBPF_EXT_LOG_MESSAGE(EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Context is required");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    // The optional data buffer carries the UTF-16 image name.
+    if (data_size_in > USHRT_MAX || (data_size_in % sizeof(WCHAR)) != 0) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Invalid image name length");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    image_context = (image_notify_context_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(image_notify_context_t) + data_size_in, EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, image_context, "image_context", result);
+
+    // Copy the context from the caller.
+    memcpy(image_context, context_in, sizeof(image_notify_context_t));
+
+    // The image name lives right after the context.
+    image_context->image_name.Buffer = NULL;
+    image_context->image_name.Length = 0;
+    image_context->image_name.MaximumLength = 0;
+    if (data_in != NULL && data_size_in > 0) {
+        image_context->image_name.Buffer = (PWSTR)(image_context + 1);
+        memcpy(image_context->image_name.Buffer, data_in, data_size_in);
+        image_context->image_name.Length = (USHORT)data_size_in;
+        image_context->image_name.MaximumLength = (USHORT)data_size_in;
+    }
+    image_context->full_image_name = &image_context->image_name;
+
+    *context = &image_context->image_md;
+    result = EBPF_SUCCESS;
+
+Exit:
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ebpf_image_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    image_md_t* image_md = (image_md_t*)context;
+    image_notify_context_t* image_context = NULL;
+    image_notify_context_t* image_context_out = (image_notify_context_t*)context_out;
+
+    if (!image_md) {
+        goto Exit;
+    }
+
+    image_context = CONTAINING_RECORD(image_md, image_notify_context_t, image_md);
+
+    if (context_out != NULL && *context_size_out >= sizeof(image_notify_context_t)) {
+        // Copy the context to the caller.
+        memcpy(image_context_out, image_context, sizeof(image_notify_context_t));
+
+        // Zero out pointers.
+        image_context_out->full_image_name = NULL;
+        image_context_out->image_name.Buffer = NULL;
+        *context_size_out = sizeof(image_notify_context_t);
+    } else {
+        *context_size_out = 0;
+    }
+
+    if (data_out != NULL && *data_size_out >= image_context->image_name.Length) {
+        if (image_context->image_name.Length > 0) {
+            memcpy(data_out, image_context->image_name.Buffer, image_context->image_name.Length);
+        }
+        *data_size_out = image_context->image_name.Length;
+    } else {
+        *data_size_out = 0;
+    }
+
+    ExFreePool(image_context);
+
+Exit:
+    EBPF_EXT_LOG_EXIT();
+}
+
+void
+_ebpf_image_load_image_notify_routine(
+    _In_opt_ PUNICODE_STRING full_image_name, _In_ HANDLE process_id, _In_ PIMAGE_INFO image_info)
+{
+    image_notify_context_t image_notify_context = {
+        .image_md = {0}, .full_image_name = full_image_name, .image_name = {0}};
+
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_extension_hook_client_t* client_context;
+
+    image_notify_context.image_md.process_id = (uint64_t)process_id;
+    image_notify_context.image_md.image_base = (uint64_t)image_info->ImageBase;
+    image_notify_context.image_md.image_size = (uint64_t)image_info->ImageSize;
+    image_notify_context.image_md.signature_level = (uint8_t)image_info->ImageSignatureLevel;
+    image_notify_context.image_md.signature_type = (uint8_t)image_info->ImageSignatureType;
+    image_notify_context.image_md.is_system_mode = (uint8_t)image_info->SystemModeImage;
+
+    // For each attached client call the image hook.
+    ebpf_result_t result;
+    client_context = ebpf_extension_hook_get_next_attached_client(_ebpf_image_hook_provider_context, NULL);
+    while (client_context != NULL) {
+        uint32_t return_value = 0;
+        if (ebpf_extension_hook_client_enter_rundown(client_context)) {
+            result = ebpf_extension_hook_invoke_program(client_context, &image_notify_context.image_md, &return_value);
+            if (result != EBPF_SUCCESS) {
+                EBPF_EXT_LOG_MESSAGE(
+                    EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                    EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                    "ebpf_extension_hook_invoke_program failed");
+            }
+            ebpf_extension_hook_client_leave_rundown(client_context);
+        } else {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "ebpf_extension_hook_client_enter_rundown failed");
+        }
+
+        client_context =
+            ebpf_extension_hook_get_next_attached_client(_ebpf_image_hook_provider_context, client_context);
+    }
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+_Success_(return >= 0) static int32_t _ebpf_image_get_image_name(
+    _In_ image_md_t* image_md, _Out_writes_bytes_(name_length) uint8_t* name, uint32_t name_length)
+{
+    image_notify_context_t* image_notify_context = CONTAINING_RECORD(image_md, image_notify_context_t, image_md);
+    PCUNICODE_STRING image_name = image_notify_context->full_image_name;
+
+    // The kernel may not supply a name, e.g. when the file name could not be obtained.
+    if (image_name == NULL || image_name->Buffer == NULL) {
+        return -ENOENT;
+    }
+    if (image_name->Length > name_length) {
+        return -EINVAL;
+    }
+    memcpy(name, image_name->Buffer, image_name->Length);
+    return (int32_t)image_name->Length;
+}
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_ext.h"
+
+/**
+ * @brief Unregister IMAGE NPI providers.
+ *
+ */
+void
+ntos_ebpf_ext_image_unregister_providers();
+
+/**
+ * @brief Register IMAGE NPI providers.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_UNSUCCESSFUL Operation failed.
+ */
+NTSTATUS
+ntos_ebpf_ext_image_register_providers();
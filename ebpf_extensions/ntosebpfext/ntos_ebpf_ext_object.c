@@ -0,0 +1,375 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the object program type hook on eBPF for Windows.
+ */
+
+#include "ebpf_ntos_hooks.h"
+#include "ntos_ebpf_ext_object.h"
+#include "ntos_ebpf_ext_program_info.h"
+#include "shared_context.h"
+
+// Altitude of the object callbacks, in the activity monitor range.
+#define NTOS_EBPF_EXT_OBJECT_ALTITUDE L"385202"
+
+static ebpf_result_t
+_ebpf_object_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context);
+
+static void
+_ebpf_object_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out);
+
+static OB_PREOP_CALLBACK_STATUS
+_ebpf_object_pre_operation_callback(
+    _In_ PVOID registration_context, _Inout_ POB_PRE_OPERATION_INFORMATION operation_information);
+
+//
+// Object Program Information NPI Provider.
+//
+static ebpf_program_data_t _ebpf_object_program_data = {
+    .header = EBPF_PROGRAM_DATA_HEADER,
+    .program_info = &_ebpf_object_program_info,
+    .program_type_specific_helper_function_addresses = NULL,
+    .context_create = _ebpf_object_context_create,
+    .context_destroy = _ebpf_object_context_destroy,
+    .required_irql = PASSIVE_LEVEL,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_object_program_info_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_program_info_provider_t* _ebpf_object_program_info_provider_context = NULL;
+
+//
+// Object Hook NPI Provider.
+//
+ebpf_attach_provider_data_t _ntos_ebpf_object_hook_provider_data = {
+    .header = {EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION, EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION_SIZE},
+    .supported_program_type = EBPF_PROGRAM_TYPE_OBJECT_GUID,
+    .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_OBJECT,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_object_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_hook_provider_t* _ebpf_object_hook_provider_context = NULL;
+
+EX_PUSH_LOCK _ebpf_object_hook_provider_lock;
+bool _ebpf_object_hook_provider_registered = FALSE;
+uint64_t _ebpf_object_hook_provider_registration_count = 0;
+static PVOID _ebpf_object_callback_registration_handle = NULL;
+
+//
+// Client attach/detach handler routines.
+//
+
+static ebpf_result_t
+_ntos_ebpf_extension_object_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    bool push_lock_acquired = false;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(attaching_client);
+    UNREFERENCED_PARAMETER(provider_context);
+
+    ExAcquirePushLockExclusive(&_ebpf_object_hook_provider_lock);
+
+    push_lock_acquired = true;
+
+    if (!_ebpf_object_hook_provider_registered) {
+        // Register the pre-operation callbacks for process and thread handles.
+        OB_OPERATION_REGISTRATION operation_registration[] = {
+            {PsProcessType,
+             OB_OPERATION_HANDLE_CREATE | OB_OPERATION_HANDLE_DUPLICATE,
+             _ebpf_object_pre_operation_callback,
+             NULL},
+            {PsThreadType,
+             OB_OPERATION_HANDLE_CREATE | OB_OPERATION_HANDLE_DUPLICATE,
+             _ebpf_object_pre_operation_callback,
+             NULL},
+        };
+        OB_CALLBACK_REGISTRATION callback_registration = {
+            .Version = OB_FLT_REGISTRATION_VERSION,
+            .OperationRegistrationCount = (USHORT)EBPF_COUNT_OF(operation_registration),
+            .Altitude = RTL_CONSTANT_STRING(NTOS_EBPF_EXT_OBJECT_ALTITUDE),
+            .RegistrationContext = NULL,
+            .OperationRegistration = operation_registration,
+        };
+        NTSTATUS status = ObRegisterCallbacks(&callback_registration, &_ebpf_object_callback_registration_handle);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "ObRegisterCallbacks failed",
+                status);
+            result = EBPF_OPERATION_NOT_SUPPORTED;
+            goto Exit;
+        }
+        _ebpf_object_hook_provider_registered = TRUE;
+    }
+
+    _ebpf_object_hook_provider_registration_count++;
+
+Exit:
+    if (push_lock_acquired) {
+        ExReleasePushLockExclusive(&_ebpf_object_hook_provider_lock);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ntos_ebpf_extension_object_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(detaching_client);
+
+    // Unregister the object callbacks.
+    ExAcquirePushLockExclusive(&_ebpf_object_hook_provider_lock);
+
+    _ebpf_object_hook_provider_registration_count--;
+
+    if (_ebpf_object_hook_provider_registered && _ebpf_object_hook_provider_registration_count == 0) {
+        ObUnRegisterCallbacks(_ebpf_object_callback_registration_handle);
+        _ebpf_object_callback_registration_handle = NULL;
+        _ebpf_object_hook_provider_registered = FALSE;
+    }
+
+    ExReleasePushLockExclusive(&_ebpf_object_hook_provider_lock);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+//
+// NMR Registration Helper Routines.
+//
+
+void
+ntos_ebpf_ext_object_unregister_providers()
+{
+    if (_ebpf_object_hook_provider_context) {
+        ebpf_extension_hook_provider_unregister(_ebpf_object_hook_provider_context);
+        _ebpf_object_hook_provider_context = NULL;
+    }
+    if (_ebpf_object_program_info_provider_context) {
+        ebpf_extension_program_info_provider_unregister(_ebpf_object_program_info_provider_context);
+        _ebpf_object_program_info_provider_context = NULL;
+    }
+}
+
+NTSTATUS
+ntos_ebpf_ext_object_register_providers()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
+        &_ebpf_object_program_info_provider_moduleid, &_ebpf_object_program_data};
+    const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
+        &_ebpf_object_hook_provider_moduleid,
+        &_ntos_ebpf_object_hook_provider_data,
+        EBPF_EXTENSION_HOOK_MAX_CLIENTS};
+
+    // Set the program type as the provider module id.
+    _ebpf_object_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_OBJECT;
+    _ebpf_object_hook_provider_moduleid.Guid = EBPF_ATTACH_TYPE_OBJECT;
+    status = ebpf_extension_program_info_provider_register(
+        &program_info_provider_parameters, &_ebpf_object_program_info_provider_context);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_program_info_provider_register",
+            status);
+        goto Exit;
+    }
+
+    status = ebpf_extension_hook_provider_register(
+        &hook_provider_parameters,
+        _ntos_ebpf_extension_object_on_client_attach,
+        _ntos_ebpf_extension_object_on_client_detach,
+        NULL,
+        &_ebpf_object_hook_provider_context);
+    if (status != EBPF_SUCCESS) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_hook_provider_register",
+            status);
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        ntos_ebpf_ext_object_unregister_providers();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+typedef struct _object_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    object_md_t object_md;
+} object_notify_context_t;
+
+static ebpf_result_t
+_ebpf_object_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context)
+{
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_result_t result;
+    object_notify_context_t* object_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_in);
+    UNREFERENCED_PARAMETER(data_size_in);
+
+    *context = NULL;
+
+    if (context_in == NULL || context_size_in < sizeof(object_notify_context_t)) {
+        EBPF_EXT_LOG_MESSAGE(EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Context is required");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    object_context = (object_notify_context_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(object_notify_context_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, object_context, "object_context", result);
+
+    // Copy the context from the caller.
+    memcpy(object_context, context_in, sizeof(object_notify_context_t));
+
+    *context = &object_context->object_md;
+    result = EBPF_SUCCESS;
+
+Exit:
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ebpf_object_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    object_md_t* object_md = (object_md_t*)context;
+    object_notify_context_t* object_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_out);
+
+    if (!object_md) {
+        goto Exit;
+    }
+
+    object_context = CONTAINING_RECORD(object_md, object_notify_context_t, object_md);
+
+    if (context_out != NULL && *context_size_out >= sizeof(object_notify_context_t)) {
+        // Copy the context to the caller.
+        memcpy(context_out, object_context, sizeof(object_notify_context_t));
+        *context_size_out = sizeof(object_notify_context_t);
+    } else {
+        *context_size_out = 0;
+    }
+
+    // This program type has no variable-length data.
+    *data_size_out = 0;
+
+    ExFreePool(object_context);
+
+Exit:
+    EBPF_EXT_LOG_EXIT();
+}
+
+static OB_PREOP_CALLBACK_STATUS
+_ebpf_object_pre_operation_callback(
+    _In_ PVOID registration_context, _Inout_ POB_PRE_OPERATION_INFORMATION operation_information)
+{
+    ebpf_extension_hook_client_snapshot_t* snapshot;
+    ACCESS_MASK* desired_access;
+    ACCESS_MASK original_desired_access;
+    uint32_t access_to_strip = 0;
+
+    UNREFERENCED_PARAMETER(registration_context);
+
+    // Handle operations are very frequent, so bail out before building the context if nothing is attached.
+    snapshot = ebpf_extension_hook_acquire_client_snapshot(_ebpf_object_hook_provider_context);
+    if (snapshot == NULL) {
+        return OB_PREOP_SUCCESS;
+    }
+
+    object_notify_context_t object_notify_context = {.object_md = {0}};
+    object_md_t* object_md = &object_notify_context.object_md;
+
+    if (operation_information->Operation == OB_OPERATION_HANDLE_CREATE) {
+        object_md->operation = OBJECT_OPERATION_HANDLE_CREATE;
+        desired_access = &operation_information->Parameters->CreateHandleInformation.DesiredAccess;
+        original_desired_access = operation_information->Parameters->CreateHandleInformation.OriginalDesiredAccess;
+    } else {
+        object_md->operation = OBJECT_OPERATION_HANDLE_DUPLICATE;
+        desired_access = &operation_information->Parameters->DuplicateHandleInformation.DesiredAccess;
+        original_desired_access = operation_information->Parameters->DuplicateHandleInformation.OriginalDesiredAccess;
+    }
+
+    if (operation_information->ObjectType == *PsProcessType) {
+        object_md->object_type = OBJECT_TYPE_PROCESS;
+        object_md->target_process_id = (uint64_t)PsGetProcessId((PEPROCESS)operation_information->Object);
+    } else {
+        object_md->object_type = OBJECT_TYPE_THREAD;
+        object_md->target_process_id = (uint64_t)PsGetThreadProcessId((PETHREAD)operation_information->Object);
+        object_md->target_thread_id = (uint64_t)PsGetThreadId((PETHREAD)operation_information->Object);
+    }
+
+    object_md->source_process_id = (uint64_t)PsGetCurrentProcessId();
+    object_md->source_thread_id = (uint64_t)PsGetCurrentThreadId();
+    object_md->desired_access = *desired_access;
+    object_md->original_desired_access = original_desired_access;
+    object_md->is_kernel_handle = (uint8_t)operation_information->KernelHandle;
+
+    // Call each attached client. Each program sees the access mask left by the programs before it.
+    uint32_t client_count = ebpf_extension_hook_client_snapshot_get_count(snapshot);
+    for (uint32_t index = 0; index < client_count; index++) {
+        ebpf_extension_hook_client_t* client_context = ebpf_extension_hook_client_snapshot_get_client(snapshot, index);
+        uint32_t return_value = 0;
+        ebpf_result_t result = ebpf_extension_hook_invoke_program(client_context, object_md, &return_value);
+        if (result != EBPF_SUCCESS) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "ebpf_extension_hook_invoke_program failed");
+            continue;
+        }
+        access_to_strip |= return_value;
+        object_md->desired_access &= ~return_value;
+    }
+
+    ebpf_extension_hook_release_client_snapshot(snapshot);
+
+    if (access_to_strip != 0) {
+        *desired_access &= ~access_to_strip;
+    }
+
+    return OB_PREOP_SUCCESS;
+}
@@ -9,6 +9,7 @@
 #include "ebpf_ntos_hooks.h"
 #include "ntos_ebpf_ext_process.h"
 #include "ntos_ebpf_ext_program_info.h"
+#include "ntos_ebpf_ext_thread.h"
 #include "shared_context.h"
 
 #include <errno.h>
@@ -17,9 +18,6 @@
 // Maximum number of bytes for inline account name/domain buffers on the stack.
 #define ACCOUNT_STRING_INLINE_BYTES 80
 
-// Define the pool tag for this extension
-ULONG EBPF_EXTENSION_POOL_TAG = EBPF_NTOS_EXTENSION_POOL_TAG;
-
 static ebpf_result_t
 _ebpf_process_context_create(
     _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
@@ -102,33 +100,22 @@ uint64_t _ebpf_process_hook_provider_registration_count = 0;
 // Client attach/detach handler routines.
 //
 
-static ebpf_result_t
-_ntos_ebpf_extension_process_on_client_attach(
-    _In_ const ebpf_extension_hook_client_t* attaching_client,
-    _In_ const ebpf_extension_hook_provider_t* provider_context)
+NTSTATUS
+ntos_ebpf_ext_process_reference_notify_routine()
 {
-    ebpf_result_t result = EBPF_SUCCESS;
-    bool push_lock_acquired = false;
-
-    EBPF_EXT_LOG_ENTRY();
-
-    UNREFERENCED_PARAMETER(attaching_client);
-    UNREFERENCED_PARAMETER(provider_context);
+    NTSTATUS status = STATUS_SUCCESS;
 
     ExAcquirePushLockExclusive(&_ebpf_process_hook_provider_lock);
 
-    push_lock_acquired = true;
-
     if (!_ebpf_process_hook_provider_registered) {
         // Register the process create notify routine.
-        NTSTATUS status = PsSetCreateProcessNotifyRoutineEx(_ebpf_process_create_process_notify_routine_ex, FALSE);
+        status = PsSetCreateProcessNotifyRoutineEx(_ebpf_process_create_process_notify_routine_ex, FALSE);
         if (!NT_SUCCESS(status)) {
             EBPF_EXT_LOG_MESSAGE_NTSTATUS(
                 EBPF_EXT_TRACELOG_LEVEL_ERROR,
                 EBPF_EXT_TRACELOG_KEYWORD_PROCESS,
                 "PsSetCreateProcessNotifyRoutineEx failed",
                 status);
-            result = EBPF_OPERATION_NOT_SUPPORTED;
             goto Exit;
         }
         _ebpf_process_hook_provider_registered = TRUE;
@@ -137,22 +124,14 @@ _ntos_ebpf_extension_process_on_client_attach(
     _ebpf_process_hook_provider_registration_count++;
 
 Exit:
-    if (push_lock_acquired) {
-        ExReleasePushLockExclusive(&_ebpf_process_hook_provider_lock);
-    }
+    ExReleasePushLockExclusive(&_ebpf_process_hook_provider_lock);
 
-    EBPF_EXT_RETURN_RESULT(result);
+    return status;
 }
 
-static void
-_ntos_ebpf_extension_process_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+void
+ntos_ebpf_ext_process_dereference_notify_routine()
 {
-    ebpf_result_t result = EBPF_SUCCESS;
-
-    EBPF_EXT_LOG_ENTRY();
-
-    UNREFERENCED_PARAMETER(detaching_client);
-
     // Unregister the process create notify routine.
     ExAcquirePushLockExclusive(&_ebpf_process_hook_provider_lock);
 
@@ -166,12 +145,40 @@ _ntos_ebpf_extension_process_on_client_detach(_In_ const ebpf_extension_hook_cli
                 EBPF_EXT_TRACELOG_KEYWORD_PROCESS,
                 "PsSetCreateProcessNotifyRoutineEx failed",
                 status);
-            result = EBPF_OPERATION_NOT_SUPPORTED;
         }
         _ebpf_process_hook_provider_registered = FALSE;
     }
 
     ExReleasePushLockExclusive(&_ebpf_process_hook_provider_lock);
+}
+
+static ebpf_result_t
+_ntos_ebpf_extension_process_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(attaching_client);
+    UNREFERENCED_PARAMETER(provider_context);
+
+    if (!NT_SUCCESS(ntos_ebpf_ext_process_reference_notify_routine())) {
+        result = EBPF_OPERATION_NOT_SUPPORTED;
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ntos_ebpf_extension_process_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(detaching_client);
+
+    ntos_ebpf_ext_process_dereference_notify_routine();
 
     EBPF_EXT_LOG_EXIT();
 }
@@ -181,7 +188,7 @@ _ntos_ebpf_extension_process_on_client_detach(_In_ const ebpf_extension_hook_cli
 //
 
 void
-ebpf_ext_unregister_ntos()
+ntos_ebpf_ext_process_unregister_providers()
 {
     if (_ebpf_process_hook_provider_context) {
         ebpf_extension_hook_provider_unregister(_ebpf_process_hook_provider_context);
@@ -194,7 +201,7 @@ ebpf_ext_unregister_ntos()
 }
 
 NTSTATUS
-ebpf_ext_register_ntos()
+ntos_ebpf_ext_process_register_providers()
 {
     NTSTATUS status = STATUS_SUCCESS;
 
@@ -236,7 +243,7 @@ ebpf_ext_register_ntos()
 
 Exit:
     if (!NT_SUCCESS(status)) {
-        ebpf_ext_unregister_ntos();
+        ntos_ebpf_ext_process_unregister_providers();
     }
     EBPF_EXT_RETURN_NTSTATUS(status);
 }
@@ -646,6 +653,11 @@ _ebpf_process_create_process_notify_routine_ex(
             ebpf_extension_hook_get_next_attached_client(_ebpf_process_hook_provider_context, client_context);
     }
 
+    // Let the thread hook recognize the initial thread of the process, which is created right after this
+    // notification. A process whose creation was denied gets no thread.
+    ntos_ebpf_ext_thread_on_process_notify(
+        process_id, create_info != NULL && NT_SUCCESS(create_info->CreationStatus));
+
     if (process_notify_context.account_name.Buffer != NULL &&
         process_notify_context.account_name.Buffer != account_name_stack_buffer) {
         ExFreePool(process_notify_context.account_name.Buffer);
@@ -22,3 +22,19 @@ ntos_ebpf_ext_process_unregister_providers();
  */
 NTSTATUS
 ntos_ebpf_ext_process_register_providers();
+
+/**
+ * @brief Register the process create notify routine, if not registered yet, and take a reference on it. It is shared
+ * by the process hook and the thread hook.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval Other The notify routine could not be registered.
+ */
+NTSTATUS
+ntos_ebpf_ext_process_reference_notify_routine();
+
+/**
+ * @brief Release a reference on the process create notify routine, and unregister it with the last one.
+ */
+void
+ntos_ebpf_ext_process_dereference_notify_routine();
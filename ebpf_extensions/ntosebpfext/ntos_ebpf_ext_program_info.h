@@ -64,3 +64,196 @@ static const ebpf_program_section_info_t _ebpf_process_section_info[] = {
         .bpf_attach_type = BPF_ATTACH_TYPE_PROCESS,
     },
 };
+
+// Thread program information.
+static const ebpf_ctx_descriptor_t _ebpf_thread_context_descriptor = {
+    sizeof(thread_md_t),
+    -1,
+    -1,
+    -1,
+};
+
+static const ebpf_program_type_descriptor_t _ebpf_thread_program_type_descriptor = {
+    .header = {EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION, EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION_SIZE},
+    .name = "thread",
+    .context_descriptor = &_ebpf_thread_context_descriptor,
+    .program_type = EBPF_PROGRAM_TYPE_THREAD_GUID,
+    .bpf_prog_type = (bpf_prog_type_t)BPF_PROG_TYPE_THREAD,
+};
+
+static const ebpf_program_info_t _ebpf_thread_program_info = {
+    .header = {EBPF_PROGRAM_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_INFORMATION_CURRENT_VERSION_SIZE},
+    .program_type_descriptor = &_ebpf_thread_program_type_descriptor,
+    .count_of_program_type_specific_helpers = 0,
+    .program_type_specific_helper_prototype = NULL,
+};
+
+static const ebpf_program_section_info_t _ebpf_thread_section_info[] = {
+    {
+        .header =
+            {EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION_SIZE},
+        .section_name = (wchar_t*)L"thread",
+        .program_type = &EBPF_PROGRAM_TYPE_THREAD,
+        .attach_type = &EBPF_ATTACH_TYPE_THREAD,
+        .bpf_program_type = (bpf_prog_type_t)BPF_PROG_TYPE_THREAD,
+        .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_THREAD,
+    },
+};
+
+// Image program information.
+static const ebpf_helper_function_prototype_t _image_ebpf_extension_helper_function_prototype[] = {
+    {.header = {EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION, EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION_SIZE},
+     .helper_id = EBPF_MAX_GENERAL_HELPER_FUNCTION + 1,
+     .name = "bpf_image_get_image_name",
+     .return_type = EBPF_RETURN_TYPE_INTEGER,
+     .arguments =
+         {EBPF_ARGUMENT_TYPE_PTR_TO_CTX, EBPF_ARGUMENT_TYPE_PTR_TO_WRITABLE_MEM, EBPF_ARGUMENT_TYPE_CONST_SIZE}},
+};
+
+static const ebpf_ctx_descriptor_t _ebpf_image_context_descriptor = {
+    sizeof(image_md_t),
+    -1,
+    -1,
+    -1,
+};
+
+static const ebpf_program_type_descriptor_t _ebpf_image_program_type_descriptor = {
+    .header = {EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION, EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION_SIZE},
+    .name = "image",
+    .context_descriptor = &_ebpf_image_context_descriptor,
+    .program_type = EBPF_PROGRAM_TYPE_IMAGE_GUID,
+    .bpf_prog_type = (bpf_prog_type_t)BPF_PROG_TYPE_IMAGE,
+};
+
+static const ebpf_program_info_t _ebpf_image_program_info = {
+    .header = {EBPF_PROGRAM_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_INFORMATION_CURRENT_VERSION_SIZE},
+    .program_type_descriptor = &_ebpf_image_program_type_descriptor,
+    .count_of_program_type_specific_helpers = EBPF_COUNT_OF(_image_ebpf_extension_helper_function_prototype),
+    .program_type_specific_helper_prototype = _image_ebpf_extension_helper_function_prototype,
+};
+
+static const ebpf_program_section_info_t _ebpf_image_section_info[] = {
+    {
+        .header =
+            {EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION_SIZE},
+        .section_name = (wchar_t*)L"image",
+        .program_type = &EBPF_PROGRAM_TYPE_IMAGE,
+        .attach_type = &EBPF_ATTACH_TYPE_IMAGE,
+        .bpf_program_type = (bpf_prog_type_t)BPF_PROG_TYPE_IMAGE,
+        .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_IMAGE,
+    },
+};
+
+// Registry program information.
+static const ebpf_helper_function_prototype_t _registry_ebpf_extension_helper_function_prototype[] = {
+    {.header = {EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION, EBPF_HELPER_FUNCTION_PROTOTYPE_CURRENT_VERSION_SIZE},
+     .helper_id = EBPF_MAX_GENERAL_HELPER_FUNCTION + 1,
+     .name = "bpf_registry_get_key_path",
+     .return_type = EBPF_RETURN_TYPE_INTEGER,
+     .arguments =
+         {EBPF_ARGUMENT_TYPE_PTR_TO_CTX, EBPF_ARGUMENT_TYPE_PTR_TO_WRITABLE_MEM, EBPF_ARGUMENT_TYPE_CONST_SIZE}},
+};
+
+static const ebpf_ctx_descriptor_t _ebpf_registry_context_descriptor = {
+    sizeof(registry_md_t),
+    EBPF_OFFSET_OF(registry_md_t, value_name_start),
+    EBPF_OFFSET_OF(registry_md_t, value_name_end),
+    -1,
+};
+
+static const ebpf_program_type_descriptor_t _ebpf_registry_program_type_descriptor = {
+    .header = {EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION, EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION_SIZE},
+    .name = "registry",
+    .context_descriptor = &_ebpf_registry_context_descriptor,
+    .program_type = EBPF_PROGRAM_TYPE_REGISTRY_GUID,
+    .bpf_prog_type = (bpf_prog_type_t)BPF_PROG_TYPE_REGISTRY,
+};
+
+static const ebpf_program_info_t _ebpf_registry_program_info = {
+    .header = {EBPF_PROGRAM_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_INFORMATION_CURRENT_VERSION_SIZE},
+    .program_type_descriptor = &_ebpf_registry_program_type_descriptor,
+    .count_of_program_type_specific_helpers = EBPF_COUNT_OF(_registry_ebpf_extension_helper_function_prototype),
+    .program_type_specific_helper_prototype = _registry_ebpf_extension_helper_function_prototype,
+};
+
+static const ebpf_program_section_info_t _ebpf_registry_section_info[] = {
+    {
+        .header =
+            {EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION_SIZE},
+        .section_name = (wchar_t*)L"registry",
+        .program_type = &EBPF_PROGRAM_TYPE_REGISTRY,
+        .attach_type = &EBPF_ATTACH_TYPE_REGISTRY,
+        .bpf_program_type = (bpf_prog_type_t)BPF_PROG_TYPE_REGISTRY,
+        .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_REGISTRY,
+    },
+};
+
+// Object program information.
+static const ebpf_ctx_descriptor_t _ebpf_object_context_descriptor = {
+    sizeof(object_md_t),
+    -1,
+    -1,
+    -1,
+};
+
+static const ebpf_program_type_descriptor_t _ebpf_object_program_type_descriptor = {
+    .header = {EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION, EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION_SIZE},
+    .name = "object",
+    .context_descriptor = &_ebpf_object_context_descriptor,
+    .program_type = EBPF_PROGRAM_TYPE_OBJECT_GUID,
+    .bpf_prog_type = (bpf_prog_type_t)BPF_PROG_TYPE_OBJECT,
+};
+
+static const ebpf_program_info_t _ebpf_object_program_info = {
+    .header = {EBPF_PROGRAM_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_INFORMATION_CURRENT_VERSION_SIZE},
+    .program_type_descriptor = &_ebpf_object_program_type_descriptor,
+    .count_of_program_type_specific_helpers = 0,
+    .program_type_specific_helper_prototype = NULL,
+};
+
+static const ebpf_program_section_info_t _ebpf_object_section_info[] = {
+    {
+        .header =
+            {EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION_SIZE},
+        .section_name = (wchar_t*)L"object",
+        .program_type = &EBPF_PROGRAM_TYPE_OBJECT,
+        .attach_type = &EBPF_ATTACH_TYPE_OBJECT,
+        .bpf_program_type = (bpf_prog_type_t)BPF_PROG_TYPE_OBJECT,
+        .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_OBJECT,
+    },
+};
+
+// Sample program information.
+static const ebpf_ctx_descriptor_t _ebpf_sample_context_descriptor = {
+    sizeof(sample_md_t),
+    -1,
+    -1,
+    -1,
+};
+
+static const ebpf_program_type_descriptor_t _ebpf_sample_program_type_descriptor = {
+    .header = {EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION, EBPF_PROGRAM_TYPE_DESCRIPTOR_CURRENT_VERSION_SIZE},
+    .name = "sample",
+    .context_descriptor = &_ebpf_sample_context_descriptor,
+    .program_type = EBPF_PROGRAM_TYPE_SAMPLE_GUID,
+    .bpf_prog_type = (bpf_prog_type_t)BPF_PROG_TYPE_SAMPLE,
+};
+
+static const ebpf_program_info_t _ebpf_sample_program_info = {
+    .header = {EBPF_PROGRAM_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_INFORMATION_CURRENT_VERSION_SIZE},
+    .program_type_descriptor = &_ebpf_sample_program_type_descriptor,
+    .count_of_program_type_specific_helpers = 0,
+    .program_type_specific_helper_prototype = NULL,
+};
+
+static const ebpf_program_section_info_t _ebpf_sample_section_info[] = {
+    {
+        .header =
+            {EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION, EBPF_PROGRAM_SECTION_INFORMATION_CURRENT_VERSION_SIZE},
+        .section_name = (wchar_t*)L"sample",
+        .program_type = &EBPF_PROGRAM_TYPE_SAMPLE,
+        .attach_type = &EBPF_ATTACH_TYPE_SAMPLE,
+        .bpf_program_type = (bpf_prog_type_t)BPF_PROG_TYPE_SAMPLE,
+        .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_SAMPLE,
+    },
+};
@@ -0,0 +1,540 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the registry program type hook on eBPF for Windows.
+ */
+
+#include "ebpf_ntos_hooks.h"
+#include "ntos_ebpf_ext_program_info.h"
+#include "ntos_ebpf_ext_registry.h"
+#include "shared_context.h"
+
+#include <errno.h>
+
+// Altitude of the registry callback, in the activity monitor range.
+#define NTOS_EBPF_EXT_REGISTRY_ALTITUDE L"385201"
+
+static ebpf_result_t
+_ebpf_registry_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context);
+
+static void
+_ebpf_registry_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out);
+
+static NTSTATUS
+_ebpf_registry_callback(_In_ PVOID callback_context, _In_opt_ PVOID argument1, _In_opt_ PVOID argument2);
+
+_Success_(return >= 0) static int32_t _ebpf_registry_get_key_path(
+    _In_ registry_md_t* registry_md, _Out_writes_bytes_(path_length) uint8_t* path, uint32_t path_length);
+
+static const void* _ebpf_registry_helper_functions[] = {
+    (void*)&_ebpf_registry_get_key_path,
+};
+
+static ebpf_helper_function_addresses_t _ebpf_registry_helper_function_address_table = {
+    .header = {EBPF_HELPER_FUNCTION_ADDRESSES_CURRENT_VERSION, EBPF_HELPER_FUNCTION_ADDRESSES_CURRENT_VERSION_SIZE},
+    .helper_function_count = EBPF_COUNT_OF(_ebpf_registry_helper_functions),
+    .helper_function_address = (uint64_t*)_ebpf_registry_helper_functions,
+};
+
+//
+// Registry Program Information NPI Provider.
+//
+static ebpf_program_data_t _ebpf_registry_program_data = {
+    .header = EBPF_PROGRAM_DATA_HEADER,
+    .program_info = &_ebpf_registry_program_info,
+    .program_type_specific_helper_function_addresses = &_ebpf_registry_helper_function_address_table,
+    .context_create = _ebpf_registry_context_create,
+    .context_destroy = _ebpf_registry_context_destroy,
+    .required_irql = PASSIVE_LEVEL,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_registry_program_info_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_program_info_provider_t* _ebpf_registry_program_info_provider_context = NULL;
+
+//
+// Registry Hook NPI Provider.
+//
+ebpf_attach_provider_data_t _ntos_ebpf_registry_hook_provider_data = {
+    .header = {EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION, EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION_SIZE},
+    .supported_program_type = EBPF_PROGRAM_TYPE_REGISTRY_GUID,
+    .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_REGISTRY,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_registry_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_hook_provider_t* _ebpf_registry_hook_provider_context = NULL;
+
+EX_PUSH_LOCK _ebpf_registry_hook_provider_lock;
+bool _ebpf_registry_hook_provider_registered = FALSE;
+uint64_t _ebpf_registry_hook_provider_registration_count = 0;
+static LARGE_INTEGER _ebpf_registry_callback_cookie = {0};
+
+//
+// Client attach/detach handler routines.
+//
+
+static ebpf_result_t
+_ntos_ebpf_extension_registry_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    bool push_lock_acquired = false;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(attaching_client);
+    UNREFERENCED_PARAMETER(provider_context);
+
+    ExAcquirePushLockExclusive(&_ebpf_registry_hook_provider_lock);
+
+    push_lock_acquired = true;
+
+    if (!_ebpf_registry_hook_provider_registered) {
+        // Register the registry callback.
+        UNICODE_STRING altitude = RTL_CONSTANT_STRING(NTOS_EBPF_EXT_REGISTRY_ALTITUDE);
+        NTSTATUS status = CmRegisterCallbackEx(
+            _ebpf_registry_callback,
+            &altitude,
+            _ebpf_ext_driver_device_object->DriverObject,
+            NULL,
+            &_ebpf_registry_callback_cookie,
+            NULL);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "CmRegisterCallbackEx failed",
+                status);
+            result = EBPF_OPERATION_NOT_SUPPORTED;
+            goto Exit;
+        }
+        _ebpf_registry_hook_provider_registered = TRUE;
+    }
+
+    _ebpf_registry_hook_provider_registration_count++;
+
+Exit:
+    if (push_lock_acquired) {
+        ExReleasePushLockExclusive(&_ebpf_registry_hook_provider_lock);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ntos_ebpf_extension_registry_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(detaching_client);
+
+    // Unregister the registry callback.
+    ExAcquirePushLockExclusive(&_ebpf_registry_hook_provider_lock);
+
+    _ebpf_registry_hook_provider_registration_count--;
+
+    if (_ebpf_registry_hook_provider_registered && _ebpf_registry_hook_provider_registration_count == 0) {
+        NTSTATUS status = CmUnRegisterCallback(_ebpf_registry_callback_cookie);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "CmUnRegisterCallback failed",
+                status);
+        }
+        _ebpf_registry_hook_provider_registered = FALSE;
+    }
+
+    ExReleasePushLockExclusive(&_ebpf_registry_hook_provider_lock);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+//
+// NMR Registration Helper Routines.
+//
+
+void
+ntos_ebpf_ext_registry_unregister_providers()
+{
+    if (_ebpf_registry_hook_provider_context) {
+        ebpf_extension_hook_provider_unregister(_ebpf_registry_hook_provider_context);
+        _ebpf_registry_hook_provider_context = NULL;
+    }
+    if (_ebpf_registry_program_info_provider_context) {
+        ebpf_extension_program_info_provider_unregister(_ebpf_registry_program_info_provider_context);
+        _ebpf_registry_program_info_provider_context = NULL;
+    }
+}
+
+NTSTATUS
+ntos_ebpf_ext_registry_register_providers()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
+        &_ebpf_registry_program_info_provider_moduleid, &_ebpf_registry_program_data};
+    const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
+        &_ebpf_registry_hook_provider_moduleid, &_ntos_ebpf_registry_hook_provider_data};
+
+    // Set the program type as the provider module id.
+    _ebpf_registry_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_REGISTRY;
+    _ebpf_registry_hook_provider_moduleid.Guid = EBPF_ATTACH_TYPE_REGISTRY;
+    status = ebpf_extension_program_info_provider_register(
+        &program_info_provider_parameters, &_ebpf_registry_program_info_provider_context);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_program_info_provider_register",
+            status);
+        goto Exit;
+    }
+
+    status = ebpf_extension_hook_provider_register(
+        &hook_provider_parameters,
+        _ntos_ebpf_extension_registry_on_client_attach,
+        _ntos_ebpf_extension_registry_on_client_detach,
+        NULL,
+        &_ebpf_registry_hook_provider_context);
+    if (status != EBPF_SUCCESS) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_hook_provider_register",
+            status);
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        ntos_ebpf_ext_registry_unregister_providers();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+typedef struct _registry_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    registry_md_t registry_md;
+    // Key object the operation applies to.  For key creation and open, this is the root object that
+    // relative_name is resolved against.  The key path is only looked up when a program asks for it.
+    PVOID key_object;
+    PCUNICODE_STRING relative_name;
+    UNICODE_STRING value_name;
+    // Key path supplied by test-run callers, which have no key object.
+    UNICODE_STRING key_path;
+} registry_notify_context_t;
+
+// Copy a UNICODE_STRING's content into a caller-supplied byte buffer.
+static int32_t
+_copy_unicode_string_to_buffer(
+    _In_ const UNICODE_STRING* source, _Out_writes_bytes_(dest_length) uint8_t* dest, uint32_t dest_length)
+{
+    if (source->Length > dest_length) {
+        return -EINVAL;
+    }
+    if (source->Buffer != NULL && source->Length > 0) {
+        memcpy(dest, source->Buffer, source->Length);
+        return (int32_t)source->Length;
+    }
+    return 0;
+}
+
+static ebpf_result_t
+_ebpf_registry_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context)
+{
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_result_t result;
+    registry_notify_context_t* registry_context = NULL;
+    const registry_notify_context_t* input_context = (const registry_notify_context_t*)context_in;
+    uint8_t* data_ptr;
+
+    *context = NULL;
+
+    if (context_in == NULL || context_size_in < sizeof(registry_notify_context_t)) {
+        EBPF_EXT_LOG_MESSAGE(EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Context is required");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    // The data buffer carries the value name followed by the key path, with lengths taken from the context.
+    if ((size_t)input_context->value_name.Length + input_context->key_path.Length != data_size_in ||
+        (input_context->value_name.Length % sizeof(WCHAR)) != 0 ||
+        (input_context->key_path.Length % sizeof(WCHAR)) != 0 || (data_size_in > 0 && data_in == NULL)) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Invalid registry data length");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    registry_context = (registry_notify_context_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(registry_notify_context_t) + data_size_in, EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, registry_context, "registry_context", result);
+
+    // Copy the context from the caller.
+    memcpy(registry_context, context_in, sizeof(registry_notify_context_t));
+
+    // The strings live right after the context.
+    data_ptr = (uint8_t*)(registry_context + 1);
+    if (data_size_in > 0) {
+        memcpy(data_ptr, data_in, data_size_in);
+    }
+    registry_context->key_object = NULL;
+    registry_context->relative_name = NULL;
+    registry_context->value_name.Buffer = (PWSTR)data_ptr;
+    registry_context->value_name.MaximumLength = registry_context->value_name.Length;
+    registry_context->key_path.Buffer = (PWSTR)(data_ptr + registry_context->value_name.Length);
+    registry_context->key_path.MaximumLength = registry_context->key_path.Length;
+
+    registry_context->registry_md.value_name_start = (uint8_t*)registry_context->value_name.Buffer;
+    registry_context->registry_md.value_name_end =
+        (uint8_t*)registry_context->value_name.Buffer + registry_context->value_name.Length;
+
+    *context = &registry_context->registry_md;
+    result = EBPF_SUCCESS;
+
+Exit:
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ebpf_registry_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    registry_md_t* registry_md = (registry_md_t*)context;
+    registry_notify_context_t* registry_context = NULL;
+    registry_notify_context_t* registry_context_out = (registry_notify_context_t*)context_out;
+
+    if (!registry_md) {
+        goto Exit;
+    }
+
+    registry_context = CONTAINING_RECORD(registry_md, registry_notify_context_t, registry_md);
+
+    if (context_out != NULL && *context_size_out >= sizeof(registry_notify_context_t)) {
+        // Copy the context to the caller.
+        memcpy(registry_context_out, registry_context, sizeof(registry_notify_context_t));
+
+        // Zero out pointers.
+        registry_context_out->registry_md.value_name_start = NULL;
+        registry_context_out->registry_md.value_name_end = NULL;
+        registry_context_out->value_name.Buffer = NULL;
+        registry_context_out->key_path.Buffer = NULL;
+        *context_size_out = sizeof(registry_notify_context_t);
+    } else {
+        *context_size_out = 0;
+    }
+
+    // Return the value name, which is the only part of the data a program can see.
+    if (data_out != NULL && *data_size_out >= registry_context->value_name.Length) {
+        if (registry_context->value_name.Length > 0) {
+            memcpy(data_out, registry_context->value_name.Buffer, registry_context->value_name.Length);
+        }
+        *data_size_out = registry_context->value_name.Length;
+    } else {
+        *data_size_out = 0;
+    }
+
+    ExFreePool(registry_context);
+
+Exit:
+    EBPF_EXT_LOG_EXIT();
+}
+
+static NTSTATUS
+_ebpf_registry_callback(_In_ PVOID callback_context, _In_opt_ PVOID argument1, _In_opt_ PVOID argument2)
+{
+    REG_NOTIFY_CLASS notify_class = (REG_NOTIFY_CLASS)(ULONG_PTR)argument1;
+    registry_notify_context_t registry_notify_context = {.registry_md = {0}};
+    PCUNICODE_STRING value_name = NULL;
+    NTSTATUS verdict = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER(callback_context);
+
+    if (argument2 == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    // Only pre-operation notifications can be denied, so those are the only ones programs are invoked for.
+    switch (notify_class) {
+    case RegNtPreCreateKeyEx: {
+        PREG_CREATE_KEY_INFORMATION info = (PREG_CREATE_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_CREATE_KEY;
+        registry_notify_context.key_object = info->RootObject;
+        registry_notify_context.relative_name = info->CompleteName;
+        break;
+    }
+    case RegNtPreOpenKeyEx: {
+        PREG_OPEN_KEY_INFORMATION info = (PREG_OPEN_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_OPEN_KEY;
+        registry_notify_context.key_object = info->RootObject;
+        registry_notify_context.relative_name = info->CompleteName;
+        break;
+    }
+    case RegNtPreDeleteKey: {
+        PREG_DELETE_KEY_INFORMATION info = (PREG_DELETE_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_DELETE_KEY;
+        registry_notify_context.key_object = info->Object;
+        break;
+    }
+    case RegNtPreRenameKey: {
+        PREG_RENAME_KEY_INFORMATION info = (PREG_RENAME_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_RENAME_KEY;
+        registry_notify_context.key_object = info->Object;
+        value_name = info->NewName;
+        break;
+    }
+    case RegNtPreSetValueKey: {
+        PREG_SET_VALUE_KEY_INFORMATION info = (PREG_SET_VALUE_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_SET_VALUE;
+        registry_notify_context.registry_md.data_type = info->Type;
+        registry_notify_context.registry_md.data_size = info->DataSize;
+        registry_notify_context.key_object = info->Object;
+        value_name = info->ValueName;
+        break;
+    }
+    case RegNtPreDeleteValueKey: {
+        PREG_DELETE_VALUE_KEY_INFORMATION info = (PREG_DELETE_VALUE_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_DELETE_VALUE;
+        registry_notify_context.key_object = info->Object;
+        value_name = info->ValueName;
+        break;
+    }
+    case RegNtPreQueryValueKey: {
+        PREG_QUERY_VALUE_KEY_INFORMATION info = (PREG_QUERY_VALUE_KEY_INFORMATION)argument2;
+        registry_notify_context.registry_md.operation = REGISTRY_OPERATION_QUERY_VALUE;
+        registry_notify_context.registry_md.data_size = info->Length;
+        registry_notify_context.key_object = info->Object;
+        value_name = info->ValueName;
+        break;
+    }
+    default:
+        return STATUS_SUCCESS;
+    }
+
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_extension_hook_client_t* client_context;
+
+    registry_notify_context.registry_md.process_id = (uint64_t)PsGetCurrentProcessId();
+    registry_notify_context.registry_md.thread_id = (uint64_t)PsGetCurrentThreadId();
+    if (value_name != NULL) {
+        registry_notify_context.value_name = *value_name;
+        registry_notify_context.registry_md.value_name_start = (uint8_t*)value_name->Buffer;
+        registry_notify_context.registry_md.value_name_end = (uint8_t*)value_name->Buffer + value_name->Length;
+    }
+
+    // For each attached client call the registry hook.
+    ebpf_result_t result;
+    client_context = ebpf_extension_hook_get_next_attached_client(_ebpf_registry_hook_provider_context, NULL);
+    while (client_context != NULL) {
+        NTSTATUS status = 0;
+        if (ebpf_extension_hook_client_enter_rundown(client_context)) {
+            result = ebpf_extension_hook_invoke_program(
+                client_context, &registry_notify_context.registry_md, (uint32_t*)&status);
+            if (result != EBPF_SUCCESS) {
+                EBPF_EXT_LOG_MESSAGE(
+                    EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                    EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                    "ebpf_extension_hook_invoke_program failed");
+            }
+            ebpf_extension_hook_client_leave_rundown(client_context);
+        } else {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "ebpf_extension_hook_client_enter_rundown failed");
+        }
+        // If the client returns a failure status, fail the operation and stop calling the other clients.
+        if (!NT_SUCCESS(status)) {
+            verdict = status;
+            break;
+        }
+
+        client_context =
+            ebpf_extension_hook_get_next_attached_client(_ebpf_registry_hook_provider_context, client_context);
+    }
+
+    EBPF_EXT_LOG_EXIT();
+    return verdict;
+}
+
+_Success_(return >= 0) static int32_t _ebpf_registry_get_key_path(
+    _In_ registry_md_t* registry_md, _Out_writes_bytes_(path_length) uint8_t* path, uint32_t path_length)
+{
+    registry_notify_context_t* registry_notify_context =
+        CONTAINING_RECORD(registry_md, registry_notify_context_t, registry_md);
+    PCUNICODE_STRING relative_name = registry_notify_context->relative_name;
+    PCUNICODE_STRING object_name = NULL;
+    uint32_t total_length;
+    int32_t return_value;
+
+    if (registry_notify_context->key_object == NULL) {
+        return _copy_unicode_string_to_buffer(&registry_notify_context->key_path, path, path_length);
+    }
+
+    // A key being created or opened by absolute path needs no lookup.
+    if (relative_name != NULL && relative_name->Length >= sizeof(WCHAR) && relative_name->Buffer[0] == L'\\') {
+        return _copy_unicode_string_to_buffer(relative_name, path, path_length);
+    }
+
+    NTSTATUS status = CmCallbackGetKeyObjectIDEx(
+        &_ebpf_registry_callback_cookie, registry_notify_context->key_object, NULL, &object_name, 0);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_VERBOSE,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "CmCallbackGetKeyObjectIDEx failed",
+            status);
+        return -ENOENT;
+    }
+
+    // Append the relative name of a key being created or opened to the path of its root.
+    total_length = object_name->Length;
+    if (relative_name != NULL && relative_name->Length > 0) {
+        total_length += sizeof(WCHAR) + relative_name->Length;
+    }
+    if (total_length > path_length) {
+        return_value = -EINVAL;
+        goto Exit;
+    }
+
+    memcpy(path, object_name->Buffer, object_name->Length);
+    if (relative_name != NULL && relative_name->Length > 0) {
+        *(WCHAR*)(path + object_name->Length) = L'\\';
+        memcpy(path + object_name->Length + sizeof(WCHAR), relative_name->Buffer, relative_name->Length);
+    }
+    return_value = (int32_t)total_length;
+
+Exit:
+    CmCallbackReleaseKeyObjectIDEx(object_name);
+    return return_value;
+}
@@ -0,0 +1,447 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the periodic sample program type hook on eBPF for Windows.
+ */
+
+#include "ebpf_ntos_hooks.h"
+#include "ntos_ebpf_ext_program_info.h"
+#include "ntos_ebpf_ext_sample.h"
+#include "shared_context.h"
+
+// Number of 100ns units in a second.
+#define SAMPLE_TIMER_UNITS_PER_SECOND (10 * 1000 * 1000)
+
+static ebpf_result_t
+_ebpf_sample_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context);
+
+static void
+_ebpf_sample_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out);
+
+static EXT_CALLBACK _ebpf_sample_timer_callback;
+static KDEFERRED_ROUTINE _ebpf_sample_dpc_routine;
+
+//
+// Sample Program Information NPI Provider.
+//
+static ebpf_program_data_t _ebpf_sample_program_data = {
+    .header = EBPF_PROGRAM_DATA_HEADER,
+    .program_info = &_ebpf_sample_program_info,
+    .program_type_specific_helper_function_addresses = NULL,
+    .context_create = _ebpf_sample_context_create,
+    .context_destroy = _ebpf_sample_context_destroy,
+    .required_irql = DISPATCH_LEVEL,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_sample_program_info_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_program_info_provider_t* _ebpf_sample_program_info_provider_context = NULL;
+
+//
+// Sample Hook NPI Provider.
+//
+ebpf_attach_provider_data_t _ntos_ebpf_sample_hook_provider_data = {
+    .header = {EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION, EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION_SIZE},
+    .supported_program_type = EBPF_PROGRAM_TYPE_SAMPLE_GUID,
+    .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_SAMPLE,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_sample_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_hook_provider_t* _ebpf_sample_hook_provider_context = NULL;
+
+EX_PUSH_LOCK _ebpf_sample_hook_provider_lock;
+bool _ebpf_sample_hook_provider_registered = FALSE;
+uint64_t _ebpf_sample_hook_provider_registration_count = 0;
+
+// Sampling timer and the frequency it is set to. The timer fires the per-CPU DPCs.
+static PEX_TIMER _ebpf_sample_timer = NULL;
+static uint32_t _ebpf_sample_frequency_hz = 0;
+static uint32_t _ebpf_sample_cpu_count = 0;
+static KDPC* _ebpf_sample_dpcs = NULL;
+
+//
+// Client attach/detach handler routines.
+//
+
+// (Re)arm the sampling timer. The caller must hold the hook provider lock.
+static void
+_ebpf_sample_set_frequency(uint32_t frequency_hz)
+{
+    LONGLONG period = SAMPLE_TIMER_UNITS_PER_SECOND / frequency_hz;
+
+    // Setting an armed timer cancels the pending expiration first.
+    ExSetTimer(_ebpf_sample_timer, -period, period, NULL);
+    _ebpf_sample_frequency_hz = frequency_hz;
+}
+
+static ebpf_result_t
+_ntos_ebpf_extension_sample_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    bool push_lock_acquired = false;
+    uint32_t frequency_hz = SAMPLE_DEFAULT_FREQUENCY_HZ;
+    const ebpf_extension_data_t* client_data = ebpf_extension_hook_client_get_client_data(attaching_client);
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(provider_context);
+
+    // The attach parameter is optional.
+    if (client_data != NULL && client_data->data != NULL) {
+        if (client_data->data_size != sizeof(sample_attach_opts_t)) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "Invalid client data passed to attach.");
+            result = EBPF_INVALID_ARGUMENT;
+            goto Exit;
+        }
+        frequency_hz = ((const sample_attach_opts_t*)client_data->data)->frequency_hz;
+        if (frequency_hz == 0 || frequency_hz > SAMPLE_MAX_FREQUENCY_HZ) {
+            EBPF_EXT_LOG_MESSAGE_UINT32(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "Unsupported sampling frequency in attach opts.",
+                frequency_hz);
+            result = EBPF_INVALID_ARGUMENT;
+            goto Exit;
+        }
+    }
+
+    // Remember the frequency of this client, so it can be recomputed when clients detach.
+    ebpf_extension_hook_client_set_provider_data(
+        (ebpf_extension_hook_client_t*)attaching_client, (const void*)(ULONG_PTR)frequency_hz);
+
+    ExAcquirePushLockExclusive(&_ebpf_sample_hook_provider_lock);
+
+    push_lock_acquired = true;
+
+    if (!_ebpf_sample_hook_provider_registered) {
+        // Allocate the sampling timer.
+        _ebpf_sample_timer = ExAllocateTimer(_ebpf_sample_timer_callback, NULL, EX_TIMER_HIGH_RESOLUTION);
+        if (_ebpf_sample_timer == NULL) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "ExAllocateTimer failed");
+            result = EBPF_NO_MEMORY;
+            goto Exit;
+        }
+        _ebpf_sample_hook_provider_registered = TRUE;
+    }
+
+    // The timer runs at the highest frequency requested by any client.
+    if (frequency_hz > _ebpf_sample_frequency_hz) {
+        _ebpf_sample_set_frequency(frequency_hz);
+    }
+
+    _ebpf_sample_hook_provider_registration_count++;
+
+Exit:
+    if (push_lock_acquired) {
+        ExReleasePushLockExclusive(&_ebpf_sample_hook_provider_lock);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ntos_ebpf_extension_sample_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    ExAcquirePushLockExclusive(&_ebpf_sample_hook_provider_lock);
+
+    _ebpf_sample_hook_provider_registration_count--;
+
+    if (_ebpf_sample_hook_provider_registered && _ebpf_sample_hook_provider_registration_count == 0) {
+        // Stop the timer, then wait for the DPCs it may have queued.
+        ExDeleteTimer(_ebpf_sample_timer, TRUE, TRUE, NULL);
+        KeFlushQueuedDpcs();
+        _ebpf_sample_timer = NULL;
+        _ebpf_sample_frequency_hz = 0;
+        _ebpf_sample_hook_provider_registered = FALSE;
+    } else if (_ebpf_sample_hook_provider_registered) {
+        // Slow the timer down if the detaching client was the one asking for the highest frequency.
+        uint32_t frequency_hz = 0;
+        ebpf_extension_hook_client_t* client_context =
+            ebpf_extension_hook_get_next_attached_client(_ebpf_sample_hook_provider_context, NULL);
+        while (client_context != NULL) {
+            if (client_context != detaching_client) {
+                uint32_t client_frequency_hz =
+                    (uint32_t)(ULONG_PTR)ebpf_extension_hook_client_get_provider_data(client_context);
+                frequency_hz = max(frequency_hz, client_frequency_hz);
+            }
+            client_context =
+                ebpf_extension_hook_get_next_attached_client(_ebpf_sample_hook_provider_context, client_context);
+        }
+        if (frequency_hz != 0 && frequency_hz < _ebpf_sample_frequency_hz) {
+            _ebpf_sample_set_frequency(frequency_hz);
+        }
+    }
+
+    ExReleasePushLockExclusive(&_ebpf_sample_hook_provider_lock);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+uint32_t
+ntos_ebpf_ext_sample_get_frequency()
+{
+    uint32_t frequency_hz;
+
+    ExAcquirePushLockExclusive(&_ebpf_sample_hook_provider_lock);
+    frequency_hz = _ebpf_sample_frequency_hz;
+    ExReleasePushLockExclusive(&_ebpf_sample_hook_provider_lock);
+
+    return frequency_hz;
+}
+
+//
+// NMR Registration Helper Routines.
+//
+
+void
+ntos_ebpf_ext_sample_unregister_providers()
+{
+    if (_ebpf_sample_hook_provider_context) {
+        ebpf_extension_hook_provider_unregister(_ebpf_sample_hook_provider_context);
+        _ebpf_sample_hook_provider_context = NULL;
+    }
+    if (_ebpf_sample_program_info_provider_context) {
+        ebpf_extension_program_info_provider_unregister(_ebpf_sample_program_info_provider_context);
+        _ebpf_sample_program_info_provider_context = NULL;
+    }
+    if (_ebpf_sample_dpcs != NULL) {
+        ExFreePool(_ebpf_sample_dpcs);
+        _ebpf_sample_dpcs = NULL;
+    }
+}
+
+NTSTATUS
+ntos_ebpf_ext_sample_register_providers()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
+        &_ebpf_sample_program_info_provider_moduleid, &_ebpf_sample_program_data};
+    const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
+        &_ebpf_sample_hook_provider_moduleid,
+        &_ntos_ebpf_sample_hook_provider_data,
+        EBPF_EXTENSION_HOOK_MAX_CLIENTS};
+
+    // Set up one DPC per CPU, each targeted at its own CPU.
+    _ebpf_sample_cpu_count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    _ebpf_sample_dpcs = (KDPC*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(KDPC) * _ebpf_sample_cpu_count, EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, _ebpf_sample_dpcs, "_ebpf_sample_dpcs", status);
+
+    for (uint32_t index = 0; index < _ebpf_sample_cpu_count; index++) {
+        PROCESSOR_NUMBER processor_number;
+        status = KeGetProcessorNumberFromIndex(index, &processor_number);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "KeGetProcessorNumberFromIndex failed",
+                status);
+            goto Exit;
+        }
+        KeInitializeDpc(&_ebpf_sample_dpcs[index], _ebpf_sample_dpc_routine, NULL);
+        status = KeSetTargetProcessorDpcEx(&_ebpf_sample_dpcs[index], &processor_number);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "KeSetTargetProcessorDpcEx failed",
+                status);
+            goto Exit;
+        }
+    }
+
+    // Set the program type as the provider module id.
+    _ebpf_sample_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_SAMPLE;
+    _ebpf_sample_hook_provider_moduleid.Guid = EBPF_ATTACH_TYPE_SAMPLE;
+    status = ebpf_extension_program_info_provider_register(
+        &program_info_provider_parameters, &_ebpf_sample_program_info_provider_context);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_program_info_provider_register",
+            status);
+        goto Exit;
+    }
+
+    status = ebpf_extension_hook_provider_register(
+        &hook_provider_parameters,
+        _ntos_ebpf_extension_sample_on_client_attach,
+        _ntos_ebpf_extension_sample_on_client_detach,
+        NULL,
+        &_ebpf_sample_hook_provider_context);
+    if (status != EBPF_SUCCESS) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_hook_provider_register",
+            status);
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        ntos_ebpf_ext_sample_unregister_providers();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+typedef struct _sample_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    sample_md_t sample_md;
+} sample_notify_context_t;
+
+static ebpf_result_t
+_ebpf_sample_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context)
+{
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_result_t result;
+    sample_notify_context_t* sample_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_in);
+    UNREFERENCED_PARAMETER(data_size_in);
+
+    *context = NULL;
+
+    if (context_in == NULL || context_size_in < sizeof(sample_notify_context_t)) {
+        EBPF_EXT_LOG_MESSAGE(EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Context is required");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    sample_context = (sample_notify_context_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(sample_notify_context_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, sample_context, "sample_context", result);
+
+    // Copy the context from the caller.
+    memcpy(sample_context, context_in, sizeof(sample_notify_context_t));
+
+    *context = &sample_context->sample_md;
+    result = EBPF_SUCCESS;
+
+Exit:
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ebpf_sample_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    sample_md_t* sample_md = (sample_md_t*)context;
+    sample_notify_context_t* sample_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_out);
+
+    if (!sample_md) {
+        goto Exit;
+    }
+
+    sample_context = CONTAINING_RECORD(sample_md, sample_notify_context_t, sample_md);
+
+    if (context_out != NULL && *context_size_out >= sizeof(sample_notify_context_t)) {
+        // Copy the context to the caller.
+        memcpy(context_out, sample_context, sizeof(sample_notify_context_t));
+        *context_size_out = sizeof(sample_notify_context_t);
+    } else {
+        *context_size_out = 0;
+    }
+
+    // This program type has no variable-length data.
+    *data_size_out = 0;
+
+    ExFreePool(sample_context);
+
+Exit:
+    EBPF_EXT_LOG_EXIT();
+}
+
+static void
+_ebpf_sample_timer_callback(_In_ PEX_TIMER timer, _In_opt_ PVOID context)
+{
+    UNREFERENCED_PARAMETER(timer);
+    UNREFERENCED_PARAMETER(context);
+
+    // Sample every CPU. A DPC that is still queued from the previous period is not queued again.
+    for (uint32_t index = 0; index < _ebpf_sample_cpu_count; index++) {
+        KeInsertQueueDpc(&_ebpf_sample_dpcs[index], NULL, NULL);
+    }
+}
+
+static void
+_ebpf_sample_dpc_routine(
+    _In_ PKDPC dpc, _In_opt_ PVOID deferred_context, _In_opt_ PVOID system_argument1, _In_opt_ PVOID system_argument2)
+{
+    ebpf_extension_hook_client_snapshot_t* snapshot;
+
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(deferred_context);
+    UNREFERENCED_PARAMETER(system_argument1);
+    UNREFERENCED_PARAMETER(system_argument2);
+
+    snapshot = ebpf_extension_hook_acquire_client_snapshot(_ebpf_sample_hook_provider_context);
+    if (snapshot == NULL) {
+        return;
+    }
+
+    // The DPC runs in the context of whatever thread was interrupted on this CPU, which is what is being sampled.
+    sample_notify_context_t sample_notify_context = {.sample_md = {0}};
+    sample_notify_context.sample_md.timestamp = KeQueryInterruptTime();
+    sample_notify_context.sample_md.process_id = (uint64_t)PsGetCurrentProcessId();
+    sample_notify_context.sample_md.thread_id = (uint64_t)PsGetCurrentThreadId();
+    sample_notify_context.sample_md.cpu_number = KeGetCurrentProcessorNumberEx(NULL);
+
+    // For each attached client call the sample hook.
+    uint32_t client_count = ebpf_extension_hook_client_snapshot_get_count(snapshot);
+    for (uint32_t index = 0; index < client_count; index++) {
+        ebpf_extension_hook_client_t* client_context = ebpf_extension_hook_client_snapshot_get_client(snapshot, index);
+        uint32_t return_value = 0;
+        ebpf_result_t result =
+            ebpf_extension_hook_invoke_program(client_context, &sample_notify_context.sample_md, &return_value);
+        if (result != EBPF_SUCCESS) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "ebpf_extension_hook_invoke_program failed");
+        }
+    }
+
+    ebpf_extension_hook_release_client_snapshot(snapshot);
+}
@@ -0,0 +1,31 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_ext.h"
+
+/**
+ * @brief Unregister SAMPLE NPI providers.
+ *
+ */
+void
+ntos_ebpf_ext_sample_unregister_providers();
+
+/**
+ * @brief Register SAMPLE NPI providers.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_UNSUCCESSFUL Operation failed.
+ */
+NTSTATUS
+ntos_ebpf_ext_sample_register_providers();
+
+/**
+ * @brief Get the frequency the sampling timer runs at, which is the highest frequency requested by the attached
+ * clients.
+ *
+ * @returns Number of samples per second taken on each CPU, or 0 if no client is attached.
+ */
+uint32_t
+ntos_ebpf_ext_sample_get_frequency();
@@ -0,0 +1,456 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief This file implements the thread program type hook on eBPF for Windows.
+ */
+
+#include "ebpf_ntos_hooks.h"
+#include "ntos_ebpf_ext_process.h"
+#include "ntos_ebpf_ext_program_info.h"
+#include "ntos_ebpf_ext_thread.h"
+#include "shared_context.h"
+
+static ebpf_result_t
+_ebpf_thread_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context);
+
+static void
+_ebpf_thread_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out);
+
+void
+_ebpf_thread_create_thread_notify_routine(_In_ HANDLE process_id, _In_ HANDLE thread_id, BOOLEAN create);
+
+//
+// Thread Program Information NPI Provider.
+//
+static ebpf_program_data_t _ebpf_thread_program_data = {
+    .header = EBPF_PROGRAM_DATA_HEADER,
+    .program_info = &_ebpf_thread_program_info,
+    .program_type_specific_helper_function_addresses = NULL,
+    .context_create = _ebpf_thread_context_create,
+    .context_destroy = _ebpf_thread_context_destroy,
+    .required_irql = PASSIVE_LEVEL,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_thread_program_info_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_program_info_provider_t* _ebpf_thread_program_info_provider_context = NULL;
+
+//
+// Thread Hook NPI Provider.
+//
+ebpf_attach_provider_data_t _ntos_ebpf_thread_hook_provider_data = {
+    .header = {EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION, EBPF_ATTACH_PROVIDER_DATA_CURRENT_VERSION_SIZE},
+    .supported_program_type = EBPF_PROGRAM_TYPE_THREAD_GUID,
+    .bpf_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_THREAD,
+};
+
+NPI_MODULEID DECLSPEC_SELECTANY _ebpf_thread_hook_provider_moduleid = {sizeof(NPI_MODULEID), MIT_GUID, {0}};
+
+static ebpf_extension_hook_provider_t* _ebpf_thread_hook_provider_context = NULL;
+
+EX_PUSH_LOCK _ebpf_thread_hook_provider_lock;
+bool _ebpf_thread_hook_provider_registered = FALSE;
+uint64_t _ebpf_thread_hook_provider_registration_count = 0;
+
+// Processes created since the thread hook was attached whose initial thread has not been created yet. The process
+// create notification is delivered just before the thread create notification of the initial thread, which is created
+// by the parent process. If more processes are pending, the oldest one is forgotten and its initial thread is reported
+// as a remote thread.
+#define NTOS_THREAD_PENDING_PROCESS_COUNT 64
+
+static KSPIN_LOCK _ebpf_thread_pending_process_lock;
+static HANDLE _ebpf_thread_pending_processes[NTOS_THREAD_PENDING_PROCESS_COUNT];
+static uint32_t _ebpf_thread_pending_process_next = 0; ///< Slot replaced when no slot is free.
+
+//
+// Client attach/detach handler routines.
+//
+
+static ebpf_result_t
+_ntos_ebpf_extension_thread_on_client_attach(
+    _In_ const ebpf_extension_hook_client_t* attaching_client,
+    _In_ const ebpf_extension_hook_provider_t* provider_context)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    bool push_lock_acquired = false;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(attaching_client);
+    UNREFERENCED_PARAMETER(provider_context);
+
+    ExAcquirePushLockExclusive(&_ebpf_thread_hook_provider_lock);
+
+    push_lock_acquired = true;
+
+    if (!_ebpf_thread_hook_provider_registered) {
+        // The process create notify routine tracks the processes whose initial thread is pending, so it is registered
+        // first. Processes left pending by an earlier registration may have exited unnoticed since.
+        KIRQL old_irql;
+        KeAcquireSpinLock(&_ebpf_thread_pending_process_lock, &old_irql);
+        memset(_ebpf_thread_pending_processes, 0, sizeof(_ebpf_thread_pending_processes));
+        KeReleaseSpinLock(&_ebpf_thread_pending_process_lock, old_irql);
+        NTSTATUS status = ntos_ebpf_ext_process_reference_notify_routine();
+        if (!NT_SUCCESS(status)) {
+            result = EBPF_OPERATION_NOT_SUPPORTED;
+            goto Exit;
+        }
+
+        // Register the thread create notify routine.
+        status = PsSetCreateThreadNotifyRoutine(_ebpf_thread_create_thread_notify_routine);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "PsSetCreateThreadNotifyRoutine failed",
+                status);
+            ntos_ebpf_ext_process_dereference_notify_routine();
+            result = EBPF_OPERATION_NOT_SUPPORTED;
+            goto Exit;
+        }
+        _ebpf_thread_hook_provider_registered = TRUE;
+    }
+
+    _ebpf_thread_hook_provider_registration_count++;
+
+Exit:
+    if (push_lock_acquired) {
+        ExReleasePushLockExclusive(&_ebpf_thread_hook_provider_lock);
+    }
+
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ntos_ebpf_extension_thread_on_client_detach(_In_ const ebpf_extension_hook_client_t* detaching_client)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    UNREFERENCED_PARAMETER(detaching_client);
+
+    // Unregister the thread create notify routine.
+    ExAcquirePushLockExclusive(&_ebpf_thread_hook_provider_lock);
+
+    _ebpf_thread_hook_provider_registration_count--;
+
+    if (_ebpf_thread_hook_provider_registered && _ebpf_thread_hook_provider_registration_count == 0) {
+        NTSTATUS status = PsRemoveCreateThreadNotifyRoutine(_ebpf_thread_create_thread_notify_routine);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "PsRemoveCreateThreadNotifyRoutine failed",
+                status);
+        }
+        ntos_ebpf_ext_process_dereference_notify_routine();
+        _ebpf_thread_hook_provider_registered = FALSE;
+    }
+
+    ExReleasePushLockExclusive(&_ebpf_thread_hook_provider_lock);
+
+    EBPF_EXT_LOG_EXIT();
+}
+
+//
+// NMR Registration Helper Routines.
+//
+
+void
+ntos_ebpf_ext_thread_unregister_providers()
+{
+    if (_ebpf_thread_hook_provider_context) {
+        ebpf_extension_hook_provider_unregister(_ebpf_thread_hook_provider_context);
+        _ebpf_thread_hook_provider_context = NULL;
+    }
+    if (_ebpf_thread_program_info_provider_context) {
+        ebpf_extension_program_info_provider_unregister(_ebpf_thread_program_info_provider_context);
+        _ebpf_thread_program_info_provider_context = NULL;
+    }
+}
+
+NTSTATUS
+ntos_ebpf_ext_thread_register_providers()
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    const ebpf_extension_program_info_provider_parameters_t program_info_provider_parameters = {
+        &_ebpf_thread_program_info_provider_moduleid, &_ebpf_thread_program_data};
+    const ebpf_extension_hook_provider_parameters_t hook_provider_parameters = {
+        &_ebpf_thread_hook_provider_moduleid, &_ntos_ebpf_thread_hook_provider_data};
+
+    KeInitializeSpinLock(&_ebpf_thread_pending_process_lock);
+
+    // Set the program type as the provider module id.
+    _ebpf_thread_program_info_provider_moduleid.Guid = EBPF_PROGRAM_TYPE_THREAD;
+    _ebpf_thread_hook_provider_moduleid.Guid = EBPF_ATTACH_TYPE_THREAD;
+    status = ebpf_extension_program_info_provider_register(
+        &program_info_provider_parameters, &_ebpf_thread_program_info_provider_context);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_program_info_provider_register",
+            status);
+        goto Exit;
+    }
+
+    status = ebpf_extension_hook_provider_register(
+        &hook_provider_parameters,
+        _ntos_ebpf_extension_thread_on_client_attach,
+        _ntos_ebpf_extension_thread_on_client_detach,
+        NULL,
+        &_ebpf_thread_hook_provider_context);
+    if (status != EBPF_SUCCESS) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "ebpf_extension_hook_provider_register",
+            status);
+        goto Exit;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        ntos_ebpf_ext_thread_unregister_providers();
+    }
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+typedef struct _thread_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    thread_md_t thread_md;
+} thread_notify_context_t;
+
+static ebpf_result_t
+_ebpf_thread_context_create(
+    _In_reads_bytes_opt_(data_size_in) const uint8_t* data_in,
+    size_t data_size_in,
+    _In_reads_bytes_opt_(context_size_in) const uint8_t* context_in,
+    size_t context_size_in,
+    _Outptr_ void** context)
+{
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_result_t result;
+    thread_notify_context_t* thread_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_in);
+    UNREFERENCED_PARAMETER(data_size_in);
+
+    *context = NULL;
+
+    if (context_in == NULL || context_size_in < sizeof(thread_notify_context_t)) {
+        EBPF_EXT_LOG_MESSAGE(EBPF_EXT_TRACELOG_LEVEL_ERROR, EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "Context is required");
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    thread_context = (thread_notify_context_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(thread_notify_context_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_RESULT(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, thread_context, "thread_context", result);
+
+    // Copy the context from the caller.
+    memcpy(thread_context, context_in, sizeof(thread_notify_context_t));
+
+    *context = &thread_context->thread_md;
+    result = EBPF_SUCCESS;
+
+Exit:
+    EBPF_EXT_RETURN_RESULT(result);
+}
+
+static void
+_ebpf_thread_context_destroy(
+    _In_opt_ void* context,
+    _Out_writes_bytes_to_(*data_size_out, *data_size_out) uint8_t* data_out,
+    _Inout_ size_t* data_size_out,
+    _Out_writes_bytes_to_(*context_size_out, *context_size_out) uint8_t* context_out,
+    _Inout_ size_t* context_size_out)
+{
+    EBPF_EXT_LOG_ENTRY();
+
+    thread_md_t* thread_md = (thread_md_t*)context;
+    thread_notify_context_t* thread_context = NULL;
+
+    UNREFERENCED_PARAMETER(data_out);
+
+    if (!thread_md) {
+        goto Exit;
+    }
+
+    thread_context = CONTAINING_RECORD(thread_md, thread_notify_context_t, thread_md);
+
+    if (context_out != NULL && *context_size_out >= sizeof(thread_notify_context_t)) {
+        // Copy the context to the caller.
+        memcpy(context_out, thread_context, sizeof(thread_notify_context_t));
+        *context_size_out = sizeof(thread_notify_context_t);
+    } else {
+        *context_size_out = 0;
+    }
+
+    // This program type has no variable-length data.
+    *data_size_out = 0;
+
+    ExFreePool(thread_context);
+
+Exit:
+    EBPF_EXT_LOG_EXIT();
+}
+
+// Query the Win32 start address of a newly created thread.
+static uint64_t
+_ebpf_thread_query_start_address(_In_ HANDLE thread_id)
+{
+    PETHREAD thread = NULL;
+    HANDLE thread_handle = NULL;
+    PVOID start_address = NULL;
+
+    NTSTATUS status = PsLookupThreadByThreadId(thread_id, &thread);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ObOpenObjectByPointer(
+        thread, OBJ_KERNEL_HANDLE, NULL, THREAD_QUERY_LIMITED_INFORMATION, *PsThreadType, KernelMode, &thread_handle);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    status = ZwQueryInformationThread(
+        thread_handle, ThreadQuerySetWin32StartAddress, &start_address, sizeof(start_address), NULL);
+    if (!NT_SUCCESS(status)) {
+        start_address = NULL;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_MESSAGE_NTSTATUS(
+            EBPF_EXT_TRACELOG_LEVEL_VERBOSE,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "Failed to query thread start address",
+            status);
+    }
+    if (thread_handle != NULL) {
+        ZwClose(thread_handle);
+    }
+    if (thread != NULL) {
+        ObDereferenceObject(thread);
+    }
+    return (uint64_t)start_address;
+}
+
+void
+ntos_ebpf_ext_thread_on_process_notify(_In_ HANDLE process_id, bool created)
+{
+    KIRQL old_irql;
+    uint32_t free_slot = NTOS_THREAD_PENDING_PROCESS_COUNT;
+
+    KeAcquireSpinLock(&_ebpf_thread_pending_process_lock, &old_irql);
+    for (uint32_t index = 0; index < NTOS_THREAD_PENDING_PROCESS_COUNT; index++) {
+        if (_ebpf_thread_pending_processes[index] == process_id) {
+            // Process IDs are reused, a pending entry left by an exited process is stale.
+            _ebpf_thread_pending_processes[index] = NULL;
+        }
+        if (_ebpf_thread_pending_processes[index] == NULL && free_slot == NTOS_THREAD_PENDING_PROCESS_COUNT) {
+            free_slot = index;
+        }
+    }
+    if (created) {
+        if (free_slot == NTOS_THREAD_PENDING_PROCESS_COUNT) {
+            free_slot = _ebpf_thread_pending_process_next;
+            _ebpf_thread_pending_process_next = (free_slot + 1) % NTOS_THREAD_PENDING_PROCESS_COUNT;
+        }
+        _ebpf_thread_pending_processes[free_slot] = process_id;
+    }
+    KeReleaseSpinLock(&_ebpf_thread_pending_process_lock, old_irql);
+}
+
+// Returns TRUE if the thread is the initial thread of a process created since the hook was attached, and stops
+// tracking that process.
+static bool
+_ebpf_thread_take_pending_process(_In_ HANDLE process_id)
+{
+    KIRQL old_irql;
+    bool pending = FALSE;
+
+    KeAcquireSpinLock(&_ebpf_thread_pending_process_lock, &old_irql);
+    for (uint32_t index = 0; index < NTOS_THREAD_PENDING_PROCESS_COUNT; index++) {
+        if (_ebpf_thread_pending_processes[index] == process_id) {
+            _ebpf_thread_pending_processes[index] = NULL;
+            pending = TRUE;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&_ebpf_thread_pending_process_lock, old_irql);
+
+    return pending;
+}
+
+void
+_ebpf_thread_create_thread_notify_routine(_In_ HANDLE process_id, _In_ HANDLE thread_id, BOOLEAN create)
+{
+    thread_notify_context_t thread_notify_context = {.thread_md = {0}};
+
+    EBPF_EXT_LOG_ENTRY();
+    ebpf_extension_hook_client_t* client_context;
+
+    thread_notify_context.thread_md.thread_id = (uint64_t)thread_id;
+    thread_notify_context.thread_md.process_id = (uint64_t)process_id;
+
+    if (create) {
+        // The create notification runs in the context of the thread that is creating the new thread.
+        thread_notify_context.thread_md.operation = THREAD_OPERATION_CREATE;
+        thread_notify_context.thread_md.creating_process_id = (uint64_t)PsGetCurrentProcessId();
+        thread_notify_context.thread_md.creating_thread_id = (uint64_t)PsGetCurrentThreadId();
+        // The initial thread of a process is created by its parent, which does not make it a remote thread.
+        thread_notify_context.thread_md.is_remote_thread =
+            (thread_notify_context.thread_md.creating_process_id != thread_notify_context.thread_md.process_id) &&
+            !_ebpf_thread_take_pending_process(process_id);
+        thread_notify_context.thread_md.start_address = _ebpf_thread_query_start_address(thread_id);
+    } else {
+        thread_notify_context.thread_md.operation = THREAD_OPERATION_DELETE;
+    }
+
+    // For each attached client call the thread hook.
+    ebpf_result_t result;
+    client_context = ebpf_extension_hook_get_next_attached_client(_ebpf_thread_hook_provider_context, NULL);
+    while (client_context != NULL) {
+        uint32_t return_value = 0;
+        if (ebpf_extension_hook_client_enter_rundown(client_context)) {
+            result =
+                ebpf_extension_hook_invoke_program(client_context, &thread_notify_context.thread_md, &return_value);
+            if (result != EBPF_SUCCESS) {
+                EBPF_EXT_LOG_MESSAGE(
+                    EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                    EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                    "ebpf_extension_hook_invoke_program failed");
+            }
+            ebpf_extension_hook_client_leave_rundown(client_context);
+        } else {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "ebpf_extension_hook_client_enter_rundown failed");
+        }
+
+        client_context =
+            ebpf_extension_hook_get_next_attached_client(_ebpf_thread_hook_provider_context, client_context);
+    }
+
+    EBPF_EXT_LOG_EXIT();
+}
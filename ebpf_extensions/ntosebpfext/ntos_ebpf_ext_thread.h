@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_ext.h"
+
+/**
+ * @brief Unregister THREAD NPI providers.
+ *
+ */
+void
+ntos_ebpf_ext_thread_unregister_providers();
+
+/**
+ * @brief Register THREAD NPI providers.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_UNSUCCESSFUL Operation failed.
+ */
+NTSTATUS
+ntos_ebpf_ext_thread_register_providers();
+
+/**
+ * @brief Track the processes whose initial thread has not been created yet, so that it is not reported as a remote
+ * thread. Called by the process create notify routine.
+ *
+ * @param[in] process_id ID of the process.
+ * @param[in] created TRUE when the process was created, FALSE when it exited or its creation was denied.
+ */
+void
+ntos_ebpf_ext_thread_on_process_notify(_In_ HANDLE process_id, bool created);
@@ -0,0 +1,299 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ * @brief User mode implementation of the kernel routines used by the ntos hooks that usersim does not provide.
+ */
+
+#include "framework.h"
+
+#include <mutex>
+#include <vector>
+
+// Distinct object types, only compared by address.
+static char _usersim_ntos_process_type;
+static char _usersim_ntos_thread_type;
+static POBJECT_TYPE _usersim_ntos_process_object_type = (POBJECT_TYPE)&_usersim_ntos_process_type;
+static POBJECT_TYPE _usersim_ntos_thread_object_type = (POBJECT_TYPE)&_usersim_ntos_thread_type;
+POBJECT_TYPE* PsProcessType = &_usersim_ntos_process_object_type;
+POBJECT_TYPE* PsThreadType = &_usersim_ntos_thread_object_type;
+
+// Each hook registers a single notify routine or callback.
+static std::mutex _usersim_ntos_lock;
+static PCREATE_THREAD_NOTIFY_ROUTINE _usersim_ntos_thread_notify_routine = nullptr;
+static PLOAD_IMAGE_NOTIFY_ROUTINE _usersim_ntos_load_image_notify_routine = nullptr;
+static PEX_CALLBACK_FUNCTION _usersim_ntos_registry_callback = nullptr;
+static PVOID _usersim_ntos_registry_callback_context = nullptr;
+static std::vector<OB_OPERATION_REGISTRATION> _usersim_ntos_object_operations;
+static PVOID _usersim_ntos_object_registration_context = nullptr;
+
+HANDLE
+PsGetProcessId(_In_ PEPROCESS process) { return ((usersim_ntos_object_t*)process)->process_id; }
+
+HANDLE
+PsGetThreadId(_In_ PETHREAD thread) { return ((usersim_ntos_object_t*)thread)->thread_id; }
+
+HANDLE
+PsGetThreadProcessId(_In_ PETHREAD thread) { return ((usersim_ntos_object_t*)thread)->process_id; }
+
+//
+// Thread notifications.
+//
+
+NTSTATUS
+PsSetCreateThreadNotifyRoutine(_In_ PCREATE_THREAD_NOTIFY_ROUTINE notify_routine)
+{
+    std::unique_lock lock(_usersim_ntos_lock);
+    if (_usersim_ntos_thread_notify_routine != nullptr) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    _usersim_ntos_thread_notify_routine = notify_routine;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsRemoveCreateThreadNotifyRoutine(_In_ PCREATE_THREAD_NOTIFY_ROUTINE notify_routine)
+{
+    std::unique_lock lock(_usersim_ntos_lock);
+    if (_usersim_ntos_thread_notify_routine != notify_routine) {
+        return STATUS_PROCEDURE_NOT_FOUND;
+    }
+    _usersim_ntos_thread_notify_routine = nullptr;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsLookupThreadByThreadId(_In_ HANDLE thread_id, _Outptr_ PETHREAD* thread)
+{
+    UNREFERENCED_PARAMETER(thread_id);
+    *thread = nullptr;
+    return STATUS_INVALID_CID;
+}
+
+NTSTATUS
+ObOpenObjectByPointer(
+    _In_ PVOID object,
+    _In_ ULONG handle_attributes,
+    _In_opt_ PVOID passed_access_state,
+    _In_ ACCESS_MASK desired_access,
+    _In_opt_ POBJECT_TYPE object_type,
+    _In_ KPROCESSOR_MODE access_mode,
+    _Out_ PHANDLE handle)
+{
+    UNREFERENCED_PARAMETER(object);
+    UNREFERENCED_PARAMETER(handle_attributes);
+    UNREFERENCED_PARAMETER(passed_access_state);
+    UNREFERENCED_PARAMETER(desired_access);
+    UNREFERENCED_PARAMETER(object_type);
+    UNREFERENCED_PARAMETER(access_mode);
+    *handle = nullptr;
+    return STATUS_NOT_SUPPORTED;
+}
+
+NTSTATUS
+ZwQueryInformationThread(
+    _In_ HANDLE thread_handle,
+    _In_ ULONG thread_information_class,
+    _Out_writes_bytes_(thread_information_length) PVOID thread_information,
+    _In_ ULONG thread_information_length,
+    _Out_opt_ PULONG return_length)
+{
+    UNREFERENCED_PARAMETER(thread_handle);
+    UNREFERENCED_PARAMETER(thread_information_class);
+    memset(thread_information, 0, thread_information_length);
+    if (return_length != nullptr) {
+        *return_length = 0;
+    }
+    return STATUS_NOT_SUPPORTED;
+}
+
+void
+usersim_ntos_invoke_thread_notify_routine(_In_ HANDLE process_id, _In_ HANDLE thread_id, BOOLEAN create)
+{
+    PCREATE_THREAD_NOTIFY_ROUTINE notify_routine;
+    {
+        std::unique_lock lock(_usersim_ntos_lock);
+        notify_routine = _usersim_ntos_thread_notify_routine;
+    }
+    if (notify_routine != nullptr) {
+        notify_routine(process_id, thread_id, create);
+    }
+}
+
+//
+// Image load notifications.
+//
+
+NTSTATUS
+PsSetLoadImageNotifyRoutineEx(_In_ PLOAD_IMAGE_NOTIFY_ROUTINE notify_routine, _In_ ULONG_PTR flags)
+{
+    UNREFERENCED_PARAMETER(flags);
+    std::unique_lock lock(_usersim_ntos_lock);
+    if (_usersim_ntos_load_image_notify_routine != nullptr) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    _usersim_ntos_load_image_notify_routine = notify_routine;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+PsRemoveLoadImageNotifyRoutine(_In_ PLOAD_IMAGE_NOTIFY_ROUTINE notify_routine)
+{
+    std::unique_lock lock(_usersim_ntos_lock);
+    if (_usersim_ntos_load_image_notify_routine != notify_routine) {
+        return STATUS_PROCEDURE_NOT_FOUND;
+    }
+    _usersim_ntos_load_image_notify_routine = nullptr;
+    return STATUS_SUCCESS;
+}
+
+void
+usersim_ntos_invoke_load_image_notify_routine(
+    _In_opt_ PUNICODE_STRING full_image_name, _In_ HANDLE process_id, _In_ PIMAGE_INFO image_info)
+{
+    PLOAD_IMAGE_NOTIFY_ROUTINE notify_routine;
+    {
+        std::unique_lock lock(_usersim_ntos_lock);
+        notify_routine = _usersim_ntos_load_image_notify_routine;
+    }
+    if (notify_routine != nullptr) {
+        notify_routine(full_image_name, process_id, image_info);
+    }
+}
+
+//
+// Registry callbacks.
+//
+
+NTSTATUS
+CmRegisterCallbackEx(
+    _In_ PEX_CALLBACK_FUNCTION function,
+    _In_ PCUNICODE_STRING altitude,
+    _In_ PVOID driver,
+    _In_opt_ PVOID context,
+    _Out_ PLARGE_INTEGER cookie,
+    _Reserved_ PVOID reserved)
+{
+    UNREFERENCED_PARAMETER(altitude);
+    UNREFERENCED_PARAMETER(driver);
+    UNREFERENCED_PARAMETER(reserved);
+    std::unique_lock lock(_usersim_ntos_lock);
+    cookie->QuadPart = 0;
+    if (_usersim_ntos_registry_callback != nullptr) {
+        return STATUS_FLT_INSTANCE_ALTITUDE_COLLISION;
+    }
+    _usersim_ntos_registry_callback = function;
+    _usersim_ntos_registry_callback_context = context;
+    cookie->QuadPart = 1;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CmUnRegisterCallback(_In_ LARGE_INTEGER cookie)
+{
+    std::unique_lock lock(_usersim_ntos_lock);
+    if (cookie.QuadPart != 1 || _usersim_ntos_registry_callback == nullptr) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    _usersim_ntos_registry_callback = nullptr;
+    _usersim_ntos_registry_callback_context = nullptr;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CmCallbackGetKeyObjectIDEx(
+    _In_ PLARGE_INTEGER cookie,
+    _In_ PVOID object,
+    _Out_opt_ PULONG_PTR object_id,
+    _Outptr_opt_ PCUNICODE_STRING* object_name,
+    _In_ ULONG flags)
+{
+    UNREFERENCED_PARAMETER(cookie);
+    UNREFERENCED_PARAMETER(object);
+    UNREFERENCED_PARAMETER(flags);
+    if (object_id != nullptr) {
+        *object_id = 0;
+    }
+    if (object_name != nullptr) {
+        *object_name = nullptr;
+    }
+    return STATUS_NOT_SUPPORTED;
+}
+
+void
+CmCallbackReleaseKeyObjectIDEx(_In_opt_ PCUNICODE_STRING object_name)
+{
+    UNREFERENCED_PARAMETER(object_name);
+}
+
+NTSTATUS
+usersim_ntos_invoke_registry_callback(REG_NOTIFY_CLASS notify_class, _In_opt_ PVOID argument2)
+{
+    PEX_CALLBACK_FUNCTION callback;
+    PVOID context;
+    {
+        std::unique_lock lock(_usersim_ntos_lock);
+        callback = _usersim_ntos_registry_callback;
+        context = _usersim_ntos_registry_callback_context;
+    }
+    if (callback == nullptr) {
+        return STATUS_SUCCESS;
+    }
+    return callback(context, (PVOID)(ULONG_PTR)notify_class, argument2);
+}
+
+//
+// Object callbacks.
+//
+
+NTSTATUS
+ObRegisterCallbacks(_In_ POB_CALLBACK_REGISTRATION callback_registration, _Outptr_ PVOID* registration_handle)
+{
+    std::unique_lock lock(_usersim_ntos_lock);
+    *registration_handle = nullptr;
+    if (callback_registration->Version != OB_FLT_REGISTRATION_VERSION ||
+        callback_registration->OperationRegistrationCount == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (!_usersim_ntos_object_operations.empty()) {
+        return STATUS_FLT_INSTANCE_ALTITUDE_COLLISION;
+    }
+    _usersim_ntos_object_operations.assign(
+        callback_registration->OperationRegistration,
+        callback_registration->OperationRegistration + callback_registration->OperationRegistrationCount);
+    _usersim_ntos_object_registration_context = callback_registration->RegistrationContext;
+    *registration_handle = &_usersim_ntos_object_operations;
+    return STATUS_SUCCESS;
+}
+
+void
+ObUnRegisterCallbacks(_In_ PVOID registration_handle)
+{
+    std::unique_lock lock(_usersim_ntos_lock);
+    if (registration_handle == &_usersim_ntos_object_operations) {
+        _usersim_ntos_object_operations.clear();
+        _usersim_ntos_object_registration_context = nullptr;
+    }
+}
+
+void
+usersim_ntos_invoke_object_pre_operation_callback(_Inout_ POB_PRE_OPERATION_INFORMATION operation_information)
+{
+    POB_PRE_OPERATION_CALLBACK pre_operation = nullptr;
+    PVOID registration_context;
+    {
+        std::unique_lock lock(_usersim_ntos_lock);
+        for (const OB_OPERATION_REGISTRATION& operation : _usersim_ntos_object_operations) {
+            if (*operation.ObjectType == operation_information->ObjectType &&
+                (operation.Operations & operation_information->Operation) != 0) {
+                pre_operation = operation.PreOperation;
+                break;
+            }
+        }
+        registration_context = _usersim_ntos_object_registration_context;
+    }
+    if (pre_operation != nullptr) {
+        (void)pre_operation(registration_context, operation_information);
+    }
+}
@@ -9,12 +9,21 @@
 
 // Versioning header structures for BPF program compatibility
 
+// Program and attach type numbers for the neteventebpfext hooks that are not defined by eBPF for Windows itself.
+#define NETEVENT_BPF_TYPE_BASE 0x2000
+#define BPF_PROG_TYPE_NETEVENT_SUMMARY (NETEVENT_BPF_TYPE_BASE + 1)
+#define BPF_ATTACH_TYPE_NETEVENT_SUMMARY (NETEVENT_BPF_TYPE_BASE + 1)
+
 // Define event types
 #define NETEVENT_EVENT_TYPE_PKTMON_DROP 100
 #define NETEVENT_EVENT_TYPE_PKTMON_FLOW 101
 
 // Define capture header version
-#define NETEVENT_PKTMON_EVENT_CURRENT_VERSION 1
+// Version 2 adds the length of the event before truncation.
+// Version 3 adds the PKTMON header fields decoded by the extension to the netevent_event_md_t.
+// Version 4 adds the source id of the NetEvent provider that pushed the event.
+// Version 5 adds the per-processor sequence number and the push timestamp of the event.
+#define NETEVENT_PKTMON_EVENT_CURRENT_VERSION 5
 // Define the length of the event header expected prior to the event data.
 // Currently this length is equal to the size of PKTMON_EVT_STREAM_PACKET_HEADER which is defined in pktmonnpik.h.
 #define PKTMON_EVENT_HEADER_LENGTH 0x35
@@ -23,18 +32,65 @@
 typedef struct _netevent_data_header
 {
     uint8_t type;
+    uint8_t source_id; ///< Source id of the NetEvent provider that pushed the event.
     uint16_t version;
+    uint32_t original_length; ///< Length of the event data following the PKTMON header, before any truncation.
+    uint32_t cpu;             ///< Index of the processor that dispatched the event.
+    uint32_t reserved;
+    uint64_t sequence;       ///< Sequence number of the event among the events dispatched by the processor.
+    uint64_t push_timestamp; ///< Performance counter value when the provider pushed the event.
 } netevent_data_header_t;
 
+// Sizes of the netevent_data_header_t in the earlier versions: version 1 only carries the type and the version, and
+// versions 2 to 4 end with the original length.
+#define NETEVENT_DATA_HEADER_SIZE_V1 (offsetof(netevent_data_header_t, original_length))
+#define NETEVENT_DATA_HEADER_SIZE_V4 (offsetof(netevent_data_header_t, cpu))
+
 // This structure is used to pass event data to the eBPF program.
 // data_meta points to netevent_data_header_t (with versioning information) followed by pktmon structure
+// The remaining fields are decoded by the extension from the PKTMON header once per event, so that programs do not
+// have to parse it. The raw header remains available through data_meta.
 typedef struct _netevent_event_md
 {
     uint8_t* data_meta;
     uint8_t* data;
     uint8_t* data_end;
+    uint64_t timestamp;     ///< PKTMON TimeStamp.
+    uint64_t packet_group;  ///< PKTMON PktGroupId.
+    uint32_t drop_reason;   ///< PKTMON DropReason.
+    uint32_t drop_location; ///< PKTMON DropLocation.
+    uint16_t component_id;  ///< PKTMON ComponentId.
+    uint16_t edge_id;       ///< PKTMON EdgeId.
+    uint16_t filter_id;     ///< PKTMON FilterId.
+    uint16_t direction;     ///< PKTMON DirectionName.
+    uint16_t packet_type;   ///< PKTMON PacketType.
+    uint16_t processor;     ///< PKTMON Processor.
+    uint8_t event_type;     ///< PKTMON EventId.
+    uint8_t source_id;      ///< Source id of the NetEvent provider that pushed the event.
+    uint8_t reserved[2];
+    uint32_t repeat_count;   ///< Number of identical drop events coalesced since the previous one was emitted.
+    uint32_t sample_weight;  ///< Number of events this event stands for when drop events are sampled, 1 otherwise.
+    uint64_t sequence;       ///< Sequence number of the event among the events dispatched by the processor.
+    uint64_t push_timestamp; ///< Performance counter value when the provider pushed the event.
 } netevent_event_md_t;
 
+// Size of the netevent_event_md_t up to NETEVENT_PKTMON_EVENT_CURRENT_VERSION 2, which only carries the data pointers.
+#define NETEVENT_EVENT_MD_SIZE_V2 (offsetof(netevent_event_md_t, timestamp))
+
+// Normalized 5-tuple of the packet carried by an event, as returned by bpf_netevent_parse_flow.
+typedef struct _netevent_flow_key
+{
+    uint8_t source_address[16];      ///< IPv6 address, or IPv4-mapped IPv6 address (::ffff:a.b.c.d) for IPv4.
+    uint8_t destination_address[16]; ///< IPv6 address, or IPv4-mapped IPv6 address (::ffff:a.b.c.d) for IPv4.
+    uint16_t source_port;            ///< Network byte order, 0 when the transport protocol has no ports.
+    uint16_t destination_port;       ///< Network byte order, 0 when the transport protocol has no ports.
+    uint8_t ip_version;              ///< 4 or 6.
+    uint8_t protocol;                ///< IP protocol number of the transport header.
+    uint16_t l3_offset;              ///< Offset of the IP header from data.
+    uint16_t l4_offset;              ///< Offset of the transport header from data, 0 when it is not present.
+    uint16_t payload_offset;         ///< Offset of the TCP or UDP payload from data, 0 when it is not present.
+} netevent_flow_key_t;
+
 // Packet capture type.
 typedef enum _netevent_capture_type
 {
@@ -44,11 +100,41 @@ typedef enum _netevent_capture_type
     NeteventCapture_None
 } netevent_capture_type_t;
 
+// Attach flags.
+// Invoke the program directly on the provider's event memory rather than on a per-CPU copy of the event. In this mode
+// data_meta points at the PKTMON header (no netevent_data_header_t is prepended, the event type is the PKTMON EventId)
+// and the program must treat the event data as read-only.
+#define NETEVENT_ATTACH_FLAG_ZERO_COPY 0x1
+// Only invoke the program for events whose PKTMON DropReason is equal to the drop_reason attach option.
+#define NETEVENT_ATTACH_FLAG_FILTER_DROP_REASON 0x2
+// Only invoke the program for events whose PKTMON ComponentId is equal to the component_id attach option.
+#define NETEVENT_ATTACH_FLAG_FILTER_COMPONENT_ID 0x4
+#define NETEVENT_ATTACH_FLAGS_ALL \
+    (NETEVENT_ATTACH_FLAG_ZERO_COPY | NETEVENT_ATTACH_FLAG_FILTER_DROP_REASON | NETEVENT_ATTACH_FLAG_FILTER_COMPONENT_ID)
+
+// Number of 32-bit words in the PKTMON EventId bitmask, one bit per possible EventId.
+#define NETEVENT_EVENT_ID_MASK_WORDS 8
+
 typedef struct _netevent_attach_opts
 {
     netevent_capture_type_t capture_type;
+    uint32_t flags;   ///< NETEVENT_ATTACH_FLAG_* values.
+    uint32_t snaplen; ///< Maximum number of bytes following the PKTMON header passed to the program, 0 for no limit.
+    uint32_t event_id_mask[NETEVENT_EVENT_ID_MASK_WORDS]; ///< PKTMON EventIds the program is invoked for, all zero for
+                                                          ///< any EventId allowed by the capture type.
+    uint32_t drop_reason;  ///< DropReason to match when NETEVENT_ATTACH_FLAG_FILTER_DROP_REASON is set.
+    uint16_t component_id; ///< ComponentId to match when NETEVENT_ATTACH_FLAG_FILTER_COMPONENT_ID is set.
 } netevent_attach_opts_t;
 
+// Sizes of the earlier versions of the attach options, which are still accepted at attach.
+#define NETEVENT_ATTACH_OPTS_SIZE_V1 (offsetof(netevent_attach_opts_t, flags))
+#define NETEVENT_ATTACH_OPTS_SIZE_V2 (offsetof(netevent_attach_opts_t, snaplen))
+#define NETEVENT_ATTACH_OPTS_SIZE_V3 (offsetof(netevent_attach_opts_t, event_id_mask))
+
+// Add a PKTMON EventId to the event_id_mask of the attach options.
+#define NETEVENT_EVENT_ID_MASK_SET(attach_opts, event_id) \
+    ((attach_opts)->event_id_mask[(uint8_t)(event_id) / 32] |= (1u << ((uint8_t)(event_id) % 32)))
+
 /*
  * @brief Write an event into the ring buffer.
  *
@@ -64,6 +150,45 @@ typedef struct _netevent_attach_opts
 typedef int
 netevent_event_hook_t(netevent_event_md_t* context);
 
+// Interval at which netevent_summary programs are invoked.
+#define NETEVENT_SUMMARY_INTERVAL_MS 1000
+// Number of entries of the per drop reason and per component counters of the summary. The last entry counts all the
+// larger values.
+#define NETEVENT_SUMMARY_DROP_REASON_COUNT 128
+#define NETEVENT_SUMMARY_COMPONENT_COUNT 64
+
+// This structure is passed to netevent_summary programs once per interval. Every counter covers the valid events
+// pushed by the NetEvent providers during the interval, whether or not a netevent_monitor program was invoked for them.
+typedef struct _netevent_summary_md
+{
+    uint64_t interval_start; ///< Interrupt time of the start of the interval, in 100ns units.
+    uint64_t interval_end;   ///< Interrupt time of the end of the interval, in 100ns units.
+    uint64_t event_count;    ///< Number of events.
+    uint64_t bytes;          ///< Total length of the event data following the PKTMON headers, before any truncation.
+    uint64_t drop_count;     ///< Number of NETEVENT_EVENT_TYPE_PKTMON_DROP events.
+    uint64_t flow_count;     ///< Number of NETEVENT_EVENT_TYPE_PKTMON_FLOW events.
+    uint64_t other_count;    ///< Number of events of any other PKTMON EventId.
+    /// Number of drop events per PKTMON DropReason.
+    uint64_t drop_reason_count[NETEVENT_SUMMARY_DROP_REASON_COUNT];
+    /// Number of events per PKTMON ComponentId.
+    uint64_t component_count[NETEVENT_SUMMARY_COMPONENT_COUNT];
+} netevent_summary_md_t;
+
+/*
+ * @brief Handle the summary of the events of an interval. Programs run at DISPATCH_LEVEL, and their return value is
+ * ignored.
+ *
+ * Program type: \ref EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY
+ *
+ * Attach type(s):
+ * \ref EBPF_ATTACH_TYPE_NETEVENT_SUMMARY
+ *
+ * @param[in] context \ref netevent_summary_md_t
+ * @return 0.
+ */
+typedef int
+netevent_summary_hook_t(netevent_summary_md_t* context);
+
 // NetEvent helper functions.
 #define NETEVENT_EXT_HELPER_FN_BASE 0xFFFF
 
@@ -74,6 +199,9 @@ netevent_event_hook_t(netevent_event_md_t* context);
 typedef enum
 {
     BPF_FUNC_netevent_push_event = NETEVENT_EXT_HELPER_FN_BASE + 1,
+    BPF_FUNC_netevent_parse_flow = NETEVENT_EXT_HELPER_FN_BASE + 2,
+    BPF_FUNC_netevent_flow_table_update = NETEVENT_EXT_HELPER_FN_BASE + 3,
+    BPF_FUNC_netevent_capture = NETEVENT_EXT_HELPER_FN_BASE + 4,
 } ebpf_netevent_event_helper_id_t;
 
 /**
@@ -88,3 +216,55 @@ EBPF_HELPER(int, bpf_netevent_push_event, (netevent_event_md_t * ctx));
 #ifndef __doxygen
 #define bpf_netevent_push_event ((bpf_netevent_push_event_t)BPF_FUNC_netevent_push_event)
 #endif
+
+/**
+ * @brief Parse the IPv4 or IPv6 and TCP or UDP headers of the packet carried by the event. The packet is parsed at
+ * most once per event, and the result is shared by all the programs invoked for it.
+ *
+ * @param[in] context Event metadata.
+ * @param[out] flow_key Buffer that receives the netevent_flow_key_t.
+ * @param[in] flow_key_length Length of the flow_key buffer, at least sizeof(netevent_flow_key_t).
+ *
+ * @retval =0 Succeeded parsing the packet.
+ * @retval -EINVAL The buffer is too small, or the headers are not fully within the event data passed to the program.
+ * @retval -ENOTSUP The event does not carry an IPv4 or IPv6 packet.
+ */
+EBPF_HELPER(int, bpf_netevent_parse_flow, (netevent_event_md_t * ctx, uint8_t* flow_key, uint32_t flow_key_length));
+#ifndef __doxygen
+#define bpf_netevent_parse_flow ((bpf_netevent_parse_flow_t)BPF_FUNC_netevent_parse_flow)
+#endif
+
+/**
+ * @brief Aggregate the event into the extension's flow table, keyed by the flow of its packet (as returned by
+ * bpf_netevent_parse_flow), its event type and its drop reason. The table is flushed periodically into
+ * netevent_flow_record_t records, which user mode reads with IOCTL_NETEVENT_EXT_GET_FLOW_RECORDS.
+ *
+ * @param[in] context Event metadata.
+ *
+ * @retval =0 Succeeded aggregating the event.
+ * @retval -EINVAL The headers of the packet are malformed.
+ * @retval -ENOTSUP The event does not carry an IPv4 or IPv6 packet.
+ * @retval -ENOSPC The flow table is full until its next flush.
+ */
+EBPF_HELPER(int, bpf_netevent_flow_table_update, (netevent_event_md_t * ctx));
+#ifndef __doxygen
+#define bpf_netevent_flow_table_update ((bpf_netevent_flow_table_update_t)BPF_FUNC_netevent_flow_table_update)
+#endif
+
+/**
+ * @brief Capture the event into the extension's capture ring, which user mode maps with
+ * IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING. The event is copied directly from the memory of the NetEvent provider, so that
+ * the capture is not limited by the program's snaplen and does not go through the program's own copy of the event.
+ *
+ * @param[in] context Event metadata.
+ * @param[in] snaplen Maximum number of bytes of event data following the PKTMON header to capture, 0 for all of them.
+ *
+ * @retval =0 Succeeded capturing the event.
+ * @retval -ENODEV The capture ring is not mapped by any process.
+ * @retval -ENOSPC The capture ring is full, the event is counted as dropped.
+ * @retval -EINVAL The event data passed to the program is not preceded by a PKTMON header.
+ */
+EBPF_HELPER(int, bpf_netevent_capture, (netevent_event_md_t * ctx, uint32_t snaplen));
+#ifndef __doxygen
+#define bpf_netevent_capture ((bpf_netevent_capture_t)BPF_FUNC_netevent_capture)
+#endif
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "ebpf_netevent_hooks.h"
+
+// This file contains the structures exchanged over NMR between neteventebpfext.sys, as the NPI client, and the NetEvent
+// providers. Providers and the extension may be built at different versions: each side only reads the fields that are
+// present in the version and size advertised by the other.
+
+// Version of the dispatch table the extension gives to the providers.
+#define EBPF_NETEVENT_EXTENSION_VERSION 4
+// First version of the dispatch table exposing the batched push_events helper to NetEvent providers.
+#define EBPF_NETEVENT_EXTENSION_VERSION_PUSH_EVENTS 3
+// First version of the dispatch table carrying the capabilities of the extension and the reserved event size.
+#define EBPF_NETEVENT_EXTENSION_VERSION_CAPABILITIES 4
+
+// Capabilities exchanged with the NetEvent providers, in both directions.
+// - NETEVENT_CAPABILITY_BATCH: the extension exposes push_events, the provider pushes events in bursts.
+// - NETEVENT_CAPABILITY_ZERO_COPY: the extension may hand the provider's event memory to the programs, which the
+//   provider allows. Without it, programs attached with NETEVENT_ATTACH_FLAG_ZERO_COPY get a copy of its events.
+#define NETEVENT_CAPABILITY_BATCH 0x1
+#define NETEVENT_CAPABILITY_ZERO_COPY 0x2
+
+// Event pushed by a provider: the PKTMON header followed by the event data.
+typedef struct _netevent_event
+{
+    uint8_t* event_start; ///< Pointer to the start of the event.
+    uint8_t* event_end;   ///< Pointer to the end of the event (i.e. first byte *outside* the memory range).
+} netevent_event_t;
+
+// Helper functions of the dispatch table, in the order of helper_function_address:
+// - [0] push_event(event): all versions.
+// - [1] push_events(events, count): EBPF_NETEVENT_EXTENSION_VERSION_PUSH_EVENTS and later.
+typedef void (*netevent_push_event_t)(netevent_event_t* netevent_event);
+typedef void (*netevent_push_events_t)(netevent_event_t* netevent_events, uint32_t event_count);
+
+typedef struct netevent_ext_header
+{
+    uint16_t version; ///< Version of the extension data structure.
+    size_t size;      ///< Size of the netevent function addresses structure.
+} netevent_ext_header_t;
+
+// Dispatch table the extension gives to each provider it binds to.
+typedef struct netevent_ext_function_addresses
+{
+    netevent_ext_header_t header;
+    netevent_capture_type_t capture_type;
+    uint32_t helper_function_count;
+    uint64_t* helper_function_address;
+    // Fields below are present since EBPF_NETEVENT_EXTENSION_VERSION_CAPABILITIES.
+    uint32_t capabilities;        ///< NETEVENT_CAPABILITY_* flags of the extension.
+    uint32_t reserved_event_size; ///< Size of the events, PKTMON header included, dispatched without allocating.
+} netevent_ext_function_addresses_t;
+
+// First version of the provider characteristics carrying the capabilities and the largest event of the provider.
+#define NETEVENT_PROVIDER_CHARACTERISTICS_VERSION_CAPABILITIES 3
+
+// NPI specific characteristics of a NetEvent provider. Providers older than
+// NETEVENT_PROVIDER_CHARACTERISTICS_VERSION_CAPABILITIES only fill in the size and version. They have no capabilities,
+// and their events are always copied before being handed to the programs.
+typedef struct netevent_provider_characteristics
+{
+    uint16_t size;           ///< Size of the characteristics structure.
+    uint16_t version;        ///< Version of the characteristics structure.
+    uint32_t capabilities;   ///< NETEVENT_CAPABILITY_* flags of the provider.
+    uint32_t max_event_size; ///< Largest event the provider pushes, PKTMON header included, or 0 if unknown.
+} netevent_provider_characteristics_t;
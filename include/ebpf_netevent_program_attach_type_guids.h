@@ -23,6 +23,17 @@ extern "C"
      */
     __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_NETEVENT = EBPF_ATTACH_TYPE_NETEVENT_GUID;
 
+#define EBPF_ATTACH_TYPE_NETEVENT_SUMMARY_GUID                                         \
+    {                                                                                  \
+        0x3f0b7c52, 0x91d4, 0x4a6e, { 0xb8, 0x2d, 0x5e, 0x17, 0xc4, 0x63, 0xa9, 0x0f } \
+    }
+
+    /** @brief Attach type for the periodic summaries of the network events.
+     *
+     * Program type: \ref EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY
+     */
+    __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_NETEVENT_SUMMARY = EBPF_ATTACH_TYPE_NETEVENT_SUMMARY_GUID;
+
     //
     // Program Types.
     //
@@ -41,6 +52,22 @@ extern "C"
      */
     __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_NETEVENT = EBPF_PROGRAM_TYPE_NETEVENT_GUID;
 
+#define EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY_GUID                                        \
+    {                                                                                  \
+        0x7a2e4d19, 0x06c3, 0x4f58, { 0x9e, 0x71, 0xd2, 0x8b, 0x3a, 0x5c, 0x14, 0xe6 } \
+    }
+
+    /** @brief Program type for the periodic summaries of the network events.
+     *
+     * eBPF program prototype: \ref netevent_summary_md_t
+     *
+     * Attach type(s): \ref EBPF_ATTACH_TYPE_NETEVENT_SUMMARY
+     *
+     * Helpers available: see bpf_helpers.h
+     */
+    __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY =
+        EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY_GUID;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,164 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// This file contains the pipeline statistics and settings exposed by neteventebpfext.sys to user mode, through device
+// control requests on its control device.
+
+#include "ebpf_netevent_hooks.h"
+
+#include <stdint.h>
+#ifndef CTL_CODE
+#include <winioctl.h>
+#endif
+
+// Win32 path of the neteventebpfext control device.
+#define NETEVENT_EXT_DEVICE_WIN32_NAME L"\\\\.\\ebpf_ext_netevent"
+
+// Get the netevent pipeline statistics. No input, the output buffer receives a netevent_ext_stats_t.
+#define IOCTL_NETEVENT_EXT_GET_STATS CTL_CODE(FILE_DEVICE_NETWORK, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+// Get the flow records flushed from the flow table. No input, the output buffer receives as many netevent_flow_record_t
+// as fit, which are removed from the extension.
+#define IOCTL_NETEVENT_EXT_GET_FLOW_RECORDS CTL_CODE(FILE_DEVICE_NETWORK, 0x801, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+// Flush the flow table right away instead of waiting for its periodic flush, so that the records aggregated so far can
+// be read with IOCTL_NETEVENT_EXT_GET_FLOW_RECORDS. No input and no output.
+#define IOCTL_NETEVENT_EXT_FLUSH_FLOW_TABLE CTL_CODE(FILE_DEVICE_NETWORK, 0x806, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+// Set the drop event coalescing settings. The input buffer is a netevent_coalescing_config_t, there is no output.
+#define IOCTL_NETEVENT_EXT_SET_COALESCING CTL_CODE(FILE_DEVICE_NETWORK, 0x802, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+// Largest coalescing window and key length accepted by IOCTL_NETEVENT_EXT_SET_COALESCING.
+#define NETEVENT_COALESCING_MAX_WINDOW_US (10 * 1000 * 1000)
+#define NETEVENT_COALESCING_MAX_KEY_LENGTH 128
+
+// Drop events with the same PKTMON EventId, DropReason and first key_length bytes of event data that follow an emitted
+// one within window_us are not dispatched to the programs. The next emitted event with the same key reports their
+// number in the repeat_count field of its netevent_event_md_t.
+typedef struct _netevent_coalescing_config
+{
+    uint32_t window_us;  ///< Coalescing window in microseconds, 0 to disable coalescing (the default).
+    uint32_t key_length; ///< Number of bytes of event data following the PKTMON header that are part of the key.
+} netevent_coalescing_config_t;
+
+// Set the drop event sampling settings. The input buffer is a netevent_sampling_config_t, there is no output.
+#define IOCTL_NETEVENT_EXT_SET_SAMPLING CTL_CODE(FILE_DEVICE_NETWORK, 0x803, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+// Largest rate and burst accepted by IOCTL_NETEVENT_EXT_SET_SAMPLING.
+#define NETEVENT_SAMPLING_MAX_RATE (1000 * 1000)
+#define NETEVENT_SAMPLING_MAX_BURST (1000 * 1000)
+
+// Drop events are sampled per stratum, a stratum being a pair of PKTMON DropReason and ComponentId. Each stratum has a
+// token bucket on each processor, refilled at rate tokens per second up to burst tokens, and a drop event is only
+// dispatched to the programs when a token is available. Rare strata are therefore always dispatched, while dominant
+// ones are capped. Each dispatched event reports in the sample_weight field of its netevent_event_md_t the number of
+// events of its stratum it stands for.
+typedef struct _netevent_sampling_config
+{
+    uint32_t rate;  ///< Tokens per second of each bucket, 0 to disable sampling (the default).
+    uint32_t burst; ///< Capacity of each bucket, at least 1 when sampling is enabled.
+} netevent_sampling_config_t;
+
+// Map the capture ring into the calling process. No input, the output buffer receives a
+// netevent_capture_ring_mapping_t. The ring is mapped into a single process at a time, and is unmapped with
+// IOCTL_NETEVENT_EXT_UNMAP_CAPTURE_RING or when the last handle to the file object it was mapped through is closed.
+#define IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING \
+    CTL_CODE(FILE_DEVICE_NETWORK, 0x804, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+// Unmap the capture ring. The request must be sent on the file object the ring was mapped through, possibly from
+// another process the handle was duplicated into. No input and no output.
+#define IOCTL_NETEVENT_EXT_UNMAP_CAPTURE_RING \
+    CTL_CODE(FILE_DEVICE_NETWORK, 0x805, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+// Size of the data area of the capture ring.
+#define NETEVENT_CAPTURE_RING_DATA_SIZE (4 * 1024 * 1024)
+
+typedef struct _netevent_capture_ring_mapping
+{
+    uint64_t address; ///< User mode address of the netevent_capture_ring_header_t that starts the mapping.
+    uint64_t size;    ///< Size of the mapping, header included.
+} netevent_capture_ring_mapping_t;
+
+// The capture ring starts with this header, followed by the data area at data_offset. The offsets only grow, and a
+// record starts in the data area at its offset modulo data_size. The consumer reads the records between
+// consumer_offset and producer_offset, then advances consumer_offset to release their space. Only producer_offset
+// and consumer_offset are read back by the extension.
+typedef struct _netevent_capture_ring_header
+{
+    uint64_t data_offset;              ///< Offset of the data area from the start of the mapping.
+    uint64_t data_size;                ///< Size of the data area, a power of two.
+    volatile uint64_t producer_offset; ///< End of the last record written. Only written by the extension.
+    volatile uint64_t dropped_count;   ///< Records dropped because the ring was full. Only written by the extension.
+    uint8_t reserved[32];
+    volatile uint64_t consumer_offset; ///< End of the last record consumed. Only written by the consumer.
+} netevent_capture_ring_header_t;
+
+// The record only pads the end of the data area, the next record starts at the beginning of the data area.
+#define NETEVENT_CAPTURE_RECORD_FLAG_PADDING 0x1
+
+// Records are 16-byte aligned. Unless it is a padding record, a record header is followed by a netevent_data_header_t,
+// the PKTMON header and captured_length bytes of event data.
+typedef struct _netevent_capture_record
+{
+    uint32_t length;          ///< Length of the record, this header included, a multiple of 16 bytes.
+    uint32_t flags;           ///< NETEVENT_CAPTURE_RECORD_FLAG_* flags.
+    uint32_t captured_length; ///< Length of the event data captured, at most the original_length of the event.
+    uint32_t reserved;
+} netevent_capture_record_t;
+
+// Event types counted separately in the statistics.
+typedef enum _netevent_stats_event_type
+{
+    NeteventStatsEventType_Drop,  ///< NETEVENT_EVENT_TYPE_PKTMON_DROP events.
+    NeteventStatsEventType_Flow,  ///< NETEVENT_EVENT_TYPE_PKTMON_FLOW events.
+    NeteventStatsEventType_Other, ///< Events of any other PKTMON EventId.
+    NeteventStatsEventType_Count
+} netevent_stats_event_type_t;
+
+// Bucket i of the event size histogram counts the events whose data following the PKTMON header is smaller than
+// (NETEVENT_STATS_SIZE_BUCKET_BASE << i) bytes, and not counted by a lower bucket. The last bucket counts all larger
+// events.
+#define NETEVENT_STATS_SIZE_BUCKET_BASE 64
+#define NETEVENT_STATS_SIZE_BUCKET_COUNT 8
+
+typedef struct _netevent_ext_stats
+{
+    uint64_t received;                ///< Events pushed by NetEvent providers.
+    uint64_t invalid;                 ///< Events dropped because they are smaller than the PKTMON header.
+    uint64_t filtered;                ///< Valid events that no attached program asked for.
+    uint64_t copied;                  ///< Events copied into a per-CPU buffer.
+    uint64_t truncated;               ///< Copied events that were truncated to a snaplen.
+    uint64_t lost_no_buffer;          ///< Events lost because the per-CPU buffers were not initialized.
+    uint64_t lost_allocation_failure; ///< Events lost because a per-CPU buffer could not be grown.
+    uint64_t invoke_failed;           ///< Program invocations that failed.
+    uint64_t buffer_resize_count;     ///< Number of times a per-CPU buffer was grown or shrunk.
+    uint64_t buffer_peak_size;        ///< Largest size any per-CPU buffer has reached.
+    uint64_t flow_table_updates;      ///< Events aggregated into the flow table.
+    uint64_t flow_table_full;         ///< Events that could not be aggregated because the flow table was full.
+    uint64_t flow_records_flushed;    ///< Records flushed from the flow table.
+    uint64_t coalesced;               ///< Drop events not dispatched because they repeat an earlier event.
+    uint64_t sampled_out;             ///< Drop events not dispatched because their stratum ran out of tokens.
+    uint64_t captured;                ///< Events written to the capture ring by bpf_netevent_capture.
+    uint64_t capture_dropped;         ///< Events bpf_netevent_capture could not write because the ring was full.
+    uint64_t passive_dispatched;      ///< Events dispatched to the programs without raising IRQL.
+    uint64_t buffer_pool_empty;       ///< Events dispatched at PASSIVE_LEVEL that found no pooled buffer available.
+    /// Valid events per event type.
+    uint64_t event_type_count[NeteventStatsEventType_Count];
+    /// Valid events per size bucket.
+    uint64_t event_size_histogram[NETEVENT_STATS_SIZE_BUCKET_COUNT];
+} netevent_ext_stats_t;
+
+// Events aggregated per flow, event type and drop reason by bpf_netevent_flow_table_update.
+typedef struct _netevent_flow_record
+{
+    netevent_flow_key_t flow_key; ///< Flow of the events, with the header offsets cleared.
+    uint32_t drop_reason;         ///< PKTMON DropReason of the events.
+    uint8_t event_type;           ///< PKTMON EventId of the events.
+    uint8_t reserved[7];
+    uint64_t count;           ///< Number of events.
+    uint64_t bytes;           ///< Total length of the packets carried by the events, before any truncation.
+    uint64_t first_timestamp; ///< PKTMON TimeStamp of the first event.
+    uint64_t last_timestamp;  ///< PKTMON TimeStamp of the last event.
+} netevent_flow_record_t;
@@ -0,0 +1,38 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// This file contains the format of the recorded PKTMON event streams written by netevent_monitor.exe and replayed by
+// netevent_sim.sys.
+
+#include <stdint.h>
+
+#define NETEVENT_TRACE_MAGIC 0x5254454e // "NETR"
+#define NETEVENT_TRACE_CURRENT_VERSION 1
+
+// Largest event of a record, PKTMON header included. Longer records are rejected by the replay, and truncated events
+// are padded back up to this length at most.
+#define NETEVENT_TRACE_MAX_EVENT_LENGTH (64 * 1024)
+
+#pragma pack(push, 1)
+
+// A trace starts with a netevent_trace_file_header_t, followed by records until the end of the file.
+typedef struct _netevent_trace_file_header
+{
+    uint32_t magic;        ///< NETEVENT_TRACE_MAGIC.
+    uint16_t version;      ///< NETEVENT_TRACE_CURRENT_VERSION.
+    uint16_t header_size;  ///< Size of this header, the first record follows it.
+    uint64_t record_count; ///< Number of records in the trace, informational.
+} netevent_trace_file_header_t;
+
+// Each record is a netevent_trace_record_t followed by the event as pushed by the NetEvent provider: the PKTMON header
+// (PKTMON_EVENT_HEADER_LENGTH bytes) then the event data, truncated to what the recording program captured.
+typedef struct _netevent_trace_record
+{
+    uint32_t length;          ///< Length of the event following this record, PKTMON header included.
+    uint32_t original_length; ///< Length of the event data following the PKTMON header, before any truncation.
+    uint64_t interarrival_ns; ///< Nanoseconds between the push of the previous event and the push of this one.
+} netevent_trace_record_t;
+
+#pragma pack(pop)
@@ -8,6 +8,19 @@
 
 #define TOKEN_SID_MAX_SIZE 68 ///< Maximum size of a SID (SECURITY_MAX_SID_SIZE).
 
+// Program and attach type numbers for the ntosebpfext hooks that are not defined by eBPF for Windows itself.
+#define NTOS_BPF_TYPE_BASE 0x1000
+#define BPF_PROG_TYPE_THREAD (NTOS_BPF_TYPE_BASE + 1)
+#define BPF_ATTACH_TYPE_THREAD (NTOS_BPF_TYPE_BASE + 1)
+#define BPF_PROG_TYPE_IMAGE (NTOS_BPF_TYPE_BASE + 2)
+#define BPF_ATTACH_TYPE_IMAGE (NTOS_BPF_TYPE_BASE + 2)
+#define BPF_PROG_TYPE_REGISTRY (NTOS_BPF_TYPE_BASE + 3)
+#define BPF_ATTACH_TYPE_REGISTRY (NTOS_BPF_TYPE_BASE + 3)
+#define BPF_PROG_TYPE_OBJECT (NTOS_BPF_TYPE_BASE + 4)
+#define BPF_ATTACH_TYPE_OBJECT (NTOS_BPF_TYPE_BASE + 4)
+#define BPF_PROG_TYPE_SAMPLE (NTOS_BPF_TYPE_BASE + 5)
+#define BPF_ATTACH_TYPE_SAMPLE (NTOS_BPF_TYPE_BASE + 5)
+
 typedef enum _process_operation
 {
     PROCESS_OPERATION_CREATE, ///< Process creation.
@@ -104,3 +117,215 @@ EBPF_HELPER(int, bpf_process_get_account_domain, (process_md_t * ctx, uint8_t* d
 #ifndef __doxygen
 #define bpf_process_get_account_domain ((bpf_process_get_account_domain_t)BPF_FUNC_process_get_account_domain)
 #endif
+
+typedef enum _thread_operation
+{
+    THREAD_OPERATION_CREATE, ///< Thread creation.
+    THREAD_OPERATION_DELETE, ///< Thread deletion.
+} thread_operation_t;
+
+typedef struct _thread_md
+{
+    uint64_t thread_id;               ///< Thread ID.
+    uint64_t process_id;              ///< ID of the process that owns the thread.
+    uint64_t start_address;           ///< Win32 start address of the thread.  Set only for THREAD_OPERATION_CREATE.
+    uint64_t creating_process_id;     ///< Creating process ID.  Set only for THREAD_OPERATION_CREATE.
+    uint64_t creating_thread_id;      ///< Creating thread ID.  Set only for THREAD_OPERATION_CREATE.
+    thread_operation_t operation : 8; ///< Operation to do.
+    /// Non-zero if the thread was created from another process, other than as the initial thread of a new process.  Set
+    /// only for creation.
+    uint8_t is_remote_thread;
+} thread_md_t;
+
+/*
+ * @brief Handle thread creation and deletion.
+ *
+ * Program type: \ref EBPF_PROGRAM_TYPE_THREAD
+ *
+ * Attach type(s):
+ * \ref EBPF_ATTACH_TYPE_THREAD
+ *
+ * @param[in] context \ref thread_md_t
+ * @return The return value is ignored.  Thread creation cannot be denied.
+ */
+typedef int
+thread_hook_t(thread_md_t* context);
+
+typedef struct _image_md
+{
+    uint64_t process_id;     ///< ID of the process the image is mapped into.  Zero for drivers.
+    uint64_t image_base;     ///< Virtual base address of the image.
+    uint64_t image_size;     ///< Size of the image in bytes.
+    uint8_t signature_level; ///< Signature level of the image (SE_SIGNING_LEVEL).
+    uint8_t signature_type;  ///< Signature type of the image (SE_IMAGE_SIGNATURE_TYPE).
+    uint8_t is_system_mode;  ///< Non-zero if the image is a kernel-mode image, such as a driver.
+} image_md_t;
+
+/*
+ * @brief Handle image loads.
+ *
+ * Program type: \ref EBPF_PROGRAM_TYPE_IMAGE
+ *
+ * Attach type(s):
+ * \ref EBPF_ATTACH_TYPE_IMAGE
+ *
+ * @param[in] context \ref image_md_t
+ * @return The return value is ignored.  Image loads cannot be denied.
+ */
+typedef int
+image_hook_t(image_md_t* context);
+
+// Image helper functions.
+#define IMAGE_EXT_HELPER_FN_BASE 0xFFFF
+
+typedef enum
+{
+    BPF_FUNC_image_get_image_name = IMAGE_EXT_HELPER_FN_BASE + 1,
+} ebpf_image_helper_id_t;
+
+/**
+ * @brief Get the full name of the loaded image.
+ *
+ * @param[in] context Image metadata.
+ * @param[out] name Buffer to store the image name.
+ * @param[in] name_length Length of the buffer in bytes.
+ *
+ * @retval >=0 The length of the image name in bytes.
+ * @retval <0 A failure occurred.
+ */
+EBPF_HELPER(int, bpf_image_get_image_name, (image_md_t * ctx, uint8_t* name, uint32_t name_length));
+#ifndef __doxygen
+#define bpf_image_get_image_name ((bpf_image_get_image_name_t)BPF_FUNC_image_get_image_name)
+#endif
+
+typedef enum _registry_operation
+{
+    REGISTRY_OPERATION_CREATE_KEY,   ///< Key creation (RegNtPreCreateKeyEx).
+    REGISTRY_OPERATION_OPEN_KEY,     ///< Key open (RegNtPreOpenKeyEx).
+    REGISTRY_OPERATION_DELETE_KEY,   ///< Key deletion (RegNtPreDeleteKey).
+    REGISTRY_OPERATION_RENAME_KEY,   ///< Key rename (RegNtPreRenameKey).
+    REGISTRY_OPERATION_SET_VALUE,    ///< Value write (RegNtPreSetValueKey).
+    REGISTRY_OPERATION_DELETE_VALUE, ///< Value deletion (RegNtPreDeleteValueKey).
+    REGISTRY_OPERATION_QUERY_VALUE,  ///< Value read (RegNtPreQueryValueKey).
+} registry_operation_t;
+
+typedef struct _registry_md
+{
+    uint8_t* value_name_start; ///< Pointer to start of the value name as UTF-16 string.  For
+                               ///< REGISTRY_OPERATION_RENAME_KEY, the new key name.  Empty for other key operations.
+    uint8_t* value_name_end;   ///< Pointer to end of the value name as UTF-16 string.
+    uint64_t process_id;       ///< ID of the process performing the operation.
+    uint64_t thread_id;        ///< ID of the thread performing the operation.
+    registry_operation_t operation : 8; ///< Operation to do.
+    uint32_t data_type; ///< Registry type (REG_*) of the value.  Set only for REGISTRY_OPERATION_SET_VALUE.
+    uint32_t data_size; ///< Size of the value data in bytes.  For REGISTRY_OPERATION_QUERY_VALUE, the size of the
+                        ///< caller's buffer.
+} registry_md_t;
+
+/*
+ * @brief Handle registry operations before they are carried out.
+ *
+ * Program type: \ref EBPF_PROGRAM_TYPE_REGISTRY
+ *
+ * Attach type(s):
+ * \ref EBPF_ATTACH_TYPE_REGISTRY
+ *
+ * @param[in] context \ref registry_md_t
+ * @return STATUS_SUCCESS to let the operation proceed, or a failure NTSTATUS (such as STATUS_ACCESS_DENIED) to
+ * fail the operation with that status.
+ */
+typedef int
+registry_hook_t(registry_md_t* context);
+
+// Registry helper functions.
+#define REGISTRY_EXT_HELPER_FN_BASE 0xFFFF
+
+typedef enum
+{
+    BPF_FUNC_registry_get_key_path = REGISTRY_EXT_HELPER_FN_BASE + 1,
+} ebpf_registry_helper_id_t;
+
+/**
+ * @brief Get the full path of the key the operation applies to.  For REGISTRY_OPERATION_CREATE_KEY and
+ * REGISTRY_OPERATION_OPEN_KEY, this is the path of the key being created or opened.
+ *
+ * @param[in] context Registry metadata.
+ * @param[out] path Buffer to store the key path.
+ * @param[in] path_length Length of the buffer in bytes.
+ *
+ * @retval >=0 The length of the key path in bytes.
+ * @retval <0 A failure occurred.
+ */
+EBPF_HELPER(int, bpf_registry_get_key_path, (registry_md_t * ctx, uint8_t* path, uint32_t path_length));
+#ifndef __doxygen
+#define bpf_registry_get_key_path ((bpf_registry_get_key_path_t)BPF_FUNC_registry_get_key_path)
+#endif
+
+typedef enum _object_operation
+{
+    OBJECT_OPERATION_HANDLE_CREATE,    ///< A handle is being opened.
+    OBJECT_OPERATION_HANDLE_DUPLICATE, ///< A handle is being duplicated.
+} object_operation_t;
+
+typedef enum _object_type
+{
+    OBJECT_TYPE_PROCESS, ///< Process object.
+    OBJECT_TYPE_THREAD,  ///< Thread object.
+} object_type_t;
+
+typedef struct _object_md
+{
+    uint64_t source_process_id;       ///< ID of the process opening or duplicating the handle.
+    uint64_t source_thread_id;        ///< ID of the thread opening or duplicating the handle.
+    uint64_t target_process_id;       ///< ID of the process the handle refers to, or that owns the target thread.
+    uint64_t target_thread_id;        ///< ID of the thread the handle refers to.  Set only for OBJECT_TYPE_THREAD.
+    uint32_t desired_access;          ///< Access mask that will be granted, after bits stripped by earlier programs.
+    uint32_t original_desired_access; ///< Access mask requested by the caller.
+    object_operation_t operation : 8; ///< Operation to do.
+    object_type_t object_type : 8;    ///< Type of the object the handle refers to.
+    uint8_t is_kernel_handle;         ///< Non-zero if the handle is a kernel handle.
+} object_md_t;
+
+/*
+ * @brief Handle the creation or duplication of process and thread handles.
+ *
+ * Program type: \ref EBPF_PROGRAM_TYPE_OBJECT
+ *
+ * Attach type(s):
+ * \ref EBPF_ATTACH_TYPE_OBJECT
+ *
+ * @param[in] context \ref object_md_t
+ * @return Access bits to remove from the desired access of the handle, or 0 to leave it unchanged.
+ */
+typedef int
+object_hook_t(object_md_t* context);
+
+#define SAMPLE_DEFAULT_FREQUENCY_HZ 100 ///< Sampling frequency used when no attach parameter is supplied.
+#define SAMPLE_MAX_FREQUENCY_HZ 10000   ///< Highest supported sampling frequency.
+
+typedef struct _sample_attach_opts
+{
+    uint32_t frequency_hz; ///< Number of samples per second taken on each CPU.
+} sample_attach_opts_t;
+
+typedef struct _sample_md
+{
+    uint64_t timestamp;  ///< Interrupt time of the sample, in 100ns units.
+    uint64_t process_id; ///< ID of the process running on the CPU when the sample was taken.
+    uint64_t thread_id;  ///< ID of the thread running on the CPU when the sample was taken.
+    uint32_t cpu_number; ///< System-wide index of the sampled CPU.
+} sample_md_t;
+
+/*
+ * @brief Handle a periodic sample on one CPU.  Programs run at DISPATCH_LEVEL on the sampled CPU.
+ *
+ * Program type: \ref EBPF_PROGRAM_TYPE_SAMPLE
+ *
+ * Attach type(s):
+ * \ref EBPF_ATTACH_TYPE_SAMPLE
+ *
+ * @param[in] context \ref sample_md_t
+ * @return The return value is ignored.
+ */
+typedef int
+sample_hook_t(sample_md_t* context);
@@ -19,6 +19,41 @@ extern "C"
     __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_PROCESS = {
         0x66e20687, 0x9805, 0x4458, {0xa0, 0xdb, 0x38, 0xe2, 0x20, 0xd3, 0x16, 0x85}};
 
+    /** @brief Attach type for handling thread creation and destruction events.
+     *
+     * Program type: \ref EBPF_PROGRAM_TYPE_THREAD
+     */
+    __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_THREAD = {
+        0x30279187, 0x0df6, 0x4418, {0x8f, 0x3e, 0x8b, 0xce, 0x63, 0x17, 0xbb, 0x7b}};
+
+    /** @brief Attach type for handling image load events.
+     *
+     * Program type: \ref EBPF_PROGRAM_TYPE_IMAGE
+     */
+    __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_IMAGE = {
+        0x1e31889b, 0xd298, 0x47fb, {0xb2, 0x2f, 0x44, 0xb8, 0x99, 0xfb, 0xc3, 0x77}};
+
+    /** @brief Attach type for handling registry operations.
+     *
+     * Program type: \ref EBPF_PROGRAM_TYPE_REGISTRY
+     */
+    __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_REGISTRY = {
+        0x8e06d2dc, 0xe532, 0x457d, {0x9d, 0xc1, 0xde, 0xf3, 0x2d, 0x27, 0x3f, 0x84}};
+
+    /** @brief Attach type for handling process and thread handle operations.
+     *
+     * Program type: \ref EBPF_PROGRAM_TYPE_OBJECT
+     */
+    __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_OBJECT = {
+        0x1144414d, 0x0f5f, 0x4570, {0xa8, 0x5f, 0x3f, 0x5c, 0xea, 0x71, 0x7a, 0x0c}};
+
+    /** @brief Attach type for periodic per-CPU samples.
+     *
+     * Program type: \ref EBPF_PROGRAM_TYPE_SAMPLE
+     */
+    __declspec(selectany) ebpf_attach_type_t EBPF_ATTACH_TYPE_SAMPLE = {
+        0x744e6f17, 0x7f70, 0x4c45, {0xb5, 0xab, 0x55, 0x79, 0xdd, 0xe7, 0x0f, 0x10}};
+
     //
     // Program Types.
     //
@@ -38,6 +73,81 @@ extern "C"
      */
     __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_PROCESS = EBPF_PROGRAM_TYPE_PROCESS_GUID;
 
+#define EBPF_PROGRAM_TYPE_THREAD_GUID                                                  \
+    {                                                                                  \
+        0xe620c642, 0xfa25, 0x4579, { 0xb6, 0x3d, 0x0f, 0x34, 0x98, 0xa1, 0xba, 0xf4 } \
+    }
+
+    /** @brief Program type for handling thread creation and destruction events.
+     *
+     * eBPF program prototype: \ref thread_md_t
+     *
+     * Attach type(s): \ref EBPF_ATTACH_TYPE_THREAD
+     *
+     * Helpers available: see bpf_helpers.h
+     */
+    __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_THREAD = EBPF_PROGRAM_TYPE_THREAD_GUID;
+
+#define EBPF_PROGRAM_TYPE_IMAGE_GUID                                                   \
+    {                                                                                  \
+        0xb14548ab, 0xece7, 0x49d4, { 0xa5, 0x51, 0x13, 0x04, 0x62, 0xa1, 0x17, 0xff } \
+    }
+
+    /** @brief Program type for handling image load events.
+     *
+     * eBPF program prototype: \ref image_md_t
+     *
+     * Attach type(s): \ref EBPF_ATTACH_TYPE_IMAGE
+     *
+     * Helpers available: see bpf_helpers.h
+     */
+    __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_IMAGE = EBPF_PROGRAM_TYPE_IMAGE_GUID;
+
+#define EBPF_PROGRAM_TYPE_REGISTRY_GUID                                                \
+    {                                                                                  \
+        0x933881e5, 0xa13e, 0x46e6, { 0xb5, 0x65, 0x93, 0x46, 0x82, 0x81, 0x9b, 0x9c } \
+    }
+
+    /** @brief Program type for handling registry operations.
+     *
+     * eBPF program prototype: \ref registry_md_t
+     *
+     * Attach type(s): \ref EBPF_ATTACH_TYPE_REGISTRY
+     *
+     * Helpers available: see bpf_helpers.h
+     */
+    __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_REGISTRY = EBPF_PROGRAM_TYPE_REGISTRY_GUID;
+
+#define EBPF_PROGRAM_TYPE_OBJECT_GUID                                                  \
+    {                                                                                  \
+        0x4e2e2fea, 0x8f96, 0x4c95, { 0x81, 0x53, 0xc5, 0x0e, 0x08, 0x57, 0x0c, 0x5d } \
+    }
+
+    /** @brief Program type for handling process and thread handle operations.
+     *
+     * eBPF program prototype: \ref object_md_t
+     *
+     * Attach type(s): \ref EBPF_ATTACH_TYPE_OBJECT
+     *
+     * Helpers available: see bpf_helpers.h
+     */
+    __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_OBJECT = EBPF_PROGRAM_TYPE_OBJECT_GUID;
+
+#define EBPF_PROGRAM_TYPE_SAMPLE_GUID                                                  \
+    {                                                                                  \
+        0x6d9c5c19, 0xb942, 0x4b77, { 0xbb, 0x2c, 0x5d, 0x6a, 0xf0, 0x6f, 0xdd, 0x7b } \
+    }
+
+    /** @brief Program type for periodic per-CPU samples.
+     *
+     * eBPF program prototype: \ref sample_md_t
+     *
+     * Attach type(s): \ref EBPF_ATTACH_TYPE_SAMPLE
+     *
+     * Helpers available: see bpf_helpers.h
+     */
+    __declspec(selectany) ebpf_program_type_t EBPF_PROGRAM_TYPE_SAMPLE = EBPF_PROGRAM_TYPE_SAMPLE_GUID;
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,9 +25,20 @@ Environment:
 
 #define ebpf_ext_custom_register_providers(PROVIDER_NAME) CONCATENATE_STRING(ebpf_ext_register_, PROVIDER_NAME)
 #define ebpf_ext_custom_unregister_providers(PROVIDER_NAME) CONCATENATE_STRING(ebpf_ext_unregister_, PROVIDER_NAME)
+#define ebpf_ext_custom_device_control(PROVIDER_NAME) CONCATENATE_STRING(ebpf_ext_device_control_, PROVIDER_NAME)
+#define ebpf_ext_custom_file_cleanup(PROVIDER_NAME) CONCATENATE_STRING(ebpf_ext_file_cleanup_, PROVIDER_NAME)
 
 NTSTATUS ebpf_ext_custom_register_providers(PROVIDER_NAME)();
 void ebpf_ext_custom_unregister_providers(PROVIDER_NAME)();
+NTSTATUS ebpf_ext_custom_device_control(PROVIDER_NAME)(
+    _In_opt_ const void* file_object,
+    ULONG io_control_code,
+    _In_reads_bytes_opt_(input_buffer_length) const void* input_buffer,
+    size_t input_buffer_length,
+    _Out_writes_bytes_to_opt_(output_buffer_length, *bytes_returned) void* output_buffer,
+    size_t output_buffer_length,
+    _Out_ size_t* bytes_returned);
+void ebpf_ext_custom_file_cleanup(PROVIDER_NAME)(_In_opt_ const void* file_object);
 
 static bool _ebpf_process_providers_registered = false;
 
@@ -64,3 +75,38 @@ ebpf_ext_unregister_providers()
         _ebpf_process_providers_registered = false;
     }
 }
+
+_IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
+ebpf_ext_device_control(
+    _In_opt_ const void* file_object,
+    ULONG io_control_code,
+    _In_reads_bytes_opt_(input_buffer_length) const void* input_buffer,
+    size_t input_buffer_length,
+    _Out_writes_bytes_to_opt_(output_buffer_length, *bytes_returned) void* output_buffer,
+    size_t output_buffer_length,
+    _Out_ size_t* bytes_returned)
+{
+    *bytes_returned = 0;
+
+    if (!_ebpf_process_providers_registered) {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    return ebpf_ext_custom_device_control(PROVIDER_NAME)(
+        file_object,
+        io_control_code,
+        input_buffer,
+        input_buffer_length,
+        output_buffer,
+        output_buffer_length,
+        bytes_returned);
+}
+
+_IRQL_requires_max_(PASSIVE_LEVEL) void ebpf_ext_file_cleanup(_In_opt_ const void* file_object)
+{
+    if (!_ebpf_process_providers_registered) {
+        return;
+    }
+
+    ebpf_ext_custom_file_cleanup(PROVIDER_NAME)(file_object);
+}
@@ -45,3 +45,35 @@ ebpf_ext_register_providers();
  */
 void
 ebpf_ext_unregister_providers();
+
+/**
+ * @brief Handle a device control request sent to the extension's control device.
+ *
+ * @param[in] file_object Opaque identifier of the file object the request was sent on.
+ * @param[in] io_control_code Device control code of the request.
+ * @param[in] input_buffer Input buffer of the request.
+ * @param[in] input_buffer_length Length of the input buffer.
+ * @param[out] output_buffer Output buffer of the request.
+ * @param[in] output_buffer_length Length of the output buffer.
+ * @param[out] bytes_returned Number of bytes written to the output buffer.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_INVALID_DEVICE_REQUEST The extension does not support the device control code.
+ * @retval STATUS_BUFFER_TOO_SMALL A buffer is too small for the request.
+ */
+_IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
+ebpf_ext_device_control(
+    _In_opt_ const void* file_object,
+    ULONG io_control_code,
+    _In_reads_bytes_opt_(input_buffer_length) const void* input_buffer,
+    size_t input_buffer_length,
+    _Out_writes_bytes_to_opt_(output_buffer_length, *bytes_returned) void* output_buffer,
+    size_t output_buffer_length,
+    _Out_ size_t* bytes_returned);
+
+/**
+ * @brief Release the resources tied to a file object when the last handle to it is closed.
+ *
+ * @param[in] file_object Opaque identifier of the file object being cleaned up.
+ */
+_IRQL_requires_max_(PASSIVE_LEVEL) void ebpf_ext_file_cleanup(_In_opt_ const void* file_object);
@@ -27,6 +27,11 @@
 
 #define EBPF_EXT_DEVICE_NAME EBPF_EXT_DEVICE_NAME_TEMPLATE(PROVIDER_NAME)
 
+#define EBPF_EXT_SYMBOLIC_LINK_NAME_TEMPLATE(_PROVIDER_NAME) \
+    EBPF_EXT_DEVICE_NAME_TEMPLATE_(L"\\DosDevices\\ebpf_ext_", _PROVIDER_NAME)
+
+#define EBPF_EXT_SYMBOLIC_LINK_NAME EBPF_EXT_SYMBOLIC_LINK_NAME_TEMPLATE(PROVIDER_NAME)
+
 // Driver global variables
 static WDFDEVICE _ebpf_ext_device = NULL;
 static BOOLEAN _ebpf_ext_driver_unloading_flag = FALSE;
@@ -60,6 +65,58 @@ static _Function_class_(EVT_WDF_DRIVER_UNLOAD) _IRQL_requires_same_
     _ebpf_ext_driver_uninitialize_objects();
 }
 
+// Forward device control requests on the control device to the extension.
+static _Function_class_(EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL) _IRQL_requires_same_ void _ebpf_ext_driver_io_device_control(
+    _In_ const WDFQUEUE queue,
+    _In_ const WDFREQUEST request,
+    size_t output_buffer_length,
+    size_t input_buffer_length,
+    ULONG io_control_code)
+{
+    NTSTATUS status;
+    void* input_buffer = NULL;
+    void* output_buffer = NULL;
+    size_t bytes_returned = 0;
+
+    UNREFERENCED_PARAMETER(queue);
+
+    if (input_buffer_length != 0) {
+        status = WdfRequestRetrieveInputBuffer(request, input_buffer_length, &input_buffer, NULL);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_BASE, "WdfRequestRetrieveInputBuffer", status);
+            goto Exit;
+        }
+    }
+
+    if (output_buffer_length != 0) {
+        status = WdfRequestRetrieveOutputBuffer(request, output_buffer_length, &output_buffer, NULL);
+        if (!NT_SUCCESS(status)) {
+            EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_BASE, "WdfRequestRetrieveOutputBuffer", status);
+            goto Exit;
+        }
+    }
+
+    status = ebpf_ext_device_control(
+        WdfRequestGetFileObject(request),
+        io_control_code,
+        input_buffer,
+        input_buffer_length,
+        output_buffer,
+        output_buffer_length,
+        &bytes_returned);
+
+Exit:
+    WdfRequestCompleteWithInformation(request, status, bytes_returned);
+}
+
+// Let the extension release the resources tied to a file object when the last handle to it is closed. The cleanup runs
+// in the context of the process closing that handle, which is not necessarily the one that opened it.
+static _Function_class_(EVT_WDF_FILE_CLEANUP) _IRQL_requires_same_ void _ebpf_ext_driver_file_cleanup(
+    _In_ const WDFFILEOBJECT file_object)
+{
+    ebpf_ext_file_cleanup(file_object);
+}
+
 //
 // Create and initialize WDF driver, device object,
 // WFP callouts and NPI providers.
@@ -71,6 +128,9 @@ _ebpf_ext_driver_initialize_objects(_Inout_ DRIVER_OBJECT* driver_object, _In_ c
     WDF_DRIVER_CONFIG driver_configuration;
     PWDFDEVICE_INIT device_initialize = NULL;
     UNICODE_STRING ebpf_device_name;
+    UNICODE_STRING ebpf_symbolic_link_name;
+    WDF_IO_QUEUE_CONFIG io_queue_configuration;
+    WDF_FILEOBJECT_CONFIG file_object_configuration;
     WDFDRIVER driver;
 
     WDF_DRIVER_CONFIG_INIT(&driver_configuration, WDF_NO_EVENT_CALLBACK);
@@ -100,6 +160,10 @@ _ebpf_ext_driver_initialize_objects(_Inout_ DRIVER_OBJECT* driver_object, _In_ c
 
     WdfDeviceInitSetCharacteristics(device_initialize, FILE_AUTOGENERATED_DEVICE_NAME, TRUE);
 
+    WDF_FILEOBJECT_CONFIG_INIT(
+        &file_object_configuration, WDF_NO_EVENT_CALLBACK, WDF_NO_EVENT_CALLBACK, _ebpf_ext_driver_file_cleanup);
+    WdfDeviceInitSetFileObjectConfig(device_initialize, &file_object_configuration, WDF_NO_OBJECT_ATTRIBUTES);
+
     RtlInitUnicodeString(&ebpf_device_name, EBPF_EXT_DEVICE_NAME);
     status = WdfDeviceInitAssignName(device_initialize, &ebpf_device_name);
     if (!NT_SUCCESS(status)) {
@@ -116,6 +180,22 @@ _ebpf_ext_driver_initialize_objects(_Inout_ DRIVER_OBJECT* driver_object, _In_ c
         goto Exit;
     }
 
+    // Expose the control device to user mode, for the device control requests of the extension.
+    RtlInitUnicodeString(&ebpf_symbolic_link_name, EBPF_EXT_SYMBOLIC_LINK_NAME);
+    status = WdfDeviceCreateSymbolicLink(_ebpf_ext_device, &ebpf_symbolic_link_name);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_BASE, "WdfDeviceCreateSymbolicLink", status);
+        goto Exit;
+    }
+
+    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&io_queue_configuration, WdfIoQueueDispatchParallel);
+    io_queue_configuration.EvtIoDeviceControl = _ebpf_ext_driver_io_device_control;
+    status = WdfIoQueueCreate(_ebpf_ext_device, &io_queue_configuration, WDF_NO_OBJECT_ATTRIBUTES, WDF_NO_HANDLE);
+    if (!NT_SUCCESS(status)) {
+        EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_BASE, "WdfIoQueueCreate", status);
+        goto Exit;
+    }
+
     _ebpf_ext_driver_device_object = WdfDeviceWdmGetDeviceObject(_ebpf_ext_device);
 
     status = ebpf_ext_register_providers();
@@ -33,6 +33,17 @@ typedef struct _ebpf_extension_hook_clients_list
     LIST_ENTRY attached_clients_list;
 } ebpf_extension_hook_clients_list_t;
 
+/**
+ * @brief Immutable array of the clients attached to a hook NPI provider. Hooks invoke programs from a snapshot so that
+ * the hot path takes no lock; a snapshot is only rewritten after all of its readers have released it.
+ */
+typedef struct _ebpf_extension_hook_client_snapshot
+{
+    EX_RUNDOWN_REF rundown;                               ///< Rundown reference held by readers of this snapshot.
+    uint32_t client_count;                                ///< Number of clients in the snapshot.
+    ebpf_extension_hook_client_t* clients[ANYSIZE_ARRAY]; ///< Attached clients, up to the provider's max_clients.
+} ebpf_extension_hook_client_snapshot_t;
+
 typedef struct _ebpf_extension_hook_provider
 {
     NPI_PROVIDER_CHARACTERISTICS characteristics;         ///< NPI Provider characteristics.
@@ -42,9 +53,17 @@ typedef struct _ebpf_extension_hook_provider
                                                               when a client attaches. */
     ebpf_extension_hook_on_client_detach detach_callback; /*!< Pointer to hook specific callback to be invoked
                                                               when a client detaches. */
+    ebpf_extension_hook_on_client_cleanup cleanup_callback; /*!< Optional hook specific callback to be invoked
+                                                                once a detached client is no longer in use. */
     const void* custom_data; ///< Opaque pointer to hook specific data associated for this provider.
     _Guarded_by_(lock)
         LIST_ENTRY attached_clients_list; ///< Linked list of hook NPI clients that are attached to this provider.
+    EX_PUSH_LOCK snapshot_lock;           ///< Serializes client attach and snapshot updates.
+    uint32_t max_clients;                 ///< Maximum number of attached clients, or 0 for no limit.
+    volatile long attached_client_count;  ///< Number of clients in the published snapshot.
+    volatile long current_snapshot;       ///< Index of the published snapshot in snapshots.
+    ebpf_extension_hook_client_snapshot_t* snapshots[2]; /*!< Published snapshot and the one being drained or rebuilt.
+                                                              NULL if the provider has no client limit. */
 } ebpf_extension_hook_provider_t;
 
 /**
@@ -79,6 +98,43 @@ Exit:
     EBPF_EXT_RETURN_NTSTATUS(status);
 }
 
+/**
+ * @brief Publish a new snapshot of the attached clients list and wait for readers of the previous snapshot to release
+ * it. The caller must hold the snapshot lock.
+ *
+ * @param[in, out] provider_context Provider module's context.
+ */
+static void
+_ebpf_extension_hook_provider_publish_snapshot(_Inout_ ebpf_extension_hook_provider_t* provider_context)
+{
+    long current_index = provider_context->current_snapshot;
+    ebpf_extension_hook_client_snapshot_t* next_snapshot = provider_context->snapshots[current_index ^ 1];
+    uint32_t client_count = 0;
+
+    // Snapshots are only kept for providers with a client limit.
+    if (next_snapshot == NULL) {
+        return;
+    }
+
+    // The next snapshot was fully drained when it was last replaced, so it can be rewritten in place.
+    ExReInitializeRundownProtection(&next_snapshot->rundown);
+
+    KIRQL old_irql = ExAcquireSpinLockShared(&provider_context->lock);
+    LIST_ENTRY* link = provider_context->attached_clients_list.Flink;
+    while (link != &provider_context->attached_clients_list && client_count < provider_context->max_clients) {
+        next_snapshot->clients[client_count++] = CONTAINING_RECORD(link, ebpf_extension_hook_client_t, link);
+        link = link->Flink;
+    }
+    ExReleaseSpinLockShared(&provider_context->lock, old_irql);
+    next_snapshot->client_count = client_count;
+
+    InterlockedExchange(&provider_context->attached_client_count, (long)client_count);
+    InterlockedExchange(&provider_context->current_snapshot, current_index ^ 1);
+
+    // Readers that picked up the previous snapshot may still be using its clients.
+    ExWaitForRundownProtectionRelease(&provider_context->snapshots[current_index]->rundown);
+}
+
 IO_WORKITEM_ROUTINE _ebpf_extension_detach_client_completion;
 #if !defined(__cplusplus)
 #pragma alloc_text(PAGE, _ebpf_extension_detach_client_completion)
@@ -107,6 +163,11 @@ _ebpf_extension_detach_client_completion(_In_ DEVICE_OBJECT* device_object, _In_
 
     work_item = hook_client->detach_work_item;
 
+    // Stop handing out the client to lock-free readers.
+    ExAcquirePushLockExclusive(&hook_client->provider_context->snapshot_lock);
+    _ebpf_extension_hook_provider_publish_snapshot(hook_client->provider_context);
+    ExReleasePushLockExclusive(&hook_client->provider_context->snapshot_lock);
+
     // The NMR model is async, but the only Windows run-down protection API available is a blocking API, so the
     // following call will block until all using threads are complete. This should be fixed in the future.
     // Issue: https://github.com/microsoft/ebpf-for-windows/issues/1854
@@ -114,6 +175,10 @@ _ebpf_extension_detach_client_completion(_In_ DEVICE_OBJECT* device_object, _In_
     // Wait for any in progress callbacks to complete.
     ebpf_ext_wait_for_rundown(&hook_client->rundown);
 
+    if (hook_client->provider_context->cleanup_callback != NULL) {
+        hook_client->provider_context->cleanup_callback(hook_client);
+    }
+
     IoFreeWorkItem(work_item);
 
     // Note: This frees the provider binding context (hook_client).
@@ -280,6 +345,7 @@ _ebpf_extension_hook_provider_attach_client(
     ebpf_extension_hook_client_t* hook_client = NULL;
     ebpf_extension_program_dispatch_table_t* client_dispatch_table;
     ebpf_result_t result = EBPF_SUCCESS;
+    bool snapshot_lock_held = FALSE;
 
     EBPF_EXT_LOG_ENTRY();
 
@@ -328,6 +394,19 @@ _ebpf_extension_hook_provider_attach_client(
         goto Exit;
     }
 
+    ExAcquirePushLockExclusive(&local_provider_context->snapshot_lock);
+    snapshot_lock_held = TRUE;
+
+    if (local_provider_context->max_clients != 0 &&
+        (uint32_t)local_provider_context->attached_client_count >= local_provider_context->max_clients) {
+        EBPF_EXT_LOG_MESSAGE(
+            EBPF_EXT_TRACELOG_LEVEL_ERROR,
+            EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+            "Too many clients attached. Attach attempt rejected.");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
     // Invoke the hook specific callback to process client attach.
     result = local_provider_context->attach_callback(hook_client, local_provider_context);
 
@@ -335,6 +414,8 @@ _ebpf_extension_hook_provider_attach_client(
         KIRQL oldIrql = ExAcquireSpinLockExclusive(&local_provider_context->lock);
         InsertTailList(&local_provider_context->attached_clients_list, &hook_client->link);
         ExReleaseSpinLockExclusive(&local_provider_context->lock, oldIrql);
+
+        _ebpf_extension_hook_provider_publish_snapshot(local_provider_context);
     } else {
         EBPF_EXT_LOG_MESSAGE_UINT32(
             EBPF_EXT_TRACELOG_LEVEL_ERROR,
@@ -345,6 +426,9 @@ _ebpf_extension_hook_provider_attach_client(
     }
 
 Exit:
+    if (snapshot_lock_held) {
+        ExReleasePushLockExclusive(&local_provider_context->snapshot_lock);
+    }
     if (NT_SUCCESS(status)) {
         *provider_binding_context = hook_client;
         hook_client = NULL;
@@ -424,6 +508,11 @@ ebpf_extension_hook_provider_unregister(_In_opt_ _Frees_ptr_opt_ ebpf_extension_
                 EBPF_EXT_LOG_NTSTATUS_API_FAILURE(EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, "NmrDeregisterProvider", status);
             }
         }
+        for (int index = 0; index < 2; index++) {
+            if (provider_context->snapshots[index] != NULL) {
+                ExFreePool(provider_context->snapshots[index]);
+            }
+        }
         ExFreePool(provider_context);
     }
     EBPF_EXT_LOG_EXIT();
@@ -449,6 +538,24 @@ ebpf_extension_hook_provider_register(
 
     memset(local_provider_context, 0, sizeof(ebpf_extension_hook_provider_t));
     InitializeListHead(&local_provider_context->attached_clients_list);
+    ExInitializePushLock(&local_provider_context->snapshot_lock);
+    local_provider_context->max_clients = parameters->max_clients;
+
+    if (parameters->max_clients != 0) {
+        size_t snapshot_size = FIELD_OFFSET(ebpf_extension_hook_client_snapshot_t, clients) +
+                               (size_t)parameters->max_clients * sizeof(ebpf_extension_hook_client_t*);
+        for (int index = 0; index < 2; index++) {
+            local_provider_context->snapshots[index] = (ebpf_extension_hook_client_snapshot_t*)
+                ExAllocatePoolUninitialized(NonPagedPoolNx, snapshot_size, EBPF_EXTENSION_POOL_TAG);
+            EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, local_provider_context->snapshots[index], "snapshot", status);
+            memset(local_provider_context->snapshots[index], 0, snapshot_size);
+            ExInitializeRundownProtection(&local_provider_context->snapshots[index]->rundown);
+        }
+
+        // Publish the empty first snapshot. The second one starts out run down, as if it had just been replaced.
+        ExWaitForRundownProtectionRelease(&local_provider_context->snapshots[1]->rundown);
+    }
 
     characteristics = &local_provider_context->characteristics;
     characteristics->Length = sizeof(NPI_PROVIDER_CHARACTERISTICS);
@@ -462,6 +569,7 @@ ebpf_extension_hook_provider_register(
 
     local_provider_context->attach_callback = attach_callback;
     local_provider_context->detach_callback = detach_callback;
+    local_provider_context->cleanup_callback = parameters->cleanup_callback;
     local_provider_context->custom_data = custom_data;
 
     status = NmrRegisterProvider(characteristics, local_provider_context, &local_provider_context->nmr_provider_handle);
@@ -520,3 +628,47 @@ ebpf_extension_hook_get_next_attached_client(
     ExReleaseSpinLockShared(&provider_context->lock, oldIrql);
     return next_client;
 }
+
+_Must_inspect_result_ ebpf_extension_hook_client_snapshot_t*
+ebpf_extension_hook_acquire_client_snapshot(_Inout_ ebpf_extension_hook_provider_t* provider_context)
+{
+    ASSERT(provider_context->snapshots[0] != NULL);
+
+    // Fast path: nothing to invoke.
+    if (ReadNoFence(&provider_context->attached_client_count) == 0) {
+        return NULL;
+    }
+
+    for (;;) {
+        long index = ReadAcquire(&provider_context->current_snapshot);
+        ebpf_extension_hook_client_snapshot_t* snapshot = provider_context->snapshots[index];
+        if (ExAcquireRundownProtection(&snapshot->rundown)) {
+            // The snapshot may have been replaced between reading the index and acquiring it.
+            if (ReadAcquire(&provider_context->current_snapshot) == index) {
+                return snapshot;
+            }
+            ExReleaseRundownProtection(&snapshot->rundown);
+        }
+        // A writer is replacing the snapshot. The new one is already published, so just retry.
+        YieldProcessor();
+    }
+}
+
+void
+ebpf_extension_hook_release_client_snapshot(_Inout_ ebpf_extension_hook_client_snapshot_t* snapshot)
+{
+    ExReleaseRundownProtection(&snapshot->rundown);
+}
+
+uint32_t
+ebpf_extension_hook_client_snapshot_get_count(_In_ const ebpf_extension_hook_client_snapshot_t* snapshot)
+{
+    return snapshot->client_count;
+}
+
+ebpf_extension_hook_client_t*
+ebpf_extension_hook_client_snapshot_get_client(
+    _In_ const ebpf_extension_hook_client_snapshot_t* snapshot, uint32_t index)
+{
+    return snapshot->clients[index];
+}
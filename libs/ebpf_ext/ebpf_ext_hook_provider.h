@@ -115,6 +115,13 @@ typedef ebpf_result_t (*ebpf_extension_hook_on_client_attach)(
  */
 typedef void (*ebpf_extension_hook_on_client_detach)(_In_ const ebpf_extension_hook_client_t* detaching_client);
 
+/**
+ * @brief This optional callback function may be implemented by hook modules. This callback is invoked once a detached
+ * hook NPI client can no longer be used to invoke programs, so that the hook can free its provider data.
+ * @param detached_client Pointer to context of the hook NPI client that has detached.
+ */
+typedef void (*ebpf_extension_hook_on_client_cleanup)(_In_ const ebpf_extension_hook_client_t* detached_client);
+
 /**
  * @brief Data structure for hook NPI provider registration parameters.
  */
@@ -122,6 +129,9 @@ typedef struct _ebpf_extension_hook_provider_parameters
 {
     const NPI_MODULEID* provider_module_id;           ///< NPI provider module ID.
     const ebpf_attach_provider_data_t* provider_data; ///< Hook provider data (contains supported program types).
+    uint32_t max_clients; /*!< Maximum number of clients attached at the same time, or 0 for no limit. Hooks that
+                               invoke programs from client snapshots must set a limit. */
+    ebpf_extension_hook_on_client_cleanup cleanup_callback; ///< (Optional) Invoked when a detached client is freed.
 } ebpf_extension_hook_provider_parameters_t;
 
 /**
@@ -198,3 +208,51 @@ ebpf_extension_hook_check_attach_parameter(
     _In_reads_(attach_parameter_size) const void* attach_parameter,
     _In_reads_(attach_parameter_size) const void* wild_card_attach_parameter,
     _Inout_ ebpf_extension_hook_provider_t* provider_context);
+
+/**
+ * @brief Client limit of the hook NPI providers that invoke programs from client snapshots. Each snapshot holds this
+ * many clients.
+ */
+#define EBPF_EXTENSION_HOOK_MAX_CLIENTS 64
+
+/**
+ *  @brief This is a lock-free snapshot of the clients attached to a hook NPI provider.
+ */
+typedef struct _ebpf_extension_hook_client_snapshot ebpf_extension_hook_client_snapshot_t;
+
+/**
+ * @brief Acquire the current snapshot of attached clients without taking a lock. The clients in the snapshot stay
+ * attached, and can be invoked without entering their rundown, until the snapshot is released. This is meant for hooks
+ * on hot paths; it returns without touching any shared state beyond one counter when no client is attached. The
+ * provider must have been registered with a client limit.
+ * @param[in, out] provider_context Provider module's context.
+ * @returns The snapshot, or NULL if no clients are attached. A non-NULL snapshot must be released with
+ * ebpf_extension_hook_release_client_snapshot.
+ */
+_Must_inspect_result_ ebpf_extension_hook_client_snapshot_t*
+ebpf_extension_hook_acquire_client_snapshot(_Inout_ ebpf_extension_hook_provider_t* provider_context);
+
+/**
+ * @brief Release a snapshot acquired by ebpf_extension_hook_acquire_client_snapshot.
+ * @param[in, out] snapshot Snapshot to release.
+ */
+void
+ebpf_extension_hook_release_client_snapshot(_Inout_ ebpf_extension_hook_client_snapshot_t* snapshot);
+
+/**
+ * @brief Get the number of clients in a snapshot.
+ * @param[in] snapshot Acquired snapshot.
+ * @returns Number of clients in the snapshot.
+ */
+uint32_t
+ebpf_extension_hook_client_snapshot_get_count(_In_ const ebpf_extension_hook_client_snapshot_t* snapshot);
+
+/**
+ * @brief Get a client from a snapshot.
+ * @param[in] snapshot Acquired snapshot.
+ * @param[in] index Index of the client, less than the snapshot's client count.
+ * @returns The client at the given index.
+ */
+ebpf_extension_hook_client_t*
+ebpf_extension_hook_client_snapshot_get_client(
+    _In_ const ebpf_extension_hook_client_snapshot_t* snapshot, uint32_t index);
@@ -0,0 +1,350 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "ebpf_ext.h"
+#include "ebpf_ext_per_cpu_buffer.h"
+#include "ebpf_ext_tracelog.h"
+
+// A buffer that has used at most a quarter of its size for this long (in 100ns units) is shrunk by
+// ebpf_ext_per_cpu_buffer_trim.
+#define EBPF_EXT_PER_CPU_BUFFER_IDLE_INTERVAL (10 * 1000 * 1000)
+
+/**
+ * @brief Buffer of a single processor, or of the pool. Each per-CPU slot is only accessed by its processor at
+ * DISPATCH_LEVEL, and each pooled slot by the caller that borrowed it. Slots are padded to a cache line so that they
+ * never share a line.
+ */
+typedef struct DECLSPEC_CACHEALIGN _ebpf_ext_per_cpu_buffer_slot
+{
+    uint8_t* data;                     ///< Buffer memory, allocated on first use.
+    size_t size;                       ///< Size of the buffer memory.
+    uint64_t last_busy_time;           ///< Interrupt time of the last request for more than a quarter of the buffer.
+    uint64_t grow_count;               ///< Number of times the buffer was grown.
+    uint64_t shrink_count;             ///< Number of times the buffer was shrunk.
+    uint64_t allocation_failure_count; ///< Number of failed allocations.
+    uint64_t peak_size;                ///< Largest size of the buffer.
+    volatile long in_use;              ///< Non-zero while a pooled slot is borrowed.
+    KSPIN_LOCK staged_lock;            ///< Protects the staged buffer, which is handed over by another thread.
+    uint8_t* volatile staged_data;     ///< Buffer staged by a reservation or a trim, installed on next use.
+    size_t staged_size;                ///< Size of the staged buffer.
+} ebpf_ext_per_cpu_buffer_slot_t;
+
+typedef struct _ebpf_ext_per_cpu_buffer
+{
+    size_t minimum_size;                   ///< Initial and minimum size of the buffers, raised by reservations.
+    EX_PUSH_LOCK reserve_lock;             ///< Serializes the reservations.
+    uint32_t cpu_count;                    ///< Number of per-CPU slots.
+    uint32_t pooled_buffer_count;          ///< Number of pooled slots, following the per-CPU slots.
+    ebpf_ext_per_cpu_buffer_slot_t* slots; ///< Cache aligned array of per-CPU slots, then pooled slots.
+    volatile int64_t pool_empty_count;     ///< Number of requests for a pooled buffer that found none available.
+} ebpf_ext_per_cpu_buffer_t;
+
+static size_t
+_ebpf_ext_per_cpu_buffer_round_up_size(size_t size, size_t minimum_size)
+{
+    size_t rounded_size = minimum_size;
+    while (rounded_size < size && rounded_size <= (SIZE_MAX / 2)) {
+        rounded_size *= 2;
+    }
+    return (rounded_size < size) ? size : rounded_size;
+}
+
+_Must_inspect_result_ NTSTATUS
+ebpf_ext_per_cpu_buffer_create(
+    size_t minimum_size, uint32_t pooled_buffer_count, _Outptr_ ebpf_ext_per_cpu_buffer_t** per_cpu_buffer)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ebpf_ext_per_cpu_buffer_t* local_per_cpu_buffer = NULL;
+    uint32_t cpu_count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    uint32_t slot_count = cpu_count + pooled_buffer_count;
+
+    EBPF_EXT_LOG_ENTRY();
+
+    *per_cpu_buffer = NULL;
+
+    local_per_cpu_buffer = (ebpf_ext_per_cpu_buffer_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNx, sizeof(ebpf_ext_per_cpu_buffer_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, local_per_cpu_buffer, "per_cpu_buffer", status);
+
+    local_per_cpu_buffer->minimum_size = (minimum_size == 0) ? 1 : minimum_size;
+    local_per_cpu_buffer->cpu_count = cpu_count;
+    local_per_cpu_buffer->pooled_buffer_count = pooled_buffer_count;
+    local_per_cpu_buffer->pool_empty_count = 0;
+    local_per_cpu_buffer->slots = (ebpf_ext_per_cpu_buffer_slot_t*)ExAllocatePoolUninitialized(
+        NonPagedPoolNxCacheAligned, slot_count * sizeof(ebpf_ext_per_cpu_buffer_slot_t), EBPF_EXTENSION_POOL_TAG);
+    EBPF_EXT_BAIL_ON_ALLOC_FAILURE_STATUS(
+        EBPF_EXT_TRACELOG_KEYWORD_EXTENSION, local_per_cpu_buffer->slots, "per_cpu_buffer slots", status);
+
+    memset(local_per_cpu_buffer->slots, 0, slot_count * sizeof(ebpf_ext_per_cpu_buffer_slot_t));
+    for (uint32_t index = 0; index < slot_count; index++) {
+        KeInitializeSpinLock(&local_per_cpu_buffer->slots[index].staged_lock);
+    }
+    ExInitializePushLock(&local_per_cpu_buffer->reserve_lock);
+
+    *per_cpu_buffer = local_per_cpu_buffer;
+    local_per_cpu_buffer = NULL;
+
+Exit:
+    if (local_per_cpu_buffer != NULL) {
+        ExFreePool(local_per_cpu_buffer);
+    }
+
+    EBPF_EXT_RETURN_NTSTATUS(status);
+}
+
+void
+ebpf_ext_per_cpu_buffer_destroy(_In_opt_ _Frees_ptr_opt_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer)
+{
+    if (per_cpu_buffer == NULL) {
+        return;
+    }
+
+    for (uint32_t index = 0; index < per_cpu_buffer->cpu_count + per_cpu_buffer->pooled_buffer_count; index++) {
+        if (per_cpu_buffer->slots[index].data != NULL) {
+            ExFreePool(per_cpu_buffer->slots[index].data);
+        }
+        if (per_cpu_buffer->slots[index].staged_data != NULL) {
+            ExFreePool(per_cpu_buffer->slots[index].staged_data);
+        }
+    }
+    ExFreePool(per_cpu_buffer->slots);
+    ExFreePool(per_cpu_buffer);
+}
+
+// Replace the buffer of a slot owned by the caller with the buffer staged for it. A larger buffer staged by a
+// reservation is always installed, a smaller one staged by a trim only if the slot is still idle and the requested size
+// fits in it.
+static void
+_ebpf_ext_per_cpu_buffer_slot_install_staged(
+    _Inout_ ebpf_ext_per_cpu_buffer_slot_t* slot, size_t size, uint64_t current_time)
+{
+    KIRQL old_irql;
+    uint8_t* staged_data;
+    size_t staged_size;
+
+    KeAcquireSpinLock(&slot->staged_lock, &old_irql);
+    staged_data = slot->staged_data;
+    staged_size = slot->staged_size;
+    slot->staged_data = NULL;
+    slot->staged_size = 0;
+    KeReleaseSpinLock(&slot->staged_lock, old_irql);
+
+    if (staged_data == NULL) {
+        return;
+    }
+    if (staged_size > slot->size) {
+        if (slot->data != NULL) {
+            slot->grow_count++;
+            ExFreePool(slot->data);
+        }
+    } else if (
+        staged_size < slot->size && size <= staged_size &&
+        current_time - slot->last_busy_time > EBPF_EXT_PER_CPU_BUFFER_IDLE_INTERVAL) {
+        slot->shrink_count++;
+        ExFreePool(slot->data);
+    } else {
+        ExFreePool(staged_data);
+        return;
+    }
+    slot->data = staged_data;
+    slot->size = staged_size;
+    slot->last_busy_time = current_time;
+    slot->peak_size = max(slot->peak_size, staged_size);
+}
+
+// Grow the buffer of a slot owned by the caller to at least the requested size. Idle buffers are only shrunk by
+// ebpf_ext_per_cpu_buffer_trim, so that a request that fits in the buffer never allocates memory.
+static _Ret_maybenull_ uint8_t*
+_ebpf_ext_per_cpu_buffer_slot_get(
+    _In_ const ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, _Inout_ ebpf_ext_per_cpu_buffer_slot_t* slot, size_t size)
+{
+    uint64_t current_time = KeQueryInterruptTime();
+    size_t new_size;
+    uint8_t* new_data;
+
+    // A staged buffer only has to be swapped in, so that no allocation is needed below.
+    if (slot->staged_data != NULL) {
+        _ebpf_ext_per_cpu_buffer_slot_install_staged(slot, size, current_time);
+    }
+
+    if (size <= slot->size) {
+        if (size > slot->size / 4) {
+            slot->last_busy_time = current_time;
+        }
+        return slot->data;
+    }
+
+    new_size = _ebpf_ext_per_cpu_buffer_round_up_size(size, per_cpu_buffer->minimum_size);
+    new_data = (uint8_t*)ebpf_allocate_on_node(new_size, EBPF_EXTENSION_POOL_TAG, ebpf_get_current_node_number());
+    if (new_data == NULL) {
+        slot->allocation_failure_count++;
+        return NULL;
+    }
+    if (slot->data != NULL) {
+        slot->grow_count++;
+        ExFreePool(slot->data);
+    }
+    slot->data = new_data;
+    slot->size = new_size;
+    slot->last_busy_time = current_time;
+    slot->peak_size = max(slot->peak_size, new_size);
+
+    return slot->data;
+}
+
+_IRQL_requires_(DISPATCH_LEVEL) _Ret_maybenull_ uint8_t*
+ebpf_ext_per_cpu_buffer_get(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, size_t size)
+{
+    uint32_t current_cpu = KeGetCurrentProcessorNumberEx(NULL);
+
+    if (current_cpu >= per_cpu_buffer->cpu_count) {
+        return NULL;
+    }
+    return _ebpf_ext_per_cpu_buffer_slot_get(per_cpu_buffer, &per_cpu_buffer->slots[current_cpu], size);
+}
+
+_IRQL_requires_max_(APC_LEVEL) _Ret_maybenull_ uint8_t* ebpf_ext_per_cpu_buffer_acquire(
+    _Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, size_t size, _Out_ uint32_t* buffer_index)
+{
+    *buffer_index = 0;
+
+    // Start from the current processor's share of the pool, so that concurrent callers rarely probe the same slots.
+    uint32_t start = (per_cpu_buffer->pooled_buffer_count == 0)
+                         ? 0
+                         : KeGetCurrentProcessorNumberEx(NULL) % per_cpu_buffer->pooled_buffer_count;
+    for (uint32_t probe = 0; probe < per_cpu_buffer->pooled_buffer_count; probe++) {
+        uint32_t index = per_cpu_buffer->cpu_count + (start + probe) % per_cpu_buffer->pooled_buffer_count;
+        ebpf_ext_per_cpu_buffer_slot_t* slot = &per_cpu_buffer->slots[index];
+        if (slot->in_use != 0 || InterlockedCompareExchange(&slot->in_use, 1, 0) != 0) {
+            continue;
+        }
+
+        uint8_t* data = _ebpf_ext_per_cpu_buffer_slot_get(per_cpu_buffer, slot, size);
+        if (data == NULL) {
+            InterlockedExchange(&slot->in_use, 0);
+            return NULL;
+        }
+        *buffer_index = index;
+        return data;
+    }
+
+    InterlockedIncrement64(&per_cpu_buffer->pool_empty_count);
+    return NULL;
+}
+
+void
+ebpf_ext_per_cpu_buffer_release(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, uint32_t buffer_index)
+{
+    InterlockedExchange(&per_cpu_buffer->slots[buffer_index].in_use, 0);
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) _Must_inspect_result_ NTSTATUS
+    ebpf_ext_per_cpu_buffer_reserve(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, size_t size)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    size_t reserved_size;
+
+    ExAcquirePushLockExclusive(&per_cpu_buffer->reserve_lock);
+
+    if (size <= per_cpu_buffer->minimum_size) {
+        goto Exit;
+    }
+    reserved_size = _ebpf_ext_per_cpu_buffer_round_up_size(size, per_cpu_buffer->minimum_size);
+
+    // The buffers in use belong to their owners, so the new ones are staged and swapped in by the owners on next use.
+    for (uint32_t index = 0; index < per_cpu_buffer->cpu_count + per_cpu_buffer->pooled_buffer_count; index++) {
+        ebpf_ext_per_cpu_buffer_slot_t* slot = &per_cpu_buffer->slots[index];
+        USHORT node = (index < per_cpu_buffer->cpu_count) ? ebpf_get_processor_node_number(index)
+                                                           : ebpf_get_current_node_number();
+        uint8_t* previous_staged_data;
+        KIRQL old_irql;
+
+        uint8_t* new_data = (uint8_t*)ebpf_allocate_on_node(reserved_size, EBPF_EXTENSION_POOL_TAG, node);
+        if (new_data == NULL) {
+            EBPF_EXT_LOG_MESSAGE(
+                EBPF_EXT_TRACELOG_LEVEL_ERROR,
+                EBPF_EXT_TRACELOG_KEYWORD_EXTENSION,
+                "Failed to allocate a reserved per-CPU buffer");
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Exit;
+        }
+
+        KeAcquireSpinLock(&slot->staged_lock, &old_irql);
+        previous_staged_data = slot->staged_data;
+        slot->staged_data = new_data;
+        slot->staged_size = reserved_size;
+        KeReleaseSpinLock(&slot->staged_lock, old_irql);
+
+        if (previous_staged_data != NULL) {
+            ExFreePool(previous_staged_data);
+        }
+    }
+
+    // Buffers are no longer shrunk below the reserved size. The owners may read the previous minimum for a while,
+    // which only rounds a growing buffer up to a smaller size.
+    per_cpu_buffer->minimum_size = reserved_size;
+
+Exit:
+    ExReleasePushLockExclusive(&per_cpu_buffer->reserve_lock);
+
+    return status;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) void ebpf_ext_per_cpu_buffer_trim(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer)
+{
+    uint64_t current_time = KeQueryInterruptTime();
+
+    // Reservations and trims are the only producers of staged buffers, so a slot without one keeps none until it is
+    // staged below.
+    ExAcquirePushLockExclusive(&per_cpu_buffer->reserve_lock);
+
+    // The buffers in use belong to their owners, so the smaller ones are staged and only swapped in by the owners if
+    // the buffers are still idle on next use. The slots are read without synchronization, which at worst stages a
+    // buffer that its owner then frees.
+    for (uint32_t index = 0; index < per_cpu_buffer->cpu_count + per_cpu_buffer->pooled_buffer_count; index++) {
+        ebpf_ext_per_cpu_buffer_slot_t* slot = &per_cpu_buffer->slots[index];
+        USHORT node = (index < per_cpu_buffer->cpu_count) ? ebpf_get_processor_node_number(index)
+                                                           : ebpf_get_current_node_number();
+        size_t size = slot->size;
+        size_t trimmed_size;
+        KIRQL old_irql;
+
+        if (size <= per_cpu_buffer->minimum_size || slot->staged_data != NULL ||
+            current_time - slot->last_busy_time <= EBPF_EXT_PER_CPU_BUFFER_IDLE_INTERVAL) {
+            continue;
+        }
+
+        // Every request since the buffer was last busy fits in a quarter of it.
+        trimmed_size = _ebpf_ext_per_cpu_buffer_round_up_size(size / 4, per_cpu_buffer->minimum_size);
+        uint8_t* new_data = (uint8_t*)ebpf_allocate_on_node(trimmed_size, EBPF_EXTENSION_POOL_TAG, node);
+        if (new_data == NULL) {
+            // The idle buffers are kept, they are still large enough.
+            break;
+        }
+
+        KeAcquireSpinLock(&slot->staged_lock, &old_irql);
+        slot->staged_data = new_data;
+        slot->staged_size = trimmed_size;
+        KeReleaseSpinLock(&slot->staged_lock, old_irql);
+    }
+
+    ExReleasePushLockExclusive(&per_cpu_buffer->reserve_lock);
+}
+
+void
+ebpf_ext_per_cpu_buffer_get_stats(
+    _In_ const ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, _Out_ ebpf_ext_per_cpu_buffer_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    // The slots are updated by their owners without synchronization, so the result is only a close estimate.
+    for (uint32_t index = 0; index < per_cpu_buffer->cpu_count + per_cpu_buffer->pooled_buffer_count; index++) {
+        const ebpf_ext_per_cpu_buffer_slot_t* slot = &per_cpu_buffer->slots[index];
+        stats->grow_count += slot->grow_count;
+        stats->shrink_count += slot->shrink_count;
+        stats->allocation_failure_count += slot->allocation_failure_count;
+        stats->peak_size = max(stats->peak_size, (size_t)slot->peak_size);
+    }
+    stats->pool_empty_count = (uint64_t)per_cpu_buffer->pool_empty_count;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "framework.h"
+
+/**
+ * @brief Set of scratch buffers, one per processor, used by hooks to stage event data at DISPATCH_LEVEL. The set also
+ * holds a pool of buffers that hooks running below DISPATCH_LEVEL borrow for the duration of an event.
+ */
+typedef struct _ebpf_ext_per_cpu_buffer ebpf_ext_per_cpu_buffer_t;
+
+/**
+ * @brief Usage statistics of a per-CPU buffer set, aggregated across all processors.
+ */
+typedef struct _ebpf_ext_per_cpu_buffer_stats
+{
+    uint64_t grow_count;               ///< Number of times a buffer was reallocated to a larger size.
+    uint64_t shrink_count;             ///< Number of times an idle buffer was reallocated to a smaller size.
+    uint64_t allocation_failure_count; ///< Number of requests that failed because memory could not be allocated.
+    uint64_t pool_empty_count;         ///< Number of requests for a pooled buffer that found none available.
+    size_t peak_size;                  ///< Largest size any of the buffers has reached.
+} ebpf_ext_per_cpu_buffer_stats_t;
+
+/**
+ * @brief Create a per-CPU buffer set. Buffers are allocated on first use, on the NUMA node of the processor using them.
+ *
+ * @param[in] minimum_size Size of the buffers when first allocated. Buffers never shrink below this size.
+ * @param[in] pooled_buffer_count Number of buffers in the pool used below DISPATCH_LEVEL, may be 0.
+ * @param[out] per_cpu_buffer Pointer to the created buffer set.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_INSUFFICIENT_RESOURCES Memory allocation failed.
+ */
+_Must_inspect_result_ NTSTATUS
+ebpf_ext_per_cpu_buffer_create(
+    size_t minimum_size, uint32_t pooled_buffer_count, _Outptr_ ebpf_ext_per_cpu_buffer_t** per_cpu_buffer);
+
+/**
+ * @brief Free a per-CPU buffer set. The caller must ensure that no processor is still using any of the buffers.
+ *
+ * @param[in] per_cpu_buffer Pointer to the buffer set.
+ */
+void
+ebpf_ext_per_cpu_buffer_destroy(_In_opt_ _Frees_ptr_opt_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer);
+
+/**
+ * @brief Get the current processor's buffer, grown to at least the requested size. Buffers grow in powers of two, and
+ * are only shrunk by ebpf_ext_per_cpu_buffer_trim, so that a request that fits in the buffer never allocates memory.
+ *
+ * The returned buffer is only valid on the current processor, until IRQL is lowered below DISPATCH_LEVEL or the
+ * buffer is requested again.
+ *
+ * @param[in, out] per_cpu_buffer Pointer to the buffer set.
+ * @param[in] size Number of bytes needed.
+ *
+ * @returns Pointer to the buffer, or NULL if it could not be grown to the requested size.
+ */
+_IRQL_requires_(DISPATCH_LEVEL) _Ret_maybenull_ uint8_t*
+ebpf_ext_per_cpu_buffer_get(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, size_t size);
+
+/**
+ * @brief Borrow a buffer from the pool, grown to at least the requested size like the per-CPU buffers. The buffer is
+ * owned by the caller, on any processor, until it is returned with ebpf_ext_per_cpu_buffer_release.
+ *
+ * @param[in, out] per_cpu_buffer Pointer to the buffer set.
+ * @param[in] size Number of bytes needed.
+ * @param[out] buffer_index Index of the borrowed buffer, to pass to ebpf_ext_per_cpu_buffer_release.
+ *
+ * @returns Pointer to the buffer, or NULL if no pooled buffer is available or it could not be grown to the requested
+ * size.
+ */
+_IRQL_requires_max_(APC_LEVEL) _Ret_maybenull_ uint8_t* ebpf_ext_per_cpu_buffer_acquire(
+    _Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, size_t size, _Out_ uint32_t* buffer_index);
+
+/**
+ * @brief Return a buffer borrowed with ebpf_ext_per_cpu_buffer_acquire to the pool.
+ *
+ * @param[in, out] per_cpu_buffer Pointer to the buffer set.
+ * @param[in] buffer_index Index of the borrowed buffer.
+ */
+void
+ebpf_ext_per_cpu_buffer_release(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, uint32_t buffer_index);
+
+/**
+ * @brief Reserve buffers of at least the given size for every processor and pooled slot, so that requests up to that
+ * size no longer allocate memory. The reserved buffers are swapped in by their owners on next use, and buffers are no
+ * longer shrunk below that size. Reservations only ever grow the buffers.
+ *
+ * @param[in, out] per_cpu_buffer Pointer to the buffer set.
+ * @param[in] size Number of bytes to reserve.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_INSUFFICIENT_RESOURCES Memory allocation failed, the buffers not reserved keep growing on demand.
+ */
+_IRQL_requires_(PASSIVE_LEVEL) _Must_inspect_result_ NTSTATUS
+    ebpf_ext_per_cpu_buffer_reserve(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, size_t size);
+
+/**
+ * @brief Shrink the buffers that have been much larger than needed for a while, down to a quarter of their size but
+ * not below the minimum size. Like reserved buffers, the smaller buffers are swapped in by their owners on next use,
+ * unless the buffers are no longer idle. Meant to be called periodically, so that requests never have to allocate
+ * memory to shrink a buffer. If memory cannot be allocated, the idle buffers are kept.
+ *
+ * @param[in, out] per_cpu_buffer Pointer to the buffer set.
+ */
+_IRQL_requires_(PASSIVE_LEVEL) void ebpf_ext_per_cpu_buffer_trim(_Inout_ ebpf_ext_per_cpu_buffer_t* per_cpu_buffer);
+
+/**
+ * @brief Get the usage statistics of a per-CPU buffer set.
+ *
+ * @param[in] per_cpu_buffer Pointer to the buffer set.
+ * @param[out] stats Aggregated statistics.
+ */
+void
+ebpf_ext_per_cpu_buffer_get_stats(
+    _In_ const ebpf_ext_per_cpu_buffer_t* per_cpu_buffer, _Out_ ebpf_ext_per_cpu_buffer_stats_t* stats);
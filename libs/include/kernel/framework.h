@@ -29,3 +29,36 @@
 #define ebpf_list_append_tail_list AppendTailList
 #define ebpf_probe_for_write ProbeForWrite
 #define ebpf_fault_injection_is_enabled() false
+#define ebpf_get_current_node_number KeGetCurrentNodeNumber
+
+// Get the NUMA node of a processor, given its index across all processor groups. Returns node 0 if it is not found.
+static __inline USHORT
+ebpf_get_processor_node_number(uint32_t processor_index)
+{
+    PROCESSOR_NUMBER processor_number;
+    GROUP_AFFINITY affinity;
+    USHORT count;
+
+    if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(processor_index, &processor_number))) {
+        return 0;
+    }
+    for (USHORT node = 0; node <= KeQueryHighestNodeNumber(); node++) {
+        KeQueryNodeActiveAffinity(node, &affinity, &count);
+        if (affinity.Group == processor_number.Group &&
+            (affinity.Mask & ((KAFFINITY)1 << processor_number.Number)) != 0) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+// Allocate uninitialized non-paged memory, preferably on the given NUMA node.
+static __inline void*
+ebpf_allocate_on_node(size_t size, ULONG tag, USHORT node)
+{
+    POOL_EXTENDED_PARAMETER parameter = {0};
+    parameter.Type = PoolExtendedParameterNumaNode;
+    parameter.Optional = TRUE;
+    parameter.PreferredNode = node;
+    return ExAllocatePool3(POOL_FLAG_NON_PAGED | POOL_FLAG_UNINITIALIZED, size, tag, &parameter, 1);
+}
@@ -10,6 +10,8 @@
 #include "usersim\ps.h"
 #include "usersim\rtl.h"
 #include "usersim\se.h"
+#include "usersim_netevent.h"
+#include "usersim_ntos.h"
 
 #define ebpf_fault_injection_is_enabled() cxplat_fault_injection_is_enabled()
 
@@ -96,6 +98,27 @@ extern "C"
         UNREFERENCED_PARAMETER(length);
     }
 
+    inline USHORT
+    ebpf_get_current_node_number()
+    {
+        return 0;
+    }
+
+    inline USHORT
+    ebpf_get_processor_node_number(uint32_t processor_index)
+    {
+        UNREFERENCED_PARAMETER(processor_index);
+        return 0;
+    }
+
+    // NUMA placement is not simulated in user mode.
+    inline void*
+    ebpf_allocate_on_node(size_t size, ULONG tag, USHORT node)
+    {
+        UNREFERENCED_PARAMETER(node);
+        return ExAllocatePoolUninitialized(NonPagedPoolNx, size, tag);
+    }
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Kernel routines used by the netevent extension that usersim does not provide, along with the types they take. They
+// are implemented by neteventebpfext_user.
+
+#include "usersim\ps.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct _KAPC_STATE
+    {
+        ULONG_PTR reserved[6];
+    } KAPC_STATE, *PKAPC_STATE, *PRKAPC_STATE;
+
+    // User mode only runs in a single process, so attaching to a process does nothing.
+    void
+    KeStackAttachProcess(_Inout_ PEPROCESS process, _Out_ PRKAPC_STATE apc_state);
+
+    void
+    KeUnstackDetachProcess(_In_ PRKAPC_STATE apc_state);
+
+#ifdef __cplusplus
+}
+#endif
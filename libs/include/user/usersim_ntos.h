@@ -0,0 +1,330 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Kernel routines used by the ntos hooks that usersim does not provide, along with the types they take. They are
+// implemented by ntosebpfext_user, which keeps the notify routines and callbacks registered by the hooks so that tests
+// can invoke them, as usersime_invoke_process_creation_notify_routine does for the process hook.
+
+#include "usersim\ob.h"
+#include "usersim\ps.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef OBJ_KERNEL_HANDLE
+#define OBJ_KERNEL_HANDLE 0x00000200L
+#endif
+
+    // Process and thread objects passed to the ntos hooks in user mode.
+    typedef struct _usersim_ntos_object
+    {
+        HANDLE process_id;
+        HANDLE thread_id; ///< NULL for a process.
+    } usersim_ntos_object_t;
+
+    extern POBJECT_TYPE* PsProcessType;
+    extern POBJECT_TYPE* PsThreadType;
+
+    HANDLE
+    PsGetProcessId(_In_ PEPROCESS process);
+
+    HANDLE
+    PsGetThreadId(_In_ PETHREAD thread);
+
+    HANDLE
+    PsGetThreadProcessId(_In_ PETHREAD thread);
+
+    //
+    // Thread notifications.
+    //
+
+    typedef void (*PCREATE_THREAD_NOTIFY_ROUTINE)(_In_ HANDLE process_id, _In_ HANDLE thread_id, _In_ BOOLEAN create);
+
+    NTSTATUS
+    PsSetCreateThreadNotifyRoutine(_In_ PCREATE_THREAD_NOTIFY_ROUTINE notify_routine);
+
+    NTSTATUS
+    PsRemoveCreateThreadNotifyRoutine(_In_ PCREATE_THREAD_NOTIFY_ROUTINE notify_routine);
+
+    // Threads cannot be looked up in user mode, this fails as for a thread that already exited.
+    NTSTATUS
+    PsLookupThreadByThreadId(_In_ HANDLE thread_id, _Outptr_ PETHREAD* thread);
+
+    NTSTATUS
+    ObOpenObjectByPointer(
+        _In_ PVOID object,
+        _In_ ULONG handle_attributes,
+        _In_opt_ PVOID passed_access_state,
+        _In_ ACCESS_MASK desired_access,
+        _In_opt_ POBJECT_TYPE object_type,
+        _In_ KPROCESSOR_MODE access_mode,
+        _Out_ PHANDLE handle);
+
+#define ThreadQuerySetWin32StartAddress 9
+
+    NTSTATUS
+    ZwQueryInformationThread(
+        _In_ HANDLE thread_handle,
+        _In_ ULONG thread_information_class,
+        _Out_writes_bytes_(thread_information_length) PVOID thread_information,
+        _In_ ULONG thread_information_length,
+        _Out_opt_ PULONG return_length);
+
+    void
+    usersim_ntos_invoke_thread_notify_routine(_In_ HANDLE process_id, _In_ HANDLE thread_id, BOOLEAN create);
+
+    //
+    // Image load notifications.
+    //
+
+    typedef struct _IMAGE_INFO
+    {
+        union
+        {
+            ULONG Properties;
+            struct
+            {
+                ULONG ImageAddressingMode : 8;
+                ULONG SystemModeImage : 1;
+                ULONG ImageMappedToAllPids : 1;
+                ULONG ExtendedInfoPresent : 1;
+                ULONG MachineTypeMismatch : 1;
+                ULONG ImageSignatureLevel : 4;
+                ULONG ImageSignatureType : 3;
+                ULONG ImagePartialMap : 1;
+                ULONG Reserved : 12;
+            };
+        };
+        PVOID ImageBase;
+        ULONG ImageSelector;
+        SIZE_T ImageSize;
+        ULONG ImageSectionNumber;
+    } IMAGE_INFO, *PIMAGE_INFO;
+
+    typedef void (*PLOAD_IMAGE_NOTIFY_ROUTINE)(
+        _In_opt_ PUNICODE_STRING full_image_name, _In_ HANDLE process_id, _In_ PIMAGE_INFO image_info);
+
+#define PS_IMAGE_NOTIFY_CONFLICTING_ARCHITECTURE 0x1
+
+    NTSTATUS
+    PsSetLoadImageNotifyRoutineEx(_In_ PLOAD_IMAGE_NOTIFY_ROUTINE notify_routine, _In_ ULONG_PTR flags);
+
+    NTSTATUS
+    PsRemoveLoadImageNotifyRoutine(_In_ PLOAD_IMAGE_NOTIFY_ROUTINE notify_routine);
+
+    void
+    usersim_ntos_invoke_load_image_notify_routine(
+        _In_opt_ PUNICODE_STRING full_image_name, _In_ HANDLE process_id, _In_ PIMAGE_INFO image_info);
+
+    //
+    // Registry callbacks. Only the pre-operation notifications the registry hook handles are defined.
+    //
+
+    typedef enum _REG_NOTIFY_CLASS
+    {
+        RegNtPreDeleteKey = 0,
+        RegNtPreSetValueKey = 1,
+        RegNtPreDeleteValueKey = 2,
+        RegNtPreRenameKey = 4,
+        RegNtPreQueryValueKey = 8,
+        RegNtPreCreateKeyEx = 26,
+        RegNtPreOpenKeyEx = 28,
+    } REG_NOTIFY_CLASS;
+
+    typedef struct _REG_CREATE_KEY_INFORMATION
+    {
+        PUNICODE_STRING CompleteName;
+        PVOID RootObject;
+        PVOID ObjectType;
+        ULONG CreateOptions;
+        PUNICODE_STRING Class;
+        PVOID SecurityDescriptor;
+        PVOID SecurityQualityOfService;
+        ACCESS_MASK DesiredAccess;
+        ACCESS_MASK GrantedAccess;
+        PULONG Disposition;
+        PVOID* ResultObject;
+        PVOID CallContext;
+        PVOID RootObjectContext;
+        PVOID Transaction;
+        PVOID Reserved;
+    } REG_CREATE_KEY_INFORMATION, REG_OPEN_KEY_INFORMATION, *PREG_CREATE_KEY_INFORMATION, *PREG_OPEN_KEY_INFORMATION;
+
+    typedef struct _REG_DELETE_KEY_INFORMATION
+    {
+        PVOID Object;
+        PVOID CallContext;
+        PVOID ObjectContext;
+        PVOID Reserved;
+    } REG_DELETE_KEY_INFORMATION, *PREG_DELETE_KEY_INFORMATION;
+
+    typedef struct _REG_RENAME_KEY_INFORMATION
+    {
+        PVOID Object;
+        PUNICODE_STRING NewName;
+        PVOID CallContext;
+        PVOID ObjectContext;
+        PVOID Reserved;
+    } REG_RENAME_KEY_INFORMATION, *PREG_RENAME_KEY_INFORMATION;
+
+    typedef struct _REG_SET_VALUE_KEY_INFORMATION
+    {
+        PVOID Object;
+        PUNICODE_STRING ValueName;
+        ULONG TitleIndex;
+        ULONG Type;
+        PVOID Data;
+        ULONG DataSize;
+        PVOID CallContext;
+        PVOID ObjectContext;
+        PVOID Reserved;
+    } REG_SET_VALUE_KEY_INFORMATION, *PREG_SET_VALUE_KEY_INFORMATION;
+
+    typedef struct _REG_DELETE_VALUE_KEY_INFORMATION
+    {
+        PVOID Object;
+        PUNICODE_STRING ValueName;
+        PVOID CallContext;
+        PVOID ObjectContext;
+        PVOID Reserved;
+    } REG_DELETE_VALUE_KEY_INFORMATION, *PREG_DELETE_VALUE_KEY_INFORMATION;
+
+    typedef struct _REG_QUERY_VALUE_KEY_INFORMATION
+    {
+        PVOID Object;
+        PUNICODE_STRING ValueName;
+        ULONG KeyValueInformationClass; ///< KEY_VALUE_INFORMATION_CLASS.
+        PVOID KeyValueInformation;
+        ULONG Length;
+        PULONG ResultLength;
+        PVOID CallContext;
+        PVOID ObjectContext;
+        PVOID Reserved;
+    } REG_QUERY_VALUE_KEY_INFORMATION, *PREG_QUERY_VALUE_KEY_INFORMATION;
+
+    typedef NTSTATUS (*PEX_CALLBACK_FUNCTION)(
+        _In_ PVOID callback_context, _In_opt_ PVOID argument1, _In_opt_ PVOID argument2);
+
+    NTSTATUS
+    CmRegisterCallbackEx(
+        _In_ PEX_CALLBACK_FUNCTION function,
+        _In_ PCUNICODE_STRING altitude,
+        _In_ PVOID driver,
+        _In_opt_ PVOID context,
+        _Out_ PLARGE_INTEGER cookie,
+        _Reserved_ PVOID reserved);
+
+    NTSTATUS
+    CmUnRegisterCallback(_In_ LARGE_INTEGER cookie);
+
+    // Key objects cannot be resolved in user mode, so this always fails.
+    NTSTATUS
+    CmCallbackGetKeyObjectIDEx(
+        _In_ PLARGE_INTEGER cookie,
+        _In_ PVOID object,
+        _Out_opt_ PULONG_PTR object_id,
+        _Outptr_opt_ PCUNICODE_STRING* object_name,
+        _In_ ULONG flags);
+
+    void
+    CmCallbackReleaseKeyObjectIDEx(_In_opt_ PCUNICODE_STRING object_name);
+
+    // Invoke the registry callback, and return its verdict. Succeeds if no callback is registered.
+    NTSTATUS
+    usersim_ntos_invoke_registry_callback(REG_NOTIFY_CLASS notify_class, _In_opt_ PVOID argument2);
+
+    //
+    // Object callbacks.
+    //
+
+    typedef ULONG OB_OPERATION;
+#define OB_OPERATION_HANDLE_CREATE 0x00000001
+#define OB_OPERATION_HANDLE_DUPLICATE 0x00000002
+#define OB_FLT_REGISTRATION_VERSION 0x0100
+
+    typedef enum _OB_PREOP_CALLBACK_STATUS
+    {
+        OB_PREOP_SUCCESS
+    } OB_PREOP_CALLBACK_STATUS, *POB_PREOP_CALLBACK_STATUS;
+
+    typedef struct _OB_PRE_CREATE_HANDLE_INFORMATION
+    {
+        ACCESS_MASK DesiredAccess;
+        ACCESS_MASK OriginalDesiredAccess;
+    } OB_PRE_CREATE_HANDLE_INFORMATION, *POB_PRE_CREATE_HANDLE_INFORMATION;
+
+    typedef struct _OB_PRE_DUPLICATE_HANDLE_INFORMATION
+    {
+        ACCESS_MASK DesiredAccess;
+        ACCESS_MASK OriginalDesiredAccess;
+        PVOID SourceProcess;
+        PVOID TargetProcess;
+    } OB_PRE_DUPLICATE_HANDLE_INFORMATION, *POB_PRE_DUPLICATE_HANDLE_INFORMATION;
+
+    typedef union _OB_PRE_OPERATION_PARAMETERS
+    {
+        OB_PRE_CREATE_HANDLE_INFORMATION CreateHandleInformation;
+        OB_PRE_DUPLICATE_HANDLE_INFORMATION DuplicateHandleInformation;
+    } OB_PRE_OPERATION_PARAMETERS, *POB_PRE_OPERATION_PARAMETERS;
+
+    typedef struct _OB_PRE_OPERATION_INFORMATION
+    {
+        OB_OPERATION Operation;
+        union
+        {
+            ULONG Flags;
+            struct
+            {
+                ULONG KernelHandle : 1;
+                ULONG Reserved : 31;
+            };
+        };
+        PVOID Object;
+        POBJECT_TYPE ObjectType;
+        PVOID CallContext;
+        POB_PRE_OPERATION_PARAMETERS Parameters;
+    } OB_PRE_OPERATION_INFORMATION, *POB_PRE_OPERATION_INFORMATION;
+
+    typedef struct _OB_POST_OPERATION_INFORMATION OB_POST_OPERATION_INFORMATION, *POB_POST_OPERATION_INFORMATION;
+
+    typedef OB_PREOP_CALLBACK_STATUS (*POB_PRE_OPERATION_CALLBACK)(
+        _In_ PVOID registration_context, _Inout_ POB_PRE_OPERATION_INFORMATION operation_information);
+
+    typedef void (*POB_POST_OPERATION_CALLBACK)(
+        _In_ PVOID registration_context, _In_ POB_POST_OPERATION_INFORMATION operation_information);
+
+    typedef struct _OB_OPERATION_REGISTRATION
+    {
+        POBJECT_TYPE* ObjectType;
+        OB_OPERATION Operations;
+        POB_PRE_OPERATION_CALLBACK PreOperation;
+        POB_POST_OPERATION_CALLBACK PostOperation;
+    } OB_OPERATION_REGISTRATION, *POB_OPERATION_REGISTRATION;
+
+    typedef struct _OB_CALLBACK_REGISTRATION
+    {
+        USHORT Version;
+        USHORT OperationRegistrationCount;
+        UNICODE_STRING Altitude;
+        PVOID RegistrationContext;
+        OB_OPERATION_REGISTRATION* OperationRegistration;
+    } OB_CALLBACK_REGISTRATION, *POB_CALLBACK_REGISTRATION;
+
+    NTSTATUS
+    ObRegisterCallbacks(_In_ POB_CALLBACK_REGISTRATION callback_registration, _Outptr_ PVOID* registration_handle);
+
+    void
+    ObUnRegisterCallbacks(_In_ PVOID registration_handle);
+
+    // Invoke the pre-operation callback registered for the object type and operation of operation_information, whose
+    // Object must point to a usersim_ntos_object_t. Does nothing if no callback is registered for them.
+    void
+    usersim_ntos_invoke_object_pre_operation_callback(_Inout_ POB_PRE_OPERATION_INFORMATION operation_information);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include "ebpf_netevent_npi.h"
+#include "ebpf_windows.h"
+#include "netevent_types.h"
+
 // Define the NPI version and provider characteristics version
 #define NPI_CURRENT_CLIENT_REVISION 1
 #define NPI_PROVIDER_CHARACTERISTICS_VERSION 1
@@ -29,23 +33,12 @@ typedef struct PROVIDER_BINDING_CONTEXT_
     void* client_binding_context;                             // Binding context of the attached client
 } PROVIDER_BINDING_CONTEXT;
 
-typedef struct _netevent_header
-{
-    USHORT Size;
-    USHORT Version;
-
-} netevent_header;
-
-typedef struct PROVIDER_NPI_SPECIFIC_CHARACTERISTICS_
-{
-    netevent_header Header;
-} PROVIDER_NPI_SPECIFIC_CHARACTERISTICS;
-
-// Define the provider module's NPI specific characteristics=
-PROVIDER_NPI_SPECIFIC_CHARACTERISTICS const netevent_npi_specific_characteristics = {
-    .Header =
-        {
-            .Size = sizeof(PROVIDER_NPI_SPECIFIC_CHARACTERISTICS),
-            .Version = 2,
-        },
+// Define the provider module's NPI specific characteristics. The events are pushed in bursts from a static array,
+// which programs may run on directly. In load generator mode, the largest event size is raised and zero copy is
+// withdrawn before registration.
+netevent_provider_characteristics_t netevent_npi_specific_characteristics = {
+    .size = sizeof(netevent_provider_characteristics_t),
+    .version = NETEVENT_PROVIDER_CHARACTERISTICS_VERSION_CAPABILITIES,
+    .capabilities = NETEVENT_CAPABILITY_BATCH | NETEVENT_CAPABILITY_ZERO_COPY,
+    .max_event_size = sizeof(netevent_message_t),
 };
@@ -6,8 +6,9 @@
 #include <wdm.h>
 #include <wsk.h>
 // clang-format on
-#include "netevent_npi_client.h"
 #include "netevent_npi_provider.h"
+#include "netevent_sim_load.h"
+#include "netevent_sim_replay.h"
 #include "netevent_types.h"
 
 #include <guiddef.h>
@@ -16,13 +17,17 @@
 // Registry key path and value name for the event interval
 #define EVENT_INTERVAL_KEY_PATH L"\\Registry\\Machine\\Software\\eBPF\\Parameters"
 #define EVENT_INTERVAL_VALUE_NAME L"NetEventInterval"
+#define EVENT_BURST_SIZE_VALUE_NAME L"NetEventBurstSize"
 #define DEFAULT_EVENT_INTERVAL 1U // milliseconds
+#define DEFAULT_EVENT_BURST_SIZE 1U
+#define MAX_EVENT_BURST_SIZE 256U
 #define DISPATCH_IRQL_EVENT_INTERVAL 2U
 
 DRIVER_INITIALIZE DriverEntry;
 DRIVER_UNLOAD DriverUnload;
 KDEFERRED_ROUTINE timer_dpc_routine;
 LONG g_event_interval = 0;
+ULONG g_event_burst_size = 0;
 
 // Function prototypes
 static NTSTATUS
@@ -50,7 +55,14 @@ static KTIMER _timer;
 static KDPC _timer_dpc;
 static EX_RUNDOWN_REF _rundown_ref;
 volatile LONG _event_counter = 0;
+// Events of the current burst. The timer DPC is the only user, and it never runs concurrently with itself.
+static netevent_message_t _burst_events[MAX_EVENT_BURST_SIZE];
+static netevent_event_t _burst_event_infos[MAX_EVENT_BURST_SIZE];
 static HANDLE _netevent_provider_handle;
+// Configuration of the load generator, which replaces the timer when its rate is not 0.
+static netevent_load_config_t _load_config;
+// Configuration of the trace replay, which replaces the timer and the load generator when a trace file is set.
+static netevent_replay_config_t _replay_config;
 const NPI_PROVIDER_CHARACTERISTICS _netevent_provider_characteristics = {
     .Version = NPI_PROVIDER_CHARACTERISTICS_VERSION,
     .Length = sizeof(NPI_PROVIDER_CHARACTERISTICS),
@@ -93,42 +105,62 @@ timer_dpc_routine(
             return;
         }
 
-        // Create a test event
-        LONG counter = InterlockedIncrement(&_event_counter);
-        netevent_message_t demo_event = {
-            .header =
-                {.EventId = NOTIFY_EVENT_TYPE_NETEVENT_LOG,
-                 .PacketDescriptor = {.PacketMetaDataLength = sizeof(PKTMON_EVT_STREAM_METADATA)}},
-            .payload = {
-                .event_id = NOTIFY_EVENT_TYPE_NETEVENT_LOG,
-                .source_ip = {192, 168, 1, 1},
-                .destination_ip = {10, 11, 12, 1},
-                .source_port = 12345,
-                .destination_port = 80,
-                .event_counter = counter}};
-
-        if (_netevent_provider_binding_context.client_dispatch->capture_type == NeteventCapture_Drop) {
-            demo_event.header.EventId = NOTIFY_EVENT_TYPE_NETEVENT_DROP;
-            demo_event.header.Metadata.DropReason = DROP_REASON_SECURITY_POLICY;
-            demo_event.payload.event_id = NOTIFY_EVENT_TYPE_NETEVENT_DROP;
+        const netevent_ext_function_addresses_t* client_dispatch = _netevent_provider_binding_context.client_dispatch;
+        BOOLEAN push_events_supported =
+            client_dispatch->header.version >= EBPF_NETEVENT_EXTENSION_VERSION_PUSH_EVENTS &&
+            client_dispatch->helper_function_count >= 2;
+        LONG counter = 0;
+
+        // Create a burst of test events
+        for (ULONG index = 0; index < g_event_burst_size; index++) {
+            netevent_message_t* demo_event = &_burst_events[index];
+            counter = InterlockedIncrement(&_event_counter);
+            *demo_event = (netevent_message_t){
+                .header =
+                    {.EventId = NOTIFY_EVENT_TYPE_NETEVENT_LOG,
+                     .PacketDescriptor = {.PacketMetaDataLength = sizeof(PKTMON_EVT_STREAM_METADATA)}},
+                .payload = {
+                    .event_id = NOTIFY_EVENT_TYPE_NETEVENT_LOG,
+                    .source_ip = {192, 168, 1, 1},
+                    .destination_ip = {10, 11, 12, 1},
+                    .source_port = 12345,
+                    .destination_port = 80,
+                    .event_counter = counter}};
+
+            if (client_dispatch->capture_type == NeteventCapture_Drop) {
+                demo_event->header.EventId = NOTIFY_EVENT_TYPE_NETEVENT_DROP;
+                demo_event->header.Metadata.DropReason = DROP_REASON_SECURITY_POLICY;
+                demo_event->payload.event_id = NOTIFY_EVENT_TYPE_NETEVENT_DROP;
+            }
+
+            // Create the event payload
+            _burst_event_infos[index].event_start = (uint8_t*)demo_event;
+            _burst_event_infos[index].event_end = (uint8_t*)demo_event + sizeof(*demo_event);
         }
 
-        // Create the event payload
-        netevent_event_info_t event_payload = {
-            .event_data_start = (unsigned char*)&demo_event,
-            .event_data_end = (unsigned char*)&demo_event + sizeof(demo_event)};
-
-        // Invoke the NPI client's push_event_helper routine
-        netevent_push_event push_event_helper =
-            (netevent_push_event)(_netevent_provider_binding_context.client_dispatch->helper_function_address[0]);
-
+        KIRQL old_irql = PASSIVE_LEVEL;
+        BOOLEAN irql_raised = FALSE;
         if ((counter % DISPATCH_IRQL_EVENT_INTERVAL) == 0) {
-            KIRQL old_irql;
             KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
-            push_event_helper(&event_payload);
-            KeLowerIrql(old_irql);
+            irql_raised = TRUE;
+        }
+
+        // Invoke the NPI client's push_events helper routine for the whole burst when it is supported, or its
+        // push_event helper routine for each event otherwise.
+        if (push_events_supported && g_event_burst_size > 1) {
+            netevent_push_events_t push_events_helper =
+                (netevent_push_events_t)(client_dispatch->helper_function_address[1]);
+            push_events_helper(_burst_event_infos, g_event_burst_size);
         } else {
-            push_event_helper(&event_payload);
+            netevent_push_event_t push_event_helper =
+                (netevent_push_event_t)(client_dispatch->helper_function_address[0]);
+            for (ULONG index = 0; index < g_event_burst_size; index++) {
+                push_event_helper(&_burst_event_infos[index]);
+            }
+        }
+
+        if (irql_raised) {
+            KeLowerIrql(old_irql);
         }
 
         // Release the rundown protection
@@ -164,8 +196,14 @@ _netevent_provider_attach_client(
         *provider_dispatch = NULL;
     }
 
-    // Lastly,start the timer (if it's not already running)
-    if (!KeCancelTimer(&_timer)) {
+    // Lastly, start the trace replay, the load generator, or the timer (if it's not already running)
+    if (_replay_config.file_path.Length != 0) {
+        return netevent_replay_start(
+            &_replay_config, EVENT_INTERVAL_KEY_PATH, (const netevent_ext_function_addresses_t*)client_dispatch);
+    } else if (_load_config.rate != 0) {
+        return netevent_load_start(
+            &_load_config, EVENT_INTERVAL_KEY_PATH, (const netevent_ext_function_addresses_t*)client_dispatch);
+    } else if (!KeCancelTimer(&_timer)) {
         // Timer is not yet running, so initialize and start it
         LARGE_INTEGER due_time;
         due_time.QuadPart = -g_event_interval;
@@ -182,8 +220,10 @@ _netevent_provider_detach_client(_In_ HANDLE provider_binding_context)
 {
     UNREFERENCED_PARAMETER(provider_binding_context);
 
-    // Stop the timer if it's running
+    // Stop the timer, the load generator or the trace replay if it's running
     KeCancelTimer(&_timer);
+    netevent_load_stop();
+    netevent_replay_stop();
 
     return STATUS_SUCCESS;
 }
@@ -222,14 +262,38 @@ read_event_interval(
     return STATUS_INVALID_PARAMETER;
 }
 
+NTSTATUS
+read_event_burst_size(
+    _In_ PWSTR value_name,
+    _In_ ULONG value_type,
+    _In_ PVOID value_data,
+    _In_ ULONG value_length,
+    _Inout_ PVOID context,
+    _In_ PVOID entry_context)
+{
+    UNREFERENCED_PARAMETER(value_name);
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(entry_context);
+
+    if (value_type == REG_DWORD && value_length == sizeof(ULONG)) {
+        g_event_burst_size = *(PULONG)value_data;
+        return STATUS_SUCCESS;
+    }
+
+    return STATUS_INVALID_PARAMETER;
+}
+
 // Driver unload routine
 _Use_decl_annotations_ void
 DriverUnload(_In_ PDRIVER_OBJECT DriverObject)
 {
     UNREFERENCED_PARAMETER(DriverObject);
 
-    // Stop the timer
+    // Stop the timer, the load generator and the trace replay
     KeCancelTimer(&_timer);
+    netevent_load_stop();
+    netevent_replay_stop();
+    netevent_replay_free_config(&_replay_config);
 
     // Wait for the client callbacks to complete
     ExWaitForRundownProtectionRelease(&_rundown_ref);
@@ -267,6 +331,38 @@ DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING RegistryPath)
         g_event_interval = DEFAULT_EVENT_INTERVAL;
     }
 
+    // Number of events generated on each timer tick, pushed as one burst.
+    RTL_QUERY_REGISTRY_TABLE burst_size_query_table[] = {
+        {
+            .QueryRoutine = read_event_burst_size,
+            .Flags = RTL_QUERY_REGISTRY_DIRECT,
+            .Name = EVENT_BURST_SIZE_VALUE_NAME,
+            .EntryContext = &g_event_burst_size,
+            .DefaultType = REG_DWORD,
+            .DefaultData = &g_event_burst_size,
+            .DefaultLength = sizeof(ULONG)},
+        {0}};
+    status = RtlQueryRegistryValues(RTL_REGISTRY_ABSOLUTE, EVENT_INTERVAL_KEY_PATH, burst_size_query_table, NULL, NULL);
+    if (!NT_SUCCESS(status) || g_event_burst_size == 0) {
+        g_event_burst_size = DEFAULT_EVENT_BURST_SIZE;
+    }
+    g_event_burst_size = min(g_event_burst_size, MAX_EVENT_BURST_SIZE);
+
+    // The load generator pushes larger events than the timer, announce them to the extension. Its event templates are
+    // shared by all the CPUs, so they must not be handed to the programs.
+    netevent_load_read_config(EVENT_INTERVAL_KEY_PATH, g_event_burst_size, &_load_config);
+    if (_load_config.rate != 0) {
+        netevent_npi_specific_characteristics.max_event_size =
+            sizeof(PKTMON_EVT_STREAM_PACKET_HEADER) + _load_config.payload_max;
+        netevent_npi_specific_characteristics.capabilities &= ~NETEVENT_CAPABILITY_ZERO_COPY;
+    }
+
+    // The events of a trace are only bounded by the trace format.
+    netevent_replay_read_config(EVENT_INTERVAL_KEY_PATH, &_replay_config);
+    if (_replay_config.file_path.Length != 0) {
+        netevent_npi_specific_characteristics.max_event_size = NETEVENT_TRACE_MAX_EVENT_LENGTH;
+    }
+
     // Specify the driver unload function
     DriverObject->DriverUnload = DriverUnload;
 
@@ -280,6 +376,9 @@ DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING RegistryPath)
     // Register the provider with the NMR
     status = NmrRegisterProvider(
         &_netevent_provider_characteristics, &_netevent_provider_registration_context, &_netevent_provider_handle);
+    if (!NT_SUCCESS(status)) {
+        netevent_replay_free_config(&_replay_config);
+    }
 
     return status;
 }
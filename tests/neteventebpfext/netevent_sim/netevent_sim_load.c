@@ -0,0 +1,580 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#define NO_CRT
+// clang-format off
+#include <wdm.h>
+// clang-format on
+#include "netevent_sim_load.h"
+#include "netevent_types.h"
+
+#define LOAD_POOL_TAG 'dlSN'
+#define LOAD_TIMER_PERIOD (10 * 1000)               // 1 millisecond, in 100 ns units
+#define LOAD_REPORT_INTERVAL (-10LL * 1000 * 1000) // 1 second, relative, in 100 ns units
+#define LOAD_MAX_BURST_SIZE 256U
+#define LOAD_MAX_TICK_BURSTS 16U    // Bursts generated by a processor on a timer tick, at most
+#define LOAD_MAX_PENDING_BURSTS 64U // Bursts waiting for the thread of a processor, at most
+#define DEFAULT_LOAD_PAYLOAD_MIN ((ULONG)sizeof(netevent_payload_t))
+#define DEFAULT_LOAD_PAYLOAD_MAX 1500U
+#define DEFAULT_LOAD_DROP_PERCENT 50U
+#define DEFAULT_LOAD_FLOW_PERCENT 50U
+#define DEFAULT_LOAD_PASSIVE_PERCENT 0U
+
+typedef enum _netevent_load_event_type
+{
+    LoadEventType_Drop,
+    LoadEventType_Flow,
+    LoadEventType_Other,
+    LoadEventType_Count
+} netevent_load_event_type_t;
+
+// State of a generating processor. The DPC and the thread each have their own random state and events, so that they
+// never share a cache line they write to.
+typedef struct DECLSPEC_CACHEALIGN _netevent_load_cpu
+{
+    ULONG processor_index;
+    ULONG rate;            // Share of the target rate of this processor, in events per second.
+    KDPC dpc;              // Pushes the DISPATCH_LEVEL bursts, targeted to the processor.
+    PKTHREAD thread;       // Pushes the PASSIVE_LEVEL bursts, affinitized to the processor.
+    KEVENT thread_event;   // Signaled when bursts are pending for the thread, and on stop.
+    LONGLONG last_counter; // Performance counter of the last DPC run.
+    ULONGLONG credit;      // Events owed, scaled by the performance counter frequency.
+    ULONG dpc_random;
+    netevent_event_t dpc_event_infos[LOAD_MAX_BURST_SIZE];
+
+    DECLSPEC_CACHEALIGN volatile LONG passive_pending; // Events waiting for the thread.
+    ULONG thread_random;
+    netevent_event_t thread_event_infos[LOAD_MAX_BURST_SIZE];
+
+    // Counters, read by the reporter thread.
+    DECLSPEC_CACHEALIGN volatile LONG64 dispatch_pushed;
+    volatile LONG64 passive_pushed;
+    volatile LONG64 missed;
+} netevent_load_cpu_t;
+
+typedef struct _netevent_load
+{
+    netevent_load_config_t config;
+    PCWSTR key_path;
+    const netevent_ext_function_addresses_t* client_dispatch;
+    BOOLEAN push_events_supported;
+    volatile LONG stopping;
+    ULONGLONG frequency; // Performance counter frequency.
+    PEX_TIMER timer;
+    KEVENT stop_event; // Signaled on stop, to end the reporter thread.
+    PKTHREAD reporter_thread;
+    // Read-only events, one per event type, with the largest payload. Shorter events only use their beginning.
+    unsigned char* event_templates[LoadEventType_Count];
+    ULONG cpu_count;
+    netevent_load_cpu_t* cpus;
+} netevent_load_t;
+
+static netevent_load_t* _load = NULL;
+
+void
+netevent_load_read_config(_In_z_ PCWSTR key_path, ULONG burst_size, _Out_ netevent_load_config_t* config)
+{
+    *config = (netevent_load_config_t){
+        .rate = 0,
+        .processor_count = 0,
+        .burst_size = burst_size,
+        .payload_min = DEFAULT_LOAD_PAYLOAD_MIN,
+        .payload_max = DEFAULT_LOAD_PAYLOAD_MAX,
+        .payload_distribution = NeteventLoadPayload_Uniform,
+        .drop_percent = DEFAULT_LOAD_DROP_PERCENT,
+        .flow_percent = DEFAULT_LOAD_FLOW_PERCENT,
+        .passive_percent = DEFAULT_LOAD_PASSIVE_PERCENT};
+
+    // Missing values keep their default.
+#define LOAD_QUERY_ENTRY(value_name, field)                                 \
+    {.Flags = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK,     \
+     .Name = (PWSTR)(value_name),                                           \
+     .EntryContext = &config->field,                                        \
+     .DefaultType = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE}
+    RTL_QUERY_REGISTRY_TABLE query_table[] = {
+        LOAD_QUERY_ENTRY(LOAD_RATE_VALUE_NAME, rate),
+        LOAD_QUERY_ENTRY(LOAD_PROCESSOR_COUNT_VALUE_NAME, processor_count),
+        LOAD_QUERY_ENTRY(LOAD_PAYLOAD_MIN_VALUE_NAME, payload_min),
+        LOAD_QUERY_ENTRY(LOAD_PAYLOAD_MAX_VALUE_NAME, payload_max),
+        LOAD_QUERY_ENTRY(LOAD_PAYLOAD_DISTRIBUTION_VALUE_NAME, payload_distribution),
+        LOAD_QUERY_ENTRY(LOAD_DROP_PERCENT_VALUE_NAME, drop_percent),
+        LOAD_QUERY_ENTRY(LOAD_FLOW_PERCENT_VALUE_NAME, flow_percent),
+        LOAD_QUERY_ENTRY(LOAD_PASSIVE_PERCENT_VALUE_NAME, passive_percent),
+        {0}};
+#undef LOAD_QUERY_ENTRY
+    (void)RtlQueryRegistryValues(RTL_REGISTRY_ABSOLUTE, key_path, query_table, NULL, NULL);
+
+    config->burst_size = max(1, min(config->burst_size, LOAD_MAX_BURST_SIZE));
+    config->payload_max = max(DEFAULT_LOAD_PAYLOAD_MIN, min(config->payload_max, LOAD_MAX_PAYLOAD_SIZE));
+    config->payload_min = max(DEFAULT_LOAD_PAYLOAD_MIN, min(config->payload_min, config->payload_max));
+    if (config->payload_distribution > NeteventLoadPayload_Imix) {
+        config->payload_distribution = NeteventLoadPayload_Uniform;
+    }
+    config->drop_percent = min(config->drop_percent, 100);
+    config->flow_percent = min(config->flow_percent, 100 - config->drop_percent);
+    config->passive_percent = min(config->passive_percent, 100);
+}
+
+// xorshift32, which is good enough to pick event types and sizes.
+static inline ULONG
+_netevent_load_random(_Inout_ ULONG* state)
+{
+    ULONG value = *state;
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+    *state = value;
+    return value;
+}
+
+static ULONG
+_netevent_load_payload_size(_Inout_ ULONG* random)
+{
+    const netevent_load_config_t* config = &_load->config;
+    ULONG value = _netevent_load_random(random);
+
+    if (config->payload_distribution == NeteventLoadPayload_Imix) {
+        value %= 12;
+        if (value < 7) {
+            return config->payload_min;
+        } else if (value < 11) {
+            return (config->payload_min + config->payload_max) / 2;
+        }
+        return config->payload_max;
+    }
+
+    return config->payload_min + value % (config->payload_max - config->payload_min + 1);
+}
+
+static unsigned char*
+_netevent_load_event_template(_Inout_ ULONG* random)
+{
+    const netevent_load_config_t* config = &_load->config;
+    ULONG value = _netevent_load_random(random) % 100;
+
+    if (value < config->drop_percent) {
+        return _load->event_templates[LoadEventType_Drop];
+    } else if (value < config->drop_percent + config->flow_percent) {
+        return _load->event_templates[LoadEventType_Flow];
+    }
+    return _load->event_templates[LoadEventType_Other];
+}
+
+// Pick the type and the size of each event of a burst, and push it to the client.
+static void
+_netevent_load_push_burst(_Inout_ ULONG* random, _Out_writes_(count) netevent_event_t* event_infos, ULONG count)
+{
+    const netevent_ext_function_addresses_t* client_dispatch = _load->client_dispatch;
+
+    for (ULONG index = 0; index < count; index++) {
+        unsigned char* event = _netevent_load_event_template(random);
+        event_infos[index].event_start = event;
+        event_infos[index].event_end =
+            event + sizeof(PKTMON_EVT_STREAM_PACKET_HEADER) + _netevent_load_payload_size(random);
+    }
+
+    if (_load->push_events_supported && count > 1) {
+        netevent_push_events_t push_events_helper =
+            (netevent_push_events_t)(client_dispatch->helper_function_address[1]);
+        push_events_helper(event_infos, count);
+    } else {
+        netevent_push_event_t push_event_helper = (netevent_push_event_t)(client_dispatch->helper_function_address[0]);
+        for (ULONG index = 0; index < count; index++) {
+            push_event_helper(&event_infos[index]);
+        }
+    }
+}
+
+// Generate the events owed by a processor since its last run. The bursts picked for PASSIVE_LEVEL are handed over to
+// the thread of the processor.
+static void
+_netevent_load_dpc_routine(
+    _In_ struct _KDPC* dpc,
+    _In_opt_ void* deferred_context,
+    _In_opt_ void* system_argument1,
+    _In_opt_ void* system_argument2)
+{
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(system_argument1);
+    UNREFERENCED_PARAMETER(system_argument2);
+
+    netevent_load_cpu_t* cpu = (netevent_load_cpu_t*)deferred_context;
+    ULONG burst_size = _load->config.burst_size;
+    LONGLONG counter = KeQueryPerformanceCounter(NULL).QuadPart;
+    ULONGLONG owed;
+    ULONGLONG missed = 0;
+    ULONG dispatch_pushed = 0;
+    BOOLEAN passive_queued = FALSE;
+
+    if (cpu == NULL || ReadNoFence(&_load->stopping)) {
+        return;
+    }
+
+    cpu->credit += (ULONGLONG)(counter - cpu->last_counter) * cpu->rate;
+    cpu->last_counter = counter;
+    owed = cpu->credit / _load->frequency;
+    cpu->credit -= owed * _load->frequency;
+
+    // The events that do not fit in this tick are counted as missed rather than carried over, so that a processor
+    // that fell behind does not catch up with a storm of events.
+    if (owed > (ULONGLONG)LOAD_MAX_TICK_BURSTS * burst_size) {
+        missed = owed - (ULONGLONG)LOAD_MAX_TICK_BURSTS * burst_size;
+        owed -= missed;
+    }
+
+    while (owed > 0) {
+        ULONG count = (ULONG)min(owed, burst_size);
+        owed -= count;
+
+        if (_netevent_load_random(&cpu->dpc_random) % 100 < _load->config.passive_percent) {
+            if ((ULONG)ReadNoFence(&cpu->passive_pending) >= LOAD_MAX_PENDING_BURSTS * burst_size) {
+                missed += count;
+            } else {
+                InterlockedAdd(&cpu->passive_pending, (LONG)count);
+                passive_queued = TRUE;
+            }
+            continue;
+        }
+
+        _netevent_load_push_burst(&cpu->dpc_random, cpu->dpc_event_infos, count);
+        dispatch_pushed += count;
+    }
+
+    if (passive_queued) {
+        KeSetEvent(&cpu->thread_event, IO_NO_INCREMENT, FALSE);
+    }
+    if (dispatch_pushed != 0) {
+        InterlockedAdd64(&cpu->dispatch_pushed, dispatch_pushed);
+    }
+    if (missed != 0) {
+        InterlockedAdd64(&cpu->missed, (LONG64)missed);
+    }
+}
+
+// Push the pending PASSIVE_LEVEL bursts of a processor.
+static void
+_netevent_load_thread_routine(_In_ void* context)
+{
+    netevent_load_cpu_t* cpu = (netevent_load_cpu_t*)context;
+    ULONG burst_size = _load->config.burst_size;
+    PROCESSOR_NUMBER processor;
+    GROUP_AFFINITY affinity = {0};
+
+    if (NT_SUCCESS(KeGetProcessorNumberFromIndex(cpu->processor_index, &processor))) {
+        affinity.Group = processor.Group;
+        affinity.Mask = (KAFFINITY)1 << processor.Number;
+        KeSetSystemGroupAffinityThread(&affinity, NULL);
+    }
+
+    for (;;) {
+        KeWaitForSingleObject(&cpu->thread_event, Executive, KernelMode, FALSE, NULL);
+
+        LONG pending;
+        while (!ReadNoFence(&_load->stopping) && (pending = ReadNoFence(&cpu->passive_pending)) > 0) {
+            ULONG count = min((ULONG)pending, burst_size);
+            _netevent_load_push_burst(&cpu->thread_random, cpu->thread_event_infos, count);
+            InterlockedAdd(&cpu->passive_pending, -(LONG)count);
+            InterlockedAdd64(&cpu->passive_pushed, count);
+        }
+
+        if (ReadNoFence(&_load->stopping)) {
+            break;
+        }
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// Write the rates achieved over the last second, until the load generator stops.
+static void
+_netevent_load_reporter_routine(_In_ void* context)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    LARGE_INTEGER interval = {.QuadPart = LOAD_REPORT_INTERVAL};
+    LONGLONG last_counter = KeQueryPerformanceCounter(NULL).QuadPart;
+    ULONGLONG last_dispatch_pushed = 0;
+    ULONGLONG last_passive_pushed = 0;
+    ULONGLONG last_missed = 0;
+
+    while (KeWaitForSingleObject(&_load->stop_event, Executive, KernelMode, FALSE, &interval) == STATUS_TIMEOUT) {
+        LONGLONG counter = KeQueryPerformanceCounter(NULL).QuadPart;
+        ULONGLONG elapsed = (ULONGLONG)max(counter - last_counter, 1);
+        ULONGLONG dispatch_pushed = 0;
+        ULONGLONG passive_pushed = 0;
+        ULONGLONG missed = 0;
+
+        for (ULONG index = 0; index < _load->cpu_count; index++) {
+            netevent_load_cpu_t* cpu = &_load->cpus[index];
+            dispatch_pushed += (ULONGLONG)ReadNoFence64(&cpu->dispatch_pushed);
+            passive_pushed += (ULONGLONG)ReadNoFence64(&cpu->passive_pushed);
+            missed += (ULONGLONG)ReadNoFence64(&cpu->missed);
+        }
+
+        ULONG passive_rate = (ULONG)((passive_pushed - last_passive_pushed) * _load->frequency / elapsed);
+        ULONG achieved_rate =
+            (ULONG)((dispatch_pushed - last_dispatch_pushed) * _load->frequency / elapsed) + passive_rate;
+        ULONG missed_rate = (ULONG)((missed - last_missed) * _load->frequency / elapsed);
+
+        (void)RtlWriteRegistryValue(
+            RTL_REGISTRY_ABSOLUTE,
+            _load->key_path,
+            LOAD_ACHIEVED_RATE_VALUE_NAME,
+            REG_DWORD,
+            &achieved_rate,
+            sizeof(achieved_rate));
+        (void)RtlWriteRegistryValue(
+            RTL_REGISTRY_ABSOLUTE,
+            _load->key_path,
+            LOAD_PASSIVE_RATE_VALUE_NAME,
+            REG_DWORD,
+            &passive_rate,
+            sizeof(passive_rate));
+        (void)RtlWriteRegistryValue(
+            RTL_REGISTRY_ABSOLUTE,
+            _load->key_path,
+            LOAD_MISSED_RATE_VALUE_NAME,
+            REG_DWORD,
+            &missed_rate,
+            sizeof(missed_rate));
+        DbgPrintEx(
+            DPFLTR_IHVNETWORK_ID,
+            DPFLTR_INFO_LEVEL,
+            "netevent_sim: %lu events/s (target %lu), %lu at PASSIVE_LEVEL, %lu missed\n",
+            achieved_rate,
+            _load->config.rate,
+            passive_rate,
+            missed_rate);
+
+        last_counter = counter;
+        last_dispatch_pushed = dispatch_pushed;
+        last_passive_pushed = passive_pushed;
+        last_missed = missed;
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// Queue the DPC of every generating processor.
+static void
+_netevent_load_timer_callback(_In_ PEX_TIMER timer, _In_opt_ void* context)
+{
+    UNREFERENCED_PARAMETER(timer);
+    UNREFERENCED_PARAMETER(context);
+
+    for (ULONG index = 0; index < _load->cpu_count; index++) {
+        KeInsertQueueDpc(&_load->cpus[index].dpc, NULL, NULL);
+    }
+}
+
+static NTSTATUS
+_netevent_load_create_thread(_In_ PKSTART_ROUTINE routine, _In_opt_ void* context, _Out_ PKTHREAD* thread)
+{
+    HANDLE thread_handle;
+    NTSTATUS status;
+
+    *thread = NULL;
+
+    status = PsCreateSystemThread(&thread_handle, THREAD_ALL_ACCESS, NULL, NULL, NULL, routine, context);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Referencing a handle just returned by PsCreateSystemThread in kernel mode cannot fail.
+    status = ObReferenceObjectByHandle(thread_handle, SYNCHRONIZE, *PsThreadType, KernelMode, (void**)thread, NULL);
+    ZwClose(thread_handle);
+
+    return status;
+}
+
+static void
+_netevent_load_wait_thread(_Inout_ PKTHREAD* thread)
+{
+    if (*thread != NULL) {
+        KeWaitForSingleObject(*thread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(*thread);
+        *thread = NULL;
+    }
+}
+
+static NTSTATUS
+_netevent_load_create_event_templates()
+{
+    static const UCHAR event_ids[LoadEventType_Count] = {
+        NOTIFY_EVENT_TYPE_NETEVENT_DROP, NOTIFY_EVENT_TYPE_NETEVENT_LOG, NOTIFY_EVENT_TYPE_NETEVENT_OTHER};
+
+    for (ULONG type = 0; type < LoadEventType_Count; type++) {
+        netevent_message_t* event = (netevent_message_t*)ExAllocatePool2(
+            POOL_FLAG_NON_PAGED, sizeof(PKTMON_EVT_STREAM_PACKET_HEADER) + LOAD_MAX_PAYLOAD_SIZE, LOAD_POOL_TAG);
+        if (event == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        // The rest of the payload is left zeroed.
+        event->header.EventId = event_ids[type];
+        event->header.PacketDescriptor.PacketMetaDataLength = sizeof(PKTMON_EVT_STREAM_METADATA);
+        if (type == LoadEventType_Drop) {
+            event->header.Metadata.DropReason = DROP_REASON_SECURITY_POLICY;
+        }
+        event->payload = (netevent_payload_t){
+            .event_id = event_ids[type],
+            .source_ip = {192, 168, 1, 1},
+            .destination_ip = {10, 11, 12, 1},
+            .source_port = 12345,
+            .destination_port = 80,
+            .event_counter = 0};
+
+        _load->event_templates[type] = (unsigned char*)event;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void
+_netevent_load_free()
+{
+    if (_load->cpus != NULL) {
+        ExFreePool(_load->cpus);
+    }
+    for (ULONG type = 0; type < LoadEventType_Count; type++) {
+        if (_load->event_templates[type] != NULL) {
+            ExFreePool(_load->event_templates[type]);
+        }
+    }
+    ExFreePool(_load);
+    _load = NULL;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS netevent_load_start(
+    _In_ const netevent_load_config_t* config,
+    _In_z_ PCWSTR key_path,
+    _In_ const netevent_ext_function_addresses_t* client_dispatch)
+{
+    NTSTATUS status;
+    ULONG processor_count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    LARGE_INTEGER frequency;
+    LONGLONG counter;
+
+    if (_load != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    _load = (netevent_load_t*)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(netevent_load_t), LOAD_POOL_TAG);
+    if (_load == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    _load->config = *config;
+    _load->key_path = key_path;
+    _load->client_dispatch = client_dispatch;
+    _load->push_events_supported =
+        client_dispatch->header.version >= EBPF_NETEVENT_EXTENSION_VERSION_PUSH_EVENTS &&
+        client_dispatch->helper_function_count >= 2;
+    _load->cpu_count = (config->processor_count == 0) ? processor_count : min(config->processor_count, processor_count);
+    KeInitializeEvent(&_load->stop_event, NotificationEvent, FALSE);
+
+    status = _netevent_load_create_event_templates();
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    _load->cpus = (netevent_load_cpu_t*)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED, sizeof(netevent_load_cpu_t) * _load->cpu_count, LOAD_POOL_TAG);
+    if (_load->cpus == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    counter = KeQueryPerformanceCounter(&frequency).QuadPart;
+    _load->frequency = (ULONGLONG)frequency.QuadPart;
+
+    for (ULONG index = 0; index < _load->cpu_count; index++) {
+        netevent_load_cpu_t* cpu = &_load->cpus[index];
+        PROCESSOR_NUMBER processor;
+
+        // The remainder of the rate goes to the first processors.
+        cpu->processor_index = index;
+        cpu->rate = config->rate / _load->cpu_count + ((index < config->rate % _load->cpu_count) ? 1 : 0);
+        cpu->last_counter = counter;
+        cpu->dpc_random = (ULONG)counter ^ (index * 2 + 1) * 0x9E3779B9;
+        cpu->thread_random = cpu->dpc_random ^ 0x85EBCA6B;
+        if (cpu->dpc_random == 0) {
+            cpu->dpc_random = 1;
+        }
+        if (cpu->thread_random == 0) {
+            cpu->thread_random = 1;
+        }
+
+        KeInitializeDpc(&cpu->dpc, _netevent_load_dpc_routine, cpu);
+        status = KeGetProcessorNumberFromIndex(index, &processor);
+        if (NT_SUCCESS(status)) {
+            status = KeSetTargetProcessorDpcEx(&cpu->dpc, &processor);
+        }
+        if (!NT_SUCCESS(status)) {
+            goto Exit;
+        }
+        KeInitializeEvent(&cpu->thread_event, SynchronizationEvent, FALSE);
+    }
+
+    for (ULONG index = 0; index < _load->cpu_count; index++) {
+        netevent_load_cpu_t* cpu = &_load->cpus[index];
+        status = _netevent_load_create_thread(_netevent_load_thread_routine, cpu, &cpu->thread);
+        if (!NT_SUCCESS(status)) {
+            goto Exit;
+        }
+    }
+    status = _netevent_load_create_thread(_netevent_load_reporter_routine, NULL, &_load->reporter_thread);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    _load->timer = ExAllocateTimer(_netevent_load_timer_callback, NULL, EX_TIMER_HIGH_RESOLUTION);
+    if (_load->timer == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+    ExSetTimer(_load->timer, -LOAD_TIMER_PERIOD, LOAD_TIMER_PERIOD, NULL);
+
+    DbgPrintEx(
+        DPFLTR_IHVNETWORK_ID,
+        DPFLTR_INFO_LEVEL,
+        "netevent_sim: generating %lu events/s on %lu processors, in bursts of %lu\n",
+        config->rate,
+        _load->cpu_count,
+        config->burst_size);
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        netevent_load_stop();
+    }
+
+    return status;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) void netevent_load_stop()
+{
+    if (_load == NULL) {
+        return;
+    }
+
+    InterlockedExchange(&_load->stopping, 1);
+
+    // Stop the timer, then wait for the DPCs it may have queued.
+    if (_load->timer != NULL) {
+        ExDeleteTimer(_load->timer, TRUE, TRUE, NULL);
+        _load->timer = NULL;
+    }
+    KeFlushQueuedDpcs();
+
+    KeSetEvent(&_load->stop_event, IO_NO_INCREMENT, FALSE);
+    _netevent_load_wait_thread(&_load->reporter_thread);
+    if (_load->cpus != NULL) {
+        for (ULONG index = 0; index < _load->cpu_count; index++) {
+            if (_load->cpus[index].thread != NULL) {
+                KeSetEvent(&_load->cpus[index].thread_event, IO_NO_INCREMENT, FALSE);
+                _netevent_load_wait_thread(&_load->cpus[index].thread);
+            }
+        }
+    }
+
+    _netevent_load_free();
+}
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_netevent_npi.h"
+
+// Registry values of the load generator, all REG_DWORD under the netevent_sim parameters key. The load generator
+// replaces the periodic timer when NetEventLoadRate is not 0.
+#define LOAD_RATE_VALUE_NAME L"NetEventLoadRate"
+#define LOAD_PROCESSOR_COUNT_VALUE_NAME L"NetEventLoadProcessorCount"
+#define LOAD_PAYLOAD_MIN_VALUE_NAME L"NetEventLoadPayloadMin"
+#define LOAD_PAYLOAD_MAX_VALUE_NAME L"NetEventLoadPayloadMax"
+#define LOAD_PAYLOAD_DISTRIBUTION_VALUE_NAME L"NetEventLoadPayloadDistribution"
+#define LOAD_DROP_PERCENT_VALUE_NAME L"NetEventLoadDropPercent"
+#define LOAD_FLOW_PERCENT_VALUE_NAME L"NetEventLoadFlowPercent"
+#define LOAD_PASSIVE_PERCENT_VALUE_NAME L"NetEventLoadPassivePercent"
+
+// Values written back by the load generator every second.
+#define LOAD_ACHIEVED_RATE_VALUE_NAME L"NetEventLoadAchievedRate"
+#define LOAD_PASSIVE_RATE_VALUE_NAME L"NetEventLoadPassiveRate"
+#define LOAD_MISSED_RATE_VALUE_NAME L"NetEventLoadMissedRate"
+
+// Largest payload pushed by the load generator, netevent_payload_t included.
+#define LOAD_MAX_PAYLOAD_SIZE 9000U
+
+typedef enum _netevent_load_payload_distribution
+{
+    NeteventLoadPayload_Uniform = 0, // Uniform between the smallest and the largest payload.
+    NeteventLoadPayload_Imix = 1,    // 7 smallest, 4 medium and 1 largest payloads out of 12 events.
+} netevent_load_payload_distribution_t;
+
+typedef struct _netevent_load_config
+{
+    ULONG rate;                 // Target events per second, all processors together. 0 disables the load generator.
+    ULONG processor_count;      // Number of processors generating events, 0 for all of them.
+    ULONG burst_size;           // Number of events per push.
+    ULONG payload_min;          // Smallest payload, in bytes.
+    ULONG payload_max;          // Largest payload, in bytes.
+    ULONG payload_distribution; // netevent_load_payload_distribution_t
+    ULONG drop_percent;         // Share of drop events.
+    ULONG flow_percent;         // Share of flow events. The remaining events are neither drop nor flow events.
+    ULONG passive_percent;      // Share of bursts pushed at PASSIVE_LEVEL, the others are pushed at DISPATCH_LEVEL.
+} netevent_load_config_t;
+
+// Read the load generator configuration, and clamp it to the supported values.
+void
+netevent_load_read_config(_In_z_ PCWSTR key_path, ULONG burst_size, _Out_ netevent_load_config_t* config);
+
+// Start pushing events to a client on each generating processor: from a DPC targeted to the processor for the
+// DISPATCH_LEVEL bursts, and from a thread affinitized to it for the PASSIVE_LEVEL bursts. The achieved rates are
+// written under the key every second.
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS netevent_load_start(
+    _In_ const netevent_load_config_t* config,
+    _In_z_ PCWSTR key_path,
+    _In_ const netevent_ext_function_addresses_t* client_dispatch);
+
+// Stop pushing events, and wait for the pushes in progress. Does nothing if the load generator is not running.
+_IRQL_requires_(PASSIVE_LEVEL) void netevent_load_stop();
@@ -0,0 +1,387 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#define NO_CRT
+// clang-format off
+#include <wdm.h>
+// clang-format on
+#include "netevent_sim_replay.h"
+#include "netevent_types.h"
+
+#define REPLAY_POOL_TAG 'rpSN'
+// The read buffer holds at least a whole record, and is refilled when the next record does not fit in what is left.
+#define REPLAY_BUFFER_SIZE (1024 * 1024)
+// Events due sooner than this are pushed right away, as waiting is not more precise than the system timer.
+#define REPLAY_MIN_WAIT_MS 1
+#define NS_PER_SECOND (1000ULL * 1000 * 1000)
+#define HUNDRED_NS_PER_SECOND (10ULL * 1000 * 1000)
+
+C_ASSERT(REPLAY_BUFFER_SIZE >= sizeof(netevent_trace_record_t) + NETEVENT_TRACE_MAX_EVENT_LENGTH);
+
+typedef struct _netevent_replay
+{
+    ULONG speed;
+    ULONG loop;
+    PCWSTR key_path;
+    const netevent_ext_function_addresses_t* client_dispatch;
+    volatile LONG stopping;
+    KEVENT stop_event; // Signaled on stop, to end the waits of the replay thread.
+    PKTHREAD thread;
+    HANDLE file_handle;
+    LARGE_INTEGER file_offset; // Offset of the first byte of the file not read into the buffer yet.
+    unsigned char* buffer;     // Events are pushed from this buffer, which must not be paged.
+    ULONG buffer_start;        // First byte of the buffer not consumed yet.
+    ULONG buffer_end;          // End of the bytes read into the buffer.
+    unsigned char* pad_buffer; // Truncated events are padded back to their original length in this buffer.
+    ULONG pad_dirty;           // Bytes of the pad buffer that may not be zero.
+} netevent_replay_t;
+
+static netevent_replay_t* _replay = NULL;
+
+void
+netevent_replay_read_config(_In_z_ PCWSTR key_path, _Out_ netevent_replay_config_t* config)
+{
+    RtlZeroMemory(config, sizeof(*config));
+    config->speed = DEFAULT_REPLAY_SPEED;
+
+    // Missing values keep their default. The file path is allocated by RtlQueryRegistryValues.
+    RTL_QUERY_REGISTRY_TABLE query_table[] = {
+        {.Flags = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK,
+         .Name = REPLAY_FILE_VALUE_NAME,
+         .EntryContext = &config->file_path,
+         .DefaultType = (REG_SZ << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE},
+        {.Flags = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK,
+         .Name = REPLAY_SPEED_VALUE_NAME,
+         .EntryContext = &config->speed,
+         .DefaultType = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE},
+        {.Flags = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK,
+         .Name = REPLAY_LOOP_VALUE_NAME,
+         .EntryContext = &config->loop,
+         .DefaultType = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE},
+        {0}};
+    (void)RtlQueryRegistryValues(RTL_REGISTRY_ABSOLUTE, key_path, query_table, NULL, NULL);
+}
+
+void
+netevent_replay_free_config(_Inout_ netevent_replay_config_t* config)
+{
+    if (config->file_path.Buffer != NULL) {
+        RtlFreeUnicodeString(&config->file_path);
+    }
+    RtlZeroMemory(&config->file_path, sizeof(config->file_path));
+}
+
+// Consume the next bytes of the trace, reading more of the file when the buffer runs out. The bytes returned remain
+// valid until the next call.
+static NTSTATUS
+_netevent_replay_read(ULONG length, _Outptr_result_bytebuffer_(length) unsigned char** data)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK io_status;
+
+    *data = NULL;
+
+    if (_replay->buffer_end - _replay->buffer_start < length) {
+        // Move the bytes left to the start of the buffer, and read the next ones after them.
+        RtlMoveMemory(
+            _replay->buffer, _replay->buffer + _replay->buffer_start, _replay->buffer_end - _replay->buffer_start);
+        _replay->buffer_end -= _replay->buffer_start;
+        _replay->buffer_start = 0;
+
+        while (_replay->buffer_end < length) {
+            status = ZwReadFile(
+                _replay->file_handle,
+                NULL,
+                NULL,
+                NULL,
+                &io_status,
+                _replay->buffer + _replay->buffer_end,
+                REPLAY_BUFFER_SIZE - _replay->buffer_end,
+                &_replay->file_offset,
+                NULL);
+            if (!NT_SUCCESS(status)) {
+                return status;
+            }
+            if (io_status.Information == 0) {
+                return STATUS_END_OF_FILE;
+            }
+            _replay->buffer_end += (ULONG)io_status.Information;
+            _replay->file_offset.QuadPart += io_status.Information;
+        }
+    }
+
+    *data = _replay->buffer + _replay->buffer_start;
+    _replay->buffer_start += length;
+
+    return STATUS_SUCCESS;
+}
+
+// Wait until an event is due, counted in nanoseconds from the start of the pass. Returns FALSE if the replay stops
+// meanwhile.
+static BOOLEAN
+_netevent_replay_wait(LONGLONG start_counter, ULONGLONG frequency, ULONGLONG due_ns)
+{
+    ULONGLONG due_counter =
+        (due_ns / NS_PER_SECOND) * frequency + ((due_ns % NS_PER_SECOND) * frequency) / NS_PER_SECOND;
+    ULONGLONG min_wait = (frequency * REPLAY_MIN_WAIT_MS) / 1000;
+
+    for (;;) {
+        ULONGLONG elapsed = (ULONGLONG)(KeQueryPerformanceCounter(NULL).QuadPart - start_counter);
+        if (elapsed + min_wait >= due_counter) {
+            return TRUE;
+        }
+
+        // Long gaps are waited for one second at a time.
+        ULONGLONG remaining = min(due_counter - elapsed, frequency);
+        LARGE_INTEGER timeout = {.QuadPart = -(LONGLONG)((remaining * HUNDRED_NS_PER_SECOND) / frequency)};
+        if (KeWaitForSingleObject(&_replay->stop_event, Executive, KernelMode, FALSE, &timeout) == STATUS_SUCCESS) {
+            return FALSE;
+        }
+    }
+}
+
+// Return an event of a record, padded with zeros up to its length before the recording truncated it. The bytes returned
+// remain valid until the next call.
+static unsigned char*
+_netevent_replay_pad_event(
+    _In_ const netevent_trace_record_t* record,
+    _In_reads_bytes_(record->length) unsigned char* data,
+    _Out_ ULONG* length)
+{
+    ULONGLONG original_length = sizeof(PKTMON_EVT_STREAM_PACKET_HEADER) + (ULONGLONG)record->original_length;
+
+    *length = record->length;
+    if (original_length <= record->length) {
+        return data;
+    }
+
+    // Only the bytes written by the previous events need to be cleared, the rest of the buffer is still zero.
+    *length = (ULONG)min(original_length, NETEVENT_TRACE_MAX_EVENT_LENGTH);
+    RtlCopyMemory(_replay->pad_buffer, data, record->length);
+    if (_replay->pad_dirty > record->length) {
+        RtlZeroMemory(_replay->pad_buffer + record->length, min(_replay->pad_dirty, *length) - record->length);
+    }
+    if (_replay->pad_dirty <= *length) {
+        _replay->pad_dirty = record->length;
+    }
+
+    return _replay->pad_buffer;
+}
+
+// Replay the whole trace once, from the start of the file.
+static NTSTATUS
+_netevent_replay_pass(_Out_ ULONGLONG* pushed)
+{
+    netevent_push_event_t push_event_helper =
+        (netevent_push_event_t)(_replay->client_dispatch->helper_function_address[0]);
+    netevent_trace_file_header_t file_header;
+    netevent_trace_record_t record;
+    netevent_event_t event_info;
+    unsigned char* data;
+    ULONG event_length;
+    LARGE_INTEGER frequency;
+    LONGLONG start_counter;
+    ULONGLONG due_ns = 0;
+    NTSTATUS status;
+
+    *pushed = 0;
+    _replay->file_offset.QuadPart = 0;
+    _replay->buffer_start = 0;
+    _replay->buffer_end = 0;
+
+    status = _netevent_replay_read(sizeof(file_header), &data);
+    if (!NT_SUCCESS(status)) {
+        return (status == STATUS_END_OF_FILE) ? STATUS_FILE_CORRUPT_ERROR : status;
+    }
+    RtlCopyMemory(&file_header, data, sizeof(file_header));
+    if (file_header.magic != NETEVENT_TRACE_MAGIC || file_header.version != NETEVENT_TRACE_CURRENT_VERSION ||
+        file_header.header_size < sizeof(file_header)) {
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+    // Skip the fields added to the header by later minor revisions of the format.
+    if (file_header.header_size > sizeof(file_header)) {
+        status = _netevent_replay_read(file_header.header_size - (ULONG)sizeof(file_header), &data);
+        if (!NT_SUCCESS(status)) {
+            return (status == STATUS_END_OF_FILE) ? STATUS_FILE_CORRUPT_ERROR : status;
+        }
+    }
+
+    start_counter = KeQueryPerformanceCounter(&frequency).QuadPart;
+
+    while (!ReadNoFence(&_replay->stopping)) {
+        // The record header is copied out, as reading the event may move it within the buffer.
+        status = _netevent_replay_read(sizeof(record), &data);
+        if (status == STATUS_END_OF_FILE) {
+            return STATUS_SUCCESS;
+        } else if (!NT_SUCCESS(status)) {
+            return status;
+        }
+        RtlCopyMemory(&record, data, sizeof(record));
+
+        if (record.length < sizeof(PKTMON_EVT_STREAM_PACKET_HEADER) ||
+            record.length > NETEVENT_TRACE_MAX_EVENT_LENGTH) {
+            return STATUS_FILE_CORRUPT_ERROR;
+        }
+        status = _netevent_replay_read(record.length, &data);
+        if (!NT_SUCCESS(status)) {
+            return (status == STATUS_END_OF_FILE) ? STATUS_FILE_CORRUPT_ERROR : status;
+        }
+
+        if (_replay->speed != 0) {
+            due_ns += (record.interarrival_ns * 100) / _replay->speed;
+            if (!_netevent_replay_wait(start_counter, (ULONGLONG)frequency.QuadPart, due_ns)) {
+                break;
+            }
+        }
+
+        // The recording may have truncated the event, which is pushed at its original length, as the provider did.
+        data = _netevent_replay_pad_event(&record, data, &event_length);
+        event_info.event_start = data;
+        event_info.event_end = data + event_length;
+        push_event_helper(&event_info);
+        (*pushed)++;
+    }
+
+    return STATUS_CANCELLED;
+}
+
+// Replay the trace, again and again if it loops, and report the rate of each pass.
+static void
+_netevent_replay_thread_routine(_In_ void* context)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    NTSTATUS status;
+    ULONGLONG pushed;
+
+    do {
+        LARGE_INTEGER frequency;
+        LONGLONG start_counter = KeQueryPerformanceCounter(&frequency).QuadPart;
+
+        status = _netevent_replay_pass(&pushed);
+
+        ULONGLONG elapsed = (ULONGLONG)max(KeQueryPerformanceCounter(NULL).QuadPart - start_counter, 1);
+        ULONG rate = (ULONG)((pushed * (ULONGLONG)frequency.QuadPart) / elapsed);
+        (void)RtlWriteRegistryValue(
+            RTL_REGISTRY_ABSOLUTE, _replay->key_path, REPLAY_RATE_VALUE_NAME, REG_DWORD, &rate, sizeof(rate));
+        DbgPrintEx(
+            DPFLTR_IHVNETWORK_ID,
+            NT_SUCCESS(status) ? DPFLTR_INFO_LEVEL : DPFLTR_ERROR_LEVEL,
+            "netevent_sim: replayed %I64u events at %lu events/s, status 0x%08X\n",
+            pushed,
+            rate,
+            status);
+    } while (NT_SUCCESS(status) && _replay->loop != 0 && pushed != 0 && !ReadNoFence(&_replay->stopping));
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS netevent_replay_start(
+    _In_ const netevent_replay_config_t* config,
+    _In_z_ PCWSTR key_path,
+    _In_ const netevent_ext_function_addresses_t* client_dispatch)
+{
+    NTSTATUS status;
+    OBJECT_ATTRIBUTES object_attributes;
+    IO_STATUS_BLOCK io_status;
+    HANDLE thread_handle;
+
+    if (_replay != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    _replay = (netevent_replay_t*)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(netevent_replay_t), REPLAY_POOL_TAG);
+    if (_replay == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    _replay->speed = config->speed;
+    _replay->loop = config->loop;
+    _replay->key_path = key_path;
+    _replay->client_dispatch = client_dispatch;
+    KeInitializeEvent(&_replay->stop_event, NotificationEvent, FALSE);
+
+    _replay->buffer = (unsigned char*)ExAllocatePool2(POOL_FLAG_NON_PAGED, REPLAY_BUFFER_SIZE, REPLAY_POOL_TAG);
+    if (_replay->buffer == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+    // ExAllocatePool2 zeroes the pad buffer.
+    _replay->pad_buffer =
+        (unsigned char*)ExAllocatePool2(POOL_FLAG_NON_PAGED, NETEVENT_TRACE_MAX_EVENT_LENGTH, REPLAY_POOL_TAG);
+    if (_replay->pad_buffer == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    InitializeObjectAttributes(
+        &object_attributes,
+        (PUNICODE_STRING)&config->file_path,
+        OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE,
+        NULL,
+        NULL);
+    status = ZwCreateFile(
+        &_replay->file_handle,
+        GENERIC_READ | SYNCHRONIZE,
+        &object_attributes,
+        &io_status,
+        NULL,
+        FILE_ATTRIBUTE_NORMAL,
+        FILE_SHARE_READ,
+        FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE | FILE_SEQUENTIAL_ONLY,
+        NULL,
+        0);
+    if (!NT_SUCCESS(status)) {
+        _replay->file_handle = NULL;
+        DbgPrintEx(
+            DPFLTR_IHVNETWORK_ID,
+            DPFLTR_ERROR_LEVEL,
+            "netevent_sim: failed to open the trace %wZ, status 0x%08X\n",
+            &config->file_path,
+            status);
+        goto Exit;
+    }
+
+    status = PsCreateSystemThread(
+        &thread_handle, THREAD_ALL_ACCESS, NULL, NULL, NULL, _netevent_replay_thread_routine, NULL);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+    // Referencing a handle just returned by PsCreateSystemThread in kernel mode cannot fail.
+    status = ObReferenceObjectByHandle(
+        thread_handle, SYNCHRONIZE, *PsThreadType, KernelMode, (void**)&_replay->thread, NULL);
+    ZwClose(thread_handle);
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        netevent_replay_stop();
+    }
+
+    return status;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL) void netevent_replay_stop()
+{
+    if (_replay == NULL) {
+        return;
+    }
+
+    InterlockedExchange(&_replay->stopping, 1);
+    KeSetEvent(&_replay->stop_event, IO_NO_INCREMENT, FALSE);
+
+    if (_replay->thread != NULL) {
+        KeWaitForSingleObject(_replay->thread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(_replay->thread);
+    }
+    if (_replay->file_handle != NULL) {
+        ZwClose(_replay->file_handle);
+    }
+    if (_replay->buffer != NULL) {
+        ExFreePool(_replay->buffer);
+    }
+    if (_replay->pad_buffer != NULL) {
+        ExFreePool(_replay->pad_buffer);
+    }
+    ExFreePool(_replay);
+    _replay = NULL;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ebpf_netevent_npi.h"
+#include "ebpf_netevent_trace.h"
+
+// Registry values of the trace replay, under the netevent_sim parameters key. The replay replaces the periodic timer
+// and the load generator when NetEventReplayFile is set.
+#define REPLAY_FILE_VALUE_NAME L"NetEventReplayFile"   // REG_SZ, NT path of the trace, e.g. \??\C:\traces\drops.bin
+#define REPLAY_SPEED_VALUE_NAME L"NetEventReplaySpeed" // REG_DWORD, percent of the original speed, 0 for no delay
+#define REPLAY_LOOP_VALUE_NAME L"NetEventReplayLoop"   // REG_DWORD, replay the trace again once it ends if not 0
+
+// Value written back by the replay at the end of each pass over the trace.
+#define REPLAY_RATE_VALUE_NAME L"NetEventReplayRate" // Events pushed per second during the pass.
+
+#define DEFAULT_REPLAY_SPEED 100U
+
+typedef struct _netevent_replay_config
+{
+    UNICODE_STRING file_path; // Empty to disable the replay.
+    ULONG speed;              // Percent of the original speed, 0 to push the events without waiting.
+    ULONG loop;               // Replay the trace again once it ends if not 0.
+} netevent_replay_config_t;
+
+// Read the replay configuration. The file path is freed by netevent_replay_free_config.
+void
+netevent_replay_read_config(_In_z_ PCWSTR key_path, _Out_ netevent_replay_config_t* config);
+
+void
+netevent_replay_free_config(_Inout_ netevent_replay_config_t* config);
+
+// Start replaying the trace to a client from a system thread, at PASSIVE_LEVEL. The trace is read and validated as it
+// is replayed, and the replay ends at the first invalid record.
+_IRQL_requires_(PASSIVE_LEVEL) NTSTATUS netevent_replay_start(
+    _In_ const netevent_replay_config_t* config,
+    _In_z_ PCWSTR key_path,
+    _In_ const netevent_ext_function_addresses_t* client_dispatch);
+
+// Stop the replay, and wait for the push in progress. Does nothing if the replay is not running.
+_IRQL_requires_(PASSIVE_LEVEL) void netevent_replay_stop();
@@ -13,6 +13,8 @@ typedef struct _EX_RUNDOWN_REF_CACHE_AWARE* PEX_RUNDOWN_REF_CACHE_AWARE;
 // The event type we want to process
 #define NOTIFY_EVENT_TYPE_NETEVENT_DROP 100
 #define NOTIFY_EVENT_TYPE_NETEVENT_LOG 101
+// Events of another type, only generated by the load generator
+#define NOTIFY_EVENT_TYPE_NETEVENT_OTHER 102
 
 #pragma pack(push, 1) // Set packing to 1 byte boundary
 
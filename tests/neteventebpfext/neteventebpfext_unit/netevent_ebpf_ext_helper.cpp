@@ -38,6 +38,8 @@ _neteventebpf_ext_helper::_neteventebpf_ext_helper(
 
 _neteventebpf_ext_helper::~_neteventebpf_ext_helper()
 {
+    additional_hook_clients.clear();
+
     if (nmr_hook_client_handle) {
         nmr_hook_client_handle.reset(nullptr);
     }
@@ -76,6 +78,40 @@ _neteventebpf_ext_helper::get_program_info_provider_data(_In_ const GUID& progra
     return *iter->second->provider_data;
 }
 
+const ebpf_program_data_t*
+_neteventebpf_ext_helper::get_program_data(_In_ const GUID& program_info_provider)
+{
+    auto iter = program_info_providers.find(program_info_provider);
+    REQUIRE(iter != program_info_providers.end());
+
+    // The program information providers publish their ebpf_program_data_t as the NPI specific characteristics.
+    return reinterpret_cast<const ebpf_program_data_t*>(iter->second->provider_data);
+}
+
+void
+_neteventebpf_ext_helper::add_hook_client(
+    _In_ const void* npi_specific_characteristics, _In_ neteventebpfext_helper_base_client_context_t* client_context)
+{
+    REQUIRE(provider_registered);
+    REQUIRE(hook_invoke_function != nullptr);
+
+    // Each hook client registers with NMR as a separate module.
+    auto hook_client_entry = std::make_unique<additional_hook_client_t>();
+    hook_client_entry->module_id = module_id;
+    hook_client_entry->module_id.Guid.Data1 += (unsigned long)additional_hook_clients.size() + 1;
+    hook_client_entry->characteristics = hook_client;
+    hook_client_entry->characteristics.ClientRegistrationInstance.ModuleId = &hook_client_entry->module_id;
+    hook_client_entry->characteristics.ClientRegistrationInstance.NpiSpecificCharacteristics =
+        npi_specific_characteristics;
+
+    client_context->helper = this;
+    hook_client_entry->registration =
+        std::make_unique<nmr_client_registration_t>(&hook_client_entry->characteristics, client_context);
+    REQUIRE(hook_client_entry->registration->nmr_client_handle != INVALID_HANDLE_VALUE);
+
+    additional_hook_clients.push_back(std::move(hook_client_entry));
+}
+
 NTSTATUS
 _neteventebpf_ext_helper::_program_info_client_attach_provider(
     _In_ HANDLE nmr_binding_handle,
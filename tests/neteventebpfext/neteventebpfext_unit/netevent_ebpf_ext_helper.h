@@ -46,6 +46,16 @@ typedef class _neteventebpf_ext_helper
     ebpf_extension_data_t
     get_program_info_provider_data(_In_ const GUID& program_info_provider);
 
+    const ebpf_program_data_t*
+    get_program_data(_In_ const GUID& program_info_provider);
+
+    // Attach another hook client, with its own attach parameters, using the dispatch function passed to the
+    // constructor. The client is detached when the helper is destroyed.
+    void
+    add_hook_client(
+        _In_ const void* npi_specific_characteristics,
+        _In_ neteventebpfext_helper_base_client_context_t* client_context);
+
   private:
     bool trace_initiated = false;
     bool ndis_handle_initialized = false;
@@ -170,4 +180,12 @@ typedef class _neteventebpf_ext_helper
     std::unique_ptr<nmr_client_registration_t> nmr_program_info_client_handle;
     std::unique_ptr<nmr_client_registration_t> nmr_hook_client_handle;
 
+    typedef struct _additional_hook_client
+    {
+        NPI_MODULEID module_id;
+        NPI_CLIENT_CHARACTERISTICS characteristics;
+        std::unique_ptr<nmr_client_registration_t> registration;
+    } additional_hook_client_t;
+    std::vector<std::unique_ptr<additional_hook_client_t>> additional_hook_clients;
+
 } neteventebpf_ext_helper_t;
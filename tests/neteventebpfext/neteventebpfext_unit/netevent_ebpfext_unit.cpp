@@ -10,7 +10,9 @@
 #include "cxplat_fault_injection.h"
 #include "cxplat_passed_test_log.h"
 #include "ebpf_netevent_hooks.h"
+#include "ebpf_netevent_npi.h"
 #include "ebpf_netevent_program_attach_type_guids.h"
+#include "ebpf_netevent_stats.h"
 #include "ebpf_structs.h"
 #include "netevent_ebpf_ext_helper.h"
 #include "netevent_ebpf_ext_program_info.h"
@@ -19,8 +21,11 @@
 
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
+#include <chrono>
 #include <ebpf_api.h>
+#include <errno.h>
 #include <iostream>
+#include <list>
 #include <string>
 #include <thread>
 
@@ -415,8 +420,8 @@ TEST_CASE("netevent_bpf_prog_run_test", "[neteventebpfext]")
     fd_t netevent_program_fd = bpf_program__fd(netevent_monitor);
     REQUIRE(netevent_program_fd != ebpf_fd_invalid);
 
-    // Validate well formatted pktmon data: [netevent_data_header_t (3 bytes)][PKTMON header (53 bytes)][additional
-    // payload] Netevent header.
+    // Validate well formatted pktmon data: [netevent_data_header_t (32 bytes in version 5)][PKTMON header (53 bytes)]
+    // [additional payload] Netevent header.
     netevent_data_header_t netevent_ext_pktmon_header = {0};
     netevent_ext_pktmon_header.version = NETEVENT_PKTMON_EVENT_CURRENT_VERSION;
     netevent_ext_pktmon_header.type = NETEVENT_EVENT_TYPE_PKTMON_DROP;
@@ -467,17 +472,76 @@ TEST_CASE("netevent_bpf_prog_run_test", "[neteventebpfext]")
     REQUIRE(memcmp(test_data_in, data_out, test_pktmon_data_size) == 0);
     REQUIRE(bpf_opts.ctx_size_out == sizeof(netevent_ctx_out));
 
+    // The typed context fields are decoded from the PKTMON header.
+    uint32_t expected_drop_reason;
+    uint16_t expected_component_id;
+    uint64_t expected_timestamp;
+    memcpy(&expected_drop_reason, pktmon_header_data + 35, sizeof(expected_drop_reason));
+    memcpy(&expected_component_id, pktmon_header_data + 29, sizeof(expected_component_id));
+    memcpy(&expected_timestamp, pktmon_header_data + 45, sizeof(expected_timestamp));
+    REQUIRE(netevent_ctx_out.event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP);
+    REQUIRE(netevent_ctx_out.drop_reason == expected_drop_reason);
+    REQUIRE(netevent_ctx_out.component_id == expected_component_id);
+    REQUIRE(netevent_ctx_out.timestamp == expected_timestamp);
+
     std::this_thread::sleep_for(std::chrono::seconds(5));
     REQUIRE(event_count == event_count_before + 1);
 
+    // Contexts that predate the typed fields are still accepted.
+    bpf_opts.ctx_size_in = static_cast<uint32_t>(NETEVENT_EVENT_MD_SIZE_V2);
+    bpf_opts.ctx_size_out = static_cast<uint32_t>(NETEVENT_EVENT_MD_SIZE_V2);
+    bpf_opts.data_size_out = sizeof(data_out);
+    REQUIRE(bpf_prog_test_run_opts(netevent_program_fd, &bpf_opts) == 0);
+    REQUIRE(bpf_opts.ctx_size_out == NETEVENT_EVENT_MD_SIZE_V2);
+
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    REQUIRE(event_count == event_count_before + 2);
+
+    // Data with a version 1 header, which only carries the type and the version in 4 bytes. The byte following the
+    // type is padding, not a source id.
+    unsigned char test_data_v1[MAX_PACKET_SIZE] = {0};
+    test_data_v1[0] = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    test_data_v1[1] = 0xff;
+    *reinterpret_cast<uint16_t*>(test_data_v1 + 2) = 1;
+    memcpy(test_data_v1 + NETEVENT_DATA_HEADER_SIZE_V1, pktmon_header_data, PKTMON_EVENT_HEADER_LENGTH);
+    memcpy(
+        test_data_v1 + NETEVENT_DATA_HEADER_SIZE_V1 + PKTMON_EVENT_HEADER_LENGTH,
+        additional_payload,
+        additional_payload_size);
+    const size_t test_data_v1_size =
+        NETEVENT_DATA_HEADER_SIZE_V1 + PKTMON_EVENT_HEADER_LENGTH + additional_payload_size;
+    netevent_ctx_out = {};
+    bpf_opts.data_in = test_data_v1;
+    bpf_opts.data_size_in = static_cast<uint32_t>(test_data_v1_size);
+    bpf_opts.ctx_size_in = sizeof(netevent_ctx_in);
+    bpf_opts.ctx_size_out = sizeof(netevent_ctx_out);
+    bpf_opts.data_size_out = sizeof(data_out);
+    REQUIRE(bpf_prog_test_run_opts(netevent_program_fd, &bpf_opts) == 0);
+    REQUIRE(bpf_opts.data_size_out == test_data_v1_size);
+    REQUIRE(memcmp(test_data_v1, data_out, test_data_v1_size) == 0);
+
+    // The PKTMON header is found right after the 4 byte header.
+    REQUIRE(netevent_ctx_out.event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP);
+    REQUIRE(netevent_ctx_out.drop_reason == expected_drop_reason);
+    REQUIRE(netevent_ctx_out.component_id == expected_component_id);
+    REQUIRE(netevent_ctx_out.timestamp == expected_timestamp);
+    REQUIRE(netevent_ctx_out.source_id == 0);
+
+    // Data shorter than a version 1 header must be rejected.
+    bpf_opts.data_size_in = static_cast<uint32_t>(NETEVENT_DATA_HEADER_SIZE_V1 - 1);
+    bpf_opts.data_size_out = sizeof(data_out);
+    REQUIRE(bpf_prog_test_run_opts(netevent_program_fd, &bpf_opts) != 0);
+    bpf_opts.data_in = test_data_in;
+    bpf_opts.data_size_in = static_cast<uint32_t>(test_pktmon_data_size);
+
     // Negative test cases.
     bpf_opts.ctx_in = NULL;
     bpf_opts.ctx_size_in = 0;
 
     REQUIRE(bpf_prog_test_run_opts(netevent_program_fd, &bpf_opts) != 0);
 
-    // Context smaller than netevent_md must be rejected
-    unsigned char smaller_ctx[sizeof(netevent_ctx_in) - 1];
+    // Context smaller than the data pointers of netevent_md must be rejected
+    unsigned char smaller_ctx[NETEVENT_EVENT_MD_SIZE_V2 - 1];
     bpf_opts.ctx_in = &smaller_ctx;
     bpf_opts.ctx_size_in = sizeof(smaller_ctx);
 
@@ -519,6 +583,1327 @@ TEST_CASE("netevent_bpf_prog_run_test", "[neteventebpfext]")
     REQUIRE(neteventebpfext_driver.unload() == true);
 }
 
+static netevent_ext_stats_t
+_get_netevent_stats()
+{
+    netevent_ext_stats_t stats;
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_GET_STATS, nullptr, 0, &stats, sizeof(stats), &bytes_returned) ==
+        STATUS_SUCCESS);
+    REQUIRE(bytes_returned == sizeof(stats));
+    return stats;
+}
+
+typedef int (*test_netevent_parse_flow_t)(netevent_event_md_t* ctx, uint8_t* flow_key, uint32_t flow_key_length);
+typedef int (*test_netevent_flow_table_update_t)(netevent_event_md_t* ctx);
+typedef int (*test_netevent_capture_t)(netevent_event_md_t* ctx, uint32_t snaplen);
+
+// Build the test run data of a drop event carrying a TCP packet:
+// [netevent_data_header_t][PKTMON header][Ethernet][VLAN tag][IPv4][TCP][payload]
+static std::vector<uint8_t>
+_build_netevent_flow_event(uint32_t drop_reason)
+{
+    const size_t packet_type_offset = 27;
+    const size_t drop_reason_offset = 35;
+    const uint16_t packet_type_ethernet = 1;
+    const uint8_t packet[] = {
+        // Ethernet, with a VLAN tag.
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0x81, 0x00, 0x00, 0x05, 0x08, 0x00,
+        // IPv4, 192.168.1.1 -> 10.0.0.2, TCP.
+        0x45, 0, 0, 44, 0, 0, 0, 0, 64, 6, 0, 0, 192, 168, 1, 1, 10, 0, 0, 2,
+        // TCP, 1234 -> 80.
+        0x04, 0xD2, 0x00, 0x50, 0, 0, 0, 0, 0, 0, 0, 0, 0x50, 0, 0, 0, 0, 0, 0, 0,
+        // Payload.
+        'a', 'b', 'c', 'd'};
+    std::vector<uint8_t> data(sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH + sizeof(packet), 0);
+    netevent_data_header_t* data_header = reinterpret_cast<netevent_data_header_t*>(data.data());
+    data_header->type = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    data_header->version = NETEVENT_PKTMON_EVENT_CURRENT_VERSION;
+    uint8_t* pktmon_header = data.data() + sizeof(netevent_data_header_t);
+    *pktmon_header = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    memcpy(pktmon_header + packet_type_offset, &packet_type_ethernet, sizeof(packet_type_ethernet));
+    memcpy(pktmon_header + drop_reason_offset, &drop_reason, sizeof(drop_reason));
+    memcpy(pktmon_header + PKTMON_EVENT_HEADER_LENGTH, packet, sizeof(packet));
+    return data;
+}
+
+TEST_CASE("netevent_parse_flow", "[neteventebpfext]")
+{
+    neteventebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_NETEVENT);
+    REQUIRE(program_data->program_type_specific_helper_function_addresses->helper_function_count == 4);
+    test_netevent_parse_flow_t parse_flow = reinterpret_cast<test_netevent_parse_flow_t>(
+        program_data->program_type_specific_helper_function_addresses->helper_function_address[1]);
+
+    std::vector<uint8_t> data = _build_netevent_flow_event(0);
+    const size_t packet_size = data.size() - sizeof(netevent_data_header_t) - PKTMON_EVENT_HEADER_LENGTH;
+    uint8_t* packet = data.data() + sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH;
+
+    auto run_parse_flow = [&](size_t data_size, netevent_flow_key_t* flow_key, uint32_t flow_key_length) {
+        netevent_event_md_t context_in = {};
+        void* context = nullptr;
+        REQUIRE(
+            program_data->context_create(
+                data.data(),
+                data_size,
+                reinterpret_cast<const uint8_t*>(&context_in),
+                sizeof(context_in),
+                &context) == EBPF_SUCCESS);
+        int result =
+            parse_flow(reinterpret_cast<netevent_event_md_t*>(context), (uint8_t*)flow_key, flow_key_length);
+        size_t data_size_out = 0;
+        size_t context_size_out = 0;
+        program_data->context_destroy(context, nullptr, &data_size_out, nullptr, &context_size_out);
+        return result;
+    };
+
+    netevent_flow_key_t flow_key;
+    REQUIRE(run_parse_flow(data.size(), &flow_key, sizeof(flow_key)) == 0);
+    const uint8_t source_address[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 192, 168, 1, 1};
+    const uint8_t destination_address[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 10, 0, 0, 2};
+    REQUIRE(flow_key.ip_version == 4);
+    REQUIRE(flow_key.protocol == 6);
+    REQUIRE(memcmp(flow_key.source_address, source_address, sizeof(source_address)) == 0);
+    REQUIRE(memcmp(flow_key.destination_address, destination_address, sizeof(destination_address)) == 0);
+    // Ports are in network byte order.
+    REQUIRE(flow_key.source_port == 0xD204);
+    REQUIRE(flow_key.destination_port == 0x5000);
+    REQUIRE(flow_key.l3_offset == 18);
+    REQUIRE(flow_key.l4_offset == 38);
+    REQUIRE(flow_key.payload_offset == 58);
+
+    // The flow key buffer must be large enough.
+    REQUIRE(run_parse_flow(data.size(), &flow_key, sizeof(flow_key) - 1) == -EINVAL);
+
+    // Truncated headers are rejected.
+    REQUIRE(run_parse_flow(data.size() - packet_size + 40, &flow_key, sizeof(flow_key)) == -EINVAL);
+
+    // Non IP packets are not supported.
+    packet[16] = 0x06;
+    REQUIRE(run_parse_flow(data.size(), &flow_key, sizeof(flow_key)) == -ENOTSUP);
+}
+
+TEST_CASE("netevent_flow_table", "[neteventebpfext]")
+{
+    neteventebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_NETEVENT);
+    test_netevent_flow_table_update_t flow_table_update = reinterpret_cast<test_netevent_flow_table_update_t>(
+        program_data->program_type_specific_helper_function_addresses->helper_function_address[2]);
+
+    auto run_flow_table_update = [&](const std::vector<uint8_t>& data) {
+        netevent_event_md_t context_in = {};
+        void* context = nullptr;
+        REQUIRE(
+            program_data->context_create(
+                data.data(),
+                data.size(),
+                reinterpret_cast<const uint8_t*>(&context_in),
+                sizeof(context_in),
+                &context) == EBPF_SUCCESS);
+        int result = flow_table_update(reinterpret_cast<netevent_event_md_t*>(context));
+        size_t data_size_out = 0;
+        size_t context_size_out = 0;
+        program_data->context_destroy(context, nullptr, &data_size_out, nullptr, &context_size_out);
+        return result;
+    };
+
+    // Three events of the same flow and drop reason, and one with another drop reason.
+    std::vector<uint8_t> data = _build_netevent_flow_event(2);
+    const uint64_t packet_size = data.size() - sizeof(netevent_data_header_t) - PKTMON_EVENT_HEADER_LENGTH;
+    for (int index = 0; index < 3; index++) {
+        REQUIRE(run_flow_table_update(data) == 0);
+    }
+    REQUIRE(run_flow_table_update(_build_netevent_flow_event(3)) == 0);
+
+    // Flush the flow table rather than waiting for the periodic flush.
+    std::vector<netevent_flow_record_t> records(16);
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_FLUSH_FLOW_TABLE, nullptr, 0, nullptr, 0, &bytes_returned) == STATUS_SUCCESS);
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr,
+            IOCTL_NETEVENT_EXT_GET_FLOW_RECORDS,
+            nullptr,
+            0,
+            records.data(),
+            records.size() * sizeof(netevent_flow_record_t),
+            &bytes_returned) == STATUS_SUCCESS);
+    REQUIRE(bytes_returned == 2 * sizeof(netevent_flow_record_t));
+
+    for (size_t index = 0; index < 2; index++) {
+        const netevent_flow_record_t& record = records[index];
+        REQUIRE(record.event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP);
+        REQUIRE(record.flow_key.ip_version == 4);
+        REQUIRE(record.flow_key.protocol == 6);
+        REQUIRE(record.flow_key.l3_offset == 0);
+        uint64_t expected_count = (record.drop_reason == 2) ? 3 : 1;
+        REQUIRE((record.drop_reason == 2 || record.drop_reason == 3));
+        REQUIRE(record.count == expected_count);
+        REQUIRE(record.bytes == expected_count * packet_size);
+    }
+
+    // Flushed records are only read once.
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr,
+            IOCTL_NETEVENT_EXT_GET_FLOW_RECORDS,
+            nullptr,
+            0,
+            records.data(),
+            records.size() * sizeof(netevent_flow_record_t),
+            &bytes_returned) == STATUS_SUCCESS);
+    REQUIRE(bytes_returned == 0);
+
+    netevent_ext_stats_t stats = _get_netevent_stats();
+    REQUIRE(stats.flow_table_updates == 4);
+    REQUIRE(stats.flow_records_flushed == 2);
+}
+
+#pragma region netevent_push_event
+
+// Minimal NetEvent NPI provider, used to push events into the extension directly from the test.
+typedef class _test_netevent_provider
+{
+  public:
+    // Providers registered at the same time must use a different module index.
+    _test_netevent_provider(
+        uint32_t module_index = 0, const netevent_provider_characteristics_t& characteristics = {})
+    {
+        module_id.Guid.Data1 += module_index;
+        npi_specific_characteristics = characteristics;
+        // Don't use REQUIRE in a constructor.
+        (void)NmrRegisterProvider(&provider_characteristics, this, &nmr_provider_handle);
+    }
+
+    ~_test_netevent_provider()
+    {
+        if (nmr_provider_handle != nullptr) {
+            NTSTATUS status = NmrDeregisterProvider(nmr_provider_handle);
+            if (status == STATUS_PENDING) {
+                NmrWaitForProviderDeregisterComplete(nmr_provider_handle);
+            }
+        }
+    }
+
+    void
+    push_event(_In_ netevent_event_t* netevent_event)
+    {
+        ((netevent_push_event_t)client_dispatch->helper_function_address[0])(netevent_event);
+    }
+
+    void
+    push_events(_In_reads_(event_count) netevent_event_t* netevent_events, uint32_t event_count)
+    {
+        ((netevent_push_events_t)client_dispatch->helper_function_address[1])(netevent_events, event_count);
+    }
+
+    const netevent_ext_function_addresses_t* client_dispatch = nullptr;
+
+  private:
+    static NTSTATUS
+    _provider_attach_client(
+        _In_ HANDLE nmr_binding_handle,
+        _In_ void* provider_context,
+        _In_ const NPI_REGISTRATION_INSTANCE* client_registration_instance,
+        _In_ void* client_binding_context,
+        _In_ const void* client_dispatch,
+        _Out_ void** provider_binding_context,
+        _Out_ const void** provider_dispatch)
+    {
+        UNREFERENCED_PARAMETER(nmr_binding_handle);
+        UNREFERENCED_PARAMETER(client_registration_instance);
+        UNREFERENCED_PARAMETER(client_binding_context);
+        auto provider = reinterpret_cast<_test_netevent_provider*>(provider_context);
+        provider->client_dispatch = reinterpret_cast<const netevent_ext_function_addresses_t*>(client_dispatch);
+        *provider_binding_context = provider;
+        *provider_dispatch = nullptr;
+        return STATUS_SUCCESS;
+    }
+
+    static NTSTATUS
+    _provider_detach_client(_In_ void* provider_binding_context)
+    {
+        reinterpret_cast<_test_netevent_provider*>(provider_binding_context)->client_dispatch = nullptr;
+        return STATUS_SUCCESS;
+    }
+
+    static void
+    _provider_cleanup_binding_context(_In_ void* provider_binding_context)
+    {
+        UNREFERENCED_PARAMETER(provider_binding_context);
+    }
+
+    HANDLE nmr_provider_handle = nullptr;
+
+    // Must match the NetEvent NPI id used by the extension.
+    NPIID npi_id = {0x2227e81a, 0x8d8b, 0x11d4, {0xab, 0xad, 0x00, 0x90, 0x27, 0x71, 0x9e, 0x09}};
+
+    // {6A3A9F7C-1E59-4E7B-9B1C-3C8A0F4D2E61}
+    NPI_MODULEID module_id = {
+        (USHORT)sizeof(NPI_MODULEID),
+        NPI_MODULEID_TYPE::MIT_GUID,
+        {0x6a3a9f7c, 0x1e59, 0x4e7b, {0x9b, 0x1c, 0x3c, 0x8a, 0x0f, 0x4d, 0x2e, 0x61}}};
+
+    // The extension only requires the provider characteristics to be present.
+    netevent_provider_characteristics_t npi_specific_characteristics = {};
+
+    NPI_PROVIDER_CHARACTERISTICS provider_characteristics{
+        0,
+        sizeof(NPI_PROVIDER_CHARACTERISTICS),
+        (PNPI_PROVIDER_ATTACH_CLIENT_FN)_provider_attach_client,
+        (PNPI_PROVIDER_DETACH_CLIENT_FN)_provider_detach_client,
+        (PNPI_PROVIDER_CLEANUP_BINDING_CONTEXT_FN)_provider_cleanup_binding_context,
+        {
+            0,
+            sizeof(NPI_REGISTRATION_INSTANCE),
+            &npi_id,
+            &module_id,
+            0,
+            &npi_specific_characteristics,
+        },
+    };
+} test_netevent_provider_t;
+
+typedef struct test_netevent_client_context_t
+{
+    neteventebpfext_helper_base_client_context_t base;
+    netevent_event_md_t netevent_context;
+    uint64_t invoke_count;
+    KIRQL invoke_irql;
+} test_netevent_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+neteventebpfext_unit_invoke_netevent_program(
+    _In_ const void* client_netevent_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_netevent_client_context_t* client_context = (test_netevent_client_context_t*)client_netevent_context;
+
+    client_context->netevent_context = *(netevent_event_md_t*)context;
+    client_context->invoke_count++;
+    client_context->invoke_irql = KeGetCurrentIrql();
+    *result = 0;
+    return EBPF_SUCCESS;
+}
+
+// Attaches a program to the netevent hook, along with the extension it is attached to. Unless another client context
+// and invoke function are given, the invocations of the program are recorded in client_context.
+typedef class _test_netevent_hook
+{
+  public:
+    // Attach with the given attach options, or with none if attach_opts is null.
+    _test_netevent_hook(
+        _In_opt_ const netevent_attach_opts_t* attach_opts,
+        _ebpf_extension_dispatch_function invoke_function =
+            (_ebpf_extension_dispatch_function)neteventebpfext_unit_invoke_netevent_program,
+        _In_opt_ neteventebpfext_helper_base_client_context_t* client = nullptr)
+        : attach_opts(attach_opts != nullptr ? *attach_opts : netevent_attach_opts_t{}),
+          npi_specific_characteristics{
+              .header = {EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION, EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION_SIZE},
+              .data = (attach_opts != nullptr) ? &this->attach_opts : nullptr,
+              .data_size = (attach_opts != nullptr) ? sizeof(netevent_attach_opts_t) : 0},
+          client_context{.base = {.desired_attach_type = BPF_ATTACH_TYPE_NETEVENT}},
+          helper(&npi_specific_characteristics, invoke_function, (client != nullptr) ? client : &client_context.base)
+    {
+    }
+
+    _test_netevent_hook(const netevent_attach_opts_t& attach_opts) : _test_netevent_hook(&attach_opts) {}
+
+    // Attach another program with its own attach options, whose invocations are recorded in client.
+    void
+    add_client(const netevent_attach_opts_t& client_attach_opts, _Inout_ test_netevent_client_context_t* client)
+    {
+        additional_client_t& additional_client = additional_clients.emplace_back();
+        additional_client.attach_opts = client_attach_opts;
+        additional_client.npi_specific_characteristics = {
+            .header = {EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION, EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION_SIZE},
+            .data = &additional_client.attach_opts,
+            .data_size = sizeof(netevent_attach_opts_t)};
+        client->base.desired_attach_type = BPF_ATTACH_TYPE_NETEVENT;
+        helper.add_hook_client(&additional_client.npi_specific_characteristics, &client->base);
+    }
+
+    netevent_attach_opts_t attach_opts;
+    ebpf_extension_data_t npi_specific_characteristics;
+    test_netevent_client_context_t client_context;
+
+  private:
+    typedef struct _additional_client
+    {
+        netevent_attach_opts_t attach_opts;
+        ebpf_extension_data_t npi_specific_characteristics;
+    } additional_client_t;
+    // Must outlive the helper, which detaches the additional clients.
+    std::list<additional_client_t> additional_clients;
+
+  public:
+    neteventebpf_ext_helper_t helper;
+} test_netevent_hook_t;
+
+TEST_CASE("netevent_snaplen", "[neteventebpfext]")
+{
+    const uint32_t snaplen = 16;
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_All, .flags = 0, .snaplen = snaplen});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // Events larger than the snaplen are truncated, and the header reports the original length.
+    for (size_t payload_size : {(size_t)8, (size_t)snaplen, (size_t)256}) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + payload_size, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = NETEVENT_EVENT_TYPE_PKTMON_FLOW;
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        client_context.invoke_count = 0;
+
+        provider.push_event(&netevent_event);
+
+        const netevent_event_md_t& netevent_context = client_context.netevent_context;
+        netevent_data_header_t* header_ptr = reinterpret_cast<netevent_data_header_t*>(netevent_context.data_meta);
+        REQUIRE(client_context.invoke_count == 1);
+        REQUIRE(header_ptr->version == NETEVENT_PKTMON_EVENT_CURRENT_VERSION);
+        REQUIRE(header_ptr->original_length == payload_size);
+        size_t expected_size = (payload_size < snaplen) ? payload_size : snaplen;
+        REQUIRE((size_t)(netevent_context.data_end - netevent_context.data) == expected_size);
+    }
+}
+
+TEST_CASE("netevent_per_client_capture_type", "[neteventebpfext]")
+{
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_Drop});
+    test_netevent_client_context_t& drop_client_context = hook.client_context;
+    test_netevent_client_context_t flow_client_context = {};
+    hook.add_client({.capture_type = NeteventCapture_Flow}, &flow_client_context);
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // The provider is asked for the union of the capture types of the clients.
+    REQUIRE(provider.client_dispatch->capture_type == NeteventCapture_All);
+
+    // Each client is only invoked for the event class it asked for.
+    for (uint32_t event_id : {NETEVENT_EVENT_TYPE_PKTMON_DROP, NETEVENT_EVENT_TYPE_PKTMON_FLOW}) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 64, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = event_id;
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        drop_client_context.invoke_count = 0;
+        flow_client_context.invoke_count = 0;
+
+        provider.push_event(&netevent_event);
+
+        test_netevent_client_context_t& invoked_client_context =
+            (event_id == NETEVENT_EVENT_TYPE_PKTMON_DROP) ? drop_client_context : flow_client_context;
+        test_netevent_client_context_t& skipped_client_context =
+            (event_id == NETEVENT_EVENT_TYPE_PKTMON_DROP) ? flow_client_context : drop_client_context;
+        netevent_data_header_t* header_ptr =
+            reinterpret_cast<netevent_data_header_t*>(invoked_client_context.netevent_context.data_meta);
+        REQUIRE(invoked_client_context.invoke_count == 1);
+        REQUIRE(skipped_client_context.invoke_count == 0);
+        REQUIRE(header_ptr->type == event_id);
+    }
+}
+
+TEST_CASE("netevent_attach_filters", "[neteventebpfext]")
+{
+    // Offsets of the DropReason and ComponentId fields in the packed PKTMON header.
+    const size_t component_id_offset = 29;
+    const size_t drop_reason_offset = 35;
+    const uint32_t drop_reason = 2;
+    const uint16_t component_id = 7;
+    netevent_attach_opts_t attach_opts = {
+        .capture_type = NeteventCapture_All,
+        .flags = NETEVENT_ATTACH_FLAG_FILTER_DROP_REASON | NETEVENT_ATTACH_FLAG_FILTER_COMPONENT_ID,
+        .drop_reason = drop_reason,
+        .component_id = component_id};
+    NETEVENT_EVENT_ID_MASK_SET(&attach_opts, NETEVENT_EVENT_TYPE_PKTMON_DROP);
+    test_netevent_hook_t hook(attach_opts);
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    struct
+    {
+        uint32_t event_id;
+        uint32_t drop_reason;
+        uint16_t component_id;
+        bool expect_invoke;
+    } test_events[] = {
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, drop_reason, component_id, true},
+        {NETEVENT_EVENT_TYPE_PKTMON_FLOW, drop_reason, component_id, false},
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, drop_reason + 1, component_id, false},
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, drop_reason, component_id + 1, false},
+    };
+    for (const auto& test_event : test_events) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 64, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = test_event.event_id;
+        memcpy(event.data() + drop_reason_offset, &test_event.drop_reason, sizeof(test_event.drop_reason));
+        memcpy(event.data() + component_id_offset, &test_event.component_id, sizeof(test_event.component_id));
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        client_context.invoke_count = 0;
+
+        provider.push_event(&netevent_event);
+
+        REQUIRE(client_context.invoke_count == (test_event.expect_invoke ? 1 : 0));
+        if (test_event.expect_invoke) {
+            // The fields the filters were evaluated on are passed to the program as typed context fields.
+            REQUIRE(client_context.netevent_context.event_type == test_event.event_id);
+            REQUIRE(client_context.netevent_context.drop_reason == test_event.drop_reason);
+            REQUIRE(client_context.netevent_context.component_id == test_event.component_id);
+        }
+    }
+}
+
+TEST_CASE("netevent_push_events", "[neteventebpfext]")
+{
+    const uint32_t burst_size = 16;
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_Drop});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // The batched helper is the second entry of the dispatch table, starting with version 3.
+    REQUIRE(provider.client_dispatch->header.version >= EBPF_NETEVENT_EXTENSION_VERSION_PUSH_EVENTS);
+    REQUIRE(provider.client_dispatch->helper_function_count >= 2);
+
+    // Alternate drop and flow events, of which only the drop events are dispatched.
+    std::vector<std::vector<uint8_t>> events;
+    std::vector<netevent_event_t> netevent_events;
+    for (uint32_t index = 0; index < burst_size; index++) {
+        events.emplace_back(PKTMON_EVENT_HEADER_LENGTH + 64 + index, (uint8_t)0);
+        *reinterpret_cast<uint32_t*>(events.back().data()) =
+            (index % 2 == 0) ? NETEVENT_EVENT_TYPE_PKTMON_DROP : NETEVENT_EVENT_TYPE_PKTMON_FLOW;
+    }
+    for (auto& event : events) {
+        netevent_events.push_back({event.data(), event.data() + event.size()});
+    }
+
+    provider.push_events(netevent_events.data(), burst_size);
+
+    const netevent_event_md_t& netevent_context = client_context.netevent_context;
+    REQUIRE(client_context.invoke_count == burst_size / 2);
+    REQUIRE((size_t)(netevent_context.data_end - netevent_context.data) == 64 + burst_size - 2);
+}
+
+TEST_CASE("netevent_provider_capabilities", "[neteventebpfext]")
+{
+    const uint32_t max_event_size = PKTMON_EVENT_HEADER_LENGTH + 10000;
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_All, .flags = NETEVENT_ATTACH_FLAG_ZERO_COPY});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    // A provider that pushes bursts, but whose event memory must not be handed to the programs.
+    netevent_provider_characteristics_t provider_characteristics = {
+        .size = sizeof(netevent_provider_characteristics_t),
+        .version = NETEVENT_PROVIDER_CHARACTERISTICS_VERSION_CAPABILITIES,
+        .capabilities = NETEVENT_CAPABILITY_BATCH,
+        .max_event_size = max_event_size};
+    test_netevent_provider_t provider(0, provider_characteristics);
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // The extension advertises its own capabilities, and the event size its buffers were reserved for.
+    REQUIRE(provider.client_dispatch->header.version >= EBPF_NETEVENT_EXTENSION_VERSION_CAPABILITIES);
+    REQUIRE(provider.client_dispatch->header.size >= sizeof(netevent_ext_function_addresses_t));
+    REQUIRE(provider.client_dispatch->capabilities & NETEVENT_CAPABILITY_BATCH);
+    // Zero copy is not offered while the program context cannot be declared read-only.
+    REQUIRE((provider.client_dispatch->capabilities & NETEVENT_CAPABILITY_ZERO_COPY) == 0);
+    REQUIRE(provider.client_dispatch->reserved_event_size == max_event_size);
+
+    // Keep using the same processor, and thus the same buffers.
+    DWORD_PTR previous_affinity = SetThreadAffinityMask(GetCurrentThread(), 1);
+    REQUIRE(previous_affinity != 0);
+
+    // The zero copy program gets a copy of the events, as the provider does not allow zero copy.
+    std::vector<uint8_t> small_event(PKTMON_EVENT_HEADER_LENGTH + 32, 0);
+    *reinterpret_cast<uint32_t*>(small_event.data()) = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    netevent_event_t small_netevent_event = {small_event.data(), small_event.data() + small_event.size()};
+    provider.push_event(&small_netevent_event);
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.netevent_context.data_meta != small_event.data());
+    REQUIRE((size_t)(client_context.netevent_context.data_end - client_context.netevent_context.data) == 32);
+
+    // Events up to the provider's max event size no longer resize the buffers.
+    netevent_ext_stats_t stats_before = _get_netevent_stats();
+    REQUIRE(stats_before.buffer_peak_size >= sizeof(netevent_data_header_t) + max_event_size);
+    std::vector<uint8_t> large_event(max_event_size, 0);
+    *reinterpret_cast<uint32_t*>(large_event.data()) = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    netevent_event_t large_netevent_event = {large_event.data(), large_event.data() + large_event.size()};
+    provider.push_event(&large_netevent_event);
+    netevent_ext_stats_t stats_after = _get_netevent_stats();
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(stats_after.buffer_resize_count == stats_before.buffer_resize_count);
+    REQUIRE(stats_after.lost_allocation_failure == stats_before.lost_allocation_failure);
+
+    SetThreadAffinityMask(GetCurrentThread(), previous_affinity);
+}
+
+TEST_CASE("netevent_passive_dispatch", "[neteventebpfext]")
+{
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_Drop});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 100, 0);
+    *reinterpret_cast<uint32_t*>(event.data()) = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    for (size_t index = PKTMON_EVENT_HEADER_LENGTH; index < event.size(); index++) {
+        event[index] = (uint8_t)index;
+    }
+    netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+
+    // Sequence numbers are per processor, keep pushing from the same one.
+    DWORD_PTR previous_affinity = SetThreadAffinityMask(GetCurrentThread(), 1);
+    REQUIRE(previous_affinity != 0);
+
+    // Events pushed at PASSIVE_LEVEL are copied into a pooled buffer, and the program runs without raising IRQL.
+    netevent_ext_stats_t stats_before = _get_netevent_stats();
+    provider.push_event(&netevent_event);
+    netevent_ext_stats_t stats_after = _get_netevent_stats();
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.invoke_irql == PASSIVE_LEVEL);
+    REQUIRE(stats_after.passive_dispatched - stats_before.passive_dispatched == 1);
+    REQUIRE(stats_after.copied - stats_before.copied == 1);
+    REQUIRE(stats_after.buffer_pool_empty == stats_before.buffer_pool_empty);
+
+    const netevent_event_md_t& netevent_context = client_context.netevent_context;
+    const netevent_data_header_t* header_ptr =
+        reinterpret_cast<const netevent_data_header_t*>(netevent_context.data_meta);
+    REQUIRE(netevent_context.data_meta != event.data());
+    REQUIRE(header_ptr->cpu == 0);
+    REQUIRE(header_ptr->sequence == netevent_context.sequence);
+    REQUIRE((size_t)(netevent_context.data_end - netevent_context.data) == event.size() - PKTMON_EVENT_HEADER_LENGTH);
+    REQUIRE(memcmp(netevent_context.data, event.data() + PKTMON_EVENT_HEADER_LENGTH, 100) == 0);
+    uint64_t passive_sequence = netevent_context.sequence;
+
+    // Events pushed at DISPATCH_LEVEL, as from a DPC, are dispatched at once on the per-CPU buffer, and share the
+    // sequence numbers of the processor.
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+    provider.push_event(&netevent_event);
+    KeLowerIrql(old_irql);
+    stats_before = stats_after;
+    stats_after = _get_netevent_stats();
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.invoke_irql == DISPATCH_LEVEL);
+    REQUIRE(stats_after.passive_dispatched == stats_before.passive_dispatched);
+    REQUIRE(netevent_context.sequence == passive_sequence + 1);
+    REQUIRE(memcmp(netevent_context.data, event.data() + PKTMON_EVENT_HEADER_LENGTH, 100) == 0);
+
+    SetThreadAffinityMask(GetCurrentThread(), previous_affinity);
+}
+
+typedef struct _test_netevent_timed_client_context
+{
+    test_netevent_client_context_t client;
+    uint64_t work_ticks; ///< Performance counter ticks each invocation spins for, standing in for a program.
+    uint64_t last_end;   ///< Performance counter at the end of the previous invocation of the burst, 0 if none.
+    uint64_t max_gap;    ///< Longest interval between two invocations of a burst.
+} test_netevent_timed_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+neteventebpfext_unit_invoke_timed_netevent_program(
+    _In_ const void* client_netevent_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_netevent_timed_client_context_t* client_context =
+        (test_netevent_timed_client_context_t*)client_netevent_context;
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+    if (client_context->last_end != 0 && (uint64_t)now.QuadPart - client_context->last_end > client_context->max_gap) {
+        client_context->max_gap = (uint64_t)now.QuadPart - client_context->last_end;
+    }
+    client_context->client.netevent_context = *(netevent_event_md_t*)context;
+    client_context->client.invoke_count++;
+    client_context->client.invoke_irql = KeGetCurrentIrql();
+
+    uint64_t end = (uint64_t)now.QuadPart + client_context->work_ticks;
+    do {
+        QueryPerformanceCounter(&now);
+    } while ((uint64_t)now.QuadPart < end);
+    client_context->last_end = (uint64_t)now.QuadPart;
+
+    *result = 0;
+    return EBPF_SUCCESS;
+}
+
+// Compares the time the processor spends at DISPATCH_LEVEL, during which its DPCs are delayed, when a burst is pushed
+// from a DPC and when it is pushed at PASSIVE_LEVEL. The former holds DISPATCH_LEVEL for the whole burst, the latter
+// only while preparing each event, which is bounded by the longest interval between two program invocations. Hidden,
+// run it with the [.benchmark] tag.
+TEST_CASE("netevent_passive_dispatch_benchmark", "[neteventebpfext][.benchmark]")
+{
+    const uint32_t burst_size = 64;
+    const uint32_t burst_count = 1000;
+    const size_t payload_size = 1024;
+    LARGE_INTEGER frequency;
+    // Longest time at DISPATCH_LEVEL when pushing from a DPC and at PASSIVE_LEVEL.
+    uint64_t dpc_push_max_ticks = 0;
+    uint64_t passive_push_max_ticks = 0;
+
+    QueryPerformanceFrequency(&frequency);
+
+    for (bool raise_irql : {true, false}) {
+        netevent_attach_opts_t attach_opts = {.capture_type = NeteventCapture_All};
+        test_netevent_timed_client_context_t client_context = {};
+        client_context.client.base.desired_attach_type = BPF_ATTACH_TYPE_NETEVENT;
+        // Each program invocation takes about a microsecond.
+        client_context.work_ticks = (uint64_t)frequency.QuadPart / (1000 * 1000);
+        test_netevent_hook_t hook(
+            &attach_opts,
+            (_ebpf_extension_dispatch_function)neteventebpfext_unit_invoke_timed_netevent_program,
+            &client_context.client.base);
+
+        test_netevent_provider_t provider;
+        REQUIRE(provider.client_dispatch != nullptr);
+
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + payload_size, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+        std::vector<netevent_event_t> netevent_events(burst_size, {event.data(), event.data() + event.size()});
+
+        for (uint32_t burst = 0; burst < burst_count; burst++) {
+            LARGE_INTEGER burst_start;
+            LARGE_INTEGER burst_end;
+            KIRQL old_irql = PASSIVE_LEVEL;
+
+            client_context.last_end = 0;
+            QueryPerformanceCounter(&burst_start);
+            if (raise_irql) {
+                old_irql = KeRaiseIrqlToDpcLevel();
+            }
+            provider.push_events(netevent_events.data(), burst_size);
+            if (raise_irql) {
+                KeLowerIrql(old_irql);
+            }
+            QueryPerformanceCounter(&burst_end);
+
+            if (raise_irql && (uint64_t)(burst_end.QuadPart - burst_start.QuadPart) > dpc_push_max_ticks) {
+                dpc_push_max_ticks = (uint64_t)(burst_end.QuadPart - burst_start.QuadPart);
+            }
+        }
+        if (!raise_irql) {
+            passive_push_max_ticks = client_context.max_gap;
+        }
+
+        REQUIRE(client_context.client.invoke_count == (uint64_t)burst_size * burst_count);
+        REQUIRE(client_context.client.invoke_irql == (raise_irql ? DISPATCH_LEVEL : PASSIVE_LEVEL));
+    }
+
+    // A whole burst of program invocations at DISPATCH_LEVEL takes longer than preparing a single event.
+    REQUIRE(passive_push_max_ticks < dpc_push_max_ticks);
+}
+
+TEST_CASE("netevent_capture_ring", "[neteventebpfext]")
+{
+    neteventebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_NETEVENT);
+    test_netevent_capture_t capture = reinterpret_cast<test_netevent_capture_t>(
+        program_data->program_type_specific_helper_function_addresses->helper_function_address[3]);
+
+    auto run_capture = [&](const std::vector<uint8_t>& data, uint32_t snaplen) {
+        netevent_event_md_t context_in = {};
+        void* context = nullptr;
+        REQUIRE(
+            program_data->context_create(
+                data.data(),
+                data.size(),
+                reinterpret_cast<const uint8_t*>(&context_in),
+                sizeof(context_in),
+                &context) == EBPF_SUCCESS);
+        int result = capture(reinterpret_cast<netevent_event_md_t*>(context), snaplen);
+        size_t data_size_out = 0;
+        size_t context_size_out = 0;
+        program_data->context_destroy(context, nullptr, &data_size_out, nullptr, &context_size_out);
+        return result;
+    };
+
+    std::vector<uint8_t> data = _build_netevent_flow_event(4);
+    const uint32_t packet_size = (uint32_t)(data.size() - sizeof(netevent_data_header_t) - PKTMON_EVENT_HEADER_LENGTH);
+
+    // Nothing is captured until the ring is mapped.
+    REQUIRE(run_capture(data, 0) == -ENODEV);
+
+    // The mapping is owned by the file object it is requested on.
+    int mapping_file = 0;
+    int other_file = 0;
+    netevent_capture_ring_mapping_t mapping = {};
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            &mapping_file,
+            IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING,
+            nullptr,
+            0,
+            &mapping,
+            sizeof(mapping),
+            &bytes_returned) == STATUS_SUCCESS);
+    REQUIRE(bytes_returned == sizeof(mapping));
+    REQUIRE(
+        ebpf_ext_device_control(
+            &other_file, IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING, nullptr, 0, &mapping, sizeof(mapping), &bytes_returned) !=
+        STATUS_SUCCESS);
+
+    netevent_capture_ring_header_t* ring_header = reinterpret_cast<netevent_capture_ring_header_t*>(mapping.address);
+    const uint8_t* data_area = reinterpret_cast<const uint8_t*>(mapping.address) + ring_header->data_offset;
+    REQUIRE(ring_header->data_size == NETEVENT_CAPTURE_RING_DATA_SIZE);
+    REQUIRE(mapping.size == ring_header->data_offset + ring_header->data_size);
+    REQUIRE(ring_header->producer_offset == 0);
+
+    // A whole event, then one truncated to 20 bytes.
+    netevent_ext_stats_t stats_before = _get_netevent_stats();
+    REQUIRE(run_capture(data, 0) == 0);
+    REQUIRE(run_capture(data, 20) == 0);
+
+    uint64_t offset = ring_header->consumer_offset;
+    const uint32_t expected_lengths[] = {packet_size, 20};
+    for (uint32_t expected_length : expected_lengths) {
+        REQUIRE(offset < ring_header->producer_offset);
+        const netevent_capture_record_t* record =
+            reinterpret_cast<const netevent_capture_record_t*>(data_area + (offset & (ring_header->data_size - 1)));
+        const netevent_data_header_t* data_header = reinterpret_cast<const netevent_data_header_t*>(record + 1);
+        const uint8_t* pktmon_header = reinterpret_cast<const uint8_t*>(data_header + 1);
+        REQUIRE(record->flags == 0);
+        REQUIRE(record->length % sizeof(netevent_capture_record_t) == 0);
+        REQUIRE(record->captured_length == expected_length);
+        REQUIRE(data_header->version == NETEVENT_PKTMON_EVENT_CURRENT_VERSION);
+        REQUIRE(data_header->type == NETEVENT_EVENT_TYPE_PKTMON_DROP);
+        REQUIRE(data_header->original_length == packet_size);
+        REQUIRE(
+            memcmp(
+                pktmon_header,
+                data.data() + sizeof(netevent_data_header_t),
+                PKTMON_EVENT_HEADER_LENGTH + expected_length) == 0);
+        offset += record->length;
+    }
+    REQUIRE(offset == ring_header->producer_offset);
+    ring_header->consumer_offset = offset;
+
+    // Large events fill the ring, which then drops the events until they are consumed.
+    std::vector<uint8_t> large_data(sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH + 60000, 0);
+    memcpy(large_data.data(), data.data(), sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH);
+    int result = 0;
+    uint32_t written_count = 0;
+    while (written_count < 1000 && (result = run_capture(large_data, 0)) == 0) {
+        written_count++;
+    }
+    REQUIRE(result == -ENOSPC);
+    REQUIRE(ring_header->dropped_count == 1);
+    REQUIRE(ring_header->producer_offset - ring_header->consumer_offset <= ring_header->data_size);
+
+    // Records never wrap around the end of the data area.
+    while (ring_header->consumer_offset < ring_header->producer_offset) {
+        const netevent_capture_record_t* record = reinterpret_cast<const netevent_capture_record_t*>(
+            data_area + (ring_header->consumer_offset & (ring_header->data_size - 1)));
+        REQUIRE(
+            (ring_header->consumer_offset & (ring_header->data_size - 1)) + record->length <= ring_header->data_size);
+        if ((record->flags & NETEVENT_CAPTURE_RECORD_FLAG_PADDING) == 0) {
+            REQUIRE(record->captured_length == 60000);
+        }
+        ring_header->consumer_offset += record->length;
+    }
+    REQUIRE(run_capture(large_data, 0) == 0);
+
+    netevent_ext_stats_t stats_after = _get_netevent_stats();
+    REQUIRE(stats_after.captured - stats_before.captured == 2 + written_count + 1);
+    REQUIRE(stats_after.capture_dropped - stats_before.capture_dropped == 1);
+
+    // Other file objects can neither unmap the ring nor release it when they are cleaned up.
+    REQUIRE(
+        ebpf_ext_device_control(
+            &other_file, IOCTL_NETEVENT_EXT_UNMAP_CAPTURE_RING, nullptr, 0, nullptr, 0, &bytes_returned) !=
+        STATUS_SUCCESS);
+    ebpf_ext_file_cleanup(&other_file);
+    ring_header->consumer_offset = ring_header->producer_offset;
+    REQUIRE(run_capture(data, 0) == 0);
+
+    // Once unmapped, nothing is captured anymore.
+    REQUIRE(
+        ebpf_ext_device_control(
+            &mapping_file, IOCTL_NETEVENT_EXT_UNMAP_CAPTURE_RING, nullptr, 0, nullptr, 0, &bytes_returned) ==
+        STATUS_SUCCESS);
+    REQUIRE(
+        ebpf_ext_device_control(
+            &mapping_file, IOCTL_NETEVENT_EXT_UNMAP_CAPTURE_RING, nullptr, 0, nullptr, 0, &bytes_returned) !=
+        STATUS_SUCCESS);
+    REQUIRE(run_capture(data, 0) == -ENODEV);
+
+    // The cleanup of the owning file object unmaps the ring.
+    REQUIRE(
+        ebpf_ext_device_control(
+            &mapping_file,
+            IOCTL_NETEVENT_EXT_MAP_CAPTURE_RING,
+            nullptr,
+            0,
+            &mapping,
+            sizeof(mapping),
+            &bytes_returned) == STATUS_SUCCESS);
+    REQUIRE(run_capture(data, 0) == 0);
+    ebpf_ext_file_cleanup(&mapping_file);
+    REQUIRE(run_capture(data, 0) == -ENODEV);
+}
+
+TEST_CASE("netevent_stats", "[neteventebpfext]")
+{
+    const uint32_t snaplen = 100;
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_Drop, .flags = 0, .snaplen = snaplen});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // Unknown requests and short output buffers are rejected.
+    netevent_ext_stats_t stats;
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(nullptr, 0, nullptr, 0, &stats, sizeof(stats), &bytes_returned) != STATUS_SUCCESS);
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_GET_STATS, nullptr, 0, &stats, sizeof(stats) - 1, &bytes_returned) !=
+        STATUS_SUCCESS);
+
+    netevent_ext_stats_t stats_before = _get_netevent_stats();
+
+    // A drop event within the snaplen, a truncated drop event, a filtered flow event and an invalid event.
+    struct
+    {
+        uint32_t event_id;
+        size_t event_size;
+    } test_events[] = {
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, PKTMON_EVENT_HEADER_LENGTH + 32},
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, PKTMON_EVENT_HEADER_LENGTH + 1000},
+        {NETEVENT_EVENT_TYPE_PKTMON_FLOW, PKTMON_EVENT_HEADER_LENGTH + 32},
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, sizeof(uint32_t)},
+    };
+    for (const auto& test_event : test_events) {
+        std::vector<uint8_t> event(test_event.event_size, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = test_event.event_id;
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        provider.push_event(&netevent_event);
+    }
+
+    netevent_ext_stats_t stats_after = _get_netevent_stats();
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(stats_after.received - stats_before.received == 4);
+    REQUIRE(stats_after.invalid - stats_before.invalid == 1);
+    REQUIRE(stats_after.filtered - stats_before.filtered == 1);
+    REQUIRE(stats_after.copied - stats_before.copied == 2);
+    REQUIRE(stats_after.truncated - stats_before.truncated == 1);
+    REQUIRE(stats_after.lost_no_buffer == stats_before.lost_no_buffer);
+    REQUIRE(stats_after.lost_allocation_failure == stats_before.lost_allocation_failure);
+    REQUIRE(
+        stats_after.event_type_count[NeteventStatsEventType_Drop] -
+            stats_before.event_type_count[NeteventStatsEventType_Drop] ==
+        2);
+    REQUIRE(
+        stats_after.event_type_count[NeteventStatsEventType_Flow] -
+            stats_before.event_type_count[NeteventStatsEventType_Flow] ==
+        1);
+
+    // 32 byte events land in the first bucket, 1000 byte events in the [512, 1024) bucket.
+    REQUIRE(stats_after.event_size_histogram[0] - stats_before.event_size_histogram[0] == 2);
+    REQUIRE(stats_after.event_size_histogram[4] - stats_before.event_size_histogram[4] == 1);
+    REQUIRE(stats_after.buffer_peak_size > 0);
+}
+
+TEST_CASE("netevent_multiple_providers", "[neteventebpfext]")
+{
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_All});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 32, 0);
+    *reinterpret_cast<uint32_t*>(event.data()) = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+
+    // Returns the source id of the event pushed by a provider, checking that the copied header carries it as well.
+    auto push_and_get_source_id = [&](test_netevent_provider_t& provider) {
+        uint64_t invoke_count = client_context.invoke_count;
+        provider.push_event(&netevent_event);
+        REQUIRE(client_context.invoke_count == invoke_count + 1);
+        const netevent_data_header_t* header_ptr =
+            reinterpret_cast<const netevent_data_header_t*>(client_context.netevent_context.data_meta);
+        REQUIRE(header_ptr->source_id == client_context.netevent_context.source_id);
+        return client_context.netevent_context.source_id;
+    };
+
+    // Each provider gets its own binding and dispatch table, and its events are tagged with its own source id.
+    test_netevent_provider_t first_provider(0);
+    REQUIRE(first_provider.client_dispatch != nullptr);
+    uint8_t first_source_id = push_and_get_source_id(first_provider);
+    uint8_t second_source_id;
+    {
+        test_netevent_provider_t second_provider(1);
+        REQUIRE(second_provider.client_dispatch != nullptr);
+        REQUIRE(second_provider.client_dispatch != first_provider.client_dispatch);
+        REQUIRE(second_provider.client_dispatch->capture_type == first_provider.client_dispatch->capture_type);
+        second_source_id = push_and_get_source_id(second_provider);
+        REQUIRE(second_source_id != first_source_id);
+        REQUIRE(push_and_get_source_id(first_provider) == first_source_id);
+    }
+
+    // The binding of a detached provider is reused by the next provider, while the others keep their source id.
+    test_netevent_provider_t third_provider(2);
+    REQUIRE(third_provider.client_dispatch != nullptr);
+    REQUIRE(push_and_get_source_id(third_provider) == second_source_id);
+    REQUIRE(push_and_get_source_id(first_provider) == first_source_id);
+}
+
+TEST_CASE("netevent_sequence_numbers", "[neteventebpfext]")
+{
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_Drop});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    auto push_event = [&](uint32_t event_id) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 32, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = event_id;
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        provider.push_event(&netevent_event);
+    };
+
+    // Sequence numbers are per processor, keep pushing from the same one.
+    DWORD_PTR previous_affinity = SetThreadAffinityMask(GetCurrentThread(), 1);
+    REQUIRE(previous_affinity != 0);
+
+    LARGE_INTEGER before;
+    LARGE_INTEGER after;
+    QueryPerformanceCounter(&before);
+    push_event(NETEVENT_EVENT_TYPE_PKTMON_DROP);
+    QueryPerformanceCounter(&after);
+    REQUIRE(client_context.invoke_count == 1);
+    uint64_t first_sequence = client_context.netevent_context.sequence;
+    REQUIRE(client_context.netevent_context.push_timestamp >= (uint64_t)before.QuadPart);
+    REQUIRE(client_context.netevent_context.push_timestamp <= (uint64_t)after.QuadPart);
+
+    // Events that no program asked for are not numbered.
+    push_event(NETEVENT_EVENT_TYPE_PKTMON_FLOW);
+    push_event(NETEVENT_EVENT_TYPE_PKTMON_DROP);
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.netevent_context.sequence == first_sequence + 1);
+
+    // The copied header carries the same values.
+    const netevent_data_header_t* header_ptr =
+        reinterpret_cast<const netevent_data_header_t*>(client_context.netevent_context.data_meta);
+    REQUIRE(header_ptr->version == NETEVENT_PKTMON_EVENT_CURRENT_VERSION);
+    REQUIRE(header_ptr->cpu == 0);
+    REQUIRE(header_ptr->sequence == client_context.netevent_context.sequence);
+    REQUIRE(header_ptr->push_timestamp == client_context.netevent_context.push_timestamp);
+
+    SetThreadAffinityMask(GetCurrentThread(), previous_affinity);
+
+    // Test run data with a version 4 header, which has no sequence number, is still accepted.
+    const ebpf_program_data_t* program_data = hook.helper.get_program_data(EBPF_PROGRAM_TYPE_NETEVENT);
+    std::vector<uint8_t> data(NETEVENT_DATA_HEADER_SIZE_V4 + PKTMON_EVENT_HEADER_LENGTH + 4, 0);
+    netevent_data_header_t* data_header = reinterpret_cast<netevent_data_header_t*>(data.data());
+    data_header->type = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    data_header->version = 4;
+    data[NETEVENT_DATA_HEADER_SIZE_V4] = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+    netevent_event_md_t context_in = {};
+    void* context = nullptr;
+    REQUIRE(
+        program_data->context_create(
+            data.data(), data.size(), reinterpret_cast<const uint8_t*>(&context_in), sizeof(context_in), &context) ==
+        EBPF_SUCCESS);
+    netevent_event_md_t* netevent_event_md = reinterpret_cast<netevent_event_md_t*>(context);
+    REQUIRE(netevent_event_md->data == data.data() + NETEVENT_DATA_HEADER_SIZE_V4 + PKTMON_EVENT_HEADER_LENGTH);
+    REQUIRE(netevent_event_md->event_type == NETEVENT_EVENT_TYPE_PKTMON_DROP);
+    REQUIRE(netevent_event_md->sequence == 0);
+    size_t data_size_out = 0;
+    size_t context_size_out = 0;
+    program_data->context_destroy(context, nullptr, &data_size_out, nullptr, &context_size_out);
+
+    // A version 5 header must be complete.
+    data_header->version = NETEVENT_PKTMON_EVENT_CURRENT_VERSION;
+    REQUIRE(
+        program_data->context_create(
+            data.data(),
+            sizeof(netevent_data_header_t) - 1,
+            reinterpret_cast<const uint8_t*>(&context_in),
+            sizeof(context_in),
+            &context) != EBPF_SUCCESS);
+}
+
+static void
+_set_netevent_coalescing(uint32_t window_us, uint32_t key_length)
+{
+    netevent_coalescing_config_t config = {.window_us = window_us, .key_length = key_length};
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_SET_COALESCING, &config, sizeof(config), nullptr, 0, &bytes_returned) ==
+        STATUS_SUCCESS);
+}
+
+TEST_CASE("netevent_coalescing", "[neteventebpfext]")
+{
+    const size_t drop_reason_offset = 35;
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_All});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // Settings beyond the limits are rejected.
+    netevent_coalescing_config_t config = {.window_us = NETEVENT_COALESCING_MAX_WINDOW_US + 1, .key_length = 0};
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_SET_COALESCING, &config, sizeof(config), nullptr, 0, &bytes_returned) !=
+        STATUS_SUCCESS);
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_SET_COALESCING, &config, sizeof(config) - 1, nullptr, 0, &bytes_returned) !=
+        STATUS_SUCCESS);
+
+    auto push_drop_event = [&](uint32_t event_id, uint32_t drop_reason, uint8_t payload_byte) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 64, payload_byte);
+        memset(event.data(), 0, PKTMON_EVENT_HEADER_LENGTH);
+        *reinterpret_cast<uint32_t*>(event.data()) = event_id;
+        memcpy(event.data() + drop_reason_offset, &drop_reason, sizeof(drop_reason));
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        provider.push_event(&netevent_event);
+    };
+
+    // Coalescing tables are per processor, keep pushing from the same one.
+    DWORD_PTR previous_affinity = SetThreadAffinityMask(GetCurrentThread(), 1);
+    REQUIRE(previous_affinity != 0);
+
+    // Coalescing is disabled by default.
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_DROP, 2, 0xAA);
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_DROP, 2, 0xAA);
+    REQUIRE(client_context.invoke_count == 2);
+
+    // Within a long window, only the first of identical drop events is dispatched. Events with another drop reason or
+    // other key bytes, and flow events, are not coalesced.
+    _set_netevent_coalescing(NETEVENT_COALESCING_MAX_WINDOW_US, 16);
+    netevent_ext_stats_t stats_before = _get_netevent_stats();
+    client_context.invoke_count = 0;
+    for (int index = 0; index < 5; index++) {
+        push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_DROP, 3, 0xAA);
+    }
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.netevent_context.repeat_count == 0);
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_DROP, 4, 0xAA);
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_DROP, 3, 0xBB);
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_FLOW, 3, 0xAA);
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_FLOW, 3, 0xAA);
+    REQUIRE(client_context.invoke_count == 5);
+    REQUIRE(_get_netevent_stats().coalesced - stats_before.coalesced == 4);
+
+    // Once the window has elapsed, the next identical event is dispatched with the number of coalesced events.
+    _set_netevent_coalescing(1, 16);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    push_drop_event(NETEVENT_EVENT_TYPE_PKTMON_DROP, 3, 0xAA);
+    REQUIRE(client_context.invoke_count == 6);
+    REQUIRE(client_context.netevent_context.drop_reason == 3);
+    REQUIRE(client_context.netevent_context.repeat_count == 4);
+
+    _set_netevent_coalescing(0, 0);
+    SetThreadAffinityMask(GetCurrentThread(), previous_affinity);
+}
+
+static void
+_set_netevent_sampling(uint32_t rate, uint32_t burst)
+{
+    netevent_sampling_config_t config = {.rate = rate, .burst = burst};
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_SET_SAMPLING, &config, sizeof(config), nullptr, 0, &bytes_returned) ==
+        STATUS_SUCCESS);
+}
+
+TEST_CASE("netevent_sampling", "[neteventebpfext]")
+{
+    const size_t component_id_offset = 29;
+    const size_t drop_reason_offset = 35;
+    test_netevent_hook_t hook({.capture_type = NeteventCapture_All});
+    test_netevent_client_context_t& client_context = hook.client_context;
+
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+
+    // Sampling needs a non-empty bucket, and settings beyond the limits are rejected.
+    netevent_sampling_config_t config = {.rate = 1, .burst = 0};
+    size_t bytes_returned = 0;
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_SET_SAMPLING, &config, sizeof(config), nullptr, 0, &bytes_returned) !=
+        STATUS_SUCCESS);
+    config = {.rate = NETEVENT_SAMPLING_MAX_RATE + 1, .burst = 1};
+    REQUIRE(
+        ebpf_ext_device_control(
+            nullptr, IOCTL_NETEVENT_EXT_SET_SAMPLING, &config, sizeof(config), nullptr, 0, &bytes_returned) !=
+        STATUS_SUCCESS);
+
+    auto push_drop_event = [&](uint32_t drop_reason, uint16_t component_id) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + 64, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = NETEVENT_EVENT_TYPE_PKTMON_DROP;
+        memcpy(event.data() + component_id_offset, &component_id, sizeof(component_id));
+        memcpy(event.data() + drop_reason_offset, &drop_reason, sizeof(drop_reason));
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        provider.push_event(&netevent_event);
+    };
+
+    // Token buckets are per processor, keep pushing from the same one.
+    DWORD_PTR previous_affinity = SetThreadAffinityMask(GetCurrentThread(), 1);
+    REQUIRE(previous_affinity != 0);
+
+    // Sampling is disabled by default, every event has a weight of 1.
+    push_drop_event(5, 1);
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.netevent_context.sample_weight == 1);
+
+    // A dominant stratum is capped to its burst, while a rare one is still dispatched.
+    _set_netevent_sampling(1, 2);
+    netevent_ext_stats_t stats_before = _get_netevent_stats();
+    client_context.invoke_count = 0;
+    for (int index = 0; index < 10; index++) {
+        push_drop_event(5, 1);
+    }
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.netevent_context.sample_weight == 1);
+    push_drop_event(6, 1);
+    REQUIRE(client_context.invoke_count == 3);
+    REQUIRE(client_context.netevent_context.drop_reason == 6);
+    REQUIRE(client_context.netevent_context.sample_weight == 1);
+    REQUIRE(_get_netevent_stats().sampled_out - stats_before.sampled_out == 8);
+
+    // Once the bucket is refilled, the next event of the stratum stands for the skipped ones.
+    _set_netevent_sampling(NETEVENT_SAMPLING_MAX_RATE, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    push_drop_event(5, 1);
+    REQUIRE(client_context.invoke_count == 4);
+    REQUIRE(client_context.netevent_context.drop_reason == 5);
+    REQUIRE(client_context.netevent_context.sample_weight == 9);
+
+    _set_netevent_sampling(0, 0);
+    SetThreadAffinityMask(GetCurrentThread(), previous_affinity);
+}
+
+typedef struct test_netevent_summary_client_context
+{
+    neteventebpfext_helper_base_client_context_t base;
+    netevent_summary_md_t summary; ///< Counters summed over all the intervals, and the last interval.
+    uint64_t invoke_count;
+} test_netevent_summary_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+neteventebpfext_unit_invoke_summary_program(
+    _In_ const void* client_summary_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_netevent_summary_client_context_t* client_context =
+        (test_netevent_summary_client_context_t*)client_summary_context;
+    const netevent_summary_md_t* summary_md = (const netevent_summary_md_t*)context;
+    uint64_t* total = (uint64_t*)&client_context->summary;
+    const uint64_t* counters = (const uint64_t*)summary_md;
+
+    for (size_t counter = 0; counter < sizeof(netevent_summary_md_t) / sizeof(uint64_t); counter++) {
+        total[counter] += counters[counter];
+    }
+    client_context->summary.interval_start = summary_md->interval_start;
+    client_context->summary.interval_end = summary_md->interval_end;
+    client_context->invoke_count++;
+    *result = 0;
+    return EBPF_SUCCESS;
+}
+
+TEST_CASE("netevent_summary_context_create", "[neteventebpfext]")
+{
+    neteventebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_NETEVENT_SUMMARY);
+    REQUIRE(
+        program_data->program_info->program_type_descriptor->bpf_prog_type ==
+        (bpf_prog_type_t)BPF_PROG_TYPE_NETEVENT_SUMMARY);
+    REQUIRE(program_data->required_irql == DISPATCH_LEVEL);
+
+    netevent_summary_md_t summary_in = {};
+    summary_in.interval_start = 10;
+    summary_in.interval_end = 20;
+    summary_in.drop_count = 3;
+    summary_in.drop_reason_count[2] = 3;
+
+    void* context = nullptr;
+    REQUIRE(program_data->context_create(nullptr, 0, nullptr, 0, &context) != EBPF_SUCCESS);
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&summary_in), sizeof(summary_in) - 1, &context) !=
+        EBPF_SUCCESS);
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&summary_in), sizeof(summary_in), &context) == EBPF_SUCCESS);
+    REQUIRE(reinterpret_cast<netevent_summary_md_t*>(context)->drop_reason_count[2] == 3);
+
+    netevent_summary_md_t summary_out = {};
+    size_t context_size_out = sizeof(summary_out);
+    size_t data_size_out = 0;
+    program_data->context_destroy(
+        context, nullptr, &data_size_out, reinterpret_cast<uint8_t*>(&summary_out), &context_size_out);
+    REQUIRE(context_size_out == sizeof(summary_out));
+    REQUIRE(data_size_out == 0);
+    REQUIRE(memcmp(&summary_out, &summary_in, sizeof(summary_in)) == 0);
+}
+
+TEST_CASE("netevent_summary", "[neteventebpfext]")
+{
+    // Offsets of the ComponentId and DropReason fields in the packed PKTMON header.
+    const size_t component_id_offset = 29;
+    const size_t drop_reason_offset = 35;
+    test_netevent_summary_client_context_t client_context = {};
+    client_context.base.desired_attach_type = (bpf_attach_type_t)BPF_ATTACH_TYPE_NETEVENT_SUMMARY;
+    test_netevent_hook_t hook(
+        nullptr, (_ebpf_extension_dispatch_function)neteventebpfext_unit_invoke_summary_program, &client_context.base);
+
+    // A summary program alone binds the extension to the NetEvent provider, for every event.
+    test_netevent_provider_t provider;
+    REQUIRE(provider.client_dispatch != nullptr);
+    REQUIRE(provider.client_dispatch->capture_type == NeteventCapture_All);
+
+    struct
+    {
+        uint32_t event_id;
+        uint32_t drop_reason;
+        uint16_t component_id;
+        size_t payload_size;
+    } test_events[] = {
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, 2, 7, 64},
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, 2, 7, 64},
+        {NETEVENT_EVENT_TYPE_PKTMON_DROP, 1000, 500, 100},
+        {NETEVENT_EVENT_TYPE_PKTMON_FLOW, 0, 7, 32},
+        {1, 0, 7, 32},
+    };
+    for (const auto& test_event : test_events) {
+        std::vector<uint8_t> event(PKTMON_EVENT_HEADER_LENGTH + test_event.payload_size, 0);
+        *reinterpret_cast<uint32_t*>(event.data()) = test_event.event_id;
+        memcpy(event.data() + drop_reason_offset, &test_event.drop_reason, sizeof(test_event.drop_reason));
+        memcpy(event.data() + component_id_offset, &test_event.component_id, sizeof(test_event.component_id));
+        netevent_event_t netevent_event = {event.data(), event.data() + event.size()};
+        provider.push_event(&netevent_event);
+    }
+
+    // Wait for the events to be reported by at least one interval.
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * NETEVENT_SUMMARY_INTERVAL_MS));
+
+    const netevent_summary_md_t& summary = client_context.summary;
+    REQUIRE(client_context.invoke_count >= 1);
+    REQUIRE(summary.interval_end > summary.interval_start);
+    REQUIRE(summary.event_count == 5);
+    REQUIRE(summary.bytes == 64 + 64 + 100 + 32 + 32);
+    REQUIRE(summary.drop_count == 3);
+    REQUIRE(summary.flow_count == 1);
+    REQUIRE(summary.other_count == 1);
+    REQUIRE(summary.drop_reason_count[2] == 2);
+    // Values beyond the counter arrays are counted in their last entry.
+    REQUIRE(summary.drop_reason_count[NETEVENT_SUMMARY_DROP_REASON_COUNT - 1] == 1);
+    REQUIRE(summary.component_count[7] == 4);
+    REQUIRE(summary.component_count[NETEVENT_SUMMARY_COMPONENT_COUNT - 1] == 1);
+}
+
+#pragma endregion
+
 TEST_CASE("libbpf attach type names", "[neteventebpfext][libbpf]")
 {
     enum bpf_attach_type attach_type;
@@ -9,12 +9,17 @@
 #include "ebpf_ntos_program_attach_type_guids.h"
 #include "ebpf_structs.h"
 #include "ntos_ebpf_ext_helper.h"
+#include "ntos_ebpf_ext_sample.h"
 #include "utils.h"
 #include "watchdog.h"
 
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
+#include <chrono>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #pragma warning(push)
 #pragma warning(disable : 28182) // Dereferencing NULL pointer. 'Temp_value_#12076' contains the same NULL
                                  //  value as 'new(1*144, nothrow)' did.
@@ -116,6 +121,7 @@ TEST_CASE("process_invoke", "[ntosebpfext]")
 {
     ebpf_extension_data_t npi_specific_characteristics = {};
     test_process_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_PROCESS;
 
     ntosebpf_ext_helper_t helper(
         &npi_specific_characteristics,
@@ -179,6 +185,7 @@ TEST_CASE("process exit codes", "[ntosebpfext]")
 {
     ebpf_extension_data_t npi_specific_characteristics = {};
     test_process_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_PROCESS;
 
     ntosebpf_ext_helper_t helper(
         &npi_specific_characteristics,
@@ -247,6 +254,7 @@ TEST_CASE("process create and exit times", "[ntosebpfext]")
 {
     ebpf_extension_data_t npi_specific_characteristics = {};
     test_process_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_PROCESS;
 
     ntosebpf_ext_helper_t helper(
         &npi_specific_characteristics,
@@ -740,4 +748,784 @@ TEST_CASE("process_resolve_account", "[ntosebpfext]")
     }
 }
 
-#pragma endregion process
\ No newline at end of file
+#pragma endregion process
+
+#pragma region thread
+
+typedef struct test_thread_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    thread_md_t thread_md;
+} test_thread_notify_context_t;
+
+TEST_CASE("thread_context_create", "[ntosebpfext]")
+{
+    ntosebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_THREAD);
+    REQUIRE(program_data->program_info->program_type_descriptor->bpf_prog_type == BPF_PROG_TYPE_THREAD);
+    REQUIRE(program_data->context_create != nullptr);
+    REQUIRE(program_data->context_destroy != nullptr);
+
+    test_thread_notify_context_t thread_ctx_in = {};
+    thread_ctx_in.thread_md.thread_id = 100;
+    thread_ctx_in.thread_md.process_id = TEST_PROCESS_ID;
+    thread_ctx_in.thread_md.start_address = 0x7ff612340000;
+    thread_ctx_in.thread_md.creating_process_id = 4321;
+    thread_ctx_in.thread_md.creating_thread_id = 200;
+    thread_ctx_in.thread_md.operation = THREAD_OPERATION_CREATE;
+    thread_ctx_in.thread_md.is_remote_thread = 1;
+
+    // A context smaller than the notify context must be rejected.
+    void* context = nullptr;
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&thread_ctx_in), sizeof(thread_ctx_in) - 1, &context) !=
+        EBPF_SUCCESS);
+    REQUIRE(program_data->context_create(nullptr, 0, nullptr, 0, &context) != EBPF_SUCCESS);
+
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&thread_ctx_in), sizeof(thread_ctx_in), &context) ==
+        EBPF_SUCCESS);
+    REQUIRE(context != nullptr);
+
+    thread_md_t* thread_md = reinterpret_cast<thread_md_t*>(context);
+    REQUIRE(thread_md->thread_id == thread_ctx_in.thread_md.thread_id);
+    REQUIRE(thread_md->start_address == thread_ctx_in.thread_md.start_address);
+    REQUIRE(thread_md->is_remote_thread == 1);
+
+    test_thread_notify_context_t thread_ctx_out = {};
+    size_t context_size_out = sizeof(thread_ctx_out);
+    size_t data_size_out = 0;
+    program_data->context_destroy(
+        context, nullptr, &data_size_out, reinterpret_cast<uint8_t*>(&thread_ctx_out), &context_size_out);
+
+    REQUIRE(context_size_out == sizeof(thread_ctx_out));
+    REQUIRE(data_size_out == 0);
+    REQUIRE(thread_ctx_out.thread_md.process_id == TEST_PROCESS_ID);
+    REQUIRE(thread_ctx_out.thread_md.creating_process_id == thread_ctx_in.thread_md.creating_process_id);
+    REQUIRE(thread_ctx_out.thread_md.creating_thread_id == thread_ctx_in.thread_md.creating_thread_id);
+    REQUIRE((int)thread_ctx_out.thread_md.operation == THREAD_OPERATION_CREATE);
+}
+
+typedef struct test_thread_client_context_t
+{
+    ntosebpfext_helper_base_client_context_t base;
+    thread_md_t thread_context;
+    uint32_t invoke_count;
+} test_thread_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+ntosebpfext_unit_invoke_thread_program(
+    _In_ const void* client_thread_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_thread_client_context_t* client_context = (test_thread_client_context_t*)client_thread_context;
+
+    client_context->thread_context = *(thread_md_t*)context;
+    client_context->invoke_count++;
+    *result = 0;
+    return EBPF_SUCCESS;
+}
+
+TEST_CASE("thread_invoke", "[ntosebpfext]")
+{
+    ebpf_extension_data_t npi_specific_characteristics = {};
+    test_thread_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_THREAD;
+
+    ntosebpf_ext_helper_t helper(
+        &npi_specific_characteristics,
+        (_ebpf_extension_dispatch_function)ntosebpfext_unit_invoke_thread_program,
+        (ntosebpfext_helper_base_client_context_t*)&client_context);
+
+    // Test thread creation in another process. The thread cannot be looked up in user mode, so it has no start
+    // address.
+    usersim_ntos_invoke_thread_notify_routine((HANDLE)TEST_PROCESS_ID, (HANDLE)100, TRUE);
+
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.thread_context.process_id == TEST_PROCESS_ID);
+    REQUIRE(client_context.thread_context.thread_id == 100);
+    REQUIRE((int)client_context.thread_context.operation == THREAD_OPERATION_CREATE);
+    REQUIRE(client_context.thread_context.creating_process_id == (uint64_t)PsGetCurrentProcessId());
+    REQUIRE(client_context.thread_context.creating_thread_id == (uint64_t)PsGetCurrentThreadId());
+    REQUIRE(client_context.thread_context.is_remote_thread == 1);
+    REQUIRE(client_context.thread_context.start_address == 0);
+
+    // Test thread creation in the creating process.
+    HANDLE current_process_id = PsGetCurrentProcessId();
+    usersim_ntos_invoke_thread_notify_routine(current_process_id, (HANDLE)101, TRUE);
+
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.thread_context.thread_id == 101);
+    REQUIRE(client_context.thread_context.is_remote_thread == 0);
+
+    // Test thread termination. Only the thread and its process are known.
+    usersim_ntos_invoke_thread_notify_routine((HANDLE)TEST_PROCESS_ID, (HANDLE)100, FALSE);
+
+    REQUIRE(client_context.invoke_count == 3);
+    REQUIRE(client_context.thread_context.process_id == TEST_PROCESS_ID);
+    REQUIRE(client_context.thread_context.thread_id == 100);
+    REQUIRE((int)client_context.thread_context.operation == THREAD_OPERATION_DELETE);
+    REQUIRE(client_context.thread_context.creating_process_id == 0);
+    REQUIRE(client_context.thread_context.creating_thread_id == 0);
+    REQUIRE(client_context.thread_context.is_remote_thread == 0);
+}
+
+TEST_CASE("thread_invoke_initial_thread", "[ntosebpfext]")
+{
+    ebpf_extension_data_t npi_specific_characteristics = {};
+    test_thread_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_THREAD;
+
+    ntosebpf_ext_helper_t helper(
+        &npi_specific_characteristics,
+        (_ebpf_extension_dispatch_function)ntosebpfext_unit_invoke_thread_program,
+        (ntosebpfext_helper_base_client_context_t*)&client_context);
+
+    // The process is created by the current process, which then creates its initial thread.
+    PS_CREATE_NOTIFY_INFO create_info = {};
+    create_info.ParentProcessId = PsGetCurrentProcessId();
+    create_info.CreatingThreadId.UniqueProcess = PsGetCurrentProcessId();
+    create_info.CreatingThreadId.UniqueThread = PsGetCurrentThreadId();
+    create_info.CreationStatus = STATUS_SUCCESS;
+
+    struct
+    {
+        uint64_t some_value;
+    } fake_eprocess = {};
+
+    usersime_invoke_process_creation_notify_routine(
+        reinterpret_cast<PEPROCESS>(&fake_eprocess), (HANDLE)TEST_PROCESS_ID, &create_info);
+    usersim_ntos_invoke_thread_notify_routine((HANDLE)TEST_PROCESS_ID, (HANDLE)100, TRUE);
+
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.thread_context.thread_id == 100);
+    REQUIRE(client_context.thread_context.creating_process_id == (uint64_t)PsGetCurrentProcessId());
+    REQUIRE(client_context.thread_context.is_remote_thread == 0);
+
+    // Any further thread the current process creates in it is a remote thread.
+    usersim_ntos_invoke_thread_notify_routine((HANDLE)TEST_PROCESS_ID, (HANDLE)101, TRUE);
+
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.thread_context.thread_id == 101);
+    REQUIRE(client_context.thread_context.is_remote_thread == 1);
+
+    // Once the process exited, a new process reusing its ID gets its own initial thread.
+    usersime_invoke_process_creation_notify_routine(
+        reinterpret_cast<PEPROCESS>(&fake_eprocess), (HANDLE)TEST_PROCESS_ID, nullptr);
+    usersime_invoke_process_creation_notify_routine(
+        reinterpret_cast<PEPROCESS>(&fake_eprocess), (HANDLE)TEST_PROCESS_ID, &create_info);
+    usersim_ntos_invoke_thread_notify_routine((HANDLE)TEST_PROCESS_ID, (HANDLE)102, TRUE);
+
+    REQUIRE(client_context.invoke_count == 3);
+    REQUIRE(client_context.thread_context.is_remote_thread == 0);
+}
+
+#pragma endregion thread
+
+#pragma region image
+
+typedef struct test_image_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    image_md_t image_md;
+    PCUNICODE_STRING full_image_name;
+    UNICODE_STRING image_name;
+} test_image_notify_context_t;
+
+typedef int (*test_image_get_image_name_t)(image_md_t* ctx, uint8_t* name, uint32_t name_length);
+
+TEST_CASE("image_context_create", "[ntosebpfext]")
+{
+    ntosebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_IMAGE);
+    REQUIRE(program_data->program_info->program_type_descriptor->bpf_prog_type == BPF_PROG_TYPE_IMAGE);
+    REQUIRE(program_data->program_type_specific_helper_function_addresses->helper_function_count == 1);
+    test_image_get_image_name_t get_image_name = reinterpret_cast<test_image_get_image_name_t>(
+        program_data->program_type_specific_helper_function_addresses->helper_function_address[0]);
+
+    std::wstring image_name = L"\\Device\\HarddiskVolume1\\Windows\\System32\\notepad.exe";
+    size_t image_name_size = image_name.size() * sizeof(wchar_t);
+
+    test_image_notify_context_t image_ctx_in = {};
+    image_ctx_in.image_md.process_id = TEST_PROCESS_ID;
+    image_ctx_in.image_md.image_base = 0x7ff612340000;
+    image_ctx_in.image_md.image_size = 0x1000;
+    image_ctx_in.image_md.signature_level = 12;
+    image_ctx_in.image_md.signature_type = 1;
+
+    // The image name must be a whole number of UTF-16 characters.
+    void* context = nullptr;
+    REQUIRE(
+        program_data->context_create(
+            reinterpret_cast<const uint8_t*>(image_name.c_str()),
+            image_name_size - 1,
+            reinterpret_cast<const uint8_t*>(&image_ctx_in),
+            sizeof(image_ctx_in),
+            &context) != EBPF_SUCCESS);
+
+    REQUIRE(
+        program_data->context_create(
+            reinterpret_cast<const uint8_t*>(image_name.c_str()),
+            image_name_size,
+            reinterpret_cast<const uint8_t*>(&image_ctx_in),
+            sizeof(image_ctx_in),
+            &context) == EBPF_SUCCESS);
+    REQUIRE(context != nullptr);
+
+    image_md_t* image_md = reinterpret_cast<image_md_t*>(context);
+    REQUIRE(image_md->image_base == image_ctx_in.image_md.image_base);
+
+    // The helper copies the name only when the buffer is large enough.
+    std::vector<uint8_t> name(MAX_IMAGE_PATH_SIZE);
+    REQUIRE(get_image_name(image_md, name.data(), 4) < 0);
+    REQUIRE(get_image_name(image_md, name.data(), (uint32_t)name.size()) == (int)image_name_size);
+    REQUIRE(memcmp(name.data(), image_name.c_str(), image_name_size) == 0);
+
+    test_image_notify_context_t image_ctx_out = {};
+    size_t context_size_out = sizeof(image_ctx_out);
+    std::vector<uint8_t> data_out(MAX_IMAGE_PATH_SIZE);
+    size_t data_size_out = data_out.size();
+    program_data->context_destroy(
+        context, data_out.data(), &data_size_out, reinterpret_cast<uint8_t*>(&image_ctx_out), &context_size_out);
+
+    REQUIRE(context_size_out == sizeof(image_ctx_out));
+    REQUIRE(data_size_out == image_name_size);
+    REQUIRE(memcmp(data_out.data(), image_name.c_str(), image_name_size) == 0);
+    REQUIRE(image_ctx_out.full_image_name == nullptr);
+    REQUIRE(image_ctx_out.image_md.process_id == TEST_PROCESS_ID);
+    REQUIRE(image_ctx_out.image_md.signature_level == 12);
+
+    // Without a name the helper reports that none is available.
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&image_ctx_in), sizeof(image_ctx_in), &context) ==
+        EBPF_SUCCESS);
+    REQUIRE(get_image_name(reinterpret_cast<image_md_t*>(context), name.data(), (uint32_t)name.size()) < 0);
+    context_size_out = sizeof(image_ctx_out);
+    data_size_out = data_out.size();
+    program_data->context_destroy(
+        context, data_out.data(), &data_size_out, reinterpret_cast<uint8_t*>(&image_ctx_out), &context_size_out);
+    REQUIRE(data_size_out == 0);
+}
+
+typedef struct test_image_client_context_t
+{
+    ntosebpfext_helper_base_client_context_t base;
+    test_image_get_image_name_t get_image_name;
+    image_md_t image_context;
+    uint8_t image_name[MAX_IMAGE_PATH_SIZE];
+    int image_name_result;
+    uint32_t invoke_count;
+} test_image_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+ntosebpfext_unit_invoke_image_program(
+    _In_ const void* client_image_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_image_client_context_t* client_context = (test_image_client_context_t*)client_image_context;
+    image_md_t* image_md = (image_md_t*)context;
+
+    client_context->image_context = *image_md;
+    client_context->image_name_result =
+        client_context->get_image_name(image_md, client_context->image_name, sizeof(client_context->image_name));
+    client_context->invoke_count++;
+    *result = 0;
+    return EBPF_SUCCESS;
+}
+
+TEST_CASE("image_invoke", "[ntosebpfext]")
+{
+    ebpf_extension_data_t npi_specific_characteristics = {};
+    test_image_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_IMAGE;
+
+    ntosebpf_ext_helper_t helper(
+        &npi_specific_characteristics,
+        (_ebpf_extension_dispatch_function)ntosebpfext_unit_invoke_image_program,
+        (ntosebpfext_helper_base_client_context_t*)&client_context);
+
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_IMAGE);
+    client_context.get_image_name = reinterpret_cast<test_image_get_image_name_t>(
+        program_data->program_type_specific_helper_function_addresses->helper_function_address[0]);
+
+    // Test a user-mode image load.
+    std::wstring image_name = L"\\Device\\HarddiskVolume1\\Windows\\System32\\kernel32.dll";
+    UNICODE_STRING image_name_unicode = {};
+    RtlInitUnicodeString(&image_name_unicode, image_name.c_str());
+
+    IMAGE_INFO image_info = {};
+    image_info.ImageBase = (PVOID)0x7ff612340000;
+    image_info.ImageSize = 0x2000;
+    image_info.ImageSignatureLevel = 12;
+    image_info.ImageSignatureType = 1;
+
+    usersim_ntos_invoke_load_image_notify_routine(&image_name_unicode, (HANDLE)TEST_PROCESS_ID, &image_info);
+
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.image_context.process_id == TEST_PROCESS_ID);
+    REQUIRE(client_context.image_context.image_base == 0x7ff612340000);
+    REQUIRE(client_context.image_context.image_size == 0x2000);
+    REQUIRE(client_context.image_context.signature_level == 12);
+    REQUIRE(client_context.image_context.signature_type == 1);
+    REQUIRE(client_context.image_context.is_system_mode == 0);
+    REQUIRE(client_context.image_name_result == (int)image_name_unicode.Length);
+    REQUIRE(memcmp(client_context.image_name, image_name.c_str(), image_name_unicode.Length) == 0);
+
+    // Test a driver load without a name, which is mapped into no process.
+    image_info.SystemModeImage = 1;
+    usersim_ntos_invoke_load_image_notify_routine(nullptr, nullptr, &image_info);
+
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.image_context.process_id == 0);
+    REQUIRE(client_context.image_context.is_system_mode == 1);
+    REQUIRE(client_context.image_name_result < 0);
+}
+
+#pragma endregion image
+
+#pragma region registry
+
+typedef struct test_registry_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    registry_md_t registry_md;
+    PVOID key_object;
+    PCUNICODE_STRING relative_name;
+    UNICODE_STRING value_name;
+    UNICODE_STRING key_path;
+} test_registry_notify_context_t;
+
+typedef int (*test_registry_get_key_path_t)(registry_md_t* ctx, uint8_t* path, uint32_t path_length);
+
+TEST_CASE("registry_context_create", "[ntosebpfext]")
+{
+    ntosebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_REGISTRY);
+    REQUIRE(program_data->program_info->program_type_descriptor->bpf_prog_type == BPF_PROG_TYPE_REGISTRY);
+    REQUIRE(program_data->program_type_specific_helper_function_addresses->helper_function_count == 1);
+    test_registry_get_key_path_t get_key_path = reinterpret_cast<test_registry_get_key_path_t>(
+        program_data->program_type_specific_helper_function_addresses->helper_function_address[0]);
+
+    std::wstring value_name = L"Start";
+    std::wstring key_path = L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\ntosebpfext";
+    std::vector<uint8_t> data_in(reinterpret_cast<const uint8_t*>(value_name.c_str()),
+                                 reinterpret_cast<const uint8_t*>(value_name.c_str() + value_name.size()));
+    data_in.insert(data_in.end(),
+                   reinterpret_cast<const uint8_t*>(key_path.c_str()),
+                   reinterpret_cast<const uint8_t*>(key_path.c_str() + key_path.size()));
+
+    test_registry_notify_context_t registry_ctx_in = {};
+    registry_ctx_in.registry_md.process_id = TEST_PROCESS_ID;
+    registry_ctx_in.registry_md.operation = REGISTRY_OPERATION_SET_VALUE;
+    registry_ctx_in.registry_md.data_type = 4; // REG_DWORD
+    registry_ctx_in.registry_md.data_size = sizeof(uint32_t);
+    registry_ctx_in.value_name.Length = (USHORT)(value_name.size() * sizeof(wchar_t));
+    registry_ctx_in.key_path.Length = (USHORT)(key_path.size() * sizeof(wchar_t));
+
+    // The string lengths must add up to the data size.
+    void* context = nullptr;
+    REQUIRE(
+        program_data->context_create(
+            data_in.data(),
+            data_in.size() - sizeof(wchar_t),
+            reinterpret_cast<const uint8_t*>(&registry_ctx_in),
+            sizeof(registry_ctx_in),
+            &context) != EBPF_SUCCESS);
+
+    REQUIRE(
+        program_data->context_create(
+            data_in.data(),
+            data_in.size(),
+            reinterpret_cast<const uint8_t*>(&registry_ctx_in),
+            sizeof(registry_ctx_in),
+            &context) == EBPF_SUCCESS);
+    REQUIRE(context != nullptr);
+
+    registry_md_t* registry_md = reinterpret_cast<registry_md_t*>(context);
+    REQUIRE(registry_md->data_type == 4);
+    REQUIRE(
+        std::wstring(
+            reinterpret_cast<const wchar_t*>(registry_md->value_name_start),
+            reinterpret_cast<const wchar_t*>(registry_md->value_name_end)) == value_name);
+
+    std::vector<uint8_t> path(MAX_IMAGE_PATH_SIZE);
+    REQUIRE(get_key_path(registry_md, path.data(), 4) < 0);
+    int path_length = get_key_path(registry_md, path.data(), (uint32_t)path.size());
+    REQUIRE(path_length == (int)(key_path.size() * sizeof(wchar_t)));
+    REQUIRE(memcmp(path.data(), key_path.c_str(), path_length) == 0);
+
+    test_registry_notify_context_t registry_ctx_out = {};
+    size_t context_size_out = sizeof(registry_ctx_out);
+    std::vector<uint8_t> data_out(MAX_IMAGE_PATH_SIZE);
+    size_t data_size_out = data_out.size();
+    program_data->context_destroy(
+        context, data_out.data(), &data_size_out, reinterpret_cast<uint8_t*>(&registry_ctx_out), &context_size_out);
+
+    REQUIRE(context_size_out == sizeof(registry_ctx_out));
+    REQUIRE(data_size_out == value_name.size() * sizeof(wchar_t));
+    REQUIRE(registry_ctx_out.registry_md.value_name_start == nullptr);
+    REQUIRE((int)registry_ctx_out.registry_md.operation == REGISTRY_OPERATION_SET_VALUE);
+    REQUIRE(registry_ctx_out.registry_md.data_size == sizeof(uint32_t));
+}
+
+typedef struct test_registry_client_context_t
+{
+    ntosebpfext_helper_base_client_context_t base;
+    NTSTATUS verdict;
+    registry_md_t registry_context;
+    uint32_t invoke_count;
+} test_registry_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+ntosebpfext_unit_invoke_registry_program(
+    _In_ const void* client_registry_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_registry_client_context_t* client_context = (test_registry_client_context_t*)client_registry_context;
+
+    client_context->registry_context = *(registry_md_t*)context;
+    client_context->invoke_count++;
+    *result = (uint32_t)client_context->verdict;
+    return EBPF_SUCCESS;
+}
+
+TEST_CASE("registry_invoke", "[ntosebpfext]")
+{
+    ebpf_extension_data_t npi_specific_characteristics = {};
+    test_registry_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_REGISTRY;
+
+    ntosebpf_ext_helper_t helper(
+        &npi_specific_characteristics,
+        (_ebpf_extension_dispatch_function)ntosebpfext_unit_invoke_registry_program,
+        (ntosebpfext_helper_base_client_context_t*)&client_context);
+
+    std::wstring value_name = L"Start";
+    UNICODE_STRING value_name_unicode = {};
+    RtlInitUnicodeString(&value_name_unicode, value_name.c_str());
+    uint32_t data = 4;
+
+    REG_SET_VALUE_KEY_INFORMATION set_value_info = {};
+    set_value_info.ValueName = &value_name_unicode;
+    set_value_info.Type = 4; // REG_DWORD
+    set_value_info.Data = &data;
+    set_value_info.DataSize = sizeof(data);
+
+    // A program that lets the operation proceed.
+    client_context.verdict = STATUS_SUCCESS;
+    REQUIRE(usersim_ntos_invoke_registry_callback(RegNtPreSetValueKey, &set_value_info) == STATUS_SUCCESS);
+
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE((int)client_context.registry_context.operation == REGISTRY_OPERATION_SET_VALUE);
+    REQUIRE(client_context.registry_context.process_id == (uint64_t)PsGetCurrentProcessId());
+    REQUIRE(client_context.registry_context.thread_id == (uint64_t)PsGetCurrentThreadId());
+    REQUIRE(client_context.registry_context.data_type == 4);
+    REQUIRE(client_context.registry_context.data_size == sizeof(data));
+    REQUIRE(
+        std::wstring(
+            reinterpret_cast<const wchar_t*>(client_context.registry_context.value_name_start),
+            reinterpret_cast<const wchar_t*>(client_context.registry_context.value_name_end)) == value_name);
+
+    // A program that denies the operation fails it with its status.
+    client_context.verdict = STATUS_ACCESS_DENIED;
+    REQUIRE(usersim_ntos_invoke_registry_callback(RegNtPreSetValueKey, &set_value_info) == STATUS_ACCESS_DENIED);
+    REQUIRE(client_context.invoke_count == 2);
+
+    REG_DELETE_KEY_INFORMATION delete_key_info = {};
+    REQUIRE(usersim_ntos_invoke_registry_callback(RegNtPreDeleteKey, &delete_key_info) == STATUS_ACCESS_DENIED);
+    REQUIRE(client_context.invoke_count == 3);
+    REQUIRE((int)client_context.registry_context.operation == REGISTRY_OPERATION_DELETE_KEY);
+    REQUIRE(client_context.registry_context.value_name_start == nullptr);
+
+    // Notifications the hook does not handle, and notifications without information, are not passed to programs.
+    REQUIRE(usersim_ntos_invoke_registry_callback((REG_NOTIFY_CLASS)3, &delete_key_info) == STATUS_SUCCESS);
+    REQUIRE(usersim_ntos_invoke_registry_callback(RegNtPreSetValueKey, nullptr) == STATUS_SUCCESS);
+    REQUIRE(client_context.invoke_count == 3);
+}
+
+#pragma endregion registry
+
+#pragma region object
+
+typedef struct test_object_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    object_md_t object_md;
+} test_object_notify_context_t;
+
+TEST_CASE("object_context_create", "[ntosebpfext]")
+{
+    ntosebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_OBJECT);
+    REQUIRE(program_data->program_info->program_type_descriptor->bpf_prog_type == BPF_PROG_TYPE_OBJECT);
+
+    test_object_notify_context_t object_ctx_in = {};
+    object_ctx_in.object_md.source_process_id = 4321;
+    object_ctx_in.object_md.target_process_id = TEST_PROCESS_ID;
+    object_ctx_in.object_md.desired_access = PROCESS_ALL_ACCESS;
+    object_ctx_in.object_md.original_desired_access = PROCESS_ALL_ACCESS;
+    object_ctx_in.object_md.operation = OBJECT_OPERATION_HANDLE_DUPLICATE;
+    object_ctx_in.object_md.object_type = OBJECT_TYPE_PROCESS;
+
+    void* context = nullptr;
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&object_ctx_in), sizeof(object_ctx_in) - 1, &context) !=
+        EBPF_SUCCESS);
+
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&object_ctx_in), sizeof(object_ctx_in), &context) ==
+        EBPF_SUCCESS);
+    REQUIRE(context != nullptr);
+
+    object_md_t* object_md = reinterpret_cast<object_md_t*>(context);
+    REQUIRE(object_md->target_process_id == TEST_PROCESS_ID);
+    REQUIRE(object_md->desired_access == PROCESS_ALL_ACCESS);
+
+    test_object_notify_context_t object_ctx_out = {};
+    size_t context_size_out = sizeof(object_ctx_out);
+    size_t data_size_out = 0;
+    program_data->context_destroy(
+        context, nullptr, &data_size_out, reinterpret_cast<uint8_t*>(&object_ctx_out), &context_size_out);
+
+    REQUIRE(context_size_out == sizeof(object_ctx_out));
+    REQUIRE(data_size_out == 0);
+    REQUIRE(object_ctx_out.object_md.source_process_id == object_ctx_in.object_md.source_process_id);
+    REQUIRE((int)object_ctx_out.object_md.operation == OBJECT_OPERATION_HANDLE_DUPLICATE);
+    REQUIRE((int)object_ctx_out.object_md.object_type == OBJECT_TYPE_PROCESS);
+}
+
+typedef struct test_object_client_context_t
+{
+    ntosebpfext_helper_base_client_context_t base;
+    uint32_t access_to_strip;
+    object_md_t object_context;
+    uint32_t invoke_count;
+} test_object_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+ntosebpfext_unit_invoke_object_program(
+    _In_ const void* client_object_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    test_object_client_context_t* client_context = (test_object_client_context_t*)client_object_context;
+
+    client_context->object_context = *(object_md_t*)context;
+    client_context->invoke_count++;
+    *result = client_context->access_to_strip;
+    return EBPF_SUCCESS;
+}
+
+TEST_CASE("object_invoke", "[ntosebpfext]")
+{
+    ebpf_extension_data_t npi_specific_characteristics = {};
+    test_object_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_OBJECT;
+
+    ntosebpf_ext_helper_t helper(
+        &npi_specific_characteristics,
+        (_ebpf_extension_dispatch_function)ntosebpfext_unit_invoke_object_program,
+        (ntosebpfext_helper_base_client_context_t*)&client_context);
+
+    // Test a process handle open, with a program that strips the right to write the process memory.
+    usersim_ntos_object_t target_process = {(HANDLE)TEST_PROCESS_ID, nullptr};
+    OB_PRE_OPERATION_PARAMETERS parameters = {};
+    parameters.CreateHandleInformation.DesiredAccess = PROCESS_VM_READ | PROCESS_VM_WRITE;
+    parameters.CreateHandleInformation.OriginalDesiredAccess = PROCESS_VM_READ | PROCESS_VM_WRITE;
+
+    OB_PRE_OPERATION_INFORMATION operation_information = {};
+    operation_information.Operation = OB_OPERATION_HANDLE_CREATE;
+    operation_information.Object = &target_process;
+    operation_information.ObjectType = *PsProcessType;
+    operation_information.Parameters = &parameters;
+
+    client_context.access_to_strip = PROCESS_VM_WRITE;
+    usersim_ntos_invoke_object_pre_operation_callback(&operation_information);
+
+    REQUIRE(client_context.invoke_count == 1);
+    REQUIRE(client_context.object_context.source_process_id == (uint64_t)PsGetCurrentProcessId());
+    REQUIRE(client_context.object_context.source_thread_id == (uint64_t)PsGetCurrentThreadId());
+    REQUIRE(client_context.object_context.target_process_id == TEST_PROCESS_ID);
+    REQUIRE(client_context.object_context.target_thread_id == 0);
+    REQUIRE(client_context.object_context.desired_access == (PROCESS_VM_READ | PROCESS_VM_WRITE));
+    REQUIRE((int)client_context.object_context.operation == OBJECT_OPERATION_HANDLE_CREATE);
+    REQUIRE((int)client_context.object_context.object_type == OBJECT_TYPE_PROCESS);
+    REQUIRE(client_context.object_context.is_kernel_handle == 0);
+    REQUIRE(parameters.CreateHandleInformation.DesiredAccess == PROCESS_VM_READ);
+    REQUIRE(parameters.CreateHandleInformation.OriginalDesiredAccess == (PROCESS_VM_READ | PROCESS_VM_WRITE));
+
+    // Test a kernel thread handle duplication, with a program that leaves the access unchanged.
+    usersim_ntos_object_t target_thread = {(HANDLE)TEST_PROCESS_ID, (HANDLE)100};
+    parameters = {};
+    parameters.DuplicateHandleInformation.DesiredAccess = THREAD_TERMINATE;
+    parameters.DuplicateHandleInformation.OriginalDesiredAccess = THREAD_TERMINATE;
+
+    operation_information.Operation = OB_OPERATION_HANDLE_DUPLICATE;
+    operation_information.KernelHandle = 1;
+    operation_information.Object = &target_thread;
+    operation_information.ObjectType = *PsThreadType;
+
+    client_context.access_to_strip = 0;
+    usersim_ntos_invoke_object_pre_operation_callback(&operation_information);
+
+    REQUIRE(client_context.invoke_count == 2);
+    REQUIRE(client_context.object_context.target_process_id == TEST_PROCESS_ID);
+    REQUIRE(client_context.object_context.target_thread_id == 100);
+    REQUIRE((int)client_context.object_context.operation == OBJECT_OPERATION_HANDLE_DUPLICATE);
+    REQUIRE((int)client_context.object_context.object_type == OBJECT_TYPE_THREAD);
+    REQUIRE(client_context.object_context.is_kernel_handle == 1);
+    REQUIRE(parameters.DuplicateHandleInformation.DesiredAccess == THREAD_TERMINATE);
+}
+
+#pragma endregion object
+
+#pragma region sample
+
+typedef struct test_sample_notify_context
+{
+    EBPF_CONTEXT_HEADER;
+    sample_md_t sample_md;
+} test_sample_notify_context_t;
+
+TEST_CASE("sample_context_create", "[ntosebpfext]")
+{
+    ntosebpf_ext_helper_t helper;
+    const ebpf_program_data_t* program_data = helper.get_program_data(EBPF_PROGRAM_TYPE_SAMPLE);
+    REQUIRE(program_data->program_info->program_type_descriptor->bpf_prog_type == BPF_PROG_TYPE_SAMPLE);
+    REQUIRE(program_data->required_irql == DISPATCH_LEVEL);
+
+    test_sample_notify_context_t sample_ctx_in = {};
+    sample_ctx_in.sample_md.timestamp = 133000000000000000;
+    sample_ctx_in.sample_md.process_id = TEST_PROCESS_ID;
+    sample_ctx_in.sample_md.thread_id = 100;
+    sample_ctx_in.sample_md.cpu_number = 3;
+
+    void* context = nullptr;
+    REQUIRE(program_data->context_create(nullptr, 0, nullptr, 0, &context) != EBPF_SUCCESS);
+    REQUIRE(
+        program_data->context_create(
+            nullptr, 0, reinterpret_cast<const uint8_t*>(&sample_ctx_in), sizeof(sample_ctx_in), &context) ==
+        EBPF_SUCCESS);
+    REQUIRE(context != nullptr);
+
+    sample_md_t* sample_md = reinterpret_cast<sample_md_t*>(context);
+    REQUIRE(sample_md->cpu_number == 3);
+
+    test_sample_notify_context_t sample_ctx_out = {};
+    size_t context_size_out = sizeof(sample_ctx_out);
+    size_t data_size_out = 0;
+    program_data->context_destroy(
+        context, nullptr, &data_size_out, reinterpret_cast<uint8_t*>(&sample_ctx_out), &context_size_out);
+
+    REQUIRE(context_size_out == sizeof(sample_ctx_out));
+    REQUIRE(sample_ctx_out.sample_md.timestamp == sample_ctx_in.sample_md.timestamp);
+    REQUIRE(sample_ctx_out.sample_md.process_id == TEST_PROCESS_ID);
+    REQUIRE(sample_ctx_out.sample_md.thread_id == sample_ctx_in.sample_md.thread_id);
+}
+
+// Samples are taken concurrently on every CPU.
+static std::mutex sample_lock;
+static std::set<uint32_t> sample_cpus;
+static uint64_t sample_last_timestamp = 0;
+
+typedef struct test_sample_client_context_t
+{
+    ntosebpfext_helper_base_client_context_t base;
+} test_sample_client_context_t;
+
+_Must_inspect_result_ ebpf_result_t
+ntosebpfext_unit_invoke_sample_program(
+    _In_ const void* client_sample_context, _In_ const void* context, _Out_ uint32_t* result)
+{
+    const sample_md_t* sample_md = (const sample_md_t*)context;
+
+    UNREFERENCED_PARAMETER(client_sample_context);
+
+    std::unique_lock lock(sample_lock);
+    sample_cpus.insert(sample_md->cpu_number);
+    sample_last_timestamp = sample_md->timestamp;
+    *result = 0;
+    return EBPF_SUCCESS;
+}
+
+static ebpf_extension_data_t
+_test_sample_client_data(_In_ sample_attach_opts_t* attach_opts)
+{
+    return {
+        .header = {EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION, EBPF_ATTACH_CLIENT_DATA_CURRENT_VERSION_SIZE},
+        .data = attach_opts,
+        .data_size = sizeof(*attach_opts)};
+}
+
+TEST_CASE("sample_invoke", "[ntosebpfext]")
+{
+    {
+        std::unique_lock lock(sample_lock);
+        sample_cpus.clear();
+        sample_last_timestamp = 0;
+    }
+
+    sample_attach_opts_t attach_opts = {.frequency_hz = 200};
+    ebpf_extension_data_t npi_specific_characteristics = _test_sample_client_data(&attach_opts);
+    test_sample_client_context_t client_context = {};
+    client_context.base.desired_attach_type = BPF_ATTACH_TYPE_SAMPLE;
+
+    ntosebpf_ext_helper_t helper(
+        &npi_specific_characteristics,
+        (_ebpf_extension_dispatch_function)ntosebpfext_unit_invoke_sample_program,
+        (ntosebpfext_helper_base_client_context_t*)&client_context);
+    REQUIRE(ntos_ebpf_ext_sample_get_frequency() == 200);
+
+    // The timer runs at the highest frequency requested by any client, and slows down once that client detaches.
+    sample_attach_opts_t fast_attach_opts = {.frequency_hz = 1000};
+    ebpf_extension_data_t fast_npi_specific_characteristics = _test_sample_client_data(&fast_attach_opts);
+    test_sample_client_context_t fast_client_context = {};
+    fast_client_context.base.desired_attach_type = BPF_ATTACH_TYPE_SAMPLE;
+    helper.add_hook_client(&fast_npi_specific_characteristics, &fast_client_context.base);
+    REQUIRE(ntos_ebpf_ext_sample_get_frequency() == 1000);
+
+    sample_attach_opts_t slow_attach_opts = {.frequency_hz = 100};
+    ebpf_extension_data_t slow_npi_specific_characteristics = _test_sample_client_data(&slow_attach_opts);
+    test_sample_client_context_t slow_client_context = {};
+    slow_client_context.base.desired_attach_type = BPF_ATTACH_TYPE_SAMPLE;
+    helper.add_hook_client(&slow_npi_specific_characteristics, &slow_client_context.base);
+    REQUIRE(ntos_ebpf_ext_sample_get_frequency() == 1000);
+
+    helper.remove_hook_clients();
+    REQUIRE(ntos_ebpf_ext_sample_get_frequency() == 200);
+
+    // Unsupported frequencies are rejected at attach, and leave the timer unchanged.
+    sample_attach_opts_t zero_attach_opts = {.frequency_hz = 0};
+    ebpf_extension_data_t zero_npi_specific_characteristics = _test_sample_client_data(&zero_attach_opts);
+    test_sample_client_context_t zero_client_context = {};
+    zero_client_context.base.desired_attach_type = BPF_ATTACH_TYPE_SAMPLE;
+    helper.add_hook_client(&zero_npi_specific_characteristics, &zero_client_context.base);
+
+    sample_attach_opts_t too_fast_attach_opts = {.frequency_hz = SAMPLE_MAX_FREQUENCY_HZ + 1};
+    ebpf_extension_data_t too_fast_npi_specific_characteristics = _test_sample_client_data(&too_fast_attach_opts);
+    test_sample_client_context_t too_fast_client_context = {};
+    too_fast_client_context.base.desired_attach_type = BPF_ATTACH_TYPE_SAMPLE;
+    helper.add_hook_client(&too_fast_npi_specific_characteristics, &too_fast_client_context.base);
+    REQUIRE(ntos_ebpf_ext_sample_get_frequency() == 200);
+    helper.remove_hook_clients();
+
+    // Every CPU is sampled by a DPC targeted at it. Wait for a sample from each of them.
+    uint32_t cpu_count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    for (;;) {
+        {
+            std::unique_lock lock(sample_lock);
+            if (sample_cpus.size() == cpu_count || std::chrono::steady_clock::now() > deadline) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::unique_lock lock(sample_lock);
+    REQUIRE(sample_cpus.size() == cpu_count);
+    REQUIRE(*sample_cpus.rbegin() == cpu_count - 1);
+    REQUIRE(sample_last_timestamp != 0);
+}
+
+#pragma endregion sample
@@ -19,10 +19,12 @@ typedef struct _ebpf_program_section_info_with_count
     size_t section_info_count;
 } ebpf_program_section_info_with_count_t;
 
-static const ebpf_program_info_t* _program_information_array[] = {&_ebpf_netevent_event_program_info};
+static const ebpf_program_info_t* _program_information_array[] = {
+    &_ebpf_netevent_event_program_info, &_ebpf_netevent_summary_program_info};
 
 static std::vector<ebpf_program_section_info_with_count_t> _section_information = {
     {&_ebpf_netevent_event_section_info[0], 1},
+    {&_ebpf_netevent_summary_section_info[0], 1},
 };
 
 uint32_t
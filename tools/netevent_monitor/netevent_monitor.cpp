@@ -0,0 +1,317 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This tool loads the netevent_monitor eBPF program, reads the events it outputs to its perf event array, and reports
+// the events lost after the neteventebpfext extension and the latency from the NetEvent providers to user mode. Losses
+// are detected from the gaps in the per-CPU sequence numbers of the netevent data header, and the latency is measured
+// against the push timestamp taken by the extension, both available since version 5 of the header. The events can also
+// be recorded to a trace file, which netevent_sim.sys replays.
+
+#include "ebpf_api.h"
+#include "ebpf_netevent_hooks.h"
+#include "ebpf_netevent_program_attach_type_guids.h"
+#include "ebpf_netevent_trace.h"
+
+#include <algorithm>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NETEVENT_MONITOR_DEFAULT_DURATION_SEC 10
+// Latency samples kept for the percentiles, later events are only counted.
+#define NETEVENT_MONITOR_MAX_LATENCY_SAMPLES (10 * 1000 * 1000)
+// Events kept for the trace file, later events are only counted.
+#define NETEVENT_MONITOR_MAX_RECORDED_EVENTS (1000 * 1000)
+
+typedef struct _netevent_monitor_cpu_state
+{
+    uint64_t next_sequence; ///< Sequence number expected for the next event of the CPU.
+    uint64_t received;      ///< Events received from the CPU.
+    uint64_t lost;          ///< Events missing from the sequence of the CPU, less those received late.
+    uint64_t out_of_order;  ///< Events received with a sequence number lower than expected.
+} netevent_monitor_cpu_state_t;
+
+typedef struct _netevent_monitor_recorded_event
+{
+    uint64_t push_timestamp;    ///< Performance counter value when the provider pushed the event.
+    uint32_t original_length;   ///< Length of the event data following the PKTMON header, before any truncation.
+    std::vector<uint8_t> event; ///< PKTMON header followed by the event data captured by the program.
+} netevent_monitor_recorded_event_t;
+
+typedef struct _netevent_monitor_state
+{
+    std::mutex lock;
+    std::map<uint32_t, netevent_monitor_cpu_state_t> cpu_states;
+    std::vector<uint64_t> latencies; ///< Latencies of the received events, in performance counter ticks.
+    uint64_t perf_buffer_lost = 0;   ///< Events reported lost by the perf buffer.
+    uint64_t unversioned = 0;        ///< Events whose header predates the sequence numbers.
+    bool recording = false;
+    std::vector<netevent_monitor_recorded_event_t> recorded_events;
+    uint64_t unrecorded = 0; ///< Events not recorded because the recording was full.
+} netevent_monitor_state_t;
+
+static void
+_print_help(_In_z_ const char* program_name)
+{
+    std::cout << "Usage: " << program_name << " [duration_sec] [--record trace_file]" << std::endl;
+    std::cout << "Attaches netevent_monitor.sys to all the network events for duration_sec seconds (default "
+              << NETEVENT_MONITOR_DEFAULT_DURATION_SEC << "), then reports the lost events and latency percentiles."
+              << std::endl;
+    std::cout << "With --record, also writes the events received to trace_file, which netevent_sim.sys can replay."
+              << std::endl;
+}
+
+static void
+_netevent_monitor_event_callback(_Inout_ void* context, int cpu, _In_reads_bytes_(size) void* data, uint32_t size)
+{
+    netevent_monitor_state_t* state = reinterpret_cast<netevent_monitor_state_t*>(context);
+    const netevent_data_header_t* header_ptr = reinterpret_cast<const netevent_data_header_t*>(data);
+    LARGE_INTEGER now;
+
+    UNREFERENCED_PARAMETER(cpu);
+    QueryPerformanceCounter(&now);
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    if (data == nullptr || size < sizeof(netevent_data_header_t) || header_ptr->version < 5) {
+        state->unversioned++;
+        return;
+    }
+
+    // The sequence numbers are assigned by the CPU that dispatched the event, which is also the one that output it.
+    netevent_monitor_cpu_state_t& cpu_state = state->cpu_states[header_ptr->cpu];
+    if (cpu_state.received != 0 && header_ptr->sequence < cpu_state.next_sequence) {
+        // A late event was counted as lost when the events following it were received. Events dispatched before the
+        // first one received were not, hence the saturation.
+        cpu_state.out_of_order++;
+        if (cpu_state.lost != 0) {
+            cpu_state.lost--;
+        }
+    } else {
+        // The events dispatched before the first one received are not counted as lost.
+        if (cpu_state.received != 0) {
+            cpu_state.lost += header_ptr->sequence - cpu_state.next_sequence;
+        }
+        cpu_state.next_sequence = header_ptr->sequence + 1;
+    }
+    cpu_state.received++;
+
+    if (state->latencies.size() < NETEVENT_MONITOR_MAX_LATENCY_SAMPLES &&
+        (uint64_t)now.QuadPart >= header_ptr->push_timestamp) {
+        state->latencies.push_back((uint64_t)now.QuadPart - header_ptr->push_timestamp);
+    }
+
+    if (state->recording && size >= sizeof(netevent_data_header_t) + PKTMON_EVENT_HEADER_LENGTH) {
+        if (state->recorded_events.size() < NETEVENT_MONITOR_MAX_RECORDED_EVENTS) {
+            const uint8_t* event = reinterpret_cast<const uint8_t*>(data) + sizeof(netevent_data_header_t);
+            state->recorded_events.push_back(
+                {header_ptr->push_timestamp,
+                 header_ptr->original_length,
+                 std::vector<uint8_t>(event, event + (size - sizeof(netevent_data_header_t)))});
+        } else {
+            state->unrecorded++;
+        }
+    }
+}
+
+// Write the recorded events to a trace file, in push order. The events of different CPUs reach user mode out of
+// order, so the inter-arrival times are only computed once all the events are sorted.
+static bool
+_write_trace(_Inout_ netevent_monitor_state_t* state, _In_z_ const char* trace_path)
+{
+    LARGE_INTEGER frequency;
+    uint64_t previous_timestamp;
+
+    QueryPerformanceFrequency(&frequency);
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    std::stable_sort(
+        state->recorded_events.begin(),
+        state->recorded_events.end(),
+        [](const netevent_monitor_recorded_event_t& left, const netevent_monitor_recorded_event_t& right) {
+            return left.push_timestamp < right.push_timestamp;
+        });
+
+    std::ofstream trace_file(trace_path, std::ios::binary | std::ios::trunc);
+    if (!trace_file) {
+        return false;
+    }
+
+    netevent_trace_file_header_t file_header = {
+        .magic = NETEVENT_TRACE_MAGIC,
+        .version = NETEVENT_TRACE_CURRENT_VERSION,
+        .header_size = (uint16_t)sizeof(netevent_trace_file_header_t),
+        .record_count = state->recorded_events.size()};
+    trace_file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+
+    previous_timestamp = state->recorded_events.empty() ? 0 : state->recorded_events.front().push_timestamp;
+    for (const netevent_monitor_recorded_event_t& recorded_event : state->recorded_events) {
+        netevent_trace_record_t record = {
+            .length = (uint32_t)recorded_event.event.size(),
+            .original_length = recorded_event.original_length,
+            .interarrival_ns =
+                ((recorded_event.push_timestamp - previous_timestamp) * 1000000000ULL) / (uint64_t)frequency.QuadPart};
+        trace_file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        trace_file.write(reinterpret_cast<const char*>(recorded_event.event.data()), recorded_event.event.size());
+        previous_timestamp = recorded_event.push_timestamp;
+    }
+
+    std::cout << "Recorded " << state->recorded_events.size() << " events to " << trace_path << " ("
+              << state->unrecorded << " not recorded)." << std::endl;
+    return trace_file.good();
+}
+
+static void
+_netevent_monitor_lost_event_callback(_Inout_ void* context, int cpu, __u64 count)
+{
+    netevent_monitor_state_t* state = reinterpret_cast<netevent_monitor_state_t*>(context);
+
+    UNREFERENCED_PARAMETER(cpu);
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    state->perf_buffer_lost += count;
+}
+
+static void
+_print_report(_Inout_ netevent_monitor_state_t* state)
+{
+    const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    LARGE_INTEGER frequency;
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    uint64_t out_of_order = 0;
+
+    QueryPerformanceFrequency(&frequency);
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    std::cout << "CPU      received      lost  out-of-order" << std::endl;
+    for (const auto& [cpu, cpu_state] : state->cpu_states) {
+        std::cout << cpu << "\t" << cpu_state.received << "\t" << cpu_state.lost << "\t" << cpu_state.out_of_order
+                  << std::endl;
+        received += cpu_state.received;
+        lost += cpu_state.lost;
+        out_of_order += cpu_state.out_of_order;
+    }
+    std::cout << "Total: " << received << " received, " << lost << " lost";
+    if (received + lost != 0) {
+        std::cout << " (" << (100.0 * lost) / (received + lost) << "%)";
+    }
+    std::cout << ", " << out_of_order << " out of order, " << state->perf_buffer_lost
+              << " reported lost by the perf buffer, " << state->unversioned << " without sequence number."
+              << std::endl;
+
+    if (state->latencies.empty()) {
+        return;
+    }
+    std::sort(state->latencies.begin(), state->latencies.end());
+    std::cout << "Latency (us) over " << state->latencies.size() << " events:";
+    for (double percentile : percentiles) {
+        size_t index = std::min(
+            state->latencies.size() - 1, (size_t)((percentile / 100.0) * (double)state->latencies.size()));
+        std::cout << " p" << percentile << "=" << (state->latencies[index] * 1000000.0) / frequency.QuadPart;
+    }
+    std::cout << " max=" << (state->latencies.back() * 1000000.0) / frequency.QuadPart << std::endl;
+}
+
+int
+main(int argc, char** argv)
+{
+    uint32_t duration_sec = NETEVENT_MONITOR_DEFAULT_DURATION_SEC;
+    const char* trace_path = nullptr;
+    netevent_monitor_state_t state;
+    struct bpf_object* object = nullptr;
+    struct perf_buffer* perf_buffer = nullptr;
+    bpf_link* link = nullptr;
+    int exit_code = 1;
+
+    for (int index = 1; index < argc; index++) {
+        std::string argument = argv[index];
+        if (argument == "--record" && index + 1 < argc && trace_path == nullptr) {
+            trace_path = argv[++index];
+            state.recording = true;
+            continue;
+        }
+        try {
+            duration_sec = (uint32_t)std::stoul(argument);
+        } catch (...) {
+            _print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    object = bpf_object__open("netevent_monitor.sys");
+    if (object == nullptr) {
+        std::cout << "Failed to open netevent_monitor.sys" << std::endl;
+        goto Exit;
+    }
+    if (bpf_object__load(object) != 0) {
+        std::cout << "Failed to load netevent_monitor.sys" << std::endl;
+        goto Exit;
+    }
+
+    {
+        bpf_program* program = bpf_object__find_program_by_name(object, "NetEventMonitor");
+        bpf_map* events_map = bpf_object__find_map_by_name(object, "netevent_events_map");
+        if (program == nullptr || events_map == nullptr) {
+            std::cout << "NetEventMonitor program or netevent_events_map not found" << std::endl;
+            goto Exit;
+        }
+
+        ebpf_perf_buffer_opts perf_opts = {
+            .sz = sizeof(ebpf_perf_buffer_opts), .flags = EBPF_PERFBUF_FLAG_AUTO_CALLBACK};
+        perf_buffer = ebpf_perf_buffer__new(
+            bpf_map__fd(events_map),
+            0,
+            _netevent_monitor_event_callback,
+            _netevent_monitor_lost_event_callback,
+            &state,
+            &perf_opts);
+        if (perf_buffer == nullptr) {
+            std::cout << "Failed to create the perf buffer" << std::endl;
+            goto Exit;
+        }
+
+        // Without filters, the program receives every event the extension dispatches, so that every gap in the
+        // sequence numbers is a lost event.
+        netevent_attach_opts_t attach_opts = {.capture_type = NeteventCapture_All};
+        ebpf_result_t result =
+            ebpf_program_attach(program, &EBPF_ATTACH_TYPE_NETEVENT, &attach_opts, sizeof(attach_opts), &link);
+        if (result != EBPF_SUCCESS) {
+            std::cout << "Failed to attach NetEventMonitor - ERROR #" << result << std::endl;
+            goto Exit;
+        }
+    }
+
+    std::cout << "Monitoring network events for " << duration_sec << " seconds." << std::endl;
+    std::this_thread::sleep_for(std::chrono::seconds(duration_sec));
+
+    bpf_link_detach(bpf_link__fd(link));
+    bpf_link__destroy(link);
+    link = nullptr;
+
+    _print_report(&state);
+    if (trace_path != nullptr && !_write_trace(&state, trace_path)) {
+        std::cout << "Failed to write the trace file " << trace_path << std::endl;
+        goto Exit;
+    }
+    exit_code = 0;
+
+Exit:
+    if (link != nullptr) {
+        bpf_link_detach(bpf_link__fd(link));
+        bpf_link__destroy(link);
+    }
+    if (perf_buffer != nullptr) {
+        perf_buffer__free(perf_buffer);
+    }
+    if (object != nullptr) {
+        bpf_object__close(object);
+    }
+    return exit_code;
+}
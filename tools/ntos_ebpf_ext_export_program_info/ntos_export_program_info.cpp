@@ -19,10 +19,22 @@ typedef struct _ebpf_program_section_info_with_count
     size_t section_info_count;
 } ebpf_program_section_info_with_count_t;
 
-static const ebpf_program_info_t* _program_information_array[] = {&_ebpf_process_program_info};
+static const ebpf_program_info_t* _program_information_array[] = {
+    &_ebpf_process_program_info,
+    &_ebpf_thread_program_info,
+    &_ebpf_image_program_info,
+    &_ebpf_registry_program_info,
+    &_ebpf_object_program_info,
+    &_ebpf_sample_program_info,
+};
 
 static std::vector<ebpf_program_section_info_with_count_t> _section_information = {
     {&_ebpf_process_section_info[0], 1},
+    {&_ebpf_thread_section_info[0], 1},
+    {&_ebpf_image_section_info[0], 1},
+    {&_ebpf_registry_section_info[0], 1},
+    {&_ebpf_object_section_info[0], 1},
+    {&_ebpf_sample_section_info[0], 1},
 };
 
 uint32_t